@@ -0,0 +1,213 @@
+# Micro benchmarks for the mruby-sdl2-gpu hot paths.
+#
+# Run it with an mruby binary that was built with this gem (plus the default
+# gembox for Time, ObjectSpace and GC) against a software GL context, e.g.:
+#
+#   xvfb-run -a env LIBGL_ALWAYS_SOFTWARE=1 bin/mruby bench/bench.rb > bench_output.txt
+#
+# Every case prints one JSON object per line so two runs can be compared with
+# bench/compare.rb. Cases registered with bench_alloc_free must not create
+# Ruby objects; the run raises at the end if one of them did.
+
+BENCH_W = 640
+BENCH_H = 480
+SDL_WINDOW_HIDDEN = 0x00000008
+MIN_TIME = 0.5
+ALLOC_FREE_FAILURES = []
+
+def bench_now
+  Time.now.to_f
+end
+
+def bench_live_objects
+  ObjectSpace.count_objects[:TOTAL] - ObjectSpace.count_objects[:FREE]
+end
+
+# Runs the block until it took at least MIN_TIME seconds, then measures the
+# allocations of a second, GC free, run with the same iteration count.
+def bench(name, batch = 1, &block)
+  iterations = 1
+  elapsed = 0.0
+  loop do
+    start = bench_now
+    iterations.times(&block)
+    elapsed = bench_now - start
+    GPU.reset_arena  # stands in for the flip a frame would end with
+    break if elapsed >= MIN_TIME
+    iterations *= 2
+  end
+
+  GC.start
+  GC.disable
+  before = bench_live_objects
+  iterations.times(&block)
+  allocs = bench_live_objects - before
+  GC.enable
+  GPU.reset_arena
+
+  calls = iterations * batch
+  puts "{\"case\":\"#{name}\",\"calls\":#{calls}," \
+       "\"calls_per_sec\":#{(calls / elapsed).round(2)}," \
+       "\"ns_per_call\":#{(elapsed * 1_000_000_000 / calls).round(2)}," \
+       "\"allocs_per_call\":#{(allocs.to_f / calls).round(4)}}"
+  allocs.to_f / calls
+end
+
+# The few objects ObjectSpace.count_objects itself creates stay well below
+# the limit for any case that runs long enough to be timed.
+def bench_alloc_free(name, &block)
+  ALLOC_FREE_FAILURES << name if bench(name, &block) >= 0.001
+end
+
+def batch_values(count)
+  values = []
+  count.times do |i|
+    x = (i * 7) % BENCH_W
+    y = (i * 13) % BENCH_H
+    values << [x.to_f, y.to_f, 0.0, 1.0, 1.0, 1.0, 1.0, 1.0]
+  end
+  values
+end
+
+screen = GPU.init(BENCH_W, BENCH_H, SDL_WINDOW_HIDDEN)
+image  = GPU::Image.new(64, 64, GPU::GPU_FORMAT_RGBA)
+rect   = GPU::Rect.new(0, 0, 32, 32)
+path   = "/tmp/mruby_sdl2_gpu_bench.png"
+image.save(path, GPU::GPU_FILE_PNG)
+surface = image.to_surface
+
+bench("blit/4")   { screen.blit(image, rect, 100.0, 100.0) }
+bench("blit/5")   { screen.blit(image, rect, 100.0, 100.0, 45.0) }
+bench("blit/6")   { screen.blit(image, rect, 100.0, 100.0, 2.0, 2.0) }
+bench("blit/7")   { screen.blit(image, rect, 100.0, 100.0, 2.0, 2.0, 45.0) }
+bench("blit/9")   { screen.blit(image, rect, 100.0, 100.0, 2.0, 2.0, 45.0, 16.0, 16.0) }
+bench("blit_rotate")      { screen.blit_rotate(image, rect, 100.0, 100.0, 45.0) }
+bench("blit_scale")       { screen.blit_scale(image, rect, 100.0, 100.0, 2.0, 2.0) }
+bench("blit_transform")   { screen.blit_transform(image, rect, 100.0, 100.0, 2.0, 2.0, 45.0) }
+bench("blit_transform_x") do
+  screen.blit_transform_x(image, rect, 100.0, 100.0, 2.0, 2.0, 45.0, 16.0, 16.0)
+end
+
+# the same blits cycling through four images, which SDL_gpu draws one
+# image switch at a time and a multi-texture batch in a single draw
+images = Array.new(4) { GPU::Image.new(32, 32, GPU::GPU_FORMAT_RGBA) }
+bench("blit/interleaved/1000", 1000) do
+  1000.times { |i| screen.blit(images[i & 3], nil, (i * 7 % BENCH_W).to_f, 100.0) }
+  GPU.flush_blit_buffer
+end
+bench("multi_batch/interleaved/1000", 1000) do
+  screen.begin_multi_batch(4)
+  1000.times { |i| screen.blit(images[i & 3], nil, (i * 7 % BENCH_W).to_f, 100.0) }
+  screen.end_multi_batch
+end
+
+[1_000, 10_000, 100_000].each do |count|
+  values = batch_values(count)
+  bench("blit_batch/#{count}", count) do
+    screen.blit_batch(image, values, nil, GPU::GPU_BATCH_XY_ST_RGBA)
+  end
+end
+packed = batch_values(10_000).map { |v| v[0, 4] << GPU::Color::WHITE }
+bench("blit_batch/packed/10000", 10_000) do
+  screen.blit_batch(image, packed, nil,
+                    GPU::GPU_BATCH_XY_ST | GPU::GPU_BATCH_RGBA_PACKED)
+end
+
+bench("line")          { screen.line(0.0, 0.0, 100.0, 100.0, 255, 0, 0, 255) }
+bench("circle_filled") { screen.circle_filled(50.0, 50.0, 20.0, 0, 255, 0, 255) }
+bench("rect_filled")   { screen.rect_filled(10.0, 10.0, 60.0, 60.0, 0, 0, 255, 255) }
+bench("tri_filled")    { screen.tri_filled(0.0, 0.0, 50.0, 0.0, 25.0, 40.0, 9, 9, 9, 255) }
+bench("gradient_fill_rect") do
+  screen.gradient_fill_rect(255, 0, 0, 255, 0, 0, 255, 255, rect, true)
+end
+
+red  = GPU::Color::RED
+blue = GPU::Color::BLUE
+bench("line/packed")          { screen.line(0.0, 0.0, 100.0, 100.0, red) }
+bench("circle_filled/packed") { screen.circle_filled(50.0, 50.0, 20.0, blue) }
+bench("rect_filled/packed")   { screen.rect_filled(10.0, 10.0, 60.0, 60.0, blue) }
+bench("gradient_fill_rect/packed") do
+  screen.gradient_fill_rect(red, blue, rect, true)
+end
+screen.flip
+
+bench("image_load") { GPU::Image.new(path).free }
+# dropped without #free, the GC pressure limit has to reclaim them
+bench("image_churn") { GPU::Image.new(64, 64, GPU::GPU_FORMAT_RGBA) }
+GPU.collect_unused
+bench("resource_scope/64_images", 64) do
+  GPU.resource_scope { 64.times { GPU::Image.new(16, 16, GPU::GPU_FORMAT_RGBA) } }
+end
+# small incremental steps leave images that died inside the scope waiting
+# for their sweep when it ends; the scope must skip them, not free them
+step_ratio = GC.step_ratio
+GC.step_ratio = 10
+bench("resource_scope/pending_garbage", 64) do
+  GPU.resource_scope do
+    64.times do
+      GPU::Image.new(16, 16, GPU::GPU_FORMAT_RGBA)
+      32.times { "garbage" * 8 }
+    end
+  end
+end
+GC.step_ratio = step_ratio
+bench("image_update") { image.update(surface) }
+bench("get_pixel") { screen.get_pixel(10, 10) }
+
+vertex = GPU::Shader.new(GPU::GPU_VERTEX_SHADER, <<-GLSL)
+attribute vec2 gpu_Vertex;
+uniform mat4 gpu_ModelViewProjectionMatrix;
+void main() { gl_Position = gpu_ModelViewProjectionMatrix * vec4(gpu_Vertex, 0.0, 1.0); }
+GLSL
+fragment = GPU::Shader.new(GPU::GPU_FRAGMENT_SHADER, <<-GLSL)
+uniform float value;
+void main() { gl_FragColor = vec4(value); }
+GLSL
+program = GPU::Program.new(vertex, fragment)
+program.activate(program.load_shader_block("gpu_Vertex", "gpu_TexCoord",
+                                           "gpu_Color",
+                                           "gpu_ModelViewProjectionMatrix"))
+location = program.get_uniform_location("value")
+bench("set_uniformf")  { GPU.set_uniformf(location, 0.5) }
+bench("set_uniformi")  { GPU.set_uniformi(location, 1) }
+bench("set_uniformfv") { GPU.set_uniformfv(location, 1, 1, [0.5]) }
+matrix = Array.new(16) { |i| i % 5 == 0 ? 1.0 : 0.0 }
+bench("set_uniform_matrix_fv") do
+  GPU.set_uniform_matrix_fv(location, 1, 4, 4, false, matrix)
+end
+GPU::Program.deactivate
+
+bench("rect_new") { GPU::Rect.new(0, 0, 8, 8) }
+
+# accessors hand back the cached wrapper and queries fill caller owned
+# buffers, none of these may allocate
+floats = GPU::QueryBuffer.new(16)
+bench_alloc_free("context_target")       { GPU.context_target }
+bench_alloc_free("get_current_renderer") { GPU.get_current_renderer }
+bench_alloc_free("camera")               { screen.camera }
+bench_alloc_free("image_renderer")       { image.renderer }
+bench_alloc_free("get_pixel_packed")     { screen.get_pixel_packed(10, 10) }
+bench_alloc_free("target_rgba_packed")   { screen.get_rgba_packed }
+bench_alloc_free("image_rgba_packed")    { image.get_rgba_packed }
+bench_alloc_free("get_virtual_coords/buffer") do
+  GPU.get_virtual_coords(screen, 10.0, 10.0, floats)
+end
+bench_alloc_free("get_uniformfv/buffer") do
+  program.get_uniformfv(location, 1, floats)
+end
+
+# not a case, compare.rb skips it
+stats = GPU.arena_stats
+puts "# arena high_water=#{stats[:high_water]} capacity=#{stats[:capacity]} " \
+     "overflows=#{stats[:overflows]}"
+report = GPU.memory_report
+puts "# vram total=#{report[:total]} images=#{report[:images]} " \
+     "targets=#{report[:targets]} gc_collections=#{report[:gc_collections]}"
+stats = GPU.multi_batch_stats
+puts "# multi_batch draws=#{stats[:draws]} quads=#{stats[:quads]}"
+
+GPU.quit
+
+unless ALLOC_FREE_FAILURES.empty?
+  raise "allocating hot path queries: #{ALLOC_FREE_FAILURES.join(', ')}"
+end
@@ -0,0 +1,45 @@
+# Compares two bench/bench.rb outputs, e.g. from two commits:
+#
+#   ruby bench/compare.rb baseline.txt bench_output.txt [threshold_percent]
+#
+# Cases whose ns/call got slower by more than the threshold (default 10%)
+# or that allocate more per call are reported as regressions and make the
+# script exit with status 1.
+require 'json'
+
+def load_results(path)
+  File.readlines(path).each_with_object({}) do |line, results|
+    line = line.strip
+    next unless line.start_with?('{')
+    row = JSON.parse(line)
+    results[row['case']] = row
+  end
+end
+
+abort "usage: #{$0} BASELINE CURRENT [THRESHOLD_PERCENT]" if ARGV.size < 2
+
+baseline  = load_results(ARGV[0])
+current   = load_results(ARGV[1])
+threshold = (ARGV[2] || 10).to_f
+regressed = false
+
+printf("%-24s %14s %14s %9s %10s\n", 'case', 'base ns/call', 'ns/call',
+       'change', 'allocs')
+current.each do |name, row|
+  base = baseline[name]
+  if base.nil?
+    printf("%-24s %14s %14.2f %9s %10.4f\n", name, '-', row['ns_per_call'],
+           'new', row['allocs_per_call'])
+    next
+  end
+  change = (row['ns_per_call'] - base['ns_per_call']) * 100.0 /
+           base['ns_per_call']
+  worse = change > threshold ||
+          row['allocs_per_call'] > base['allocs_per_call']
+  regressed ||= worse
+  printf("%-24s %14.2f %14.2f %8.1f%% %10.4f%s\n", name, base['ns_per_call'],
+         row['ns_per_call'], change, row['allocs_per_call'],
+         worse ? '  REGRESSION' : '')
+end
+
+exit(regressed ? 1 : 0)
@@ -0,0 +1,194 @@
+# Golden image check for the mruby-sdl2-gpu drawing paths.
+#
+# Renders a few fixed scenes into offscreen targets, reads them back and
+# compares them pixel by pixel with the PNGs in bench/golden/. Run it from
+# the repository root with an mruby binary built with this gem against a
+# software GL context, like bench/bench.rb:
+#
+#   xvfb-run -a env LIBGL_ALWAYS_SOFTWARE=1 bin/mruby bench/golden.rb
+#
+# A channel may be off by the tolerance (default 2, --tolerance=N) before a
+# pixel counts as different. For every scene that differs the rendering is
+# written next to its reference as NAME.actual.png, with the differing
+# pixels in NAME.diff.png, and the run raises at the end. With --update the
+# renderings replace the references instead; check them before committing.
+#
+# The scenes only draw opaque, pixel aligned content with nearest filtering,
+# so any conforming GL implementation renders them exactly.
+
+GOLDEN_DIR = "bench/golden"
+GOLDEN_W = 128
+GOLDEN_H = 96
+SDL_WINDOW_HIDDEN = 0x00000008
+
+update    = ARGV.include?("--update")
+tolerance = 2
+ARGV.each do |arg|
+  tolerance = arg.split("=", 2)[1].to_i if arg.start_with?("--tolerance=")
+end
+
+SCENES = []
+
+def scene(name, &block)
+  SCENES << [name, block]
+end
+
+def golden_image(w, h)
+  image = GPU::Image.new(w, h, GPU::GPU_FORMAT_RGBA)
+  [image, GPU.load_target(image)]
+end
+
+# The [r, g, b, a] of every pixel, row by row.
+def golden_pixels(target, w, h)
+  GPU.flush_blit_buffer
+  pixels = []
+  h.times do |y|
+    w.times { |x| pixels << target.get_pixel(x, y) }
+  end
+  pixels
+end
+
+def golden_channels_close?(a, b, tolerance)
+  4.times do |i|
+    return false if (a[i] - b[i]).abs > tolerance
+  end
+  true
+end
+
+# The reference, or nil when it was never written.
+def golden_load(path)
+  GPU::Image.new(path)
+rescue RuntimeError
+  nil
+end
+
+screen = GPU.init(GOLDEN_W, GOLDEN_H, SDL_WINDOW_HIDDEN)
+
+# a texture with a differently coloured quadrant in every corner, so flips
+# and rotations show
+sprite, sprite_target = golden_image(32, 32)
+sprite.filter(GPU::GPU_FILTER_NEAREST)
+sprite_target.clear
+sprite_target.rect_filled(0.0, 0.0, 16.0, 16.0, 255, 0, 0, 255)
+sprite_target.rect_filled(16.0, 0.0, 32.0, 16.0, 0, 255, 0, 255)
+sprite_target.rect_filled(0.0, 16.0, 16.0, 32.0, 0, 0, 255, 255)
+sprite_target.rect_filled(16.0, 16.0, 32.0, 32.0, 255, 255, 0, 255)
+GPU.flush_blit_buffer
+rect = GPU::Rect.new(0, 0, 32, 32)
+
+# a second texture for the multi-texture batch to switch between
+tile, tile_target = golden_image(32, 32)
+tile_target.clear_rgb(255, 0, 255)
+
+# blits are centred on the given position
+scene("blits") do |t|
+  t.blit(sprite, rect, 24.0, 24.0)
+  t.blit(sprite, rect, 64.0, 24.0, 180.0)
+  t.blit(sprite, rect, 104.0, 24.0, -1.0, 1.0)
+  t.blit(sprite, rect, 40.0, 68.0, 2.0, 1.0)
+  t.blit(sprite, rect, 104.0, 68.0, 1.0, -1.0)
+end
+
+scene("rectangles") do |t|
+  t.rect_filled(8.0, 8.0, 56.0, 40.0, 255, 0, 0, 255)
+  t.rect_filled(40.0, 24.0, 100.0, 72.0, 0, 255, 0, 255)
+  t.rect_filled(0.0, 80.0, 128.0, 96.0, 0, 0, 255, 255)
+  t.rect_filled(110.0, 0.0, 128.0, 20.0, 255, 255, 255, 255)
+end
+
+scene("gradients") do |t|
+  t.gradient_fill_rect(255, 0, 0, 255, 0, 0, 255, 255,
+                       GPU::Rect.new(0, 0, 64, 96), true)
+  t.gradient_fill_rect(255, 255, 0, 255, 0, 255, 255, 255,
+                       GPU::Rect.new(64, 0, 64, 96), false)
+end
+
+scene("blit_batch") do |t|
+  values = []
+  [[8.0, 8.0], [60.0, 30.0], [92.0, 56.0]].each do |x, y|
+    [[0.0, 0.0], [32.0, 0.0], [32.0, 32.0], [0.0, 32.0]].each do |dx, dy|
+      values << [x + dx, y + dy, dx / 32.0, dy / 32.0, 1.0, 1.0, 1.0, 1.0]
+    end
+  end
+  indices = []
+  3.times { |q| indices.concat([0, 1, 2, 0, 2, 3].map { |i| q * 4 + i }) }
+  t.blit_batch(sprite, values, indices, GPU::GPU_BATCH_XY_ST_RGBA)
+end
+
+scene("packed_colors") do |t|
+  t.rect_filled(8.0, 8.0, 56.0, 40.0, GPU::Color::ORANGE)
+  t.rect_filled(40.0, 24.0, 100.0, 44.0, GPU::Color::TEAL)
+  t.rect_filled(104.0, 4.0, 124.0, 44.0, GPU::Color::CORNFLOWER_BLUE)
+  t.gradient_fill_rect(GPU::Color::NAVY, GPU::Color::PINK,
+                       GPU::Rect.new(0, 48, 128, 48), false)
+  t.gradient_fill_rect(GPU::Color::GOLD, GPU::Color::PURPLE,
+                       GPU::Rect.new(100, 56, 20, 32), true)
+end
+
+# the named blit variants; blit_transform_x places the pivot, given from
+# the top left of the region, at x, y
+scene("blit_calls") do |t|
+  t.blit_rotate(sprite, rect, 24.0, 24.0, 180.0)
+  t.blit_scale(sprite, rect, 64.0, 24.0, 1.0, -1.0)
+  t.blit_transform(sprite, rect, 104.0, 24.0, -1.0, -1.0, 180.0)
+  t.blit_transform_x(sprite, rect, 8.0, 52.0, 2.0, 1.0, 0.0, 0.0, 0.0)
+  t.blit_transform_x(sprite, rect, 104.0, 68.0, 1.0, 1.0, 180.0, 16.0, 16.0)
+end
+
+# overlapping blits alternating between two textures, drawn in order
+scene("multi_batch") do |t|
+  t.begin_multi_batch(2)
+  8.times do |i|
+    t.blit(i.even? ? sprite : tile, rect, 16.0 + i * 14.0, 20.0 + (i % 3) * 25.0)
+  end
+  t.end_multi_batch
+end
+
+failed = []
+SCENES.each do |name, block|
+  image, target = golden_image(GOLDEN_W, GOLDEN_H)
+  target.clear_rgb(0, 0, 0)
+  block.call(target)
+  actual = golden_pixels(target, GOLDEN_W, GOLDEN_H)
+  path = "#{GOLDEN_DIR}/#{name}.png"
+
+  if update
+    image.save(path, GPU::GPU_FILE_PNG)
+    puts "#{name}: written"
+    next
+  end
+
+  reference = golden_load(path)
+  if reference.nil?
+    image.save("#{GOLDEN_DIR}/#{name}.actual.png", GPU::GPU_FILE_PNG)
+    puts "#{name}: no reference, run with --update"
+    failed << name
+    next
+  end
+  expected = golden_pixels(GPU.load_target(reference), GOLDEN_W, GOLDEN_H)
+
+  diff, diff_target = golden_image(GOLDEN_W, GOLDEN_H)
+  diff_target.clear_rgb(0, 0, 0)
+  different = 0
+  actual.each_with_index do |pixel, i|
+    next if golden_channels_close?(pixel, expected[i], tolerance)
+    different += 1
+    x = (i % GOLDEN_W).to_f
+    y = (i / GOLDEN_W).to_f
+    diff_target.rect_filled(x, y, x + 1.0, y + 1.0, 255, 0, 0, 255)
+  end
+
+  if 0 == different
+    puts "#{name}: ok"
+  else
+    image.save("#{GOLDEN_DIR}/#{name}.actual.png", GPU::GPU_FILE_PNG)
+    GPU.flush_blit_buffer
+    diff.save("#{GOLDEN_DIR}/#{name}.diff.png", GPU::GPU_FILE_PNG)
+    puts "#{name}: #{different} pixels differ by more than #{tolerance}"
+    failed << name
+  end
+end
+
+screen.flip
+GPU.quit
+raise "golden images differ: #{failed.join(', ')}" unless failed.empty?
@@ -0,0 +1,40 @@
+# Cold start cost of the gem: GPU.init and the first raw GL call, which
+# resolves the GL entry points the bindings use. Each measurement only
+# happens once per process, so run it a few times in fresh processes:
+#
+#   for i in 1 2 3 4 5; do
+#     xvfb-run -a env LIBGL_ALWAYS_SOFTWARE=1 bin/mruby bench/startup.rb
+#   done > startup_output.txt
+#
+# The rows have the bench/bench.rb format (calls is 1), so two runs can be
+# compared with bench/compare.rb; it keeps the last row of every case.
+
+SDL_WINDOW_HIDDEN = 0x00000008
+
+def startup_row(name, seconds)
+  seconds = 0.000000001 if seconds <= 0.0
+  puts "{\"case\":\"#{name}\",\"calls\":1," \
+       "\"calls_per_sec\":#{(1.0 / seconds).round(2)}," \
+       "\"ns_per_call\":#{(seconds * 1_000_000_000).round(2)}," \
+       "\"allocs_per_call\":0.0}"
+end
+
+start = Time.now.to_f
+screen = GPU.init(640, 480, SDL_WINDOW_HIDDEN)
+startup_row("startup/gpu_init", Time.now.to_f - start)
+
+# blit_batch goes through the streaming buffer, the first raw GL path
+image = GPU::Image.new(16, 16, GPU::GPU_FORMAT_RGBA)
+start = Time.now.to_f
+screen.blit_batch(image, [0.0, 0.0, 0.0, 0.0, 16.0, 0.0, 1.0, 0.0,
+                          0.0, 16.0, 0.0, 1.0], [],
+                  GPU::GPU_BATCH_XY | GPU::GPU_BATCH_ST)
+screen.flip
+startup_row("startup/first_batch", Time.now.to_f - start)
+
+stats = GPU.gl_stats
+startup_row("startup/gl_load", stats[:load_time]) if stats[:loaded]
+puts "# gl version=#{stats[:version]} resolved=#{stats[:resolved]}/" \
+     "#{stats[:functions]}"
+
+GPU.quit
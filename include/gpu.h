@@ -4,15 +4,165 @@
 #include "sdl2.h"
 
 extern struct RClass *mod_GPU;
+extern struct RClass *class_Target;
+extern struct RClass *class_Image;
 #define SDL_GPU_NEW_IMAGE_FROM_STRING_BUG
 
 
 extern GPU_Target * mrb_sdl2_gpu_target_get_ptr(mrb_state *mrb, mrb_value target);
 extern mrb_value mrb_sdl2_gpu_target(mrb_state *mrb, GPU_Target *target);
+extern mrb_value mrb_sdl2_gpu_target_borrowed(mrb_state *mrb, GPU_Target *target);
+extern void mrb_sdl2_gpu_target_detach(mrb_state *mrb, mrb_value target);
+extern GPU_Rect mrb_sdl2_gpu_target_visible_rect(GPU_Target *target);
+extern mrb_bool mrb_sdl2_gpu_cull_box(GPU_Target *target, float x1, float y1,
+                                      float x2, float y2);
 
 extern GPU_Image * mrb_sdl2_gpu_image_get_ptr(mrb_state *mrb, mrb_value image);
 extern mrb_value mrb_sdl2_gpu_image(mrb_state *mrb, GPU_Image *image);
+extern mrb_value mrb_sdl2_gpu_image_borrowed(mrb_state *mrb, GPU_Image *image);
+extern void mrb_sdl2_gpu_image_detach(mrb_state *mrb, mrb_value image);
+
+Uint32 mrb_sdl2_gpu_program_get_uint32(mrb_state *mrb, mrb_value programid);
+
+GPU_AttributeFormat *mrb_sdl2_gpu_attributeformat_get_ptr(mrb_state *mrb,
+                                                          mrb_value format);
+GPU_Attribute *mrb_sdl2_gpu_attribute_get_ptr(mrb_state *mrb,
+                                              mrb_value attribute);
 
 GPU_Rect *mrb_sdl2_gpu_rect_get_ptr(mrb_state *mrb, mrb_value rect);
 mrb_value mrb_sdl2_gpu_rect(mrb_state *mrb, GPU_Rect rect);
+
+/* packed 0xRRGGBBAA colors, see gpu_color.c */
+#define MRB_SDL2_GPU_BATCH_RGBA_PACKED 0x1000  /* above SDL_gpu's batch bits */
+mrb_value mrb_sdl2_gpu_color_pack(SDL_Color color);
+SDL_Color mrb_sdl2_gpu_color_unpack(mrb_state *mrb, mrb_value color);
+SDL_Color mrb_sdl2_gpu_color_args(mrb_state *mrb, mrb_value const *args,
+                                  mrb_int argc);
+
+/* subsystems living in their own translation units */
+void mrb_sdl2_gpu_target_pool_init(mrb_state *mrb);
+void mrb_sdl2_gpu_post_chain_init(mrb_state *mrb);
+void mrb_sdl2_gpu_blur_init(mrb_state *mrb);
+void mrb_sdl2_gpu_blur_release(void);
+void mrb_sdl2_gpu_font_init(mrb_state *mrb);
+void mrb_sdl2_gpu_font_release(void);
+void mrb_sdl2_gpu_tilemap_init(mrb_state *mrb);
+void mrb_sdl2_gpu_particles_init(mrb_state *mrb);
+void mrb_sdl2_gpu_particles_release(void);
+void mrb_sdl2_gpu_spatial_grid_init(mrb_state *mrb);
+void mrb_sdl2_gpu_damage_init(mrb_state *mrb);
+void mrb_sdl2_gpu_damage_release(mrb_state *mrb);
+void mrb_sdl2_gpu_damage_box(GPU_Target *target, float x1, float y1,
+                             float x2, float y2);
+void mrb_sdl2_gpu_layer_init(mrb_state *mrb);
+void mrb_sdl2_gpu_mesh_init(mrb_state *mrb);
+void mrb_sdl2_gpu_mesh_release(void);
+void mrb_sdl2_gpu_stream_init(mrb_state *mrb);
+void mrb_sdl2_gpu_stream_release(void);
+void mrb_sdl2_gpu_identity_init(mrb_state *mrb);
+void mrb_sdl2_gpu_query_buffer_init(mrb_state *mrb);
+void mrb_sdl2_gpu_color_init(mrb_state *mrb);
+void mrb_sdl2_gpu_arena_init(mrb_state *mrb);
+void mrb_sdl2_gpu_vram_init(mrb_state *mrb);
+void mrb_sdl2_gpu_resource_scope_init(mrb_state *mrb);
+void mrb_sdl2_gpu_gl_init(mrb_state *mrb);
+void mrb_sdl2_gpu_multi_batch_init(mrb_state *mrb);
+void mrb_sdl2_gpu_multi_batch_release(void);
+
+/* per frame scratch memory, see gpu_arena.c */
+void mrb_sdl2_gpu_end_frame(void);
+void *mrb_sdl2_gpu_arena_alloc(mrb_state *mrb, size_t bytes);
+void mrb_sdl2_gpu_arena_reset(void);
+void mrb_sdl2_gpu_arena_release(void);
+
+/* GPU.resource_scope, see gpu_resource_scope.c */
+void mrb_sdl2_gpu_scope_adopt(mrb_state *mrb, mrb_value obj);
+void mrb_sdl2_gpu_scope_forget(void const *data);
+
+/* multi-texture batching, see gpu_multi_batch.c */
+#define MRB_SDL2_GPU_MAX_SLOTS   16
+#define MRB_SDL2_GPU_SLOT_FLOATS 9  /* x, y, s, t, r, g, b, a, slot */
+mrb_bool mrb_sdl2_gpu_multi_batch_blit(GPU_Target *target, GPU_Image *image,
+                                       GPU_Rect *rect, float x, float y,
+                                       mrb_bool use_anchor,
+                                       float pivot_x, float pivot_y,
+                                       float degrees, float scale_x,
+                                       float scale_y);
+void mrb_sdl2_gpu_multi_batch_sync(GPU_Target *target);
+void mrb_sdl2_gpu_multi_batch_end(GPU_Target *target);
+void mrb_sdl2_gpu_multi_batch_touch(GPU_Image const *image);
+void mrb_sdl2_gpu_multi_batch_forget(GPU_Image const *image);
+void mrb_sdl2_gpu_multi_batch_flush(void);
+
+/* VRAM registry, see gpu_vram.c */
+size_t mrb_sdl2_gpu_vram_estimate(Uint16 w, Uint16 h, GPU_FormatEnum format);
+mrb_bool mrb_sdl2_gpu_vram_reserve(mrb_state *mrb, size_t bytes);
+void mrb_sdl2_gpu_gc_pressure(mrb_state *mrb, size_t bytes);
+void mrb_sdl2_gpu_vram_add(GPU_Image *image, const char *site);
+void mrb_sdl2_gpu_vram_remove(GPU_Image const *image);
+void mrb_sdl2_gpu_vram_resize(GPU_Image const *image);
+void mrb_sdl2_gpu_vram_touch(GPU_Image const *image);
+void mrb_sdl2_gpu_vram_next_frame(void);
+void mrb_sdl2_gpu_vram_clear(void);
+
+/* caller supplied query output, see gpu_query_buffer.c */
+void mrb_sdl2_gpu_query_buffer_write_floats(mrb_state *mrb, mrb_value buffer,
+                                            float const *values, int n);
+void mrb_sdl2_gpu_query_buffer_write_uints(mrb_state *mrb, mrb_value buffer,
+                                           Uint32 const *values, int n);
+
+/* wrapper identity map, see gpu_identity.c */
+struct RData;
+struct mrb_data_type;
+struct RData *mrb_sdl2_gpu_identity_find(mrb_state *mrb, void const *ptr,
+                                         struct mrb_data_type const *type);
+void mrb_sdl2_gpu_identity_add(void const *ptr, struct RData *wrapper);
+void mrb_sdl2_gpu_identity_remove(void const *ptr,
+                                  struct mrb_data_type const *type,
+                                  void const *data);
+void mrb_sdl2_gpu_identity_clear(mrb_state *mrb,
+                                 void (*detach)(mrb_state *, struct RData *));
+
+/* built-in shaders, see gpu_glsl.c */
+extern const char *mrb_sdl2_gpu_builtin_vertex_source;
+Uint32 mrb_sdl2_gpu_builtin_program(mrb_state *mrb, const char *vertex_source,
+                                    const char *fragment_source);
+
+/* raw OpenGL access, see gpu_gl.c */
+void mrb_sdl2_gpu_gl_require(mrb_state *mrb);
+mrb_bool mrb_sdl2_gpu_gl_available(void);
+mrb_bool mrb_sdl2_gpu_gl_has_instancing(void);
+Uint32 mrb_sdl2_gpu_gl_texture(GPU_Image *image);
+void mrb_sdl2_gpu_gl_begin(mrb_state *mrb, GPU_Target *target, float *mvp);
+void mrb_sdl2_gpu_gl_end(void);
+void mrb_sdl2_gpu_gl_bind_image(GPU_Image *image);
+Uint32 mrb_sdl2_gpu_gl_generation(void);
+void mrb_sdl2_gpu_gl_delete_buffer(Uint32 buffer, Uint32 generation);
+void mrb_sdl2_gpu_gl_release(void);
+
+/* streaming vertex buffer, see gpu_stream.c */
+typedef struct mrb_sdl2_gpu_stream_program_t {
+  Uint32 id;
+  int    mvp;         /* uniform locations, looked up once */
+  int    tex;
+  int    attribs[4];  /* gpu_Vertex, gpu_TexCoord, gpu_Color, gpu_TexSlot */
+} mrb_sdl2_gpu_stream_program_t;
+
+void mrb_sdl2_gpu_stream_program_init(mrb_sdl2_gpu_stream_program_t *program,
+                                      Uint32 id);
+mrb_bool mrb_sdl2_gpu_stream_usable(mrb_state *mrb);
+mrb_bool mrb_sdl2_gpu_stream_ready(mrb_state *mrb, GPU_Image *image,
+                                   Uint32 flags);
+void *mrb_sdl2_gpu_stream_reserve(size_t vertex_bytes, size_t index_bytes,
+                                  Uint16 **indices);
+void mrb_sdl2_gpu_stream_trim(void const *vertices, size_t vertex_bytes);
+void mrb_sdl2_gpu_stream_draw(mrb_state *mrb, GPU_Target *target,
+                              GPU_Image *image, Uint32 flags,
+                              float const *vertices, int num_vertices,
+                              Uint16 const *indices, int num_indices);
+void mrb_sdl2_gpu_stream_draw_slots(mrb_state *mrb, GPU_Target *target,
+                                    mrb_sdl2_gpu_stream_program_t const *program,
+                                    GPU_Image *const *images,
+                                    int num_images, float const *vertices,
+                                    int num_quads);
 #endif /* end of MRUBY_SDL2_GPU_H */
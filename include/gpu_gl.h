@@ -0,0 +1,134 @@
+#ifndef MRUBY_SDL2_GPU_GL_H
+#define MRUBY_SDL2_GPU_GL_H
+
+/* The OpenGL entry points the raw GL paths call, nothing more. They are
+ * resolved through SDL_GL_GetProcAddress the first time a raw GL path
+ * runs (see mrb_sdl2_gpu_gl_require), so programs that never use them pay
+ * nothing at startup and the gem needs no GL loader library.
+ *
+ * X(return type, name without the gl prefix, parameters, required).
+ * Optional ones stay NULL when missing; their callers check
+ * mrb_sdl2_gpu_gl_version / mrb_sdl2_gpu_gl_extension first. */
+
+#include <SDL2/SDL_opengl.h>
+
+#define MRB_SDL2_GPU_GL_FUNCTIONS(X)                                          \
+  X(void, ActiveTexture, (GLenum texture), TRUE)                              \
+  X(void, BindBuffer, (GLenum target, GLuint buffer), TRUE)                   \
+  X(void, BindFramebuffer, (GLenum target, GLuint framebuffer), TRUE)         \
+  X(void, BindTexture, (GLenum target, GLuint texture), TRUE)                 \
+  X(void, BindVertexArray, (GLuint array), FALSE)                             \
+  X(void, BlendEquationSeparate, (GLenum rgb, GLenum alpha), TRUE)            \
+  X(void, BlendFuncSeparate, (GLenum src_rgb, GLenum dst_rgb,                 \
+                              GLenum src_alpha, GLenum dst_alpha), TRUE)      \
+  X(void, BufferData, (GLenum target, GLsizeiptr size, const void *data,      \
+                       GLenum usage), TRUE)                                   \
+  X(void, BufferStorage, (GLenum target, GLsizeiptr size, const void *data,   \
+                          GLbitfield flags), FALSE)                           \
+  X(void, BufferSubData, (GLenum target, GLintptr offset, GLsizeiptr size,    \
+                          const void *data), TRUE)                            \
+  X(GLenum, ClientWaitSync, (GLsync sync, GLbitfield flags,                   \
+                             GLuint64 timeout), FALSE)                        \
+  X(void, DeleteBuffers, (GLsizei n, const GLuint *buffers), TRUE)            \
+  X(void, DeleteSync, (GLsync sync), FALSE)                                   \
+  X(void, Disable, (GLenum cap), TRUE)                                        \
+  X(void, DisableVertexAttribArray, (GLuint index), TRUE)                     \
+  X(void, DrawArrays, (GLenum mode, GLint first, GLsizei count), TRUE)        \
+  X(void, DrawArraysInstanced, (GLenum mode, GLint first, GLsizei count,      \
+                                GLsizei instances), FALSE)                    \
+  X(void, DrawArraysInstancedARB, (GLenum mode, GLint first, GLsizei count,   \
+                                   GLsizei instances), FALSE)                 \
+  X(void, DrawElements, (GLenum mode, GLsizei count, GLenum type,             \
+                         const void *indices), TRUE)                          \
+  X(void, DrawElementsInstanced, (GLenum mode, GLsizei count, GLenum type,    \
+                                  const void *indices, GLsizei instances),    \
+    FALSE)                                                                    \
+  X(void, DrawElementsInstancedARB, (GLenum mode, GLsizei count, GLenum type, \
+                                     const void *indices, GLsizei instances), \
+    FALSE)                                                                    \
+  X(void, Enable, (GLenum cap), TRUE)                                         \
+  X(void, EnableVertexAttribArray, (GLuint index), TRUE)                      \
+  X(GLsync, FenceSync, (GLenum condition, GLbitfield flags), FALSE)           \
+  X(void, GenBuffers, (GLsizei n, GLuint *buffers), TRUE)                     \
+  X(void, GenVertexArrays, (GLsizei n, GLuint *arrays), FALSE)                \
+  X(GLint, GetAttribLocation, (GLuint program, const GLchar *name), TRUE)     \
+  X(GLenum, GetError, (void), TRUE)                                           \
+  X(void, GetIntegerv, (GLenum pname, GLint *data), TRUE)                     \
+  X(const GLubyte *, GetString, (GLenum name), TRUE)                          \
+  X(GLint, GetUniformLocation, (GLuint program, const GLchar *name), TRUE)    \
+  X(void *, MapBufferRange, (GLenum target, GLintptr offset,                  \
+                             GLsizeiptr length, GLbitfield access), FALSE)    \
+  X(void, Scissor, (GLint x, GLint y, GLsizei w, GLsizei h), TRUE)            \
+  X(void, Uniform1i, (GLint location, GLint value), TRUE)                     \
+  X(void, Uniform1iv, (GLint location, GLsizei count, const GLint *value),    \
+    TRUE)                                                                     \
+  X(void, UniformMatrix4fv, (GLint location, GLsizei count,                   \
+                             GLboolean transpose, const GLfloat *value),      \
+    TRUE)                                                                     \
+  X(GLboolean, UnmapBuffer, (GLenum target), FALSE)                           \
+  X(void, UseProgram, (GLuint program), TRUE)                                 \
+  X(void, VertexAttrib4f, (GLuint index, GLfloat x, GLfloat y, GLfloat z,     \
+                           GLfloat w), TRUE)                                  \
+  X(void, VertexAttribDivisor, (GLuint index, GLuint divisor), FALSE)         \
+  X(void, VertexAttribDivisorARB, (GLuint index, GLuint divisor), FALSE)      \
+  X(void, VertexAttribPointer, (GLuint index, GLint size, GLenum type,        \
+                                GLboolean normalized, GLsizei stride,         \
+                                const void *pointer), TRUE)                   \
+  X(void, Viewport, (GLint x, GLint y, GLsizei w, GLsizei h), TRUE)
+
+#define MRB_SDL2_GPU_GL_DECLARE(type, name, params, required)                 \
+  typedef type (APIENTRY *mrb_sdl2_gpu_gl##name##_t) params;                  \
+  extern mrb_sdl2_gpu_gl##name##_t mrb_sdl2_gpu_gl##name;
+MRB_SDL2_GPU_GL_FUNCTIONS(MRB_SDL2_GPU_GL_DECLARE)
+#undef MRB_SDL2_GPU_GL_DECLARE
+
+/* the usual names, so GL code reads like GL code */
+#define glActiveTexture            mrb_sdl2_gpu_glActiveTexture
+#define glBindBuffer               mrb_sdl2_gpu_glBindBuffer
+#define glBindFramebuffer          mrb_sdl2_gpu_glBindFramebuffer
+#define glBindTexture              mrb_sdl2_gpu_glBindTexture
+#define glBindVertexArray          mrb_sdl2_gpu_glBindVertexArray
+#define glBlendEquationSeparate    mrb_sdl2_gpu_glBlendEquationSeparate
+#define glBlendFuncSeparate        mrb_sdl2_gpu_glBlendFuncSeparate
+#define glBufferData               mrb_sdl2_gpu_glBufferData
+#define glBufferStorage            mrb_sdl2_gpu_glBufferStorage
+#define glBufferSubData            mrb_sdl2_gpu_glBufferSubData
+#define glClientWaitSync           mrb_sdl2_gpu_glClientWaitSync
+#define glDeleteBuffers            mrb_sdl2_gpu_glDeleteBuffers
+#define glDeleteSync               mrb_sdl2_gpu_glDeleteSync
+#define glDisable                  mrb_sdl2_gpu_glDisable
+#define glDisableVertexAttribArray mrb_sdl2_gpu_glDisableVertexAttribArray
+#define glDrawArrays               mrb_sdl2_gpu_glDrawArrays
+#define glDrawArraysInstanced      mrb_sdl2_gpu_glDrawArraysInstanced
+#define glDrawArraysInstancedARB   mrb_sdl2_gpu_glDrawArraysInstancedARB
+#define glDrawElements             mrb_sdl2_gpu_glDrawElements
+#define glDrawElementsInstanced    mrb_sdl2_gpu_glDrawElementsInstanced
+#define glDrawElementsInstancedARB mrb_sdl2_gpu_glDrawElementsInstancedARB
+#define glEnable                   mrb_sdl2_gpu_glEnable
+#define glEnableVertexAttribArray  mrb_sdl2_gpu_glEnableVertexAttribArray
+#define glFenceSync                mrb_sdl2_gpu_glFenceSync
+#define glGenBuffers               mrb_sdl2_gpu_glGenBuffers
+#define glGenVertexArrays          mrb_sdl2_gpu_glGenVertexArrays
+#define glGetAttribLocation        mrb_sdl2_gpu_glGetAttribLocation
+#define glGetError                 mrb_sdl2_gpu_glGetError
+#define glGetIntegerv              mrb_sdl2_gpu_glGetIntegerv
+#define glGetString                mrb_sdl2_gpu_glGetString
+#define glGetUniformLocation       mrb_sdl2_gpu_glGetUniformLocation
+#define glMapBufferRange           mrb_sdl2_gpu_glMapBufferRange
+#define glScissor                  mrb_sdl2_gpu_glScissor
+#define glUniform1i                mrb_sdl2_gpu_glUniform1i
+#define glUniform1iv               mrb_sdl2_gpu_glUniform1iv
+#define glUniformMatrix4fv         mrb_sdl2_gpu_glUniformMatrix4fv
+#define glUnmapBuffer              mrb_sdl2_gpu_glUnmapBuffer
+#define glUseProgram               mrb_sdl2_gpu_glUseProgram
+#define glVertexAttrib4f           mrb_sdl2_gpu_glVertexAttrib4f
+#define glVertexAttribDivisor      mrb_sdl2_gpu_glVertexAttribDivisor
+#define glVertexAttribDivisorARB   mrb_sdl2_gpu_glVertexAttribDivisorARB
+#define glVertexAttribPointer      mrb_sdl2_gpu_glVertexAttribPointer
+#define glViewport                 mrb_sdl2_gpu_glViewport
+
+/* capabilities of the loaded context, FALSE before the first load */
+mrb_bool mrb_sdl2_gpu_gl_version(int major, int minor);
+mrb_bool mrb_sdl2_gpu_gl_extension(const char *name);
+
+#endif /* end of MRUBY_SDL2_GPU_GL_H */
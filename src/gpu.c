@@ -14,13 +14,13 @@
 #include "mruby/variable.h"
 #include "mruby/array.h"
 #include "mruby/string.h"
+#include "mruby/hash.h"
 
 // mruby-sdl2 related includes
 #include "../include/sdl2_surface.h"
 #include "../include/sdl2_render.h"
 #include "../include/sdl2_rwops.h"
 
-#include "glew/GL/glew.h"
 #include "../include/gpu.h"
 
 struct RClass *mod_GPU               = NULL;
@@ -47,13 +47,22 @@ struct RClass *class_AttributeFormat = NULL;
 
 typedef struct mrb_sdl2_gpu_target_data_t {
   GPU_Target *target;
+  mrb_bool    owned;  /* FALSE when somebody else (e.g. a pool) frees it */
 } mrb_sdl2_gpu_target_data_t;
 
+static struct mrb_data_type const mrb_sdl2_gpu_target_data_type;
+
 static void
 mrb_sdl2_gpu_target_data_free(mrb_state *mrb, void *p) {
   mrb_sdl2_gpu_target_data_t *data =
     (mrb_sdl2_gpu_target_data_t*)p;
-  if (NULL != data->target) {
+  if (NULL == data)
+    return;
+  mrb_sdl2_gpu_scope_forget(data);
+  mrb_sdl2_gpu_identity_remove(data->target, &mrb_sdl2_gpu_target_data_type,
+                               data);
+  if (NULL != data->target && data->owned) {
+    mrb_sdl2_gpu_multi_batch_end(data->target);
     GPU_FreeTarget(data->target);
   }
   mrb_free(mrb, data);
@@ -76,17 +85,255 @@ mrb_sdl2_gpu_target_get_ptr(mrb_state *mrb, mrb_value target) {
 }
 
 
-mrb_value
-mrb_sdl2_gpu_target(mrb_state *mrb, GPU_Target *target) {
-  mrb_sdl2_gpu_target_data_t *data =
-    (mrb_sdl2_gpu_target_data_t*)
+/* Returns the live wrapper of target if there is one. An owned wrap hands
+ * the caller's reference to it, which for an already owning wrapper means
+ * dropping the extra reference GPU_LoadTarget took. */
+static mrb_value
+mrb_sdl2_gpu_target_wrap(mrb_state *mrb, GPU_Target *target, mrb_bool owned) {
+  mrb_sdl2_gpu_target_data_t *data;
+  struct RData *wrapper =
+    mrb_sdl2_gpu_identity_find(mrb, target,
+                               &mrb_sdl2_gpu_target_data_type);
+  if (NULL != wrapper) {
+    data = (mrb_sdl2_gpu_target_data_t*)wrapper->data;
+    if (owned && data->owned) {
+      GPU_FreeTarget(target);
+    }
+    data->owned = data->owned || owned;
+    return mrb_obj_value(wrapper);
+  }
+  data = (mrb_sdl2_gpu_target_data_t*)
       mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_target_data_t));
   if (NULL == data) {
     mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
   }
   data->target = target;
-  return mrb_obj_value(
-  Data_Wrap_Struct(mrb, class_Target, &mrb_sdl2_gpu_target_data_type, data));
+  data->owned = owned;
+  wrapper =
+    Data_Wrap_Struct(mrb, class_Target, &mrb_sdl2_gpu_target_data_type, data);
+  mrb_sdl2_gpu_identity_add(target, wrapper);
+  if (owned)
+    mrb_sdl2_gpu_scope_adopt(mrb, mrb_obj_value(wrapper));
+  return mrb_obj_value(wrapper);
+}
+
+/* Wraps a target the caller owns a reference of. */
+mrb_value
+mrb_sdl2_gpu_target(mrb_state *mrb, GPU_Target *target) {
+  return mrb_sdl2_gpu_target_wrap(mrb, target, TRUE);
+}
+
+/* Wraps a target whose lifetime is managed on the C side. */
+mrb_value
+mrb_sdl2_gpu_target_borrowed(mrb_state *mrb, GPU_Target *target) {
+  return mrb_sdl2_gpu_target_wrap(mrb, target, FALSE);
+}
+
+/* Makes a wrapper forget its target, e.g. after the owner freed it. */
+void
+mrb_sdl2_gpu_target_detach(mrb_state *mrb, mrb_value target) {
+  mrb_sdl2_gpu_target_data_t *data =
+    (mrb_sdl2_gpu_target_data_t*)
+      mrb_data_get_ptr(mrb, target, &mrb_sdl2_gpu_target_data_type);
+  if (NULL != data) {
+    mrb_sdl2_gpu_identity_remove(data->target,
+                                 &mrb_sdl2_gpu_target_data_type, data);
+    data->target = NULL;
+  }
+}
+
+static void
+mrb_sdl2_gpu_rect_intersect(GPU_Rect *area, GPU_Rect const *other) {
+  float x2 = SDL_min(area->x + area->w, other->x + other->w);
+  float y2 = SDL_min(area->y + area->h, other->y + other->h);
+  area->x = SDL_max(area->x, other->x);
+  area->y = SDL_max(area->y, other->y);
+  area->w = SDL_max(0.0f, x2 - area->x);
+  area->h = SDL_max(0.0f, y2 - area->y);
+}
+
+/* Bounding box of the world area the target shows: the part of its
+ * viewport inside the target and its clip rect, mapped back through the
+ * viewport, which squeezes the whole target into it, and the camera,
+ * which zooms and rotates around the target center. Draws outside of it
+ * cannot touch the target. */
+GPU_Rect
+mrb_sdl2_gpu_target_visible_rect(GPU_Target *target) {
+  GPU_Rect area, view;
+  float cx, cy, dx, dy, hw, hh, zoom, angle, c, s;
+  /* the viewport is in real pixels, the rest in virtual ones */
+  float sx = target->using_virtual_resolution && 0 != target->base_w ?
+      (float) target->w / target->base_w : 1.0f;
+  float sy = target->using_virtual_resolution && 0 != target->base_h ?
+      (float) target->h / target->base_h : 1.0f;
+  area.x = 0.0f;
+  area.y = 0.0f;
+  area.w = target->w;
+  area.h = target->h;
+  if (target->use_clip_rect)
+    mrb_sdl2_gpu_rect_intersect(&area, &target->clip_rect);
+  view.x = target->viewport.x * sx;
+  view.y = target->viewport.y * sy;
+  view.w = target->viewport.w * sx;
+  view.h = target->viewport.h * sy;
+  if (view.w > 0.0f && view.h > 0.0f) {
+    mrb_sdl2_gpu_rect_intersect(&area, &view);
+    area.x = (area.x - view.x) * target->w / view.w;
+    area.y = (area.y - view.y) * target->h / view.h;
+    area.w = area.w * target->w / view.w;
+    area.h = area.h * target->h / view.h;
+  }
+  if (!target->use_camera)
+    return area;
+
+  zoom = target->camera.zoom > 0.0f ? target->camera.zoom : 1.0f;
+  angle = target->camera.angle * (float) M_PI / 180.0f;
+  c = SDL_cos(angle);
+  s = SDL_sin(angle);
+  dx = (area.x + area.w / 2.0f - target->w / 2.0f) / zoom;
+  dy = (area.y + area.h / 2.0f - target->h / 2.0f) / zoom;
+  cx = target->camera.x + target->w / 2.0f + dx * c + dy * s;
+  cy = target->camera.y + target->h / 2.0f - dx * s + dy * c;
+  c = SDL_fabs(c);
+  s = SDL_fabs(s);
+  hw = area.w / 2.0f / zoom;
+  hh = area.h / 2.0f / zoom;
+  area.w = 2.0f * (hw * c + hh * s);
+  area.h = 2.0f * (hw * s + hh * c);
+  area.x = cx - area.w / 2.0f;
+  area.y = cy - area.h / 2.0f;
+  return area;
+}
+
+/* Argument access for the per-frame draw calls. They read the arguments
+ * straight off the VM stack instead of parsing a mrb_get_args format on
+ * every call; a splat call hands them over packed into one Array. */
+static mrb_value const *
+mrb_sdl2_gpu_argv(mrb_state *mrb, mrb_int *argc) {
+  mrb_value *argv;
+  if (mrb->c->ci->argc >= 0) {
+    *argc = mrb->c->ci->argc;
+    return mrb->c->stack + 1;
+  }
+  mrb_get_args(mrb, "*", &argv, argc);
+  return argv;
+}
+
+static inline float
+mrb_sdl2_gpu_arg_float(mrb_state *mrb, mrb_value value) {
+  if (mrb_float_p(value))
+    return (float) mrb_float(value);
+  if (mrb_fixnum_p(value))
+    return (float) mrb_fixnum(value);
+  return (float) mrb_to_flo(mrb, value);
+}
+
+/* draw culling, see GPU.set_culling and GPU.cull_stats */
+static mrb_bool cull_enabled = TRUE;
+static Uint32   cull_drawn   = 0;
+static Uint32   cull_culled  = 0;
+
+/* Returns TRUE (and counts it) when the world space box cannot touch the
+ * target, so the caller can skip submitting it. Boxes that do get drawn
+ * damage the target when it backs a retained window, and flush a batch
+ * that still samples the image the target renders to. */
+static mrb_bool
+mrb_sdl2_gpu_cull_test(GPU_Target *target, float x1, float y1,
+                       float x2, float y2) {
+  GPU_Rect visible;
+  if (NULL == target) {
+    cull_drawn++;
+    return FALSE;
+  }
+  if (cull_enabled) {
+    visible = mrb_sdl2_gpu_target_visible_rect(target);
+    if (SDL_max(x1, x2) < visible.x || SDL_max(y1, y2) < visible.y ||
+        SDL_min(x1, x2) > visible.x + visible.w ||
+        SDL_min(y1, y2) > visible.y + visible.h) {
+      cull_culled++;
+      return TRUE;
+    }
+  }
+  cull_drawn++;
+  mrb_sdl2_gpu_multi_batch_touch(target->image);
+  mrb_sdl2_gpu_damage_box(target, SDL_min(x1, x2), SDL_min(y1, y2),
+                          SDL_max(x1, x2), SDL_max(y1, y2));
+  return FALSE;
+}
+
+/* The cull test for draws that cannot join a multi-texture batch, so a
+ * batch pending on target goes out first to keep the drawing order. */
+mrb_bool
+mrb_sdl2_gpu_cull_box(GPU_Target *target, float x1, float y1,
+                      float x2, float y2) {
+  mrb_sdl2_gpu_multi_batch_sync(target);
+  return mrb_sdl2_gpu_cull_test(target, x1, y1, x2, y2);
+}
+
+/* Outlines are padded by the line thickness (and radius for round shapes)
+ * before testing. */
+static mrb_bool
+mrb_sdl2_gpu_cull_line(GPU_Target *target, float x1, float y1,
+                       float x2, float y2, float radius) {
+  float pad = radius + GPU_GetLineThickness();
+  return mrb_sdl2_gpu_cull_box(target, SDL_min(x1, x2) - pad,
+                               SDL_min(y1, y2) - pad,
+                               SDL_max(x1, x2) + pad,
+                               SDL_max(y1, y2) + pad);
+}
+
+/* Culls a whole batch by the bounding box of its vertex positions. */
+static mrb_bool
+mrb_sdl2_gpu_cull_batch(GPU_Target *target, float const *values,
+                        int count, int stride) {
+  float x1, y1, x2, y2;
+  int k;
+  if (NULL == values || count <= 0 || stride < 2)
+    return FALSE;
+  x1 = x2 = values[0];
+  y1 = y2 = values[1];
+  for (k = 1; k < count; k++) {
+    float x = values[k * stride], y = values[k * stride + 1];
+    x1 = SDL_min(x1, x);
+    x2 = SDL_max(x2, x);
+    y1 = SDL_min(y1, y);
+    y2 = SDL_max(y2, y);
+  }
+  return mrb_sdl2_gpu_cull_box(target, x1, y1, x2, y2);
+}
+
+/* Culls a blit placed with its pivot (pixels from the source region's top
+ * left, or the image anchor with use_anchor) at x, y. Rotated blits are
+ * tested with the circle swept by the region around the pivot. Blits may
+ * join a multi-texture batch instead, so only reading the batch target's
+ * image flushes it. */
+static mrb_bool
+mrb_sdl2_gpu_cull_blit(GPU_Target *target, GPU_Image *image, GPU_Rect *rect,
+                       float x, float y, mrb_bool use_anchor,
+                       float pivot_x, float pivot_y,
+                       float scale_x, float scale_y, mrb_bool rotated) {
+  float w, h, reach_x, reach_y, radius;
+  if (NULL == image)
+    return FALSE;
+  mrb_sdl2_gpu_multi_batch_sync(image->target);
+  w = NULL != rect ? rect->w : image->w;
+  h = NULL != rect ? rect->h : image->h;
+  if (use_anchor) {
+    pivot_x = image->anchor_x * w;
+    pivot_y = image->anchor_y * h;
+  }
+  if (!rotated) {
+    return mrb_sdl2_gpu_cull_test(target,
+                                  x - pivot_x * scale_x, y - pivot_y * scale_y,
+                                  x + (w - pivot_x) * scale_x,
+                                  y + (h - pivot_y) * scale_y);
+  }
+  reach_x = SDL_max(pivot_x, w - pivot_x);
+  reach_y = SDL_max(pivot_y, h - pivot_y);
+  radius = SDL_sqrt(reach_x * reach_x + reach_y * reach_y) *
+           SDL_max(SDL_fabs(scale_x), SDL_fabs(scale_y));
+  return mrb_sdl2_gpu_cull_test(target, x - radius, y - radius,
+                                x + radius, y + radius);
 }
 /*******************************
  * GPU_Target bindings ends here
@@ -105,6 +352,7 @@ mrb_sdl2_gpu_shader_data_free(mrb_state *mrb, void *p) {
   mrb_sdl2_gpu_shader_data_t *data =
     (mrb_sdl2_gpu_shader_data_t*)p;
   if (NULL != data) {
+    mrb_sdl2_gpu_scope_forget(data);
     if (0 != data->shaderid) {
       GPU_FreeShader(data->shaderid);
     }
@@ -131,6 +379,7 @@ mrb_sdl2_gpu_shader_get_uint32(mrb_state *mrb, mrb_value shaderid) {
 
 mrb_value
 mrb_sdl2_gpu_shader(mrb_state *mrb, Uint32 shaderid) {
+  mrb_value shader;
   mrb_sdl2_gpu_shader_data_t *data =
     (mrb_sdl2_gpu_shader_data_t*)
       mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_shader_data_t));
@@ -138,8 +387,10 @@ mrb_sdl2_gpu_shader(mrb_state *mrb, Uint32 shaderid) {
     mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
   }
   data->shaderid = shaderid;
-  return mrb_obj_value(
+  shader = mrb_obj_value(
   Data_Wrap_Struct(mrb, class_Shader, &mrb_sdl2_gpu_shader_data_type, data));
+  mrb_sdl2_gpu_scope_adopt(mrb, shader);
+  return shader;
 }
 /*******************************
  * Shader bindings ends here
@@ -149,6 +400,10 @@ mrb_sdl2_gpu_shader(mrb_state *mrb, Uint32 shaderid) {
  * Program bindings starts here
  *********************************/
 
+/* What a linked program or compiled shader is charged as GC pressure,
+ * the driver does not tell how much it really keeps. */
+#define MRB_SDL2_GPU_PROGRAM_PRESSURE (16 * 1024)
+
 typedef struct mrb_sdl2_gpu_program_data_t {
   Uint32 programid;
 } mrb_sdl2_gpu_program_data_t;
@@ -157,6 +412,7 @@ static void
 mrb_sdl2_gpu_program_data_free(mrb_state *mrb, void *p) {
   mrb_sdl2_gpu_program_data_t *data =
     (mrb_sdl2_gpu_program_data_t*)p;
+  mrb_sdl2_gpu_scope_forget(data);
   if (0 != data->programid) {
     GPU_FreeShaderProgram(data->programid);
   }
@@ -182,6 +438,7 @@ mrb_sdl2_gpu_program_get_uint32(mrb_state *mrb, mrb_value programid) {
 
 mrb_value
 mrb_sdl2_gpu_program(mrb_state *mrb, Uint32 programid) {
+  mrb_value program;
   mrb_sdl2_gpu_program_data_t *data =
     (mrb_sdl2_gpu_program_data_t*)
       mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_program_data_t));
@@ -189,11 +446,13 @@ mrb_sdl2_gpu_program(mrb_state *mrb, Uint32 programid) {
     mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
   }
   data->programid = programid;
-  return mrb_obj_value(
+  program = mrb_obj_value(
       Data_Wrap_Struct(mrb,
                        class_Program,
                        &mrb_sdl2_gpu_program_data_type,
                        data));
+  mrb_sdl2_gpu_scope_adopt(mrb, program);
+  return program;
 }
 /*******************************
  * Program bindings ends here
@@ -232,6 +491,9 @@ mrb_sdl2_gpu_attributeformat_get_ptr(mrb_state *mrb,
       mrb_data_get_ptr(mrb,
                        attributeformat,
                        &mrb_sdl2_gpu_attributeformat_data_type);
+  if (NULL == data) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "AttributeFormat is not initialized");
+  }
   return &data->attributeformat;
 }
 
@@ -271,10 +533,12 @@ static void
 mrb_sdl2_gpu_attribute_data_free(mrb_state *mrb, void *p) {
   mrb_sdl2_gpu_attribute_data_t *data =
     (mrb_sdl2_gpu_attribute_data_t*)p;
-  if (NULL != data->attribute) {
-    mrb_free(mrb, (void *) data->attribute);
+  if (NULL != data) {
+    if (NULL != data->attribute) {
+      mrb_free(mrb, (void *) data->attribute);
+    }
+    mrb_free(mrb, data);
   }
-  mrb_free(mrb, data);
 }
 
 static struct mrb_data_type const mrb_sdl2_gpu_attribute_data_type = {
@@ -290,6 +554,9 @@ mrb_sdl2_gpu_attribute_get_ptr(mrb_state *mrb, mrb_value attribute) {
   data =
     (mrb_sdl2_gpu_attribute_data_t*)
       mrb_data_get_ptr(mrb, attribute, &mrb_sdl2_gpu_attribute_data_type);
+  if (NULL == data) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Attribute is not initialized");
+  }
   return data->attribute;
 }
 
@@ -470,16 +737,41 @@ mrb_sdl2_gpu_rect(mrb_state *mrb, GPU_Rect rect) {
 
 typedef struct mrb_sdl2_gpu_image_data_t {
   GPU_Image *image;
+  mrb_bool   owned;
 } mrb_sdl2_gpu_image_data_t;
 
+static struct mrb_data_type const mrb_sdl2_gpu_image_data_type;
+
+/* GPU_FreeImage takes the image's target along unless GPU_LoadTarget
+ * references keep it alive, so only owning target wrappers stay valid. */
+static void
+mrb_sdl2_gpu_image_release(mrb_state *mrb, mrb_sdl2_gpu_image_data_t *data) {
+  struct RData *target;
+  mrb_sdl2_gpu_identity_remove(data->image, &mrb_sdl2_gpu_image_data_type,
+                               data);
+  if (NULL == data->image || !data->owned)
+    return;
+  target = mrb_sdl2_gpu_identity_find(mrb, data->image->target,
+                                      &mrb_sdl2_gpu_target_data_type);
+  if (NULL != target &&
+      !((mrb_sdl2_gpu_target_data_t*)target->data)->owned) {
+    mrb_sdl2_gpu_identity_remove(data->image->target,
+                                 &mrb_sdl2_gpu_target_data_type,
+                                 target->data);
+    ((mrb_sdl2_gpu_target_data_t*)target->data)->target = NULL;
+  }
+  mrb_sdl2_gpu_multi_batch_forget(data->image);
+  mrb_sdl2_gpu_vram_remove(data->image);
+  GPU_FreeImage(data->image);
+}
+
 static void
 mrb_sdl2_gpu_image_data_free(mrb_state *mrb, void *p) {
   mrb_sdl2_gpu_image_data_t *data =
     (mrb_sdl2_gpu_image_data_t*)p;
   if (NULL != data) {
-    if (NULL != data->image) {
-      GPU_FreeImage(data->image);
-    }
+    mrb_sdl2_gpu_scope_forget(data);
+    mrb_sdl2_gpu_image_release(mrb, data);
     mrb_free(mrb, data);
   }
 }
@@ -502,20 +794,53 @@ mrb_sdl2_gpu_image_data_t *data;
   return data->image;
 }
 
-mrb_value
-mrb_sdl2_gpu_image(mrb_state *mrb, GPU_Image *image) {
-  mrb_sdl2_gpu_image_data_t *data =
-    (mrb_sdl2_gpu_image_data_t*)
+static mrb_value
+mrb_sdl2_gpu_image_wrap(mrb_state *mrb, GPU_Image *image, mrb_bool owned) {
+  mrb_sdl2_gpu_image_data_t *data;
+  struct RData *wrapper =
+    mrb_sdl2_gpu_identity_find(mrb, image, &mrb_sdl2_gpu_image_data_type);
+  if (NULL != wrapper) {
+    data = (mrb_sdl2_gpu_image_data_t*)wrapper->data;
+    data->owned = data->owned || owned;
+    return mrb_obj_value(wrapper);
+  }
+  data = (mrb_sdl2_gpu_image_data_t*)
       mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_image_data_t));
   if (NULL == data) {
     mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory for Image.");
   }
   data->image = image;
-  return mrb_obj_value(
-      Data_Wrap_Struct(mrb,
-                       class_Image,
-                       &mrb_sdl2_gpu_image_data_type,
-                       data));
+  data->owned = owned;
+  wrapper = Data_Wrap_Struct(mrb,
+                             class_Image,
+                             &mrb_sdl2_gpu_image_data_type,
+                             data);
+  mrb_sdl2_gpu_identity_add(image, wrapper);
+  if (owned)
+    mrb_sdl2_gpu_scope_adopt(mrb, mrb_obj_value(wrapper));
+  return mrb_obj_value(wrapper);
+}
+
+mrb_value
+mrb_sdl2_gpu_image(mrb_state *mrb, GPU_Image *image) {
+  return mrb_sdl2_gpu_image_wrap(mrb, image, TRUE);
+}
+
+mrb_value
+mrb_sdl2_gpu_image_borrowed(mrb_state *mrb, GPU_Image *image) {
+  return mrb_sdl2_gpu_image_wrap(mrb, image, FALSE);
+}
+
+void
+mrb_sdl2_gpu_image_detach(mrb_state *mrb, mrb_value image) {
+  mrb_sdl2_gpu_image_data_t *data =
+    (mrb_sdl2_gpu_image_data_t*)
+      mrb_data_get_ptr(mrb, image, &mrb_sdl2_gpu_image_data_type);
+  if (NULL != data) {
+    mrb_sdl2_gpu_identity_remove(data->image,
+                                 &mrb_sdl2_gpu_image_data_type, data);
+    data->image = NULL;
+  }
 }
 /*******************************
  * GPU_Image bindings ends here
@@ -630,14 +955,19 @@ mrb_sdl2_gpu_context(mrb_state *mrb, GPU_Context *context) {
  * GPU_Camera bindings renderer starts here
  *******************************************/
 typedef struct mrb_sdl2_gpu_camera_data_t {
-  GPU_Camera camera;
+  GPU_Camera  camera;
+  void const *owner;  /* what the cached camera belongs to, or NULL */
 } mrb_sdl2_gpu_camera_data_t;
 
+static struct mrb_data_type const mrb_sdl2_gpu_camera_data_type;
+
 static void
 mrb_sdl2_gpu_camera_data_free(mrb_state *mrb, void *p) {
   mrb_sdl2_gpu_camera_data_t *data =
     (mrb_sdl2_gpu_camera_data_t*)p;
   if (NULL != data) {
+    mrb_sdl2_gpu_identity_remove(data->owner, &mrb_sdl2_gpu_camera_data_type,
+                                 data);
     mrb_free(mrb, data);
   }
 }
@@ -664,15 +994,35 @@ mrb_sdl2_gpu_camera(mrb_state *mrb, GPU_Camera *camera) {
   mrb_sdl2_gpu_camera_data_t *data =
     (mrb_sdl2_gpu_camera_data_t*)
       mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_camera_data_t));
-  if (NULL != data) {
+  if (NULL == data) {
     mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
   }
   data->camera = *camera;
+  data->owner = NULL;
   return mrb_obj_value(
       Data_Wrap_Struct(mrb,
                        class_Camera,
                        &mrb_sdl2_gpu_camera_data_type, data));
 }
+
+/* The Camera object last handed out for owner (a target) while it still
+ * holds camera, otherwise a new one that takes its place. A Camera is a
+ * copy, one that scripts already hold never changes under them. */
+static mrb_value
+mrb_sdl2_gpu_camera_cached(mrb_state *mrb, void const *owner,
+                           GPU_Camera *camera) {
+  mrb_value obj;
+  struct RData *wrapper =
+    mrb_sdl2_gpu_identity_find(mrb, owner, &mrb_sdl2_gpu_camera_data_type);
+  if (NULL != wrapper &&
+      0 == SDL_memcmp(&((mrb_sdl2_gpu_camera_data_t*)wrapper->data)->camera,
+                      camera, sizeof(GPU_Camera)))
+    return mrb_obj_value(wrapper);
+  obj = mrb_sdl2_gpu_camera(mrb, camera);
+  ((mrb_sdl2_gpu_camera_data_t*)DATA_PTR(obj))->owner = owner;
+  mrb_sdl2_gpu_identity_add(owner, RDATA(obj));
+  return obj;
+}
 /********************************************
  * GPU_Camera bindings renderer ends here
  ********************************************/
@@ -684,14 +1034,16 @@ typedef struct mrb_sdl2_gpu_renderer_data_t {
   GPU_Renderer *renderer;
 } mrb_sdl2_gpu_renderer_data_t;
 
+static struct mrb_data_type const mrb_sdl2_gpu_renderer_data_type;
+
+/* Renderers belong to SDL_gpu, GPU.quit frees them. */
 static void
 mrb_sdl2_gpu_renderer_data_free(mrb_state *mrb, void *p) {
   mrb_sdl2_gpu_renderer_data_t *data =
     (mrb_sdl2_gpu_renderer_data_t*)p;
   if (NULL != data) {
-    if (NULL != data->renderer) {
-      GPU_FreeRenderer(data->renderer);
-    }
+    mrb_sdl2_gpu_identity_remove(data->renderer,
+                                 &mrb_sdl2_gpu_renderer_data_type, data);
     mrb_free(mrb, data);
   }
 }
@@ -715,17 +1067,23 @@ mrb_sdl2_gpu_renderer_get_ptr(mrb_state *mrb, mrb_value renderer) {
 
 mrb_value
 mrb_sdl2_gpu_renderer(mrb_state *mrb, GPU_Renderer *renderer) {
-  mrb_sdl2_gpu_renderer_data_t *data =
-    (mrb_sdl2_gpu_renderer_data_t*)
+  mrb_sdl2_gpu_renderer_data_t *data;
+  struct RData *wrapper =
+    mrb_sdl2_gpu_identity_find(mrb, renderer,
+                               &mrb_sdl2_gpu_renderer_data_type);
+  if (NULL != wrapper)
+    return mrb_obj_value(wrapper);
+  data = (mrb_sdl2_gpu_renderer_data_t*)
       mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_renderer_data_t));
   if (NULL == data) {
     mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
   }
   data->renderer = renderer;
-  return mrb_obj_value(
-      Data_Wrap_Struct(mrb,
-                       class_Renderer,
-                       &mrb_sdl2_gpu_renderer_data_type, data));
+  wrapper = Data_Wrap_Struct(mrb,
+                             class_Renderer,
+                             &mrb_sdl2_gpu_renderer_data_type, data);
+  mrb_sdl2_gpu_identity_add(renderer, wrapper);
+  return mrb_obj_value(wrapper);
 }
 /********************************
   GPU_Renderer bindings ends here
@@ -865,7 +1223,7 @@ mrb_sdl2_gpu_init(mrb_state *mrb, mrb_value self) {
   if (NULL == t)
     mrb_raise(mrb, E_NOTIMP_ERROR, "GEORGE");
 
-  return mrb_sdl2_gpu_target(mrb, t);
+  return mrb_sdl2_gpu_target_borrowed(mrb, t);
 }
 
 static mrb_value
@@ -874,7 +1232,7 @@ mrb_sdl2_gpu_init_renderer(mrb_state *mrb, mrb_value self) {
   GPU_Target *t;
   mrb_get_args(mrb, "iiii", &renderer_enum, &w, &h, &sdl_flags);
   t = GPU_InitRenderer(renderer_enum, w, h, sdl_flags);
-  return mrb_sdl2_gpu_target(mrb, t);
+  return mrb_sdl2_gpu_target_borrowed(mrb, t);
 }
 
 static mrb_value
@@ -886,7 +1244,7 @@ mrb_sdl2_gpu_init_renderer_by_id(mrb_state *mrb, mrb_value self) {
   mrb_get_args(mrb, "oiii", &renderer_request, &w, &h, &sdl_flags);
   r = mrb_sdl2_gpu_rendererid_get_ptr(mrb, renderer_request);
   t = GPU_InitRendererByID(*r, w, h, sdl_flags);
-  return mrb_sdl2_gpu_target(mrb, t);
+  return mrb_sdl2_gpu_target_borrowed(mrb, t);
 }
 
 static mrb_value
@@ -904,8 +1262,29 @@ mrb_sdl2_gpu_close_current_renderer(mrb_state *mrb, mrb_value self) {
   return mrb_nil_value();
 }
 
+/* GPU_Quit frees every target, image and renderer, the wrappers left
+ * alive must not touch theirs afterwards. */
+static void
+mrb_sdl2_gpu_quit_detach(mrb_state *mrb, struct RData *wrapper) {
+  if (&mrb_sdl2_gpu_target_data_type == wrapper->type)
+    ((mrb_sdl2_gpu_target_data_t*)wrapper->data)->target = NULL;
+  else if (&mrb_sdl2_gpu_image_data_type == wrapper->type)
+    ((mrb_sdl2_gpu_image_data_t*)wrapper->data)->image = NULL;
+  else if (&mrb_sdl2_gpu_renderer_data_type == wrapper->type)
+    ((mrb_sdl2_gpu_renderer_data_t*)wrapper->data)->renderer = NULL;
+}
+
 static mrb_value
 mrb_sdl2_gpu_quit(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_blur_release();
+  mrb_sdl2_gpu_font_release();
+  mrb_sdl2_gpu_damage_release(mrb);
+  mrb_sdl2_gpu_mesh_release();
+  mrb_sdl2_gpu_multi_batch_release();
+  mrb_sdl2_gpu_stream_release();
+  mrb_sdl2_gpu_gl_release();
+  mrb_sdl2_gpu_identity_clear(mrb, mrb_sdl2_gpu_quit_detach);
+  mrb_sdl2_gpu_vram_clear();
   GPU_Quit();
   return mrb_nil_value();
 }
@@ -1039,7 +1418,7 @@ mrb_sdl2_gpu_get_context_target(mrb_state *mrb, mrb_value self) {
   GPU_Target *t = GPU_GetContextTarget();
   if (NULL == t)
     return mrb_nil_value();
-  return mrb_sdl2_gpu_target(mrb, t);
+  return mrb_sdl2_gpu_target_borrowed(mrb, t);
 }
 
 static mrb_value
@@ -1050,7 +1429,7 @@ mrb_sdl2_gpu_get_window_target(mrb_state *mrb, mrb_value self) {
   t = GPU_GetWindowTarget(windowID);
   if (NULL == t)
     return mrb_nil_value();
-  return mrb_sdl2_gpu_target(mrb, t);
+  return mrb_sdl2_gpu_target_borrowed(mrb, t);
 }
 
 static mrb_value
@@ -1185,21 +1564,30 @@ mrb_sdl2_gpu_set_virtual_resolution(mrb_state *mrb, mrb_value self) {
   GPU_Target *t;
   mrb_get_args(mrb, "oii", &target, &w, &h);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, target);
+  mrb_sdl2_gpu_multi_batch_sync(t);
   GPU_SetVirtualResolution(t, w, h);
 
   return mrb_nil_value();
 }
 
+/* get_virtual_coords(target, x, y, buffer = nil) -> [x, y] or buffer */
 static mrb_value
 mrb_sdl2_gpu_get_virtual_coords(mrb_state *mrb, mrb_value self) {
-  mrb_value target;
+  mrb_value target, array, buffer = mrb_nil_value();
   GPU_Target *t;
-  float x, y;
+  float xy[2];
   mrb_float dx, dy;
-  mrb_get_args(mrb, "off", &target, &dx, &dy);
+  mrb_get_args(mrb, "off|o", &target, &dx, &dy, &buffer);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, target);
-  GPU_GetVirtualCoords(t, &x, &y, dx, dy);
-  return mrb_nil_value();
+  GPU_GetVirtualCoords(t, &xy[0], &xy[1], dx, dy);
+  if (!mrb_nil_p(buffer)) {
+    mrb_sdl2_gpu_query_buffer_write_floats(mrb, buffer, xy, 2);
+    return buffer;
+  }
+  array = mrb_ary_new_capa(mrb, 2);
+  mrb_ary_push(mrb, array, mrb_float_value(mrb, xy[0]));
+  mrb_ary_push(mrb, array, mrb_float_value(mrb, xy[1]));
+  return array;
 }
 
 static mrb_value
@@ -1208,6 +1596,7 @@ mrb_sdl2_gpu_unset_virtual_resolution(mrb_state *mrb, mrb_value self) {
   GPU_Target *t;
   mrb_get_args(mrb, "oii", &target);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, target);
+  mrb_sdl2_gpu_multi_batch_sync(t);
   GPU_UnsetVirtualResolution(t);
   return mrb_nil_value();
 }
@@ -1244,21 +1633,23 @@ mrb_sdl2_gpu_target_set_viewport(mrb_state *mrb, mrb_value self) {
   mrb_get_args(mrb, "o", &rect);
   r = mrb_sdl2_gpu_rect_get_ptr(mrb, rect);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
   GPU_SetViewport(t, *r);
   return mrb_nil_value();
 }
 
 static mrb_value
 mrb_sdl2_gpu_default_camera(mrb_state *mrb, mrb_value self) {
+  static char const default_camera_owner = 0;
   GPU_Camera c = GPU_GetDefaultCamera();
-  return mrb_sdl2_gpu_camera(mrb, &c);
+  return mrb_sdl2_gpu_camera_cached(mrb, &default_camera_owner, &c);
 }
 
 static mrb_value
 mrb_sdl2_gpu_target_get_camera(mrb_state *mrb, mrb_value self) {
   GPU_Target *t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
   GPU_Camera c = GPU_GetCamera(t);
-  return mrb_sdl2_gpu_camera(mrb, &c);
+  return mrb_sdl2_gpu_camera_cached(mrb, t, &c);
 }
 
 static mrb_value
@@ -1270,11 +1661,20 @@ mrb_sdl2_gpu_target_set_camera(mrb_state *mrb, mrb_value self) {
   mrb_get_args(mrb, "o", &camera);
   c = mrb_sdl2_gpu_camera_get_ptr(mrb, camera);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
 
   resultc = GPU_SetCamera(t, c);
   return mrb_sdl2_gpu_camera(mrb, &resultc);
 }
 
+static mrb_value
+mrb_sdl2_gpu_target_get_pixel_packed(mrb_state *mrb, mrb_value self) {
+  mrb_int x, y;
+  mrb_get_args(mrb, "ii", &x, &y);
+  return mrb_sdl2_gpu_color_pack(
+      GPU_GetPixel(mrb_sdl2_gpu_target_get_ptr(mrb, self), x, y));
+}
+
 static mrb_value
 mrb_sdl2_gpu_target_get_pixel(mrb_state *mrb, mrb_value self) {
   GPU_Target *t;
@@ -1307,6 +1707,7 @@ mrb_sdl2_gpu_target_set_clip_rect(mrb_state *mrb, mrb_value self) {
 
   r = mrb_sdl2_gpu_rect_get_ptr(mrb, rect);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
   rectResult = GPU_SetClipRect(t, *r);
   return mrb_sdl2_gpu_rect(mrb, rectResult);
 }
@@ -1318,6 +1719,7 @@ mrb_sdl2_gpu_target_set_clip(mrb_state *mrb, mrb_value self) {
   mrb_int x, y, w, h;
   mrb_get_args(mrb, "iiii", &x, &y, &w, &h);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
   rectResult = GPU_SetClip(t, x, y, w, h);
   return mrb_sdl2_gpu_rect(mrb, rectResult);
 }
@@ -1325,6 +1727,7 @@ mrb_sdl2_gpu_target_set_clip(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_target_unset_clip(mrb_state *mrb, mrb_value self) {
   GPU_Target *t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
   GPU_UnsetClip(t);
   return mrb_nil_value();
 }
@@ -1342,10 +1745,11 @@ mrb_sdl2_gpu_target_set_rgb(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_target_set_rgba(mrb_state *mrb, mrb_value self) {
   GPU_Target *t;
-  mrb_int r, g, b, a;
-  mrb_get_args(mrb, "iiii", &r, &g, &b, &a);
+  mrb_value *rgba;
+  mrb_int rgba_len;
+  mrb_get_args(mrb, "*", &rgba, &rgba_len);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-  GPU_SetTargetRGBA(t, r, g, b, a);
+  GPU_SetTargetColor(t, mrb_sdl2_gpu_color_args(mrb, rgba, rgba_len));
   return mrb_nil_value();
 }
 
@@ -1361,14 +1765,24 @@ mrb_sdl2_gpu_target_free(mrb_state *mrb, mrb_value self) {
   mrb_sdl2_gpu_target_data_t *data =
     (mrb_sdl2_gpu_target_data_t*)
       mrb_data_get_ptr(mrb, self, &mrb_sdl2_gpu_target_data_type);
-  if (NULL != data->target) {
+  mrb_sdl2_gpu_identity_remove(data->target, &mrb_sdl2_gpu_target_data_type,
+                               data);
+  if (NULL != data->target && data->owned) {
+    mrb_sdl2_gpu_multi_batch_end(data->target);
     GPU_FreeTarget(data->target);
-    data->target = NULL;
   }
-  mrb_free(mrb, data);
+  data->target = NULL;
   return self;
 }
 
+static mrb_value
+mrb_sdl2_gpu_target_image(mrb_state *mrb, mrb_value self) {
+  GPU_Target *t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  if (NULL == t || NULL == t->image)
+    return mrb_nil_value();
+  return mrb_sdl2_gpu_image_borrowed(mrb, t->image);
+}
+
 static mrb_value
 mrb_sdl2_gpu_load_surface(mrb_state *mrb, mrb_value self) {
   mrb_value filename;
@@ -1391,6 +1805,7 @@ mrb_sdl2_gpu_save_surface(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_image_initialize(mrb_state *mrb, mrb_value self) {
   GPU_Image *image = NULL;
+  mrb_bool over_budget = FALSE;
   mrb_sdl2_gpu_image_data_t *data =
     (mrb_sdl2_gpu_image_data_t*)DATA_PTR(self);
 
@@ -1401,6 +1816,9 @@ mrb_sdl2_gpu_image_initialize(mrb_state *mrb, mrb_value self) {
       mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
     }
     data->image = NULL;
+  } else {
+    mrb_sdl2_gpu_image_release(mrb, data);
+    data->image = NULL;
   }
   if (1 == mrb->c->ci->argc) {
     mrb_value str;
@@ -1409,35 +1827,57 @@ mrb_sdl2_gpu_image_initialize(mrb_state *mrb, mrb_value self) {
 #ifdef SDL_GPU_NEW_IMAGE_FROM_STRING_BUG
     surface = IMG_Load(RSTRING_PTR(str));
     if (NULL == surface) {
+      if (NULL == DATA_PTR(self))
+        mrb_free(mrb, data);
       mrb_raise(mrb, E_RUNTIME_ERROR, "could not load image");
       return mrb_nil_value();
     }
-    image = GPU_CreateImage(surface->w, surface->h, GPU_FORMAT_RGBA);
-    GPU_UpdateImage(image, NULL, surface, NULL);
+    over_budget = !mrb_sdl2_gpu_vram_reserve(
+        mrb, mrb_sdl2_gpu_vram_estimate(surface->w, surface->h,
+                                        GPU_FORMAT_RGBA));
+    if (!over_budget) {
+      image = GPU_CreateImage(surface->w, surface->h, GPU_FORMAT_RGBA);
+      GPU_UpdateImage(image, NULL, surface, NULL);
+    }
     SDL_FreeSurface(surface);
 #else
     image = GPU_LoadImage(RSTRING_PTR(str));
+    if (NULL != image)
+      mrb_sdl2_gpu_gc_pressure(mrb, mrb_sdl2_gpu_vram_estimate(
+          image->texture_w, image->texture_h, image->format));
 #endif
+    mrb_sdl2_gpu_vram_add(image, RSTRING_PTR(str));
   } else if (2 == mrb->c->ci->argc) {
     mrb_int handle, take_ownership;
     mrb_get_args(mrb, "ii", &handle, &take_ownership);
   } else if (3 == mrb->c->ci->argc) {
     mrb_int w, h, format;
     mrb_get_args(mrb, "iii", &w, &h, &format);
-    image = GPU_CreateImage(w, h, format);
+    over_budget = !mrb_sdl2_gpu_vram_reserve(
+        mrb, mrb_sdl2_gpu_vram_estimate(w, h, (GPU_FormatEnum) format));
+    if (!over_budget)
+      image = GPU_CreateImage(w, h, format);
+    mrb_sdl2_gpu_vram_add(image, "Image.new");
   } else {
-    mrb_free(mrb, data);
+    if (NULL == DATA_PTR(self))
+      mrb_free(mrb, data);
     mrb_raise(mrb, E_ARGUMENT_ERROR, "wrong number of arguments.");
   }
   if (NULL == image) {
-    mrb_free(mrb, data);
+    if (NULL == DATA_PTR(self))
+      mrb_free(mrb, data);
+    if (over_budget)
+      mrb_raise(mrb, E_RUNTIME_ERROR, "Image would exceed the VRAM budget");
     mrb_raise(mrb, E_RUNTIME_ERROR,
               "Could not initialize Image with the given paramets");
   }
   data->image = image;
+  data->owned = TRUE;
 
   DATA_PTR(self) = data;
   DATA_TYPE(self) = &mrb_sdl2_gpu_image_data_type;
+  mrb_sdl2_gpu_identity_add(image, RDATA(self));
+  mrb_sdl2_gpu_scope_adopt(mrb, self);
   return self;
 }
 
@@ -1446,10 +1886,8 @@ mrb_sdl2_gpu_image_free(mrb_state *mrb, mrb_value self) {
   mrb_sdl2_gpu_image_data_t *data =
     (mrb_sdl2_gpu_image_data_t*)
       mrb_data_get_ptr(mrb, self, &mrb_sdl2_gpu_image_data_type);
-  if (NULL != data->image) {
-    GPU_FreeImage(data->image);
-    data->image = NULL;
-  }
+  mrb_sdl2_gpu_image_release(mrb, data);
+  data->image = NULL;
   return self;
 }
 
@@ -1466,9 +1904,15 @@ mrb_sdl2_gpu_image_create_alias(mrb_state *mrb, mrb_value self) {
 
 static mrb_value
 mrb_sdl2_gpu_image_copy(mrb_state *mrb, mrb_value self) {
-  GPU_Image *i;
+  GPU_Image *i, *copy;
   i = mrb_sdl2_gpu_image_get_ptr(mrb, self);
-  return mrb_sdl2_gpu_image(mrb, GPU_CopyImage(i));
+  if (!mrb_sdl2_gpu_vram_reserve(
+          mrb, mrb_sdl2_gpu_vram_estimate(i->texture_w, i->texture_h,
+                                          i->format)))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "copy would exceed the VRAM budget");
+  copy = GPU_CopyImage(i);
+  mrb_sdl2_gpu_vram_add(copy, "Image#copy");
+  return mrb_sdl2_gpu_image(mrb, copy);
 }
 
 static mrb_value
@@ -1488,6 +1932,7 @@ mrb_sdl2_gpu_image_update(mrb_state *mrb, mrb_value self) {
   if (argc > 2)
     sr = mrb_sdl2_gpu_rect_get_ptr(mrb, surface_rect);
 
+  mrb_sdl2_gpu_multi_batch_touch(i);
   GPU_UpdateImage(i, ir, s, sr);
   return mrb_nil_value();
 }
@@ -1506,7 +1951,10 @@ mrb_sdl2_gpu_image_save(mrb_state *mrb, mrb_value self) {
 
 static mrb_value
 mrb_sdl2_gpu_image_generate_mipmaps(mrb_state *mrb, mrb_value self) {
-  GPU_GenerateMipmaps(mrb_sdl2_gpu_image_get_ptr(mrb, self));
+  GPU_Image *i = mrb_sdl2_gpu_image_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_touch(i);
+  GPU_GenerateMipmaps(i);
+  mrb_sdl2_gpu_vram_resize(i);
   return mrb_nil_value();
 }
 
@@ -1522,11 +1970,12 @@ mrb_sdl2_gpu_image_set_rgb(mrb_state *mrb, mrb_value self) {
 
 static mrb_value
 mrb_sdl2_gpu_image_set_rgba(mrb_state *mrb, mrb_value self) {
-  mrb_int r, g, b, a;
+  mrb_value *rgba;
+  mrb_int rgba_len;
   GPU_Image *i;
-  mrb_get_args(mrb, "iiii", &r, &g, &b, &a);
+  mrb_get_args(mrb, "*", &rgba, &rgba_len);
   i = mrb_sdl2_gpu_image_get_ptr(mrb, self);
-  GPU_SetRGBA(i, r, g, b, a);
+  GPU_SetColor(i, mrb_sdl2_gpu_color_args(mrb, rgba, rgba_len));
   return mrb_nil_value();
 }
 
@@ -1580,8 +2029,11 @@ mrb_sdl2_gpu_image_set_blend_mode(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_image_set_filter(mrb_state *mrb, mrb_value self) {
   mrb_int filter;
+  GPU_Image *i;
   mrb_get_args(mrb, "i", &filter);
-  GPU_SetImageFilter(mrb_sdl2_gpu_image_get_ptr(mrb, self), filter);
+  i = mrb_sdl2_gpu_image_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_touch(i);
+  GPU_SetImageFilter(i, filter);
   return mrb_nil_value();
 }
 
@@ -1602,27 +2054,38 @@ mrb_sdl2_gpu_image_set_snap_mode(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_image_set_wrap_mode(mrb_state *mrb, mrb_value self) {
   mrb_int wrap_mode_x, wrap_mode_y;
+  GPU_Image *i;
   mrb_get_args(mrb, "ii", &wrap_mode_x, &wrap_mode_y);
-  GPU_SetWrapMode(mrb_sdl2_gpu_image_get_ptr(mrb, self),
-                  wrap_mode_x, wrap_mode_y);
+  i = mrb_sdl2_gpu_image_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_touch(i);
+  GPU_SetWrapMode(i, wrap_mode_x, wrap_mode_y);
   return mrb_nil_value();
 }
 
 static mrb_value
 mrb_sdl2_gpu_surface_to_image(mrb_state *mrb, mrb_value self) {
-  GPU_Image *i = GPU_CopyImageFromSurface(
-      mrb_sdl2_video_surface_get_ptr(mrb, self));
+  SDL_Surface *s = mrb_sdl2_video_surface_get_ptr(mrb, self);
+  GPU_Image *i;
+  if (!mrb_sdl2_gpu_vram_reserve(
+          mrb, mrb_sdl2_gpu_vram_estimate(s->w, s->h, GPU_FORMAT_RGBA)))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "image would exceed the VRAM budget");
+  i = GPU_CopyImageFromSurface(s);
   if (NULL == i)
     mrb_raise(mrb, E_RUNTIME_ERROR, "Could not convert surface to image");
+  mrb_sdl2_gpu_vram_add(i, "Surface#to_image");
   return  mrb_sdl2_gpu_image(mrb, i);
 }
 
 static mrb_value
 mrb_sdl2_gpu_target_to_image(mrb_state *mrb, mrb_value self) {
-  return
-      mrb_sdl2_gpu_image(mrb,
-                         GPU_CopyImageFromTarget(
-                             mrb_sdl2_gpu_target_get_ptr(mrb, self)));
+  GPU_Target *t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  GPU_Image *i;
+  if (!mrb_sdl2_gpu_vram_reserve(
+          mrb, mrb_sdl2_gpu_vram_estimate(t->w, t->h, GPU_FORMAT_RGBA)))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "image would exceed the VRAM budget");
+  i = GPU_CopyImageFromTarget(t);
+  mrb_sdl2_gpu_vram_add(i, "Target#to_image");
+  return mrb_sdl2_gpu_image(mrb, i);
 }
 
 static mrb_value
@@ -1644,29 +2107,48 @@ mrb_sdl2_gpu_image_to_surface(mrb_state *mrb, mrb_value self) {
 
 static mrb_value
 mrb_sdl2_gpu_target_clear(mrb_state *mrb, mrb_value self) {
-  GPU_Clear(mrb_sdl2_gpu_target_get_ptr(mrb, self));
+  GPU_Target *t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
+  GPU_Clear(t);
   return mrb_nil_value();
 }
 
 static mrb_value
 mrb_sdl2_gpu_target_clear_rgb(mrb_state *mrb, mrb_value self) {
   mrb_int r, g, b;
+  GPU_Target *t;
   mrb_get_args(mrb, "iii", &r, &g, &b);
-  GPU_ClearRGB(mrb_sdl2_gpu_target_get_ptr(mrb, self), r, g, b);
+  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
+  GPU_ClearRGB(t, r, g, b);
   return mrb_nil_value();
 }
 
 static mrb_value
 mrb_sdl2_gpu_target_clear_rgba(mrb_state *mrb, mrb_value self) {
   mrb_int r, g, b, a;
-  mrb_get_args(mrb, "iii", &r, &g, &b, &a);
-  GPU_ClearRGBA(mrb_sdl2_gpu_target_get_ptr(mrb, self), r, g, b, a);
+  GPU_Target *t;
+  mrb_get_args(mrb, "iiii", &r, &g, &b, &a);
+  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
+  GPU_ClearRGBA(t, r, g, b, a);
   return mrb_nil_value();
 }
 
+/* The bookkeeping every way of ending a frame does: Target#flip and the
+ * retained window's Target#present. */
+void
+mrb_sdl2_gpu_end_frame(void) {
+  mrb_sdl2_gpu_arena_reset();
+  mrb_sdl2_gpu_vram_next_frame();
+}
+
 static mrb_value
 mrb_sdl2_gpu_target_flip(mrb_state *mrb, mrb_value self) {
-  GPU_Flip(mrb_sdl2_gpu_target_get_ptr(mrb, self));
+  GPU_Target *t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_multi_batch_sync(t);
+  GPU_Flip(t);
+  mrb_sdl2_gpu_end_frame();
   return mrb_nil_value();
 }
 
@@ -1676,57 +2158,121 @@ mrb_sdl2_gpu_flush_blit_buffer(mrb_state *mrb, mrb_value self) {
   return mrb_nil_value();
 }
 
+static mrb_value
+mrb_sdl2_gpu_set_culling(mrb_state *mrb, mrb_value self) {
+  mrb_bool enabled;
+  mrb_get_args(mrb, "b", &enabled);
+  cull_enabled = enabled;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_is_culling(mrb_state *mrb, mrb_value self) {
+  return mrb_bool_value(cull_enabled);
+}
+
+static mrb_value
+mrb_sdl2_gpu_cull_stats(mrb_state *mrb, mrb_value self) {
+  mrb_value hash = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "drawn")),
+               mrb_fixnum_value(cull_drawn));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "culled")),
+               mrb_fixnum_value(cull_culled));
+  return hash;
+}
+
+static mrb_value
+mrb_sdl2_gpu_reset_cull_stats(mrb_state *mrb, mrb_value self) {
+  cull_drawn = 0;
+  cull_culled = 0;
+  return self;
+}
+
+/* Reads image, source rect and n floats, exactly that many. */
+static GPU_Target *
+mrb_sdl2_gpu_blit_args(mrb_state *mrb, mrb_value self, int n,
+                       GPU_Image **image, GPU_Rect **rect, float *f) {
+  mrb_int argc;
+  mrb_value const *argv = mrb_sdl2_gpu_argv(mrb, &argc);
+  int k;
+  if (argc != n + 2)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "wrong number of arguments (%S for %S)",
+               mrb_fixnum_value(argc), mrb_fixnum_value(n + 2));
+  *image = mrb_sdl2_gpu_image_get_ptr(mrb, argv[0]);
+  *rect = mrb_sdl2_gpu_rect_get_ptr(mrb, argv[1]);
+  mrb_sdl2_gpu_vram_touch(*image);
+  for (k = 0; k < n; k++) {
+    f[k] = mrb_sdl2_gpu_arg_float(mrb, argv[k + 2]);
+  }
+  return mrb_sdl2_gpu_target_get_ptr(mrb, self);
+}
+
+/* The blit variants: method name, floats after image and rect, whether
+ * the image anchor is the pivot, else the pivot, the scale and rotation
+ * the cull test and multi-texture batch need and the draw call. The
+ * floats come in the order Target#blit takes them: x, y, then scale_x,
+ * scale_y, then degrees, then pivot_x, pivot_y. */
+#define MRB_SDL2_GPU_BLITS(X)                                                 \
+  X(blit_rotate, 3, TRUE, 0.0f, 0.0f, 1.0f, 1.0f, TRUE, f[2],                 \
+    GPU_BlitRotate(i, r, t, f[0], f[1], f[2]))                                \
+  X(blit_scale, 4, TRUE, 0.0f, 0.0f, f[2], f[3], FALSE, 0.0f,                 \
+    GPU_BlitScale(i, r, t, f[0], f[1], f[2], f[3]))                           \
+  X(blit_transform, 5, TRUE, 0.0f, 0.0f, f[2], f[3], TRUE, f[4],              \
+    GPU_BlitTransform(i, r, t, f[0], f[1], f[4], f[2], f[3]))                 \
+  X(blit_transform_x, 7, FALSE, f[5], f[6], f[2], f[3], TRUE, f[4],           \
+    GPU_BlitTransformX(i, r, t, f[0], f[1], f[5], f[6], f[4], f[2], f[3]))
+
+#define MRB_SDL2_GPU_BLIT_STUB(name, n, use_anchor, pivot_x, pivot_y,         \
+                               scale_x, scale_y, rotated, degrees, draw)      \
+static mrb_value                                                              \
+mrb_sdl2_gpu_target_##name(mrb_state *mrb, mrb_value self) {                  \
+  GPU_Image *i;                                                               \
+  GPU_Rect *r;                                                                \
+  float f[n];                                                                 \
+  GPU_Target *t = mrb_sdl2_gpu_blit_args(mrb, self, n, &i, &r, f);            \
+  if (!mrb_sdl2_gpu_cull_blit(t, i, r, f[0], f[1], use_anchor,                \
+                              pivot_x, pivot_y, scale_x, scale_y, rotated) && \
+      !mrb_sdl2_gpu_multi_batch_blit(t, i, r, f[0], f[1], use_anchor,         \
+                                     pivot_x, pivot_y, degrees,               \
+                                     scale_x, scale_y))                       \
+    draw;                                                                     \
+  return self;                                                                \
+}
+
+MRB_SDL2_GPU_BLITS(MRB_SDL2_GPU_BLIT_STUB)
+
+/* blit(image, rect, x, y) and, picked by the argument count, the forms of
+ * blit_rotate, blit_scale, blit_transform and blit_transform_x. Calling
+ * those directly skips the dispatch. */
 static mrb_value
 mrb_sdl2_gpu_target_blit(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y;
-  mrb_value src_rect, src_image;
-  GPU_Target *t;
   GPU_Image *i;
   GPU_Rect *r;
-  if (4 == mrb->c->ci->argc) {
-    mrb_get_args(mrb, "ooff", &src_image, &src_rect, &x, &y);
-    t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-    i = mrb_sdl2_gpu_image_get_ptr(mrb, src_image);
-    r = mrb_sdl2_gpu_rect_get_ptr(mrb, src_rect);
-    GPU_Blit(i, r, t, x, y);
-  } else if (5 == mrb->c->ci->argc) {
-    mrb_float degrees;
-    mrb_get_args(mrb, "oofff", &src_image, &src_rect, &x, &y, &degrees);
-    t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-    i = mrb_sdl2_gpu_image_get_ptr(mrb, src_image);
-    r = mrb_sdl2_gpu_rect_get_ptr(mrb, src_rect);
-    GPU_BlitRotate(i, r, t, x, y, degrees);
-  } else if (6 == mrb->c->ci->argc) {
-    mrb_float scale_x, scale_y;
-    mrb_get_args(mrb, "ooffff", &src_image, &src_rect, &x, &y,
-                                &scale_x, &scale_y);
-    t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-    i = mrb_sdl2_gpu_image_get_ptr(mrb, src_image);
-    r = mrb_sdl2_gpu_rect_get_ptr(mrb, src_rect);
-    GPU_BlitScale(i, r, t, x, y, scale_x, scale_y);
-  } else if (7 == mrb->c->ci->argc) {
-    mrb_float degrees, scale_x, scale_y;
-    mrb_get_args(mrb, "ooffff", &src_image, &src_rect, &x, &y,
-                                &scale_x, &scale_y, &degrees);
-    t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-    i = mrb_sdl2_gpu_image_get_ptr(mrb, src_image);
-    r = mrb_sdl2_gpu_rect_get_ptr(mrb, src_rect);
-    GPU_BlitTransform(i, r, t, x, y, degrees, scale_x, scale_y);
-  } else if (9 == mrb->c->ci->argc) {
-    mrb_float pivot_x, pivot_y, degrees, scaleX, scaleY;
-    mrb_get_args(mrb, "oofffffff", &src_image, &src_rect, &x, &y,
-                                   &scaleX, &scaleY, &degrees,
-                                   &pivot_x, &pivot_y);
-    t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-    i = mrb_sdl2_gpu_image_get_ptr(mrb, src_image);
-    r = mrb_sdl2_gpu_rect_get_ptr(mrb, src_rect);
-    GPU_BlitTransformX(i, r, t, x, y, pivot_x, pivot_y,
-                       degrees, scaleX, scaleY);
-  } else {
+  GPU_Target *t;
+  float f[2];
+  mrb_int argc;
+  mrb_sdl2_gpu_argv(mrb, &argc);
+  switch (argc) {
+  case 4:
+    break;
+  case 5:
+    return mrb_sdl2_gpu_target_blit_rotate(mrb, self);
+  case 6:
+    return mrb_sdl2_gpu_target_blit_scale(mrb, self);
+  case 7:
+    return mrb_sdl2_gpu_target_blit_transform(mrb, self);
+  case 9:
+    return mrb_sdl2_gpu_target_blit_transform_x(mrb, self);
+  default:
     mrb_raise(mrb, E_RUNTIME_ERROR,
-              "Incorrect number of arguments, expected 4, 5, 6 or 7 arguments");
+              "Incorrect number of arguments, expected 4, 5, 6, 7 or 9 arguments");
   }
-
+  t = mrb_sdl2_gpu_blit_args(mrb, self, 2, &i, &r, f);
+  if (!mrb_sdl2_gpu_cull_blit(t, i, r, f[0], f[1], TRUE, 0.0f, 0.0f,
+                              1.0f, 1.0f, FALSE) &&
+      !mrb_sdl2_gpu_multi_batch_blit(t, i, r, f[0], f[1], TRUE, 0.0f, 0.0f,
+                                     0.0f, 1.0f, 1.0f))
+    GPU_Blit(i, r, t, f[0], f[1]);
   return self;
 }
 
@@ -1765,8 +2311,9 @@ mrb_sdl2_gpu_image_renderer(mrb_state *mrb, mrb_value self) {
 
 static mrb_value
 mrb_sdl2_gpu_image_target(mrb_state *mrb, mrb_value self) {
-  return mrb_sdl2_gpu_target(mrb, (mrb_sdl2_gpu_image_get_ptr(mrb, self)
-                                   ->target));
+  return mrb_sdl2_gpu_target_borrowed(mrb,
+                                      (mrb_sdl2_gpu_image_get_ptr(mrb, self)
+                                       ->target));
 }
 
 static mrb_value
@@ -1867,9 +2414,12 @@ mrb_sdl2_gpu_image_bytes_per_pixel(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_image_set_bytes_per_pixel(mrb_state *mrb, mrb_value self) {
   mrb_int bpp;
+  GPU_Image *image;
   mrb_get_args(mrb, "i", &bpp);
-  return mrb_fixnum_value((mrb_sdl2_gpu_image_get_ptr(mrb, self)
-                           ->bytes_per_pixel = bpp));
+  image = mrb_sdl2_gpu_image_get_ptr(mrb, self);
+  image->bytes_per_pixel = bpp;
+  mrb_sdl2_gpu_vram_resize(image);
+  return mrb_fixnum_value(bpp);
 }
 
 static mrb_value
@@ -1885,17 +2435,23 @@ mrb_sdl2_gpu_image_texture_h(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_image_set_texture_w(mrb_state *mrb, mrb_value self) {
   mrb_int w;
+  GPU_Image *image;
   mrb_get_args(mrb, "i", &w);
-  return mrb_fixnum_value((mrb_sdl2_gpu_image_get_ptr(mrb, self)
-                           ->texture_w = w));
+  image = mrb_sdl2_gpu_image_get_ptr(mrb, self);
+  image->texture_w = w;
+  mrb_sdl2_gpu_vram_resize(image);
+  return mrb_fixnum_value(w);
 }
 
 static mrb_value
 mrb_sdl2_gpu_image_set_texture_h(mrb_state *mrb, mrb_value self) {
   mrb_int h;
+  GPU_Image *image;
   mrb_get_args(mrb, "i", &h);
-  return mrb_fixnum_value((mrb_sdl2_gpu_image_get_ptr(mrb, self)
-                           ->texture_h = h));
+  image = mrb_sdl2_gpu_image_get_ptr(mrb, self);
+  image->texture_h = h;
+  mrb_sdl2_gpu_vram_resize(image);
+  return mrb_fixnum_value(h);
 }
 
 static mrb_value
@@ -1907,9 +2463,12 @@ mrb_sdl2_gpu_image_has_mipmaps(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_image_set_has_mipmaps(mrb_state *mrb, mrb_value self) {
   mrb_bool bool_var;
+  GPU_Image *image;
   mrb_get_args(mrb, "b", &bool_var);
-  return (0 != (mrb_sdl2_gpu_image_get_ptr(mrb, self)->has_mipmaps =
-                bool_var)) ? mrb_true_value() : mrb_false_value();
+  image = mrb_sdl2_gpu_image_get_ptr(mrb, self);
+  image->has_mipmaps = bool_var;
+  mrb_sdl2_gpu_vram_resize(image);
+  return mrb_bool_value(bool_var);
 }
 
 static mrb_value
@@ -1942,10 +2501,10 @@ mrb_sdl2_gpu_image_set_target(mrb_state *mrb, mrb_value self) {
   mrb_value target;
   mrb_get_args(mrb, "o", &target);
   return
-  mrb_sdl2_gpu_target(mrb,
-                      (mrb_sdl2_gpu_image_get_ptr(mrb, self)
-                       ->target =
-                       mrb_sdl2_gpu_target_get_ptr(mrb, target)));
+  mrb_sdl2_gpu_target_borrowed(mrb,
+                               (mrb_sdl2_gpu_image_get_ptr(mrb, self)
+                                ->target =
+                                mrb_sdl2_gpu_target_get_ptr(mrb, target)));
 }
 
 static mrb_value
@@ -2215,292 +2774,163 @@ mrb_sdl2_gpu_rect_set_h(mrb_state *mrb, mrb_value self) {
   return mrb_fixnum_value((mrb_sdl2_gpu_rect_get_ptr(mrb, self)->h = h));
 }
 
-static mrb_value
-mrb_sdl2_gpu_target_pixel(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "ffiiii", &x, &y, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_Pixel(t, x, y, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_line(mrb_state *mrb, mrb_value self) {
-  mrb_float x1, y1, x2, y2;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "ffffiiii", &x1, &y1, &x2, &y2, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_Line(t, x1, y1, x2, y2, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_arc(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y, radius, start_angle, end_angle;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "fffffiiii", &x, &y, &radius, &start_angle,
-                                &end_angle, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_Arc(t, x, y, radius, start_angle, end_angle, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_arc_filled(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y, radius, start_angle, end_angle;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "fffffiiii", &x, &y, &radius, &start_angle,
-                                &end_angle, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_ArcFilled(t, x, y, radius, start_angle,
-                end_angle, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_circle(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y, radius;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "fffiiii", &x, &y, &radius, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_Circle(t, x, y, radius, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_circle_filled(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y, radius;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "fffiiii", &x, &y, &radius, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_CircleFilled(t, x, y, radius, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_ellipse(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y, rx, ry, degree;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "fffffiiii", &x, &y, &rx, &ry, &degree, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_Ellipse(t, x, y, rx, ry, degree, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_ellipse_filled(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y, rx, ry, degree;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "fffffiiii", &x, &y, &rx, &ry, &degree, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_EllipseFilled(t, x, y, rx, ry, degree, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_sector(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y, inner_radius, outer_radius, start_angle, end_angle;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "ffffffiiii", &x, &y, &inner_radius, &outer_radius,
-                                  &end_angle, &start_angle, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_Sector(t, x, y, inner_radius, outer_radius,
-             start_angle, end_angle, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_sector_filled(mrb_state *mrb, mrb_value self) {
-  mrb_float x, y, inner_radius, outer_radius, start_angle, end_angle;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "ffffffiiii", &x, &y, &inner_radius, &outer_radius,
-                                  &end_angle, &start_angle, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_SectorFilled(t, x, y, inner_radius, outer_radius,
-             start_angle, end_angle, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_tri(mrb_state *mrb, mrb_value self) {
-  mrb_float x1, y1, x2, y2, x3, y3;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "ffffffiiii", &x1, &y1, &x2, &y2, &x3, &y3,
-                                  &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_Tri(t, x1, y1, x2, y2, x3, y3, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_tri_filled(mrb_state *mrb, mrb_value self) {
-  mrb_float x1, y1, x2, y2, x3, y3;
-  mrb_int r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "ffffffiiii", &x1, &y1, &x2, &y2, &x3, &y3,
-                                  &r, &g, &b, &a);
+/* Reads the arguments of a primitive: n floats followed by the color, as
+ * one packed value or r, g, b, a. */
+static GPU_Target *
+mrb_sdl2_gpu_primitive_args(mrb_state *mrb, mrb_value self, int n, float *f,
+                            SDL_Color *color) {
+  mrb_int argc;
+  mrb_value const *argv = mrb_sdl2_gpu_argv(mrb, &argc);
+  GPU_Target *t;
+  int k;
+  if (argc != n + 1 && argc != n + 4)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR,
+               "wrong number of arguments (%S for %S or %S)",
+               mrb_fixnum_value(argc), mrb_fixnum_value(n + 1),
+               mrb_fixnum_value(n + 4));
+  for (k = 0; k < n; k++) {
+    f[k] = mrb_sdl2_gpu_arg_float(mrb, argv[k]);
+  }
+  *color = mrb_sdl2_gpu_color_args(mrb, argv + n, argc - n);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
   if (NULL == t)
     mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_TriFilled(t, x1, y1, x2, y2, x3, y3, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_rect(mrb_state *mrb, mrb_value self) {
-  mrb_float x1, y1, x2, y2;
-  mrb_int   r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "ffffiiii", &x1, &y1, &x2, &y2, &r, &g, &b, &a);
+  return t;
+}
+
+/* The primitives: method name, float arguments before the color, the cull
+ * test on them and the draw call. Each entry becomes a Target method
+ * reading its arguments straight off the stack. */
+#define MRB_SDL2_GPU_PRIMITIVES(X)                                            \
+  X(pixel, 2,                                                                 \
+    mrb_sdl2_gpu_cull_box(t, f[0], f[1], f[0], f[1]),                         \
+    GPU_Pixel(t, f[0], f[1], color))                                          \
+  X(line, 4,                                                                  \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[2], f[3], 0.0f),                  \
+    GPU_Line(t, f[0], f[1], f[2], f[3], color))                               \
+  X(arc, 5,                                                                   \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[0], f[1], f[2]),                  \
+    GPU_Arc(t, f[0], f[1], f[2], f[3], f[4], color))                          \
+  X(arc_filled, 5,                                                            \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[0], f[1], f[2]),                  \
+    GPU_ArcFilled(t, f[0], f[1], f[2], f[3], f[4], color))                    \
+  X(circle, 3,                                                                \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[0], f[1], f[2]),                  \
+    GPU_Circle(t, f[0], f[1], f[2], color))                                   \
+  X(circle_filled, 3,                                                         \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[0], f[1], f[2]),                  \
+    GPU_CircleFilled(t, f[0], f[1], f[2], color))                             \
+  X(ellipse, 5,                                                               \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[0], f[1], SDL_max(f[2], f[3])),   \
+    GPU_Ellipse(t, f[0], f[1], f[2], f[3], f[4], color))                      \
+  X(ellipse_filled, 5,                                                        \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[0], f[1], SDL_max(f[2], f[3])),   \
+    GPU_EllipseFilled(t, f[0], f[1], f[2], f[3], f[4], color))                \
+  /* sector takes end_angle before start_angle */                             \
+  X(sector, 6,                                                                \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[0], f[1], f[3]),                  \
+    GPU_Sector(t, f[0], f[1], f[2], f[3], f[5], f[4], color))                 \
+  X(sector_filled, 6,                                                         \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[0], f[1], f[3]),                  \
+    GPU_SectorFilled(t, f[0], f[1], f[2], f[3], f[5], f[4], color))           \
+  X(tri, 6,                                                                   \
+    mrb_sdl2_gpu_cull_line(t, SDL_min(f[0], SDL_min(f[2], f[4])),             \
+                           SDL_min(f[1], SDL_min(f[3], f[5])),                \
+                           SDL_max(f[0], SDL_max(f[2], f[4])),                \
+                           SDL_max(f[1], SDL_max(f[3], f[5])), 0.0f),         \
+    GPU_Tri(t, f[0], f[1], f[2], f[3], f[4], f[5], color))                    \
+  X(tri_filled, 6,                                                            \
+    mrb_sdl2_gpu_cull_box(t, SDL_min(f[0], SDL_min(f[2], f[4])),              \
+                          SDL_min(f[1], SDL_min(f[3], f[5])),                 \
+                          SDL_max(f[0], SDL_max(f[2], f[4])),                 \
+                          SDL_max(f[1], SDL_max(f[3], f[5]))),                \
+    GPU_TriFilled(t, f[0], f[1], f[2], f[3], f[4], f[5], color))              \
+  X(rect, 4,                                                                  \
+    mrb_sdl2_gpu_cull_line(t, f[0], f[1], f[2], f[3], 0.0f),                  \
+    GPU_Rectangle(t, f[0], f[1], f[2], f[3], color))                          \
+  X(rect_filled, 4,                                                           \
+    mrb_sdl2_gpu_cull_box(t, f[0], f[1], f[2], f[3]),                         \
+    GPU_RectangleFilled(t, f[0], f[1], f[2], f[3], color))
+
+#define MRB_SDL2_GPU_PRIMITIVE_STUB(name, n, culled, draw)                    \
+static mrb_value                                                              \
+mrb_sdl2_gpu_target_##name(mrb_state *mrb, mrb_value self) {                  \
+  float f[n];                                                                 \
+  SDL_Color color;                                                            \
+  GPU_Target *t = mrb_sdl2_gpu_primitive_args(mrb, self, n, f, &color);       \
+  if (!(culled))                                                              \
+    draw;                                                                     \
+  return self;                                                                \
+}
+
+MRB_SDL2_GPU_PRIMITIVES(MRB_SDL2_GPU_PRIMITIVE_STUB)
+
+/* rect2(rect, color) and rect_filled2(rect, color) */
+static GPU_Target *
+mrb_sdl2_gpu_rect_primitive_args(mrb_state *mrb, mrb_value self,
+                                 GPU_Rect **re, SDL_Color *color) {
+  mrb_int argc;
+  mrb_value const *argv = mrb_sdl2_gpu_argv(mrb, &argc);
+  GPU_Target *t;
+  if (2 != argc && 5 != argc)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR,
+               "wrong number of arguments (%S for 2 or 5)",
+               mrb_fixnum_value(argc));
+  *re = mrb_sdl2_gpu_rect_get_ptr(mrb, argv[0]);
+  *color = mrb_sdl2_gpu_color_args(mrb, argv + 1, argc - 1);
   t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
   if (NULL == t)
     mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_Rectangle(t, x1, y1, x2, y2, (SDL_Color) {r, g, b, a});
-  return self;
+  if (NULL == *re)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Rect's ptr");
+  return t;
 }
 
 static mrb_value
 mrb_sdl2_gpu_target_rect2(mrb_state *mrb, mrb_value self) {
-  mrb_value rect;
-  mrb_int   r, g, b, a;
-  GPU_Target *t = NULL;
   GPU_Rect *re;
-  mrb_get_args(mrb, "oiiii", &rect, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-  re = mrb_sdl2_gpu_rect_get_ptr(mrb, rect);
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-  if (NULL == re)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Rect's ptr");
-  GPU_Rectangle2(t, *re, (SDL_Color) {r, g, b, a});
-  return self;
-}
-
-static mrb_value
-mrb_sdl2_gpu_target_rect_filled(mrb_state *mrb, mrb_value self) {
-  mrb_float x1, y1, x2, y2;
-  mrb_int   r, g, b, a;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "ffffiiii", &x1, &y1, &x2, &y2, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  GPU_RectangleFilled(t, x1, y1, x2, y2, (SDL_Color) {r, g, b, a});
+  SDL_Color color;
+  GPU_Target *t = mrb_sdl2_gpu_rect_primitive_args(mrb, self, &re, &color);
+  if (!mrb_sdl2_gpu_cull_line(t, re->x, re->y, re->x + re->w, re->y + re->h,
+                              0.0f))
+    GPU_Rectangle2(t, *re, color);
   return self;
 }
 
 static mrb_value
 mrb_sdl2_gpu_target_rect_filled2(mrb_state *mrb, mrb_value self) {
-  mrb_value rect;
-  mrb_int   r, g, b, a;
-  GPU_Target *t = NULL;
   GPU_Rect *re;
-  mrb_get_args(mrb, "oiiii", &rect, &r, &g, &b, &a);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-  re = mrb_sdl2_gpu_rect_get_ptr(mrb, rect);
-  
-  if (NULL == t)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-
-  if (NULL == re)
-    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Rect's ptr");
-
-  GPU_RectangleFilled2(t, *re, (SDL_Color) {r, g, b, a});
+  SDL_Color color;
+  GPU_Target *t = mrb_sdl2_gpu_rect_primitive_args(mrb, self, &re, &color);
+  if (!mrb_sdl2_gpu_cull_box(t, re->x, re->y, re->x + re->w, re->y + re->h))
+    GPU_RectangleFilled2(t, *re, color);
   return self;
 }
 
 static mrb_value
 mrb_sdl2_gpu_target_rect_round(mrb_state *mrb, mrb_value self) {
-  mrb_value *args;
   mrb_int argc;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "*", &args, &argc);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_value const *args = mrb_sdl2_gpu_argv(mrb, &argc);
+  GPU_Target *t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
 
   if (NULL == t)
     mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-  if (8 == argc) {
-    mrb_float x1     = mrb_float(args[0]),
-              y1     = mrb_float(args[1]),
-              x2     = mrb_float(args[2]),
-              y2     = mrb_float(args[3]),
-              radius = mrb_float(args[4]);
-    mrb_int r = mrb_fixnum(args[5]),
-            g = mrb_fixnum(args[6]),
-            b = mrb_fixnum(args[7]),
-            a = mrb_fixnum(args[8]);
-    GPU_RectangleRound(t, x1, y1, x2, y2,
-                       radius, (SDL_Color) {r, g, b, a});
-  } else if (5 == argc) {
-    mrb_int r = mrb_fixnum(args[2]),
-            g = mrb_fixnum(args[3]),
-            b = mrb_fixnum(args[4]),
-            a = mrb_fixnum(args[5]);
+  if (argc >= 3 && MRB_TT_DATA == mrb_type(args[0])) {
     GPU_Rect *re      = mrb_sdl2_gpu_rect_get_ptr(mrb, args[0]);
-    mrb_float radius = mrb_float(args[1]);
-    GPU_RectangleRound2(t, *re, radius, (SDL_Color) {r, g, b, a});
+    mrb_float radius = mrb_sdl2_gpu_arg_float(mrb, args[1]);
+    SDL_Color color  = mrb_sdl2_gpu_color_args(mrb, args + 2, argc - 2);
+    if (!mrb_sdl2_gpu_cull_line(t, re->x, re->y, re->x + re->w,
+                                re->y + re->h, 0.0f))
+      GPU_RectangleRound2(t, *re, radius, color);
+  } else if (argc >= 6) {
+    mrb_float x1     = mrb_sdl2_gpu_arg_float(mrb, args[0]),
+              y1     = mrb_sdl2_gpu_arg_float(mrb, args[1]),
+              x2     = mrb_sdl2_gpu_arg_float(mrb, args[2]),
+              y2     = mrb_sdl2_gpu_arg_float(mrb, args[3]),
+              radius = mrb_sdl2_gpu_arg_float(mrb, args[4]);
+    SDL_Color color  = mrb_sdl2_gpu_color_args(mrb, args + 5, argc - 5);
+    if (!mrb_sdl2_gpu_cull_line(t, x1, y1, x2, y2, 0.0f))
+      GPU_RectangleRound(t, x1, y1, x2, y2, radius, color);
   } else {
     mrb_raise(mrb, E_ARGUMENT_ERROR, "unexpected arguments");
   }
@@ -2510,34 +2940,27 @@ mrb_sdl2_gpu_target_rect_round(mrb_state *mrb, mrb_value self) {
 
 static mrb_value
 mrb_sdl2_gpu_target_rect_round_filled(mrb_state *mrb, mrb_value self) {
-  mrb_value *args;
   mrb_int argc;
-  GPU_Target *t = NULL;
-  mrb_get_args(mrb, "*", &args, &argc);
-  t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_value const *args = mrb_sdl2_gpu_argv(mrb, &argc);
+  GPU_Target *t = mrb_sdl2_gpu_target_get_ptr(mrb, self);
 
   if (NULL == t)
     mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
-  if (8 == argc) {
-    mrb_float x1     = mrb_float(args[0]),
-              y1     = mrb_float(args[1]),
-              x2     = mrb_float(args[2]),
-              y2     = mrb_float(args[3]),
-              radius = mrb_float(args[4]);
-    mrb_int r = mrb_fixnum(args[5]),
-            g = mrb_fixnum(args[6]),
-            b = mrb_fixnum(args[7]),
-            a = mrb_fixnum(args[8]);
-    GPU_RectangleRoundFilled(t, x1, y1, x2, y2,
-                       radius, (SDL_Color) {r, g, b, a});
-  } else if (5 == argc) {
-    mrb_int r = mrb_fixnum(args[2]),
-            g = mrb_fixnum(args[3]),
-            b = mrb_fixnum(args[4]),
-            a = mrb_fixnum(args[5]);
+  if (argc >= 3 && MRB_TT_DATA == mrb_type(args[0])) {
     GPU_Rect *re      = mrb_sdl2_gpu_rect_get_ptr(mrb, args[0]);
-    mrb_float radius = mrb_float(args[1]);
-    GPU_RectangleRoundFilled2(t, *re, radius, (SDL_Color) {r, g, b, a});
+    mrb_float radius = mrb_sdl2_gpu_arg_float(mrb, args[1]);
+    SDL_Color color  = mrb_sdl2_gpu_color_args(mrb, args + 2, argc - 2);
+    if (!mrb_sdl2_gpu_cull_box(t, re->x, re->y, re->x + re->w, re->y + re->h))
+      GPU_RectangleRoundFilled2(t, *re, radius, color);
+  } else if (argc >= 6) {
+    mrb_float x1     = mrb_sdl2_gpu_arg_float(mrb, args[0]),
+              y1     = mrb_sdl2_gpu_arg_float(mrb, args[1]),
+              x2     = mrb_sdl2_gpu_arg_float(mrb, args[2]),
+              y2     = mrb_sdl2_gpu_arg_float(mrb, args[3]),
+              radius = mrb_sdl2_gpu_arg_float(mrb, args[4]);
+    SDL_Color color  = mrb_sdl2_gpu_color_args(mrb, args + 5, argc - 5);
+    if (!mrb_sdl2_gpu_cull_box(t, x1, y1, x2, y2))
+      GPU_RectangleRoundFilled(t, x1, y1, x2, y2, radius, color);
   } else {
     mrb_raise(mrb, E_ARGUMENT_ERROR, "unexpected arguments");
   }
@@ -2547,26 +2970,39 @@ mrb_sdl2_gpu_target_rect_round_filled(mrb_state *mrb, mrb_value self) {
 static mrb_value
 mrb_sdl2_gpu_target_gradient_fill_rect(mrb_state *mrb, mrb_value self) {
   GPU_Target *target;
-  mrb_int r1, r2, g1, g2, b1, b2, a1, a2;
-  mrb_value rect;
+  mrb_int argc;
+  mrb_value const *args = mrb_sdl2_gpu_argv(mrb, &argc);
+  SDL_Color c1, c2;
   GPU_Rect *re = NULL;
   mrb_bool vertical;
   float i;
   int difr, difg, difb, difa;
-  mrb_get_args(mrb, "iiiiiiiiob", &r1, &g1, &b1, &a1,
-                                  &r2, &g2, &b2, &a2,
-                                  &rect, &vertical);
+  /* (color1, color2, rect, vertical) or the colors as r, g, b, a each */
+  if (4 == argc) {
+    c1 = mrb_sdl2_gpu_color_args(mrb, args, 1);
+    c2 = mrb_sdl2_gpu_color_args(mrb, args + 1, 1);
+  } else if (10 == argc) {
+    c1 = mrb_sdl2_gpu_color_args(mrb, args, 4);
+    c2 = mrb_sdl2_gpu_color_args(mrb, args + 4, 4);
+  } else {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "unexpected arguments");
+  }
+  vertical = mrb_test(args[argc - 1]);
   target = mrb_sdl2_gpu_target_get_ptr(mrb, self);
-  re = mrb_sdl2_gpu_rect_get_ptr(mrb, rect);
+  re = mrb_sdl2_gpu_rect_get_ptr(mrb, args[argc - 2]);
 
   if (target == NULL || re == NULL) {
     mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get target or rectangle");
   }
+  if (mrb_sdl2_gpu_cull_box(target, re->x, re->y,
+                            re->x + re->w, re->y + re->h)) {
+    return self;
+  }
 
-  difr = r2 - r1;
-  difg = g2 - g1;
-  difb = b2 - b1;
-  difa = a2 - a1;
+  difr = c2.r - c1.r;
+  difg = c2.g - c1.g;
+  difb = c2.b - c1.b;
+  difa = c2.a - c1.a;
   if (vertical) {
     int r, g, b, a;
     for (i = 0; i < re->h; i+=1.0) {
@@ -2576,10 +3012,10 @@ mrb_sdl2_gpu_target_gradient_fill_rect(mrb_state *mrb, mrb_value self) {
       rec.y = re->y + i;
       rec.w = re->w;
       rec.h = 1;
-      r = r1 + difr * mod;
-      g = g1 + difg * mod;
-      b = b1 + difb * mod;
-      a = a1 + difa * mod;
+      r = c1.r + difr * mod;
+      g = c1.g + difg * mod;
+      b = c1.b + difb * mod;
+      a = c1.a + difa * mod;
       GPU_RectangleFilled2(target, rec, (SDL_Color) {r, g, b, a});
     }
   } else {
@@ -2591,10 +3027,10 @@ mrb_sdl2_gpu_target_gradient_fill_rect(mrb_state *mrb, mrb_value self) {
       rec.y = re->y;
       rec.w = 1;
       rec.h = re->h;
-      r = r1 + difr * mod;
-      g = g1 + difg * mod;
-      b = b1 + difb * mod;
-      a = a1 + difa * mod;
+      r = c1.r + difr * mod;
+      g = c1.g + difg * mod;
+      b = c1.b + difb * mod;
+      a = c1.a + difa * mod;
       GPU_RectangleFilled2(target, rec, (SDL_Color) {r, g, b, a});
     }
   }
@@ -2613,6 +3049,18 @@ mrb_sdl2_gpu_target_get_rgba(mrb_state *mrb, mrb_value self) {
   return ary;
 }
 
+static mrb_value
+mrb_sdl2_gpu_target_get_rgba_packed(mrb_state *mrb, mrb_value self) {
+  return mrb_sdl2_gpu_color_pack(
+      mrb_sdl2_gpu_target_get_ptr(mrb, self)->color);
+}
+
+static mrb_value
+mrb_sdl2_gpu_image_get_rgba_packed(mrb_state *mrb, mrb_value self) {
+  return mrb_sdl2_gpu_color_pack(
+      mrb_sdl2_gpu_image_get_ptr(mrb, self)->color);
+}
+
 static mrb_value
 mrb_sdl2_gpu_image_get_rgba(mrb_state *mrb, mrb_value self) {
   mrb_value ary;
@@ -2651,10 +3099,11 @@ mrb_sdl2_gpu_program_initialize(mrb_state *mrb, mrb_value self) {
     programid = GPU_LinkShaders(s1, s2);
   } else {
     int i;
-    Uint32 *p = (Uint32 *) SDL_malloc(sizeof(Uint32) * (rest_args + 1));
+    Uint32 *p = (Uint32 *) mrb_sdl2_gpu_arena_alloc(mrb, sizeof(Uint32) *
+                                                         (rest_args + 1));
     p[0] = mrb_sdl2_gpu_shader_get_uint32(mrb, object);
     for (i = 1; i < (rest_args + 1); i++) {
-      p[1] = mrb_sdl2_gpu_shader_get_uint32(mrb, objects[i-1]);
+      p[i] = mrb_sdl2_gpu_shader_get_uint32(mrb, objects[i-1]);
     }
     programid = GPU_LinkManyShaders(p, rest_args+1);
   }
@@ -2662,10 +3111,12 @@ mrb_sdl2_gpu_program_initialize(mrb_state *mrb, mrb_value self) {
     mrb_raise(mrb, E_RUNTIME_ERROR,
               "Could not initialize Shader Program");
   }
+  mrb_sdl2_gpu_gc_pressure(mrb, MRB_SDL2_GPU_PROGRAM_PRESSURE);
   data->programid = programid;
 
   DATA_PTR(self) = data;
   DATA_TYPE(self) = &mrb_sdl2_gpu_program_data_type;
+  mrb_sdl2_gpu_scope_adopt(mrb, self);
   return self;
 }
 
@@ -2674,12 +3125,9 @@ mrb_sdl2_gpu_program_free(mrb_state *mrb, mrb_value self) {
   mrb_sdl2_gpu_program_data_t *data =
     (mrb_sdl2_gpu_program_data_t*)
       mrb_data_get_ptr(mrb, self, &mrb_sdl2_gpu_program_data_type);
-  if (NULL != data) {
-    if (0 != data->programid) {
-      GPU_FreeShaderProgram(data->programid);
-      data->programid = 0;
-    }
-    mrb_free(mrb, data);
+  if (NULL != data && 0 != data->programid) {
+    GPU_FreeShaderProgram(data->programid);
+    data->programid = 0;
   }
   return self;
 }
@@ -2707,10 +3155,12 @@ mrb_sdl2_gpu_shader_initialize(mrb_state *mrb, mrb_value self) {
     mrb_raise(mrb, E_RUNTIME_ERROR,
               "Could not initialize Shader");
   }
+  mrb_sdl2_gpu_gc_pressure(mrb, MRB_SDL2_GPU_PROGRAM_PRESSURE);
   data->shaderid = shaderid;
 
   DATA_PTR(self) = data;
   DATA_TYPE(self) = &mrb_sdl2_gpu_shader_data_type;
+  mrb_sdl2_gpu_scope_adopt(mrb, self);
   return self;
 }
 
@@ -2719,12 +3169,9 @@ mrb_sdl2_gpu_shader_free(mrb_state *mrb, mrb_value self) {
   mrb_sdl2_gpu_shader_data_t *data =
     (mrb_sdl2_gpu_shader_data_t*)
       mrb_data_get_ptr(mrb, self, &mrb_sdl2_gpu_shader_data_type);
-  if (NULL != data) {
-    if (0 != data->shaderid) {
-      GPU_FreeShader(data->shaderid);
-      data->shaderid = 0;
-    }
-    mrb_free(mrb, data);
+  if (NULL != data && 0 != data->shaderid) {
+    GPU_FreeShader(data->shaderid);
+    data->shaderid = 0;
   }
   return self;
 }
@@ -2804,15 +3251,25 @@ static mrb_value
 mrb_sdl2_gpu_attributeformat_initialize(mrb_state *mrb, mrb_value self) {
   mrb_int num_elements_per_vertex, stride_bytes, offset_bytes, type;
   mrb_bool normalized;
+  mrb_sdl2_gpu_attributeformat_data_t *data =
+    (mrb_sdl2_gpu_attributeformat_data_t*)DATA_PTR(self);
   mrb_get_args(mrb, "iibii", &num_elements_per_vertex, &type, &normalized,
                              &stride_bytes, &offset_bytes);
-  return mrb_sdl2_gpu_attributeformat(mrb,
-                                      GPU_MakeAttributeFormat(
-                                          num_elements_per_vertex,
-                                          type,
-                                          normalized,
-                                          stride_bytes,
-                                          offset_bytes));
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_attributeformat_data_t*)
+        mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_attributeformat_data_t));
+    if (NULL == data) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+  }
+  data->attributeformat = GPU_MakeAttributeFormat(num_elements_per_vertex,
+                                                  type,
+                                                  normalized,
+                                                  stride_bytes,
+                                                  offset_bytes);
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_attributeformat_data_type;
+  return self;
 }
 
 static mrb_value
@@ -2822,16 +3279,54 @@ mrb_sdl2_gpu_attributeformat_free(mrb_state *mrb, mrb_value self) {
       mrb_data_get_ptr(mrb, self, &mrb_sdl2_gpu_attributeformat_data_type);
   if (NULL != data) {
     mrb_free(mrb, data);
+    DATA_PTR(self) = NULL;
   }
   return self;
 }
 
+/* new(location, values, format): values is an array of floats, or nil when
+ * the attribute only describes a layout (see GPU::Mesh). The values live in
+ * the same allocation as the attribute. */
 static mrb_value
 mrb_sdl2_gpu_attribute_initialize(mrb_state *mrb, mrb_value self) {
-  mrb_int location;
+  mrb_int location, i, n;
   mrb_value values, format;
-  mrb_get_args(mrb, "iAo", &location, &values, &format);
-  mrb_raise(mrb, E_NOTIMP_ERROR, "not implemented.");
+  mrb_sdl2_gpu_attribute_data_t *data =
+    (mrb_sdl2_gpu_attribute_data_t*)DATA_PTR(self);
+  GPU_AttributeFormat *format_c;
+  GPU_Attribute *attribute;
+  float *values_c;
+  mrb_get_args(mrb, "iA!o", &location, &values, &format);
+  format_c = mrb_sdl2_gpu_attributeformat_get_ptr(mrb, format);
+  if (NULL == format_c) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "Attribute needs an AttributeFormat");
+  }
+  n = mrb_nil_p(values) ? 0 : RARRAY_LEN(values);
+  /* checked before anything is allocated, the conversion cannot raise */
+  for (i = 0; i < n; i++) {
+    if (!mrb_fixnum_p(RARRAY_PTR(values)[i]) &&
+        !mrb_float_p(RARRAY_PTR(values)[i]))
+      mrb_raise(mrb, E_TYPE_ERROR, "attribute values must be numbers");
+  }
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_attribute_data_t*)
+        mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_attribute_data_t));
+    data->attribute = NULL;
+    DATA_PTR(self) = data;
+    DATA_TYPE(self) = &mrb_sdl2_gpu_attribute_data_type;
+  } else if (NULL != data->attribute) {
+    mrb_free(mrb, data->attribute);
+    data->attribute = NULL;
+  }
+  attribute = (GPU_Attribute*)
+      mrb_malloc(mrb, sizeof(GPU_Attribute) + sizeof(float) * n);
+  values_c = (float*)(attribute + 1);
+  for (i = 0; i < n; i++) {
+    values_c[i] = mrb_to_flo(mrb, RARRAY_PTR(values)[i]);
+  }
+  *attribute = GPU_MakeAttribute(location, n > 0 ? values_c : NULL, *format_c);
+  data->attribute = attribute;
+  return self;
 }
 
 static mrb_value
@@ -2844,6 +3339,7 @@ mrb_sdl2_gpu_attribute_free(mrb_state *mrb, mrb_value self) {
       mrb_free(mrb, data->attribute);
     }
     mrb_free(mrb, data);
+    DATA_PTR(self) = NULL;
   }
   return self;
 }
@@ -2905,17 +3401,50 @@ mrb_sdl2_gpu_image_set(mrb_state *mrb, mrb_value self) {
   return self;
 }
 
+/* A single uniform holds at most a 4x4 matrix; arrays are read one
+ * element location at a time. */
+#define MRB_SDL2_GPU_UNIFORM_MAX_VALUES 16
+
+static mrb_int
+mrb_sdl2_gpu_uniform_count(mrb_state *mrb, mrb_int count) {
+  if (count < 0 || count > MRB_SDL2_GPU_UNIFORM_MAX_VALUES)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "a uniform has 0 to 16 values");
+  return count;
+}
+
+/* Uniform getters take an optional GPU::QueryBuffer to fill instead of
+ * returning a new Array. */
+static mrb_value
+mrb_sdl2_gpu_uniform_floats(mrb_state *mrb, float const *values, int count,
+                            mrb_value buffer) {
+  mrb_value ary;
+  int i;
+  if (!mrb_nil_p(buffer)) {
+    mrb_sdl2_gpu_query_buffer_write_floats(mrb, buffer, values, count);
+    return buffer;
+  }
+  ary = mrb_ary_new_capa(mrb, count);
+  for (i = 0; i < count; i++) {
+    mrb_ary_push(mrb, ary, mrb_float_value(mrb, values[i]));
+  }
+  return ary;
+}
+
 static mrb_value
 mrb_sdl2_gpu_program_get_uniformuiv(mrb_state *mrb, mrb_value self) {
   mrb_int location, arguments_num;
-  unsigned int *values;
+  unsigned int values[MRB_SDL2_GPU_UNIFORM_MAX_VALUES];
   int i;
-  mrb_value ary;
-  mrb_get_args(mrb, "ii", &location, &arguments_num);
-  values = (unsigned int *) SDL_malloc(sizeof(unsigned int *) * arguments_num);
+  mrb_value ary, buffer = mrb_nil_value();
+  mrb_get_args(mrb, "ii|o", &location, &arguments_num, &buffer);
+  arguments_num = mrb_sdl2_gpu_uniform_count(mrb, arguments_num);
   GPU_GetUniformuiv(mrb_sdl2_gpu_program_get_uint32(mrb, self),
                     location,
                     values);
+  if (!mrb_nil_p(buffer)) {
+    mrb_sdl2_gpu_query_buffer_write_uints(mrb, buffer, values, arguments_num);
+    return buffer;
+  }
   ary = mrb_ary_new_capa(mrb, arguments_num);
   for (i = 0; i < arguments_num; i++) {
     mrb_ary_push(mrb, ary, mrb_fixnum_value(values[i]));
@@ -2939,38 +3468,47 @@ mrb_sdl2_gpu_set_uniformi(mrb_state *mrb, mrb_value self) {
   return self;
 }
 
+/* Number of values a vector setter reads from values, raising when the
+ * Array holds fewer. */
+static int
+mrb_sdl2_gpu_vector_len(mrb_state *mrb, mrb_value values,
+                        mrb_int num_elements_per_value, mrb_int num_values) {
+  mrb_int n = num_elements_per_value * num_values;
+  if (num_elements_per_value < 0 || num_values < 0 || n > RARRAY_LEN(values))
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "expected %S values, got %S",
+               mrb_fixnum_value(n), mrb_fixnum_value(RARRAY_LEN(values)));
+  return (int) n;
+}
+
 static mrb_value
 mrb_sdl2_gpu_set_uniformuiv(mrb_state *mrb, mrb_value self) {
   mrb_int location, num_elements_per_value, num_values;
   mrb_value values;
   unsigned int * values_c;
-  int i;
+  int i, n;
   mrb_get_args(mrb, "iiiA", &location, &num_elements_per_value,
                                        &num_values, &values);
-  values_c = (unsigned int *) SDL_malloc(sizeof(unsigned int) *
-                                         num_values           *
-                                         num_elements_per_value);
-  for (i = 0; i < num_values; i++) {
-    values_c[i] = mrb_fixnum(mrb_ary_ref(mrb, values, i));
+  n = mrb_sdl2_gpu_vector_len(mrb, values, num_elements_per_value,
+                              num_values);
+  values_c = (unsigned int *) mrb_sdl2_gpu_arena_alloc(
+      mrb, sizeof(unsigned int) * n);
+  for (i = 0; i < n; i++) {
+    values_c[i] = (unsigned int) mrb_int(mrb, RARRAY_PTR(values)[i]);
   }
+  GPU_SetUniformuiv(location, num_elements_per_value, num_values, values_c);
   return self;
 }
 
 static mrb_value
 mrb_sdl2_gpu_program_get_uniformfv(mrb_state *mrb, mrb_value self) {
   mrb_int location, number_of_values;
-  mrb_value ary;
-  int i;
-  float *values;
-  mrb_get_args(mrb, "ii", &location, &number_of_values);
-  values = (float *) SDL_malloc(sizeof(float) * number_of_values);
-  ary = mrb_ary_new_capa(mrb, number_of_values);
+  mrb_value buffer = mrb_nil_value();
+  float values[MRB_SDL2_GPU_UNIFORM_MAX_VALUES];
+  mrb_get_args(mrb, "ii|o", &location, &number_of_values, &buffer);
+  number_of_values = mrb_sdl2_gpu_uniform_count(mrb, number_of_values);
   GPU_GetUniformfv(mrb_sdl2_gpu_program_get_uint32(mrb, self),
                    location, values);
-  for (i = 0; i < number_of_values; i++) {
-    mrb_ary_push(mrb, ary, mrb_float_value(mrb, values[i]));
-  }
-  return ary;
+  return mrb_sdl2_gpu_uniform_floats(mrb, values, number_of_values, buffer);
 }
 
 static mrb_value
@@ -2987,38 +3525,51 @@ mrb_sdl2_gpu_set_uniformfv(mrb_state *mrb, mrb_value self) {
   mrb_int location, num_elements_per_value, num_values;
   mrb_value values;
   float * values_c;
-  int i;
+  int i, n;
   mrb_get_args(mrb, "iiiA", &location, &num_elements_per_value,
                             &num_values, &values);
-  values_c = (float *) SDL_malloc(sizeof(float) *
-                                  num_values           *
-                                  num_elements_per_value);
-  for (i = 0; i < num_values; i++) {
-    values_c[i] = mrb_float(mrb_ary_ref(mrb, values, i));
+  n = mrb_sdl2_gpu_vector_len(mrb, values, num_elements_per_value,
+                              num_values);
+  values_c = (float *) mrb_sdl2_gpu_arena_alloc(mrb, sizeof(float) * n);
+  for (i = 0; i < n; i++) {
+    values_c[i] = mrb_to_flo(mrb, RARRAY_PTR(values)[i]);
   }
+  GPU_SetUniformfv(location, num_elements_per_value, num_values, values_c);
   return self;
 }
 
 static mrb_value
 mrb_sdl2_gpu_program_get_umfv(mrb_state *mrb, mrb_value self) {
   mrb_int location, number_of_values;
-  mrb_value ary;
-  int i;
-  float *values;
-  mrb_get_args(mrb, "ii", &location, &number_of_values);
-  values = (float *) SDL_malloc(sizeof(float) * number_of_values);
-  ary = mrb_ary_new_capa(mrb, number_of_values);
+  mrb_value buffer = mrb_nil_value();
+  float values[MRB_SDL2_GPU_UNIFORM_MAX_VALUES];
+  mrb_get_args(mrb, "ii|o", &location, &number_of_values, &buffer);
+  number_of_values = mrb_sdl2_gpu_uniform_count(mrb, number_of_values);
   GPU_GetUniformMatrixfv(mrb_sdl2_gpu_program_get_uint32(mrb, self),
                          location, values);
-  for (i = 0; i < number_of_values; i++) {
-    mrb_ary_push(mrb, ary, mrb_float_value(mrb, values[i]));
-  }
-  return ary;
+  return mrb_sdl2_gpu_uniform_floats(mrb, values, number_of_values, buffer);
 }
 
+/* set_uniform_matrixfv(location, num_matrices, num_rows, num_columns,
+ *                      transpose, values) */
 static mrb_value
 mrb_sdl2_gpu_set_umfv(mrb_state *mrb, mrb_value self) {
-  mrb_raise(mrb, E_NOTIMP_ERROR, "not implemented");
+  mrb_int location, num_matrices, num_rows, num_columns;
+  mrb_bool transpose;
+  mrb_value values;
+  float *values_c;
+  int i, n;
+  mrb_get_args(mrb, "iiiibA", &location, &num_matrices, &num_rows,
+                              &num_columns, &transpose, &values);
+  n = mrb_sdl2_gpu_vector_len(mrb, values, num_rows * num_columns,
+                              num_matrices);
+  values_c = (float *) mrb_sdl2_gpu_arena_alloc(mrb, sizeof(float) * n);
+  for (i = 0; i < n; i++) {
+    values_c[i] = mrb_to_flo(mrb, RARRAY_PTR(values)[i]);
+  }
+  GPU_SetUniformMatrixfv(location, num_matrices, num_rows, num_columns,
+                         transpose, values_c);
+  return self;
 }
 
 static mrb_value
@@ -3034,7 +3585,7 @@ static mrb_value
 mrb_sdl2_gpu_set_attributei(mrb_state *mrb, mrb_value self) {
   mrb_int location;
   mrb_int value;
-  mrb_get_args(mrb, "if", &location, &value);
+  mrb_get_args(mrb, "ii", &location, &value);
   GPU_SetAttributei(location, value);
   return self;
 }
@@ -3043,7 +3594,7 @@ static mrb_value
 mrb_sdl2_gpu_set_attributeui(mrb_state *mrb, mrb_value self) {
   mrb_int location;
   mrb_int value;
-  mrb_get_args(mrb, "if", &location, &value);
+  mrb_get_args(mrb, "ii", &location, &value);
   GPU_SetAttributeui(location, value);
   return self;
 }
@@ -3056,9 +3607,9 @@ mrb_sdl2_gpu_set_attributefv(mrb_state *mrb, mrb_value self) {
   int size, i;
   mrb_get_args(mrb, "iA", &location, &values);
   size = mrb_ary_len(mrb, values);
-  values_c = (float *) SDL_malloc(sizeof(float) * size);
+  values_c = (float *) mrb_sdl2_gpu_arena_alloc(mrb, sizeof(float) * size);
   for (i = 0; i < size; i++) {
-    values_c[i] = mrb_float(mrb_ary_ref(mrb, values, i));
+    values_c[i] = (float) mrb_to_flo(mrb, RARRAY_PTR(values)[i]);
   }
   GPU_SetAttributefv(location, size, values_c);
   return self;
@@ -3072,9 +3623,9 @@ mrb_sdl2_gpu_set_attributeiv(mrb_state *mrb, mrb_value self) {
   int size, i;
   mrb_get_args(mrb, "iA", &location, &values);
   size = mrb_ary_len(mrb, values);
-  values_c = (int *) SDL_malloc(sizeof(int) * size);
+  values_c = (int *) mrb_sdl2_gpu_arena_alloc(mrb, sizeof(int) * size);
   for (i = 0; i < size; i++) {
-    values_c[i] = mrb_float(mrb_ary_ref(mrb, values, i));
+    values_c[i] = (int) mrb_int(mrb, RARRAY_PTR(values)[i]);
   }
   GPU_SetAttributeiv(location, size, values_c);
   return self;
@@ -3088,105 +3639,191 @@ mrb_sdl2_gpu_set_attributeuiv(mrb_state *mrb, mrb_value self) {
   int size, i;
   mrb_get_args(mrb, "iA", &location, &values);
   size = mrb_ary_len(mrb, values);
-  values_c = (unsigned int *) SDL_malloc(sizeof(unsigned int) * size);
+  values_c = (unsigned int *) mrb_sdl2_gpu_arena_alloc(mrb, sizeof(unsigned int) * size);
   for (i = 0; i < size; i++) {
-    values_c[i] = mrb_float(mrb_ary_ref(mrb, values, i));
+    values_c[i] = (unsigned int) mrb_int(mrb, RARRAY_PTR(values)[i]);
   }
   GPU_SetAttributeuiv(location, size, values_c);
   return self;
 }
 
-float *get_floats(mrb_state *mrb, mrb_value self) {
-  float * result = NULL;
-  mrb_value f;
-  int size, i, j, k;
-
-  if (MRB_TT_ARRAY != self.tt)
-    return NULL;
+/* Batch arrays are either flat or one level of per vertex arrays. */
+static int
+mrb_sdl2_gpu_batch_len(mrb_state *mrb, mrb_value ary) {
+  if (!mrb_array_p(ary) || 0 == RARRAY_LEN(ary))
+    return 0;
+  if (mrb_array_p(RARRAY_PTR(ary)[0]))
+    return RARRAY_LEN(ary) * RARRAY_LEN(RARRAY_PTR(ary)[0]);
+  return RARRAY_LEN(ary);
+}
 
-  size = RARRAY_LEN(self);  // mrb_ary_len(mrb, self);
-  if (mrb_ary_ref(mrb, self, 0).tt == MRB_TT_ARRAY)
-    size *= RARRAY_LEN(mrb_ary_ref(mrb, self, 0));
-
-  result = (float *) SDL_malloc(sizeof(float) * size);
-  i = 0;
-  f = self;
-  if (mrb_array_p(mrb_ary_ref(mrb, self, 0))) {
-    for (j = 0; j < RARRAY_LEN(f); j++) {
-      int k_max = RARRAY_LEN(mrb_ary_ref(mrb, self, 0));
-      mrb_value j_value = mrb_ary_ref(mrb, self, j);
-      for (k = 0; k < k_max; k++)
-        result[i++] = mrb_float(mrb_ary_ref(mrb, j_value, k));
-    }
-  } else {
-    for (j = 0; j < RARRAY_LEN(f); j++) {
-      result[i++] = mrb_float(mrb_ary_ref(mrb, self, j));
+/* Reads the values of a batch array into out. When bounds is given it
+ * receives the box around the positions, the first two of every stride
+ * values. Column packed of every vertex, if not -1, holds one packed
+ * color and is written out as the four floats SDL_gpu expects. */
+static void
+mrb_sdl2_gpu_batch_read_floats(mrb_state *mrb, mrb_value ary, float *out,
+                               int stride, int packed, float *bounds) {
+  int n = RARRAY_LEN(ary), i = 0, j, k;
+  mrb_bool nested = n > 0 && mrb_array_p(RARRAY_PTR(ary)[0]);
+  int k_max = nested ? RARRAY_LEN(RARRAY_PTR(ary)[0]) : 1;
+  for (j = 0; j < n; j++) {
+    mrb_value row = RARRAY_PTR(ary)[j];
+    for (k = 0; k < k_max; k++, i++) {
+      mrb_value value = nested ? mrb_ary_ref(mrb, row, k) : row;
+      int c = i % stride;
+      float v;
+      if (c == packed) {
+        SDL_Color color = mrb_sdl2_gpu_color_unpack(mrb, value);
+        *out++ = color.r / 255.0f;
+        *out++ = color.g / 255.0f;
+        *out++ = color.b / 255.0f;
+        *out++ = color.a / 255.0f;
+        continue;
+      }
+      v = mrb_to_flo(mrb, value);
+      *out++ = v;
+      if (NULL == bounds || c > 1)
+        continue;
+      if (i < 2) {
+        bounds[c] = bounds[c + 2] = v;
+      } else {
+        bounds[c] = SDL_min(bounds[c], v);
+        bounds[c + 2] = SDL_max(bounds[c + 2], v);
+      }
     }
   }
-  return result;
 }
 
-unsigned short *get_uint(mrb_state *mrb, mrb_value self) {
-  unsigned short * result = NULL;
-  mrb_value f;
-  int size = 1, i, j, k;
-
-  if (MRB_TT_ARRAY != self.tt)
-    return NULL;
-
-  f = self;
-  while (mrb_array_p(f)) {
-    size *= mrb_ary_len(mrb, f);
-    f = mrb_ary_ref(mrb, self, 0);
-  }
-
-  result = (unsigned short *) SDL_malloc(sizeof(unsigned short) * size);
-  i = 0;
-  if (mrb_array_p(mrb_ary_ref(mrb, self, 0))) {
-    for (j = 0; j < mrb_ary_len(mrb, self); j++) {
-      int k_max = mrb_ary_len(mrb, mrb_ary_ref(mrb, self, 0));
-      mrb_value j_value = mrb_ary_ref(mrb, self, j);
-      for (k = 0; k < k_max; k++)
-        result[i++] = mrb_int(mrb, mrb_ary_ref(mrb, j_value, k));
-    }
-  } else {
-    for (j = 0; j < mrb_ary_len(mrb, self); j++) {
-      result[i++] = mrb_int(mrb, mrb_ary_ref(mrb, self, j));
+/* Reads the indices of a batch array into out, raising on one that does
+ * not name one of the num_vertices vertices. */
+static void
+mrb_sdl2_gpu_batch_read_indices(mrb_state *mrb, mrb_value ary, Uint16 *out,
+                                int num_vertices) {
+  int n = RARRAY_LEN(ary), i = 0, j, k;
+  mrb_bool nested = n > 0 && mrb_array_p(RARRAY_PTR(ary)[0]);
+  int k_max = nested ? RARRAY_LEN(RARRAY_PTR(ary)[0]) : 1;
+  for (j = 0; j < n; j++) {
+    mrb_value row = RARRAY_PTR(ary)[j];
+    for (k = 0; k < k_max; k++) {
+      mrb_int index = mrb_int(mrb, nested ? mrb_ary_ref(mrb, row, k) : row);
+      if (index < 0 || index >= num_vertices)
+        mrb_raisef(mrb, E_ARGUMENT_ERROR,
+                   "batch index %S out of range for %S vertices",
+                   mrb_fixnum_value(index), mrb_fixnum_value(num_vertices));
+      out[i++] = (Uint16) index;
     }
   }
+}
+
+static unsigned short *
+get_uint(mrb_state *mrb, mrb_value self, int num_vertices) {
+  unsigned short *result;
+  int size = mrb_sdl2_gpu_batch_len(mrb, self);
+  if (0 == size)
+    return NULL;
+  result = (unsigned short *) mrb_sdl2_gpu_arena_alloc(
+      mrb, sizeof(unsigned short) * size);
+  mrb_sdl2_gpu_batch_read_indices(mrb, self, result, num_vertices);
   return result;
 }
 
+/* blit_batch(image, values, indices, flags). Batches in a format the
+ * streaming buffer takes are read straight into it; everything else is
+ * converted and handed to SDL_gpu. With GPU_BATCH_RGBA_PACKED every
+ * vertex carries one packed GPU::Color instead of four color floats. */
 static mrb_value
 mrb_sdl2_gpu_target_blit_batch(mrb_state *mrb, mrb_value self) {
   mrb_value image, indices, values;
   mrb_int batch_flags;
   GPU_Image *image_c = NULL;
+  GPU_Target *target;
   float *values_c;
   unsigned short *indices_c = NULL;
-  int i = 0, j;
+  int stride = 0, num_values, num_vertices, num_indices, first;
+  int packed = -1, vertex_floats;
   mrb_get_args(mrb, "oAA!i", &image, &values, &indices, &batch_flags);
 
   image_c = mrb_sdl2_gpu_image_get_ptr(mrb, image);
+  target = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_vram_touch(image_c);
+
+  if (batch_flags & GPU_BATCH_XYZ) stride+=3;
+  else if (batch_flags & GPU_BATCH_XY) stride+=2;
+  if (batch_flags & GPU_BATCH_ST) stride+=2;
+  if (batch_flags & MRB_SDL2_GPU_BATCH_RGBA_PACKED) stride+=1;
+  else if (batch_flags & GPU_BATCH_RGBA) stride+=4;
+  else if (batch_flags & GPU_BATCH_RGB) stride+=3;
+  if (0 == stride)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid batch flags");
+  if (batch_flags & MRB_SDL2_GPU_BATCH_RGBA_PACKED) {
+    packed = stride - 1;
+    batch_flags = (batch_flags & ~(MRB_SDL2_GPU_BATCH_RGBA_PACKED |
+                                   GPU_BATCH_RGB)) | GPU_BATCH_RGBA;
+  }
+  vertex_floats = packed < 0 ? stride : stride + 3;
+
+  num_values = mrb_sdl2_gpu_batch_len(mrb, values);
+  if (0 != num_values % stride)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR,
+               "batch values (%S) are not a multiple of the %S per vertex",
+               mrb_fixnum_value(num_values), mrb_fixnum_value(stride));
+  num_vertices = num_values / stride;
+  num_indices = mrb_sdl2_gpu_batch_len(mrb, indices);
+  if (0 == num_vertices)
+    return self;
+  /* Uint16 indices (and SDL_gpu's vertex count) reach 65535 vertices,
+   * only a plain triangle list can be split */
+  if (num_indices > 0 && num_vertices > 65535)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR,
+               "indexed batches take at most 65535 vertices, not %S",
+               mrb_fixnum_value(num_vertices));
+
+  if (num_vertices <= 65536 &&
+      mrb_sdl2_gpu_stream_ready(mrb, image_c, batch_flags)) {
+    Uint16 *stream_indices = NULL;
+    float *stream_values = (float*) mrb_sdl2_gpu_stream_reserve(
+        sizeof(float) * num_vertices * vertex_floats,
+        sizeof(Uint16) * num_indices, &stream_indices);
+    if (NULL != stream_values) {
+      float bounds[4];
+      mrb_sdl2_gpu_batch_read_floats(mrb, values, stream_values, stride,
+                                     packed, bounds);
+      if (mrb_sdl2_gpu_cull_box(target, bounds[0], bounds[1],
+                                bounds[2], bounds[3])) {
+        /* hand the reservation back, nothing of it is drawn */
+        mrb_sdl2_gpu_stream_trim(stream_values, 0);
+        return self;
+      }
+      if (num_indices > 0)
+        mrb_sdl2_gpu_batch_read_indices(mrb, indices, stream_indices,
+                                        num_vertices);
+      mrb_sdl2_gpu_stream_draw(mrb, target, image_c, batch_flags,
+                               stream_values, num_vertices,
+                               stream_indices, num_indices);
+      return self;
+    }
+  }
 
-  if (batch_flags & GPU_BATCH_XYZ) i+=3;
-  else if (batch_flags & GPU_BATCH_XY) i+=2;
-  if (batch_flags & GPU_BATCH_ST) i+=2;
-  if (batch_flags & GPU_BATCH_RGBA) i+=4;
-  else if (batch_flags & GPU_BATCH_RGB) i+=3;
-
-  values_c = get_floats(mrb, values);
-  indices_c = get_uint(mrb, indices);
-
-  j = mrb_ary_len(mrb, values) * mrb_ary_len(mrb, mrb_ary_ref(mrb, values, 0));
-
-  GPU_TriangleBatch(image_c, mrb_sdl2_gpu_target_get_ptr(mrb, self),
-                    mrb_ary_len(mrb, values), values_c,
-                    mrb_array_p(indices) ? mrb_ary_len(mrb, indices) : 0,
-                    indices_c, batch_flags);
-
-  SDL_free(values_c);
-  SDL_free(indices_c);
+  values_c = (float*) mrb_sdl2_gpu_arena_alloc(
+      mrb, sizeof(float) * num_vertices * vertex_floats);
+  mrb_sdl2_gpu_batch_read_floats(mrb, values, values_c, stride, packed, NULL);
+  indices_c = get_uint(mrb, indices, num_vertices);
+
+  if (num_indices > 0) {
+    if (!mrb_sdl2_gpu_cull_batch(target, values_c, num_vertices,
+                                 vertex_floats))
+      GPU_TriangleBatch(image_c, target, num_vertices, values_c,
+                        num_indices, indices_c, batch_flags);
+    return self;
+  }
+  /* whole triangles per call, the vertex count is an unsigned short */
+  for (first = 0; first < num_vertices; first += 65535) {
+    float *chunk = values_c + (size_t) first * vertex_floats;
+    int count = SDL_min(num_vertices - first, 65535);
+    if (!mrb_sdl2_gpu_cull_batch(target, chunk, count, vertex_floats))
+      GPU_TriangleBatch(image_c, target, count, chunk, 0, NULL, batch_flags);
+  }
 
   return self;
 }
@@ -3303,7 +3940,7 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_module_function(mrb, mod_GPU, "create_alias_target",      mrb_sdl2_gpu_create_alias_target,      MRB_ARGS_REQ(1)); 
   mrb_define_module_function(mrb, mod_GPU, "load_target",              mrb_sdl2_gpu_load_target,              MRB_ARGS_REQ(1)); 
   mrb_define_module_function(mrb, mod_GPU, "set_virtual_resolution",   mrb_sdl2_gpu_set_virtual_resolution,   MRB_ARGS_REQ(3));
-  mrb_define_module_function(mrb, mod_GPU, "get_virtual_coords",       mrb_sdl2_gpu_get_virtual_coords,       MRB_ARGS_REQ(3)); 
+  mrb_define_module_function(mrb, mod_GPU, "get_virtual_coords",       mrb_sdl2_gpu_get_virtual_coords,       MRB_ARGS_REQ(3) | MRB_ARGS_OPT(1));
   mrb_define_module_function(mrb, mod_GPU, "unset_virtual_resolution", mrb_sdl2_gpu_unset_virtual_resolution, MRB_ARGS_REQ(1));
   mrb_define_module_function(mrb, mod_GPU, "make_rect",                mrb_sdl2_gpu_make_rect,                MRB_ARGS_REQ(4));
   mrb_define_module_function(mrb, mod_GPU, "make_color",               mrb_sdl2_gpu_make_color,               MRB_ARGS_REQ(4));
@@ -3326,13 +3963,16 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_method(mrb, class_Target, "camera",        mrb_sdl2_gpu_target_get_camera,    MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Target, "camera=",       mrb_sdl2_gpu_target_set_camera,    MRB_ARGS_REQ(1));
   mrb_define_method(mrb, class_Target, "get_pixel",     mrb_sdl2_gpu_target_get_pixel,     MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_Target, "get_pixel_packed", mrb_sdl2_gpu_target_get_pixel_packed, MRB_ARGS_REQ(2));
   mrb_define_method(mrb, class_Target, "set_clip_rect", mrb_sdl2_gpu_target_set_clip_rect, MRB_ARGS_REQ(1));
   mrb_define_method(mrb, class_Target, "set_clip",      mrb_sdl2_gpu_target_set_clip,      MRB_ARGS_REQ(4));
   mrb_define_method(mrb, class_Target, "unset_clip",    mrb_sdl2_gpu_target_unset_clip,    MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Target, "set_rgb",       mrb_sdl2_gpu_target_set_rgb,       MRB_ARGS_REQ(3));
-  mrb_define_method(mrb, class_Target, "set_rgba",      mrb_sdl2_gpu_target_set_rgba,      MRB_ARGS_REQ(4));
-  mrb_define_method(mrb, class_Target, "get_rgba",      mrb_sdl2_gpu_target_get_rgba,      MRB_ARGS_REQ(4));
+  mrb_define_method(mrb, class_Target, "set_rgba",      mrb_sdl2_gpu_target_set_rgba,      MRB_ARGS_REQ(1) | MRB_ARGS_OPT(3));
+  mrb_define_method(mrb, class_Target, "get_rgba",      mrb_sdl2_gpu_target_get_rgba,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Target, "get_rgba_packed", mrb_sdl2_gpu_target_get_rgba_packed, MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Target, "unset_color",   mrb_sdl2_gpu_target_unset_color,   MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Target, "image",         mrb_sdl2_gpu_target_image,         MRB_ARGS_NONE());
 
   /***************************************************************************
    * Image Class Functions
@@ -3346,8 +3986,9 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_method(mrb, class_Image, "save",               mrb_sdl2_gpu_image_save,               MRB_ARGS_REQ(1));
   mrb_define_method(mrb, class_Image, "generate_mipmaps",   mrb_sdl2_gpu_image_generate_mipmaps,   MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Image, "set_rgb",            mrb_sdl2_gpu_image_set_rgb,            MRB_ARGS_REQ(3));
-  mrb_define_method(mrb, class_Image, "set_rgba",           mrb_sdl2_gpu_image_set_rgba,           MRB_ARGS_REQ(4));
+  mrb_define_method(mrb, class_Image, "set_rgba",           mrb_sdl2_gpu_image_set_rgba,           MRB_ARGS_REQ(1) | MRB_ARGS_OPT(3));
   mrb_define_method(mrb, class_Image, "get_rgba",           mrb_sdl2_gpu_image_get_rgba,           MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Image, "get_rgba_packed",    mrb_sdl2_gpu_image_get_rgba_packed,    MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Image, "unset_color",        mrb_sdl2_gpu_image_unset_color,        MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Image, "blending",           mrb_sdl2_gpu_image_get_blending,       MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Image, "blending=",          mrb_sdl2_gpu_image_set_blending,       MRB_ARGS_REQ(1));
@@ -3379,32 +4020,30 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
    * info: http://dinomage.com/reference/SDL_gpu/group__Rendering.html
    ***************************************************************************/
   mrb_define_module_function(mrb, mod_GPU, "flush_blit_buffer", mrb_sdl2_gpu_flush_blit_buffer, MRB_ARGS_NONE()); 
+  mrb_define_module_function(mrb, mod_GPU, "set_culling",       mrb_sdl2_gpu_set_culling,       MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, mod_GPU, "culling?",          mrb_sdl2_gpu_is_culling,        MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "cull_stats",        mrb_sdl2_gpu_cull_stats,        MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "reset_cull_stats",  mrb_sdl2_gpu_reset_cull_stats,  MRB_ARGS_NONE());
 
   mrb_define_method(mrb, class_Target, "clear",              mrb_sdl2_gpu_target_clear,              MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Target, "clear_rgb",          mrb_sdl2_gpu_target_clear_rgb,          MRB_ARGS_REQ(3));
   mrb_define_method(mrb, class_Target, "clear_rgba",         mrb_sdl2_gpu_target_clear_rgba,         MRB_ARGS_REQ(4));
   mrb_define_method(mrb, class_Target, "flip",               mrb_sdl2_gpu_target_flip,               MRB_ARGS_NONE());
-  mrb_define_method(mrb, class_Target, "blit",               mrb_sdl2_gpu_target_blit,               MRB_ARGS_REQ(4) | MRB_ARGS_OPT(3));
+  mrb_define_method(mrb, class_Target, "blit",               mrb_sdl2_gpu_target_blit,               MRB_ARGS_REQ(4) | MRB_ARGS_OPT(5));
+#define MRB_SDL2_GPU_BLIT_METHOD(name, n, use_anchor, pivot_x, pivot_y, scale_x, scale_y, rotated, degrees, draw) \
+  mrb_define_method(mrb, class_Target, #name, mrb_sdl2_gpu_target_##name, MRB_ARGS_REQ(n + 2));
+  MRB_SDL2_GPU_BLITS(MRB_SDL2_GPU_BLIT_METHOD)
+#undef MRB_SDL2_GPU_BLIT_METHOD
   mrb_define_method(mrb, class_Target, "blit_batch",         mrb_sdl2_gpu_target_blit_batch,         MRB_ARGS_REQ(4));
-  mrb_define_method(mrb, class_Target, "pixel",              mrb_sdl2_gpu_target_pixel,              MRB_ARGS_REQ(6));
-  mrb_define_method(mrb, class_Target, "line",               mrb_sdl2_gpu_target_line,               MRB_ARGS_REQ(8));
-  mrb_define_method(mrb, class_Target, "arc",                mrb_sdl2_gpu_target_arc,                MRB_ARGS_REQ(9));
-  mrb_define_method(mrb, class_Target, "arc_filled",         mrb_sdl2_gpu_target_arc_filled,         MRB_ARGS_REQ(9));
-  mrb_define_method(mrb, class_Target, "circle",             mrb_sdl2_gpu_target_circle,             MRB_ARGS_REQ(7));
-  mrb_define_method(mrb, class_Target, "circle_filled",      mrb_sdl2_gpu_target_circle_filled,      MRB_ARGS_REQ(7));
-  mrb_define_method(mrb, class_Target, "ellipse",            mrb_sdl2_gpu_target_ellipse,            MRB_ARGS_REQ(7));
-  mrb_define_method(mrb, class_Target, "ellipse_filled",     mrb_sdl2_gpu_target_ellipse_filled,     MRB_ARGS_REQ(7));
-  mrb_define_method(mrb, class_Target, "sector",             mrb_sdl2_gpu_target_sector,             MRB_ARGS_REQ(10));
-  mrb_define_method(mrb, class_Target, "sector_filled",      mrb_sdl2_gpu_target_sector_filled,      MRB_ARGS_REQ(10));
-  mrb_define_method(mrb, class_Target, "tri",                mrb_sdl2_gpu_target_tri,                MRB_ARGS_REQ(10));
-  mrb_define_method(mrb, class_Target, "tri_filled",         mrb_sdl2_gpu_target_tri_filled,         MRB_ARGS_REQ(10));
-  mrb_define_method(mrb, class_Target, "rect2",              mrb_sdl2_gpu_target_rect2,              MRB_ARGS_REQ(5));
-  mrb_define_method(mrb, class_Target, "rect_filled2",       mrb_sdl2_gpu_target_rect_filled2,       MRB_ARGS_REQ(5));
-  mrb_define_method(mrb, class_Target, "rect",               mrb_sdl2_gpu_target_rect,               MRB_ARGS_REQ(8));
-  mrb_define_method(mrb, class_Target, "rect_filled",        mrb_sdl2_gpu_target_rect_filled,        MRB_ARGS_REQ(8));
-  mrb_define_method(mrb, class_Target, "rect_round",         mrb_sdl2_gpu_target_rect_round,         MRB_ARGS_REQ(6) | MRB_ARGS_OPT(3));
-  mrb_define_method(mrb, class_Target, "rect_round_filled",  mrb_sdl2_gpu_target_rect_round_filled,  MRB_ARGS_REQ(6) | MRB_ARGS_OPT(3));
-  mrb_define_method(mrb, class_Target, "gradient_fill_rect", mrb_sdl2_gpu_target_gradient_fill_rect, MRB_ARGS_REQ(10));
+#define MRB_SDL2_GPU_PRIMITIVE_METHOD(name, n, culled, draw) \
+  mrb_define_method(mrb, class_Target, #name, mrb_sdl2_gpu_target_##name, MRB_ARGS_REQ(n + 1) | MRB_ARGS_OPT(3));
+  MRB_SDL2_GPU_PRIMITIVES(MRB_SDL2_GPU_PRIMITIVE_METHOD)
+#undef MRB_SDL2_GPU_PRIMITIVE_METHOD
+  mrb_define_method(mrb, class_Target, "rect2",              mrb_sdl2_gpu_target_rect2,              MRB_ARGS_REQ(2) | MRB_ARGS_OPT(3));
+  mrb_define_method(mrb, class_Target, "rect_filled2",       mrb_sdl2_gpu_target_rect_filled2,       MRB_ARGS_REQ(2) | MRB_ARGS_OPT(3));
+  mrb_define_method(mrb, class_Target, "rect_round",         mrb_sdl2_gpu_target_rect_round,         MRB_ARGS_REQ(3) | MRB_ARGS_OPT(6));
+  mrb_define_method(mrb, class_Target, "rect_round_filled",  mrb_sdl2_gpu_target_rect_round_filled,  MRB_ARGS_REQ(3) | MRB_ARGS_OPT(6));
+  mrb_define_method(mrb, class_Target, "gradient_fill_rect", mrb_sdl2_gpu_target_gradient_fill_rect, MRB_ARGS_REQ(4) | MRB_ARGS_OPT(6));
   // TBD - GPU_Polygon - array of floats involved
 
   /**************************************************************************
@@ -3424,9 +4063,9 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_method(mrb, class_Program, "get_attribute_location", mrb_sdl2_gpu_program_get_arg_location,  MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Program, "get_uniform_location",   mrb_sdl2_gpu_program_get_uni_location,  MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Program, "load_shader_block",      mrb_sdl2_gpu_program_load_shader_block, MRB_ARGS_NONE());
-  mrb_define_method(mrb, class_Program, "get_uniformuiv",         mrb_sdl2_gpu_program_get_uniformuiv,    MRB_ARGS_NONE());
-  mrb_define_method(mrb, class_Program, "get_uniformfv",          mrb_sdl2_gpu_program_get_uniformfv,     MRB_ARGS_NONE());
-  mrb_define_method(mrb, class_Program, "get_uniform_matrix_fv",  mrb_sdl2_gpu_program_get_umfv,          MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Program, "get_uniformuiv",         mrb_sdl2_gpu_program_get_uniformuiv,    MRB_ARGS_REQ(2) | MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_Program, "get_uniformfv",          mrb_sdl2_gpu_program_get_uniformfv,     MRB_ARGS_REQ(2) | MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_Program, "get_uniform_matrix_fv",  mrb_sdl2_gpu_program_get_umfv,          MRB_ARGS_REQ(2) | MRB_ARGS_OPT(1));
 
   mrb_define_module_function(mrb, mod_GPU, "set_uniformi",          mrb_sdl2_gpu_set_uniformi,     MRB_ARGS_NONE());
   mrb_define_module_function(mrb, mod_GPU, "set_uniformui",         mrb_sdl2_gpu_set_uniformui,    MRB_ARGS_NONE());
@@ -3438,8 +4077,8 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_module_function(mrb, mod_GPU, "set_attributei",        mrb_sdl2_gpu_set_attributei,   MRB_ARGS_NONE());
   mrb_define_module_function(mrb, mod_GPU, "set_attributeui",       mrb_sdl2_gpu_set_attributeui,  MRB_ARGS_NONE());
   mrb_define_module_function(mrb, mod_GPU, "set_attributefv",       mrb_sdl2_gpu_set_attributefv,  MRB_ARGS_NONE());
-  mrb_define_module_function(mrb, mod_GPU, "set_attributefv",       mrb_sdl2_gpu_set_attributeiv,  MRB_ARGS_NONE());
-  mrb_define_module_function(mrb, mod_GPU, "set_attributefv",       mrb_sdl2_gpu_set_attributeuiv, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "set_attributeiv",       mrb_sdl2_gpu_set_attributeiv,  MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "set_attributeuiv",      mrb_sdl2_gpu_set_attributeuiv, MRB_ARGS_NONE());
 
   mrb_define_method(mrb, class_Shader, "initialize", mrb_sdl2_gpu_shader_initialize, MRB_ARGS_NONE());
   mrb_define_method(mrb, class_Shader, "free",       mrb_sdl2_gpu_shader_free,       MRB_ARGS_NONE());
@@ -3448,10 +4087,10 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_method(mrb, class_ShaderBlock, "free",       mrb_sdl2_gpu_shaderblock_free,       MRB_ARGS_NONE());
   mrb_define_method(mrb, class_ShaderBlock, "set",       mrb_sdl2_gpu_shaderblock_set,       MRB_ARGS_NONE());
 
-  mrb_define_method(mrb, class_AttributeFormat, "initialize", mrb_sdl2_gpu_attributeformat_initialize, MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_AttributeFormat, "initialize", mrb_sdl2_gpu_attributeformat_initialize, MRB_ARGS_REQ(5));
   mrb_define_method(mrb, class_AttributeFormat, "free",       mrb_sdl2_gpu_attributeformat_free,       MRB_ARGS_NONE());
 
-  mrb_define_method(mrb, class_Attribute, "initialize", mrb_sdl2_gpu_attribute_initialize, MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Attribute, "initialize", mrb_sdl2_gpu_attribute_initialize, MRB_ARGS_REQ(3));
   mrb_define_method(mrb, class_Attribute, "free",       mrb_sdl2_gpu_attribute_free,       MRB_ARGS_NONE());
   
   mrb_define_method(mrb, class_Image, "set", mrb_sdl2_gpu_image_set,       MRB_ARGS_NONE());
@@ -3587,6 +4226,17 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_const(mrb, mod_GPU, "GPU_EQ_REVERSE_SUBTRACT", mrb_fixnum_value(GPU_EQ_REVERSE_SUBTRACT));
   mrb_gc_arena_restore(mrb, arena_size);
 
+  arena_size = mrb_gc_arena_save(mrb);
+  mrb_define_const(mrb, mod_GPU, "GPU_TYPE_BYTE",           mrb_fixnum_value(GPU_TYPE_BYTE));
+  mrb_define_const(mrb, mod_GPU, "GPU_TYPE_UNSIGNED_BYTE",  mrb_fixnum_value(GPU_TYPE_UNSIGNED_BYTE));
+  mrb_define_const(mrb, mod_GPU, "GPU_TYPE_SHORT",          mrb_fixnum_value(GPU_TYPE_SHORT));
+  mrb_define_const(mrb, mod_GPU, "GPU_TYPE_UNSIGNED_SHORT", mrb_fixnum_value(GPU_TYPE_UNSIGNED_SHORT));
+  mrb_define_const(mrb, mod_GPU, "GPU_TYPE_INT",            mrb_fixnum_value(GPU_TYPE_INT));
+  mrb_define_const(mrb, mod_GPU, "GPU_TYPE_UNSIGNED_INT",   mrb_fixnum_value(GPU_TYPE_UNSIGNED_INT));
+  mrb_define_const(mrb, mod_GPU, "GPU_TYPE_FLOAT",          mrb_fixnum_value(GPU_TYPE_FLOAT));
+  mrb_define_const(mrb, mod_GPU, "GPU_TYPE_DOUBLE",         mrb_fixnum_value(GPU_TYPE_DOUBLE));
+  mrb_gc_arena_restore(mrb, arena_size);
+
   arena_size = mrb_gc_arena_save(mrb);
   mrb_define_const(mrb, mod_GPU, "GPU_BLEND_NORMAL",              mrb_fixnum_value(GPU_BLEND_NORMAL));
   mrb_define_const(mrb, mod_GPU, "GPU_BLEND_PREMULTIPLIED_ALPHA", mrb_fixnum_value(GPU_BLEND_PREMULTIPLIED_ALPHA));
@@ -3620,6 +4270,7 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_const(mrb, mod_GPU, "GPU_BATCH_XYZ_RGBA",    mrb_fixnum_value(GPU_BATCH_XYZ_RGBA));
   mrb_define_const(mrb, mod_GPU, "GPU_BATCH_XY_ST_RGBA",  mrb_fixnum_value(GPU_BATCH_XY_ST_RGBA));
   mrb_define_const(mrb, mod_GPU, "GPU_BATCH_XYZ_ST_RGBA", mrb_fixnum_value(GPU_BATCH_XYZ_ST_RGBA));
+  mrb_define_const(mrb, mod_GPU, "GPU_BATCH_RGBA_PACKED", mrb_fixnum_value(MRB_SDL2_GPU_BATCH_RGBA_PACKED));
   mrb_gc_arena_restore(mrb, arena_size);
 
   arena_size = mrb_gc_arena_save(mrb);
@@ -3676,7 +4327,30 @@ void mrb_mruby_sdl2_gpu_gem_init(mrb_state *mrb) {
   mrb_define_const(mrb, mod_GPU, "GPU_DEBUG_LEVEL_3",   mrb_fixnum_value(GPU_DEBUG_LEVEL_3));
   mrb_define_const(mrb, mod_GPU, "GPU_DEBUG_LEVEL_MAX", mrb_fixnum_value(GPU_DEBUG_LEVEL_MAX));
   mrb_gc_arena_restore(mrb, arena_size);
+
+  mrb_sdl2_gpu_target_pool_init(mrb);
+  mrb_sdl2_gpu_post_chain_init(mrb);
+  mrb_sdl2_gpu_blur_init(mrb);
+  mrb_sdl2_gpu_font_init(mrb);
+  mrb_sdl2_gpu_tilemap_init(mrb);
+  mrb_sdl2_gpu_particles_init(mrb);
+  mrb_sdl2_gpu_spatial_grid_init(mrb);
+  mrb_sdl2_gpu_damage_init(mrb);
+  mrb_sdl2_gpu_layer_init(mrb);
+  mrb_sdl2_gpu_mesh_init(mrb);
+  mrb_sdl2_gpu_stream_init(mrb);
+  mrb_sdl2_gpu_identity_init(mrb);
+  mrb_sdl2_gpu_query_buffer_init(mrb);
+  mrb_sdl2_gpu_color_init(mrb);
+  mrb_sdl2_gpu_arena_init(mrb);
+  mrb_sdl2_gpu_vram_init(mrb);
+  mrb_sdl2_gpu_resource_scope_init(mrb);
+  mrb_sdl2_gpu_gl_init(mrb);
+  mrb_sdl2_gpu_multi_batch_init(mrb);
 }
 
 void mrb_mruby_sdl2_gpu_gem_final(mrb_state *mrb) {
+  mrb_sdl2_gpu_particles_release();
+  mrb_sdl2_gpu_arena_release();
+  mrb_sdl2_gpu_identity_clear(mrb, NULL);
 }
@@ -0,0 +1,149 @@
+/*Copyright 2015 <Daniel Kolev>
+  Frame arena - scratch memory for the native copies a call only needs
+  while it runs (uniform and attribute values, batch arrays, shader id
+  lists). Allocation bumps a pointer and nothing is freed one by one:
+  ending a frame with Target#flip or a retained window's Target#present
+  rewinds the whole arena, so a call that raises half way leaks nothing
+  either. Programs that only render offscreen never end a frame and must
+  call GPU.reset_arena once per frame themselves, or the arena grows
+  without bound.
+
+  A frame that outgrows the block chains an extra one; the next reset
+  folds them into a single block large enough for that frame.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/hash.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_ARENA_ALIGN   16
+#define MRB_SDL2_GPU_ARENA_INITIAL (64 * 1024)
+
+typedef struct mrb_sdl2_gpu_arena_block_t {
+  struct mrb_sdl2_gpu_arena_block_t *prev;
+  size_t capacity;
+  size_t used;
+} mrb_sdl2_gpu_arena_block_t;
+
+static struct {
+  mrb_sdl2_gpu_arena_block_t *block;  /* newest, older ones via prev */
+  size_t used;        /* bytes handed out since the last reset */
+  size_t high_water;  /* most used in one frame */
+  size_t resets;
+  size_t overflows;   /* allocations that needed a new block */
+} arena = { NULL, 0, 0, 0, 0 };
+
+/* Header sized to keep the payload aligned. */
+#define MRB_SDL2_GPU_ARENA_HEADER                                             \
+  ((sizeof(mrb_sdl2_gpu_arena_block_t) + MRB_SDL2_GPU_ARENA_ALIGN - 1) &      \
+   ~(size_t) (MRB_SDL2_GPU_ARENA_ALIGN - 1))
+
+static mrb_sdl2_gpu_arena_block_t *
+mrb_sdl2_gpu_arena_block(size_t capacity) {
+  mrb_sdl2_gpu_arena_block_t *block = (mrb_sdl2_gpu_arena_block_t*)
+    SDL_malloc(MRB_SDL2_GPU_ARENA_HEADER + capacity);
+  if (NULL == block)
+    return NULL;
+  block->prev = NULL;
+  block->capacity = capacity;
+  block->used = 0;
+  return block;
+}
+
+/* bytes of scratch memory, valid until the frame ends */
+void *
+mrb_sdl2_gpu_arena_alloc(mrb_state *mrb, size_t bytes) {
+  mrb_sdl2_gpu_arena_block_t *block = arena.block;
+  void *result;
+  bytes = (bytes + MRB_SDL2_GPU_ARENA_ALIGN - 1) &
+          ~(size_t) (MRB_SDL2_GPU_ARENA_ALIGN - 1);
+  if (NULL == block || block->capacity - block->used < bytes) {
+    size_t capacity = NULL == block ? MRB_SDL2_GPU_ARENA_INITIAL :
+                                      block->capacity * 2;
+    mrb_sdl2_gpu_arena_block_t *next;
+    while (capacity < bytes) {
+      capacity *= 2;
+    }
+    next = mrb_sdl2_gpu_arena_block(capacity);
+    if (NULL == next)
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    if (NULL != block)
+      arena.overflows++;
+    next->prev = block;
+    arena.block = block = next;
+  }
+  result = (Uint8*) block + MRB_SDL2_GPU_ARENA_HEADER + block->used;
+  block->used += bytes;
+  arena.used += bytes;
+  if (arena.used > arena.high_water)
+    arena.high_water = arena.used;
+  return result;
+}
+
+/* Forgets everything handed out. Chained blocks are replaced by one that
+ * holds what the frame needed. */
+void
+mrb_sdl2_gpu_arena_reset(void) {
+  mrb_sdl2_gpu_arena_block_t *block = arena.block;
+  if (NULL != block && NULL != block->prev) {
+    size_t capacity = block->capacity;
+    mrb_sdl2_gpu_arena_block_t *merged;
+    while (capacity < arena.used) {
+      capacity *= 2;
+    }
+    mrb_sdl2_gpu_arena_release();
+    merged = mrb_sdl2_gpu_arena_block(capacity);
+    arena.block = merged;  /* NULL is fine, the next alloc starts over */
+  } else if (NULL != block) {
+    block->used = 0;
+  }
+  arena.used = 0;
+  arena.resets++;
+}
+
+void
+mrb_sdl2_gpu_arena_release(void) {
+  while (NULL != arena.block) {
+    mrb_sdl2_gpu_arena_block_t *prev = arena.block->prev;
+    SDL_free(arena.block);
+    arena.block = prev;
+  }
+}
+
+/* GPU.arena_stats -> {used:, capacity:, high_water:, resets:, overflows:} */
+static mrb_value
+mrb_sdl2_gpu_arena_stats(mrb_state *mrb, mrb_value self) {
+  mrb_value stats = mrb_hash_new_capa(mrb, 5);
+  mrb_sdl2_gpu_arena_block_t *block;
+  size_t capacity = 0;
+  for (block = arena.block; NULL != block; block = block->prev) {
+    capacity += block->capacity;
+  }
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "used")),
+               mrb_fixnum_value(arena.used));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "capacity")),
+               mrb_fixnum_value(capacity));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "high_water")),
+               mrb_fixnum_value(arena.high_water));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "resets")),
+               mrb_fixnum_value(arena.resets));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "overflows")),
+               mrb_fixnum_value(arena.overflows));
+  return stats;
+}
+
+/* GPU.reset_arena, for programs that render without ever flipping or
+ * presenting; they call it once per frame. */
+static mrb_value
+mrb_sdl2_gpu_reset_arena(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_arena_reset();
+  return self;
+}
+
+void
+mrb_sdl2_gpu_arena_init(mrb_state *mrb) {
+  mrb_define_module_function(mrb, mod_GPU, "arena_stats", mrb_sdl2_gpu_arena_stats, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "reset_arena", mrb_sdl2_gpu_reset_arena, MRB_ARGS_NONE());
+}
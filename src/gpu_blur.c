@@ -0,0 +1,282 @@
+/*Copyright 2015 <Daniel Kolev>
+  Target#blur - two pass separable gaussian blur. Neighbouring kernel taps
+  are merged into one bilinear fetch, and large radii are first reduced by
+  a chain of half size downsamples, so any radius costs a small, bounded
+  number of passes. Programs and intermediate targets are cached.
+  */
+
+#include <math.h>
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/hash.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_BLUR_MAX_TAPS       8
+#define MRB_SDL2_GPU_BLUR_KERNEL_RADIUS  8   /* radius handled per level */
+#define MRB_SDL2_GPU_BLUR_MAX_LEVELS     4
+#define MRB_SDL2_GPU_BLUR_CACHE_SIZE     8
+
+static const char *mrb_sdl2_gpu_blur_fragment_source =
+  "varying vec4 color;\n"
+  "varying vec2 texCoord;\n"
+  "uniform sampler2D tex;\n"
+  "uniform vec2 direction;\n"
+  "uniform float offsets[8];\n"
+  "uniform float weights[8];\n"
+  "uniform int taps;\n"
+  "void main() {\n"
+  "  vec4 sum = texture2D(tex, texCoord) * weights[0];\n"
+  "  for (int i = 1; i < 8; i++) {\n"
+  "    if (i >= taps) break;\n"
+  "    vec2 offset = direction * offsets[i];\n"
+  "    sum += (texture2D(tex, texCoord + offset) +\n"
+  "            texture2D(tex, texCoord - offset)) * weights[i];\n"
+  "  }\n"
+  "  gl_FragColor = sum * color;\n"
+  "}\n";
+
+typedef struct mrb_sdl2_gpu_blur_target_t {
+  GPU_Image  *image;
+  GPU_Target *target;
+  Uint16      w;
+  Uint16      h;
+  int         role;
+  Uint32      stamp;
+} mrb_sdl2_gpu_blur_target_t;
+
+static struct {
+  Uint32          programid;
+  GPU_ShaderBlock block;
+  int             direction_loc;
+  int             offsets_loc;
+  int             weights_loc;
+  int             taps_loc;
+  Uint32          stamp;
+  mrb_sdl2_gpu_blur_target_t cache[MRB_SDL2_GPU_BLUR_CACHE_SIZE];
+} blur_state;
+
+static void
+mrb_sdl2_gpu_blur_load_program(mrb_state *mrb) {
+  if (0 != blur_state.programid)
+    return;
+  blur_state.programid =
+    mrb_sdl2_gpu_builtin_program(mrb, mrb_sdl2_gpu_builtin_vertex_source,
+                                 mrb_sdl2_gpu_blur_fragment_source);
+  blur_state.block = GPU_LoadShaderBlock(blur_state.programid, "gpu_Vertex",
+                                         "gpu_TexCoord", "gpu_Color",
+                                         "gpu_ModelViewProjectionMatrix");
+  blur_state.direction_loc =
+    GPU_GetUniformLocation(blur_state.programid, "direction");
+  blur_state.offsets_loc =
+    GPU_GetUniformLocation(blur_state.programid, "offsets");
+  blur_state.weights_loc =
+    GPU_GetUniformLocation(blur_state.programid, "weights");
+  blur_state.taps_loc = GPU_GetUniformLocation(blur_state.programid, "taps");
+}
+
+/* Returns the cached target for a size and role, evicting the least
+ * recently used entry when the cache is full. */
+static GPU_Target *
+mrb_sdl2_gpu_blur_target(mrb_state *mrb, Uint16 w, Uint16 h, int role) {
+  mrb_sdl2_gpu_blur_target_t *entry = NULL;
+  int i;
+  blur_state.stamp++;
+  for (i = 0; i < MRB_SDL2_GPU_BLUR_CACHE_SIZE; i++) {
+    mrb_sdl2_gpu_blur_target_t *e = &blur_state.cache[i];
+    if (NULL != e->target && e->w == w && e->h == h && e->role == role) {
+      e->stamp = blur_state.stamp;
+      return e->target;
+    }
+    if (NULL == entry || NULL == e->target ||
+        (NULL != entry->target && e->stamp < entry->stamp))
+      entry = e;
+  }
+  if (NULL != entry->target) {
+    GPU_FreeTarget(entry->target);
+    mrb_sdl2_gpu_vram_remove(entry->image);
+    GPU_FreeImage(entry->image);
+    entry->target = NULL;
+  }
+  if (!mrb_sdl2_gpu_vram_reserve(
+          mrb, mrb_sdl2_gpu_vram_estimate(w, h, GPU_FORMAT_RGBA)))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "blur Image would exceed the VRAM budget");
+  entry->image = GPU_CreateImage(w, h, GPU_FORMAT_RGBA);
+  if (NULL == entry->image)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create blur Image");
+  entry->target = GPU_LoadTarget(entry->image);
+  if (NULL == entry->target) {
+    GPU_FreeImage(entry->image);
+    entry->image = NULL;
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create blur Target");
+  }
+  mrb_sdl2_gpu_vram_add(entry->image, "blur");
+  GPU_SetImageFilter(entry->image, GPU_FILTER_LINEAR);
+  GPU_SetWrapMode(entry->image, GPU_WRAP_NONE, GPU_WRAP_NONE);
+  entry->w = w;
+  entry->h = h;
+  entry->role = role;
+  entry->stamp = blur_state.stamp;
+  return entry->target;
+}
+
+/* Frees the cached program and targets, called before GPU.quit. */
+void
+mrb_sdl2_gpu_blur_release(void) {
+  int i;
+  for (i = 0; i < MRB_SDL2_GPU_BLUR_CACHE_SIZE; i++) {
+    if (NULL != blur_state.cache[i].target) {
+      GPU_FreeTarget(blur_state.cache[i].target);
+      mrb_sdl2_gpu_vram_remove(blur_state.cache[i].image);
+      GPU_FreeImage(blur_state.cache[i].image);
+      blur_state.cache[i].target = NULL;
+      blur_state.cache[i].image = NULL;
+    }
+  }
+  if (0 != blur_state.programid) {
+    GPU_FreeShaderProgram(blur_state.programid);
+    blur_state.programid = 0;
+  }
+}
+
+/* Stretches image over the whole target, replacing its contents. */
+static void
+mrb_sdl2_gpu_blur_copy(GPU_Image *image, GPU_Target *target) {
+  GPU_bool blending = GPU_GetBlending(image);
+  mrb_sdl2_gpu_multi_batch_touch(target->image);
+  GPU_Clear(target);
+  GPU_SetBlending(image, 0);
+  GPU_BlitScale(image, NULL, target, target->w / 2.0f, target->h / 2.0f,
+                (float) target->w / image->w, (float) target->h / image->h);
+  GPU_SetBlending(image, blending);
+}
+
+/* Builds the weights of a gaussian with the given radius (3 sigma) and
+ * folds neighbouring taps into single linear-filtered samples. Returns
+ * the number of taps, the first one being the center. */
+static int
+mrb_sdl2_gpu_blur_kernel(float radius, float *offsets, float *weights) {
+  float gauss[2 * MRB_SDL2_GPU_BLUR_MAX_TAPS];
+  float sigma = radius / 3.0f, total;
+  int size = (int) ceilf(radius);
+  int i, taps = 1;
+  if (size > 2 * MRB_SDL2_GPU_BLUR_MAX_TAPS - 2)
+    size = 2 * MRB_SDL2_GPU_BLUR_MAX_TAPS - 2;
+  if (sigma < 0.5f)
+    sigma = 0.5f;
+  total = 0.0f;
+  for (i = 0; i <= size; i++) {
+    gauss[i] = expf(-(i * i) / (2.0f * sigma * sigma));
+    total += i == 0 ? gauss[i] : 2.0f * gauss[i];
+  }
+  offsets[0] = 0.0f;
+  weights[0] = gauss[0] / total;
+  for (i = 1; i <= size; i += 2) {
+    float w1 = gauss[i];
+    float w2 = i + 1 <= size ? gauss[i + 1] : 0.0f;
+    weights[taps] = (w1 + w2) / total;
+    offsets[taps] = (i * w1 + (i + 1) * w2) / (w1 + w2);
+    taps++;
+  }
+  for (i = taps; i < MRB_SDL2_GPU_BLUR_MAX_TAPS; i++) {
+    offsets[i] = 0.0f;
+    weights[i] = 0.0f;
+  }
+  return taps;
+}
+
+static void
+mrb_sdl2_gpu_blur_pass(GPU_Image *image, GPU_Target *target,
+                       float dx, float dy) {
+  float direction[2];
+  direction[0] = dx;
+  direction[1] = dy;
+  GPU_SetUniformfv(blur_state.direction_loc, 2, 1, direction);
+  mrb_sdl2_gpu_blur_copy(image, target);
+}
+
+/* blur(image, radius) or blur(image, radius: r, downsample: levels)
+ * Draws the blurred image stretched over the whole target. */
+static mrb_value
+mrb_sdl2_gpu_target_blur(mrb_state *mrb, mrb_value self) {
+  mrb_value image_obj, options;
+  GPU_Target *dest = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  GPU_Image *image, *current;
+  GPU_Target *ping, *pong;
+  float radius, offsets[MRB_SDL2_GPU_BLUR_MAX_TAPS];
+  float weights[MRB_SDL2_GPU_BLUR_MAX_TAPS];
+  mrb_int levels = -1;
+  Uint16 w, h;
+  int i, taps;
+  mrb_get_args(mrb, "oo", &image_obj, &options);
+  image = mrb_sdl2_gpu_image_get_ptr(mrb, image_obj);
+
+  if (mrb_hash_p(options)) {
+    mrb_value value;
+    value = mrb_hash_get(mrb, options,
+                         mrb_symbol_value(mrb_intern_lit(mrb, "radius")));
+    if (mrb_nil_p(value))
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "blur needs a radius");
+    radius = mrb_to_flo(mrb, value);
+    value = mrb_hash_get(mrb, options,
+                         mrb_symbol_value(mrb_intern_lit(mrb, "downsample")));
+    if (!mrb_nil_p(value))
+      levels = mrb_fixnum(mrb_to_int(mrb, value));
+  } else {
+    radius = mrb_to_flo(mrb, options);
+  }
+  if (radius < 0.0f)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "blur radius must not be negative");
+
+  if (levels < 0) {
+    levels = 0;
+    while (radius / (1 << levels) > MRB_SDL2_GPU_BLUR_KERNEL_RADIUS &&
+           levels < MRB_SDL2_GPU_BLUR_MAX_LEVELS)
+      levels++;
+  } else if (levels > MRB_SDL2_GPU_BLUR_MAX_LEVELS) {
+    levels = MRB_SDL2_GPU_BLUR_MAX_LEVELS;
+  }
+
+  /* downsample chain, each level halving the previous one */
+  mrb_sdl2_gpu_multi_batch_sync(image->target);
+  current = image;
+  w = image->w;
+  h = image->h;
+  for (i = 0; i < levels; i++) {
+    w = w > 1 ? w / 2 : 1;
+    h = h > 1 ? h / 2 : 1;
+    ping = mrb_sdl2_gpu_blur_target(mrb, w, h, 0);
+    mrb_sdl2_gpu_blur_copy(current, ping);
+    current = ping->image;
+  }
+
+  if (radius / (1 << levels) >= 0.5f) {
+    mrb_sdl2_gpu_blur_load_program(mrb);
+    ping = mrb_sdl2_gpu_blur_target(mrb, w, h, 0);
+    pong = mrb_sdl2_gpu_blur_target(mrb, w, h, 1);
+    taps = mrb_sdl2_gpu_blur_kernel(radius / (1 << levels), offsets, weights);
+
+    GPU_ActivateShaderProgram(blur_state.programid, &blur_state.block);
+    GPU_SetUniformfv(blur_state.offsets_loc, 1, MRB_SDL2_GPU_BLUR_MAX_TAPS,
+                     offsets);
+    GPU_SetUniformfv(blur_state.weights_loc, 1, MRB_SDL2_GPU_BLUR_MAX_TAPS,
+                     weights);
+    GPU_SetUniformi(blur_state.taps_loc, taps);
+    mrb_sdl2_gpu_blur_pass(current, pong, 1.0f / current->texture_w, 0.0f);
+    mrb_sdl2_gpu_blur_pass(pong->image, ping, 0.0f, 1.0f / pong->image->texture_h);
+    GPU_DeactivateShaderProgram();
+    current = ping->image;
+  }
+
+  mrb_sdl2_gpu_multi_batch_sync(dest);
+  GPU_BlitScale(current, NULL, dest, dest->w / 2.0f, dest->h / 2.0f,
+                (float) dest->w / current->w, (float) dest->h / current->h);
+  return self;
+}
+
+void
+mrb_sdl2_gpu_blur_init(mrb_state *mrb) {
+  mrb_define_method(mrb, class_Target, "blur", mrb_sdl2_gpu_target_blur, MRB_ARGS_REQ(2));
+}
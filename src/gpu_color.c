@@ -0,0 +1,153 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::Color - colors packed into one 0xRRGGBBAA Integer. Every drawing
+  method takes one in place of its four r, g, b, a arguments, so a color
+  kept in a constant or an instance variable is passed as a single
+  immediate instead of being split up and parsed again on every call.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/array.h"
+
+#include "../include/gpu.h"
+
+static struct RClass *mod_Color = NULL;
+
+typedef struct mrb_sdl2_gpu_named_color_t {
+  const char *name;
+  Uint32      rgba;
+} mrb_sdl2_gpu_named_color_t;
+
+static mrb_sdl2_gpu_named_color_t const named_colors[] = {
+  { "TRANSPARENT",     0x00000000 },
+  { "BLACK",           0x000000FF },
+  { "WHITE",           0xFFFFFFFF },
+  { "GRAY",            0x808080FF },
+  { "DARK_GRAY",       0x404040FF },
+  { "LIGHT_GRAY",      0xC0C0C0FF },
+  { "RED",             0xFF0000FF },
+  { "GREEN",           0x00FF00FF },
+  { "BLUE",            0x0000FFFF },
+  { "YELLOW",          0xFFFF00FF },
+  { "CYAN",            0x00FFFFFF },
+  { "MAGENTA",         0xFF00FFFF },
+  { "ORANGE",          0xFFA500FF },
+  { "PURPLE",          0x800080FF },
+  { "PINK",            0xFFC0CBFF },
+  { "BROWN",           0xA52A2AFF },
+  { "MAROON",          0x800000FF },
+  { "OLIVE",           0x808000FF },
+  { "NAVY",            0x000080FF },
+  { "TEAL",            0x008080FF },
+  { "LIME",            0x32CD32FF },
+  { "GOLD",            0xFFD700FF },
+  { "SILVER",          0xC0C0C0FF },
+  { "CORNFLOWER_BLUE", 0x6495EDFF },
+};
+
+/*************************************
+ * GPU::Color bindings starts here
+ *************************************/
+
+/* The fixnum for c. On builds with 32 bit Integers colors with the high
+ * bit of red set come out negative; unpacking only looks at the low
+ * 32 bits, so they work all the same. */
+mrb_value
+mrb_sdl2_gpu_color_pack(SDL_Color c) {
+  return mrb_fixnum_value((mrb_int) (((Uint32) c.r << 24) |
+                                     ((Uint32) c.g << 16) |
+                                     ((Uint32) c.b << 8) | c.a));
+}
+
+SDL_Color
+mrb_sdl2_gpu_color_unpack(mrb_state *mrb, mrb_value color) {
+  Uint32 rgba;
+  SDL_Color c;
+  if (mrb_fixnum_p(color))
+    rgba = (Uint32) mrb_fixnum(color);
+  else if (mrb_float_p(color))  /* 0xFFFFFFFF and co. with 32 bit Integers */
+    rgba = (Uint32) mrb_float(color);
+  else
+    rgba = (Uint32) mrb_int(mrb, color);
+  c.r = (Uint8) (rgba >> 24);
+  c.g = (Uint8) (rgba >> 16);
+  c.b = (Uint8) (rgba >> 8);
+  c.a = (Uint8) rgba;
+  return c;
+}
+
+/* The color of a drawing call, the trailing argc arguments: either one
+ * packed color or r, g, b, a. */
+SDL_Color
+mrb_sdl2_gpu_color_args(mrb_state *mrb, mrb_value const *args, mrb_int argc) {
+  SDL_Color c;
+  if (1 == argc)
+    return mrb_sdl2_gpu_color_unpack(mrb, args[0]);
+  if (4 != argc)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR,
+               "expected a packed color or r, g, b, a (%S color arguments)",
+               mrb_fixnum_value(argc));
+  c.r = (Uint8) mrb_int(mrb, args[0]);
+  c.g = (Uint8) mrb_int(mrb, args[1]);
+  c.b = (Uint8) mrb_int(mrb, args[2]);
+  c.a = (Uint8) mrb_int(mrb, args[3]);
+  return c;
+}
+
+/* GPU::Color.rgba(r, g, b, a = 255) -> packed color */
+static mrb_value
+mrb_sdl2_gpu_color_rgba(mrb_state *mrb, mrb_value self) {
+  mrb_int r, g, b, a = 255;
+  SDL_Color c;
+  mrb_get_args(mrb, "iii|i", &r, &g, &b, &a);
+  c.r = (Uint8) r;
+  c.g = (Uint8) g;
+  c.b = (Uint8) b;
+  c.a = (Uint8) a;
+  return mrb_sdl2_gpu_color_pack(c);
+}
+
+/* GPU::Color.unpack(color) -> [r, g, b, a] */
+static mrb_value
+mrb_sdl2_gpu_color_unpack_m(mrb_state *mrb, mrb_value self) {
+  mrb_value color, ary;
+  SDL_Color c;
+  mrb_get_args(mrb, "o", &color);
+  c = mrb_sdl2_gpu_color_unpack(mrb, color);
+  ary = mrb_ary_new_capa(mrb, 4);
+  mrb_ary_push(mrb, ary, mrb_fixnum_value(c.r));
+  mrb_ary_push(mrb, ary, mrb_fixnum_value(c.g));
+  mrb_ary_push(mrb, ary, mrb_fixnum_value(c.b));
+  mrb_ary_push(mrb, ary, mrb_fixnum_value(c.a));
+  return ary;
+}
+
+/* GPU::Color.with_alpha(color, a) -> color with its alpha replaced */
+static mrb_value
+mrb_sdl2_gpu_color_with_alpha(mrb_state *mrb, mrb_value self) {
+  mrb_value color;
+  mrb_int a;
+  SDL_Color c;
+  mrb_get_args(mrb, "oi", &color, &a);
+  c = mrb_sdl2_gpu_color_unpack(mrb, color);
+  c.a = (Uint8) a;
+  return mrb_sdl2_gpu_color_pack(c);
+}
+/***********************************
+ * GPU::Color bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_color_init(mrb_state *mrb) {
+  size_t i;
+  mod_Color = mrb_define_module_under(mrb, mod_GPU, "Color");
+
+  mrb_define_module_function(mrb, mod_Color, "rgba",       mrb_sdl2_gpu_color_rgba,       MRB_ARGS_REQ(3) | MRB_ARGS_OPT(1));
+  mrb_define_module_function(mrb, mod_Color, "unpack",     mrb_sdl2_gpu_color_unpack_m,   MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, mod_Color, "with_alpha", mrb_sdl2_gpu_color_with_alpha, MRB_ARGS_REQ(2));
+
+  for (i = 0; i < sizeof(named_colors) / sizeof(named_colors[0]); i++) {
+    mrb_define_const(mrb, mod_Color, named_colors[i].name,
+                     mrb_fixnum_value((mrb_int) named_colors[i].rgba));
+  }
+}
@@ -0,0 +1,358 @@
+/*Copyright 2015 <Daniel Kolev>
+  Retained Target mode - a window keeps its picture in a backing image and
+  only the damaged part of it is redrawn and presented. Draws submitted to
+  the backing target through the core bindings damage their bounding box,
+  everything else (fonts, tilemaps, ...) is reported with Target#damage.
+
+    screen.set_retained(true)
+    loop do
+      screen.damage(x, y, w, h) if widget.changed?
+      if area = screen.begin_redraw
+        back = screen.backing
+        ...draw, clipped and culled to area...
+      end
+      screen.present  # copies the damage over and flips, or does nothing
+    end
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/variable.h"
+#include "mruby/array.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_RETAINED_MAX 8
+
+typedef struct mrb_sdl2_gpu_retained_t {
+  GPU_Target *window;
+  GPU_Image  *image;
+  GPU_Target *backing;
+  mrb_value   backing_obj;
+  GPU_Rect    damage;
+  mrb_bool    dirty;
+  GPU_Rect    previous;  /* still missing from the other back buffer */
+  mrb_bool    previous_dirty;
+} mrb_sdl2_gpu_retained_t;
+
+static mrb_sdl2_gpu_retained_t retained[MRB_SDL2_GPU_RETAINED_MAX];
+static int retained_count = 0;
+
+/*************************************
+ * Retained Target bindings starts here
+ *************************************/
+
+static void
+mrb_sdl2_gpu_rect_union(GPU_Rect *dst, mrb_bool *dirty, GPU_Rect r) {
+  float x2, y2;
+  if (r.w <= 0.0f || r.h <= 0.0f)
+    return;
+  if (!*dirty) {
+    *dst = r;
+    *dirty = TRUE;
+    return;
+  }
+  x2 = SDL_max(dst->x + dst->w, r.x + r.w);
+  y2 = SDL_max(dst->y + dst->h, r.y + r.h);
+  dst->x = SDL_min(dst->x, r.x);
+  dst->y = SDL_min(dst->y, r.y);
+  dst->w = x2 - dst->x;
+  dst->h = y2 - dst->y;
+}
+
+/* Clamps a rect to the window, rounding out to whole pixels. */
+static GPU_Rect
+mrb_sdl2_gpu_damage_clamp(mrb_sdl2_gpu_retained_t *r, float x1, float y1,
+                          float x2, float y2) {
+  GPU_Rect rect;
+  x1 = SDL_max(0.0f, SDL_floor(x1));
+  y1 = SDL_max(0.0f, SDL_floor(y1));
+  x2 = SDL_min((float) r->window->w, SDL_ceil(x2));
+  y2 = SDL_min((float) r->window->h, SDL_ceil(y2));
+  rect.x = x1;
+  rect.y = y1;
+  rect.w = SDL_max(0.0f, x2 - x1);
+  rect.h = SDL_max(0.0f, y2 - y1);
+  return rect;
+}
+
+/* Keeps the backing wrappers alive for as long as the C side uses them. */
+static void
+mrb_sdl2_gpu_retained_sync_objects(mrb_state *mrb) {
+  mrb_value objects = mrb_ary_new_capa(mrb, retained_count);
+  int i;
+  for (i = 0; i < retained_count; i++) {
+    mrb_ary_push(mrb, objects, retained[i].backing_obj);
+  }
+  mrb_iv_set(mrb, mrb_obj_value(mod_GPU), mrb_intern_lit(mrb, "__retained__"),
+             objects);
+}
+
+static mrb_sdl2_gpu_retained_t *
+mrb_sdl2_gpu_retained_find(GPU_Target *window) {
+  int i;
+  for (i = 0; i < retained_count; i++) {
+    if (retained[i].window == window)
+      return &retained[i];
+  }
+  return NULL;
+}
+
+/* Called by the core draw bindings with the world space box of every draw
+ * that survived culling. */
+void
+mrb_sdl2_gpu_damage_box(GPU_Target *target, float x1, float y1,
+                        float x2, float y2) {
+  mrb_sdl2_gpu_retained_t *r = NULL;
+  int i;
+  if (0 == retained_count)
+    return;
+  for (i = 0; i < retained_count; i++) {
+    if (retained[i].backing == target) {
+      r = &retained[i];
+      break;
+    }
+  }
+  if (NULL == r)
+    return;
+  if (target->use_camera) {
+    /* forward map the corners, the inverse of visible_rect */
+    float zoom = target->camera.zoom > 0.0f ? target->camera.zoom : 1.0f;
+    float angle = target->camera.angle * (float) M_PI / 180.0f;
+    float c = SDL_cos(angle), s = SDL_sin(angle);
+    float hw = target->w / 2.0f, hh = target->h / 2.0f;
+    float xs[4], ys[4];
+    int k;
+    xs[0] = x1; ys[0] = y1;
+    xs[1] = x2; ys[1] = y1;
+    xs[2] = x2; ys[2] = y2;
+    xs[3] = x1; ys[3] = y2;
+    for (k = 0; k < 4; k++) {
+      float ux = xs[k] - target->camera.x - hw;
+      float uy = ys[k] - target->camera.y - hh;
+      xs[k] = hw + zoom * (ux * c - uy * s);
+      ys[k] = hh + zoom * (ux * s + uy * c);
+    }
+    x1 = SDL_min(SDL_min(xs[0], xs[1]), SDL_min(xs[2], xs[3]));
+    x2 = SDL_max(SDL_max(xs[0], xs[1]), SDL_max(xs[2], xs[3]));
+    y1 = SDL_min(SDL_min(ys[0], ys[1]), SDL_min(ys[2], ys[3]));
+    y2 = SDL_max(SDL_max(ys[0], ys[1]), SDL_max(ys[2], ys[3]));
+  }
+  if (target->use_clip_rect) {
+    x1 = SDL_max(x1, target->clip_rect.x);
+    y1 = SDL_max(y1, target->clip_rect.y);
+    x2 = SDL_min(x2, target->clip_rect.x + target->clip_rect.w);
+    y2 = SDL_min(y2, target->clip_rect.y + target->clip_rect.h);
+  }
+  mrb_sdl2_gpu_rect_union(&r->damage, &r->dirty,
+                          mrb_sdl2_gpu_damage_clamp(r, x1, y1, x2, y2));
+}
+
+static void
+mrb_sdl2_gpu_retained_free_backing(mrb_state *mrb,
+                                   mrb_sdl2_gpu_retained_t *r) {
+  if (NULL != mrb && !mrb_nil_p(r->backing_obj))
+    mrb_sdl2_gpu_target_detach(mrb, r->backing_obj);
+  if (NULL != r->backing) {
+    mrb_sdl2_gpu_multi_batch_end(r->backing);
+    GPU_FreeTarget(r->backing);
+  }
+  if (NULL != r->image) {
+    mrb_sdl2_gpu_multi_batch_forget(r->image);
+    mrb_sdl2_gpu_vram_remove(r->image);
+    GPU_FreeImage(r->image);
+  }
+  r->backing = NULL;
+  r->image = NULL;
+  r->backing_obj = mrb_nil_value();
+}
+
+/* (Re)creates the backing image when missing or when the window size
+ * changed; a new backing is damaged as a whole. */
+static void
+mrb_sdl2_gpu_retained_sync(mrb_state *mrb, mrb_sdl2_gpu_retained_t *r) {
+  GPU_Rect all;
+  if (NULL != r->image && r->image->w == r->window->w &&
+      r->image->h == r->window->h)
+    return;
+  mrb_sdl2_gpu_retained_free_backing(mrb, r);
+  if (!mrb_sdl2_gpu_vram_reserve(
+          mrb, mrb_sdl2_gpu_vram_estimate(r->window->w, r->window->h,
+                                          GPU_FORMAT_RGBA)))
+    mrb_raise(mrb, E_RUNTIME_ERROR,
+              "The backing Image would exceed the VRAM budget");
+  r->image = GPU_CreateImage(r->window->w, r->window->h, GPU_FORMAT_RGBA);
+  if (NULL == r->image)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create the backing Image");
+  r->backing = GPU_LoadTarget(r->image);
+  if (NULL == r->backing) {
+    GPU_FreeImage(r->image);
+    r->image = NULL;
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create the backing Target");
+  }
+  /* the backing replaces window pixels instead of blending over them */
+  GPU_SetBlending(r->image, 0);
+  GPU_ClearRGBA(r->backing, 0, 0, 0, 0);
+  mrb_sdl2_gpu_vram_add(r->image, "Target#set_retained");
+  r->backing_obj = mrb_sdl2_gpu_target_borrowed(mrb, r->backing);
+  mrb_sdl2_gpu_retained_sync_objects(mrb);
+  all = mrb_sdl2_gpu_damage_clamp(r, 0.0f, 0.0f, r->window->w, r->window->h);
+  r->damage = all;
+  r->dirty = TRUE;
+  r->previous = all;
+  r->previous_dirty = TRUE;
+}
+
+static mrb_sdl2_gpu_retained_t *
+mrb_sdl2_gpu_retained_get(mrb_state *mrb, mrb_value self) {
+  GPU_Target *window = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_retained_t *r;
+  if (NULL == window)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
+  r = mrb_sdl2_gpu_retained_find(window);
+  if (NULL == r)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Target is not retained, see set_retained");
+  mrb_sdl2_gpu_retained_sync(mrb, r);
+  return r;
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_set_retained(mrb_state *mrb, mrb_value self) {
+  mrb_bool enabled;
+  GPU_Target *window = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_sdl2_gpu_retained_t *r;
+  mrb_get_args(mrb, "b", &enabled);
+  if (NULL == window)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
+  r = mrb_sdl2_gpu_retained_find(window);
+  if (enabled && NULL == r) {
+    if (MRB_SDL2_GPU_RETAINED_MAX == retained_count)
+      mrb_raise(mrb, E_RUNTIME_ERROR, "Too many retained Targets");
+    r = &retained[retained_count++];
+    SDL_memset(r, 0, sizeof(mrb_sdl2_gpu_retained_t));
+    r->window = window;
+    r->backing_obj = mrb_nil_value();
+    mrb_sdl2_gpu_retained_sync(mrb, r);
+  } else if (!enabled && NULL != r) {
+    mrb_sdl2_gpu_retained_free_backing(mrb, r);
+    *r = retained[--retained_count];
+    mrb_sdl2_gpu_retained_sync_objects(mrb);
+  }
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_is_retained(mrb_state *mrb, mrb_value self) {
+  GPU_Target *window = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  return mrb_bool_value(NULL != window &&
+                        NULL != mrb_sdl2_gpu_retained_find(window));
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_backing(mrb_state *mrb, mrb_value self) {
+  return mrb_sdl2_gpu_retained_get(mrb, self)->backing_obj;
+}
+
+/* damage(x, y, w, h) in window pixels */
+static mrb_value
+mrb_sdl2_gpu_target_damage(mrb_state *mrb, mrb_value self) {
+  mrb_float x, y, w, h;
+  mrb_sdl2_gpu_retained_t *r;
+  mrb_get_args(mrb, "ffff", &x, &y, &w, &h);
+  r = mrb_sdl2_gpu_retained_get(mrb, self);
+  mrb_sdl2_gpu_rect_union(&r->damage, &r->dirty,
+                          mrb_sdl2_gpu_damage_clamp(r, x, y, x + w, y + h));
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_damage_all(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_retained_t *r = mrb_sdl2_gpu_retained_get(mrb, self);
+  r->damage = mrb_sdl2_gpu_damage_clamp(r, 0.0f, 0.0f,
+                                        r->window->w, r->window->h);
+  r->dirty = TRUE;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_damage_rect(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_retained_t *r = mrb_sdl2_gpu_retained_get(mrb, self);
+  if (!r->dirty)
+    return mrb_nil_value();
+  return mrb_sdl2_gpu_rect(mrb, r->damage);
+}
+
+/* Clips the backing target to the damage reported so far and returns it,
+ * or returns nil when nothing has to be redrawn. */
+static mrb_value
+mrb_sdl2_gpu_target_begin_redraw(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_retained_t *r = mrb_sdl2_gpu_retained_get(mrb, self);
+  if (!r->dirty)
+    return mrb_nil_value();
+  GPU_SetClipRect(r->backing, r->damage);
+  return mrb_sdl2_gpu_rect(mrb, r->damage);
+}
+
+/* Copies the damaged area, together with the area damaged one frame ago
+ * that the other back buffer still lacks, onto the window and flips.
+ * Returns false without flipping when nothing changed. */
+static mrb_value
+mrb_sdl2_gpu_target_present(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_retained_t *r = mrb_sdl2_gpu_retained_get(mrb, self);
+  GPU_Rect area = r->damage;
+  mrb_bool dirty = FALSE;
+  GPU_Camera camera;
+  GPU_UnsetClip(r->backing);
+  if (!r->dirty) {
+    mrb_sdl2_gpu_end_frame();
+    return mrb_false_value();
+  }
+  mrb_sdl2_gpu_rect_union(&area, &dirty, r->damage);
+  if (r->previous_dirty)
+    mrb_sdl2_gpu_rect_union(&area, &dirty, r->previous);
+
+  mrb_sdl2_gpu_multi_batch_sync(r->window);
+  mrb_sdl2_gpu_multi_batch_sync(r->backing);
+  camera = GPU_SetCamera(r->window, NULL);
+  GPU_SetClipRect(r->window, area);
+  GPU_Blit(r->image, &area, r->window,
+           area.x + area.w / 2.0f, area.y + area.h / 2.0f);
+  GPU_UnsetClip(r->window);
+  GPU_SetCamera(r->window, &camera);
+  GPU_Flip(r->window);
+  mrb_sdl2_gpu_vram_touch(r->image);
+  mrb_sdl2_gpu_end_frame();
+
+  r->previous = r->damage;
+  r->previous_dirty = TRUE;
+  r->dirty = FALSE;
+  return mrb_true_value();
+}
+
+/* Frees every backing image, GPU.quit calls it before GPU_Quit. */
+void
+mrb_sdl2_gpu_damage_release(mrb_state *mrb) {
+  if (0 == retained_count)
+    return;
+  while (retained_count > 0) {
+    mrb_sdl2_gpu_retained_free_backing(mrb, &retained[--retained_count]);
+  }
+  mrb_sdl2_gpu_retained_sync_objects(mrb);
+}
+/***********************************
+ * Retained Target bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_damage_init(mrb_state *mrb) {
+  mrb_define_method(mrb, class_Target, "set_retained",  mrb_sdl2_gpu_target_set_retained,  MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_Target, "retained?",     mrb_sdl2_gpu_target_is_retained,   MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Target, "backing",       mrb_sdl2_gpu_target_backing,       MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Target, "damage",        mrb_sdl2_gpu_target_damage,        MRB_ARGS_REQ(4));
+  mrb_define_method(mrb, class_Target, "damage_all",    mrb_sdl2_gpu_target_damage_all,    MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Target, "damage_rect",   mrb_sdl2_gpu_target_damage_rect,   MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Target, "begin_redraw",  mrb_sdl2_gpu_target_begin_redraw,  MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Target, "present",       mrb_sdl2_gpu_target_present,       MRB_ARGS_NONE());
+}
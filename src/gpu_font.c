@@ -0,0 +1,832 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::Font - text rendering through a glyph atlas. Glyphs are rasterized
+  once with SDL_ttf (optionally as a signed distance field) and packed into
+  a shared texture with a shelf packer. Laid out strings are cached. Each
+  draw goes out as one triangle batch, and inside Font#batch everything
+  drawn on the same target is submitted together when the block ends:
+
+    font.batch do
+      labels.each { |l| font.draw(screen, l.text, l.x, l.y) }
+    end
+  */
+
+#include <math.h>
+#include <SDL/SDL_gpu.h>
+#include <SDL2/SDL_ttf.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/error.h"
+#include "mruby/variable.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_FONT_ATLAS_SIZE   1024
+#define MRB_SDL2_GPU_FONT_SDF_SPREAD   4
+#define MRB_SDL2_GPU_FONT_RUN_CACHE    256  /* power of two */
+#define MRB_SDL2_GPU_FONT_MAX_VERTICES 65532
+#define MRB_SDL2_GPU_FONT_FLOATS       8    /* x, y, s, t, r, g, b, a */
+
+static struct RClass *class_Font = NULL;
+
+static const char *mrb_sdl2_gpu_font_sdf_fragment_source =
+  "varying vec4 color;\n"
+  "varying vec2 texCoord;\n"
+  "uniform sampler2D tex;\n"
+  "void main() {\n"
+  "  float distance = texture2D(tex, texCoord).a;\n"
+  "  float width = max(fwidth(distance) * 0.7, 0.001);\n"
+  "  float alpha = smoothstep(0.5 - width, 0.5 + width, distance);\n"
+  "  gl_FragColor = vec4(color.rgb, color.a * alpha);\n"
+  "}\n";
+
+static struct {
+  Uint32          programid;
+  GPU_ShaderBlock block;
+} sdf_state;
+
+/*************************************
+ * GPU::Font bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_glyph_t {
+  Uint16   codepoint;
+  mrb_bool used;
+  mrb_bool visible;
+  float    x0, y0, x1, y1;  /* quad relative to the pen, y down */
+  float    s0, t0, s1, t1;
+  float    advance;
+} mrb_sdl2_gpu_glyph_t;
+
+typedef struct mrb_sdl2_gpu_shelf_t {
+  int x;
+  int y;
+  int h;
+} mrb_sdl2_gpu_shelf_t;
+
+typedef struct mrb_sdl2_gpu_run_t {
+  Uint32  hash;
+  Uint32  generation;
+  mrb_int len;
+  char   *text;
+  float  *quads;  /* x0, y0, x1, y1, s0, t0, s1, t1 per glyph */
+  int     num_quads;
+  float   width;
+  float   height;
+} mrb_sdl2_gpu_run_t;
+
+typedef struct mrb_sdl2_gpu_font_data_t {
+  TTF_Font  *font;
+  GPU_Image *atlas;
+  int        atlas_size;
+  mrb_bool   sdf;
+  int        padding;
+  int        line_skip;
+  int        ascent;
+  Uint32     generation;
+  mrb_sdl2_gpu_glyph_t *glyphs;  /* open addressing on the codepoint */
+  int        glyph_capa;
+  int        glyph_count;
+  mrb_sdl2_gpu_shelf_t *shelves;
+  int        num_shelves;
+  int        shelf_capa;
+  int        next_y;
+  mrb_sdl2_gpu_run_t runs[MRB_SDL2_GPU_FONT_RUN_CACHE];
+  float     *vertices;
+  Uint16    *indices;
+  int        num_vertices;
+  int        vertex_capa;
+  mrb_value  pending;   /* Target of the queued text, also in __target__ */
+  int        batching;  /* open Font#batch blocks */
+} mrb_sdl2_gpu_font_data_t;
+
+static void
+mrb_sdl2_gpu_font_clear_runs(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data) {
+  int i;
+  for (i = 0; i < MRB_SDL2_GPU_FONT_RUN_CACHE; i++) {
+    mrb_free(mrb, data->runs[i].text);
+    mrb_free(mrb, data->runs[i].quads);
+    data->runs[i].text = NULL;
+    data->runs[i].quads = NULL;
+    data->runs[i].len = -1;
+  }
+}
+
+static void
+mrb_sdl2_gpu_font_release_data(mrb_state *mrb,
+                               mrb_sdl2_gpu_font_data_t *data) {
+  mrb_sdl2_gpu_font_clear_runs(mrb, data);
+  if (NULL != data->font) {
+    TTF_CloseFont(data->font);
+    TTF_Quit();  /* one per open font, SDL_ttf counts them */
+    data->font = NULL;
+  }
+  if (NULL != data->atlas) {
+    mrb_sdl2_gpu_multi_batch_forget(data->atlas);
+    mrb_sdl2_gpu_vram_remove(data->atlas);
+    GPU_FreeImage(data->atlas);
+    data->atlas = NULL;
+  }
+  mrb_free(mrb, data->glyphs);
+  mrb_free(mrb, data->shelves);
+  mrb_free(mrb, data->vertices);
+  mrb_free(mrb, data->indices);
+  data->glyphs = NULL;
+  data->shelves = NULL;
+  data->vertices = NULL;
+  data->indices = NULL;
+  data->num_vertices = 0;
+  data->vertex_capa = 0;
+  data->pending = mrb_nil_value();
+}
+
+static void
+mrb_sdl2_gpu_font_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_font_data_t *data = (mrb_sdl2_gpu_font_data_t*)p;
+  if (NULL == data)
+    return;
+  mrb_sdl2_gpu_font_release_data(mrb, data);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_font_data_type = {
+  "Font", mrb_sdl2_gpu_font_data_free
+};
+
+static mrb_sdl2_gpu_font_data_t *
+mrb_sdl2_gpu_font_get_ptr(mrb_state *mrb, mrb_value font) {
+  mrb_sdl2_gpu_font_data_t *data =
+    (mrb_sdl2_gpu_font_data_t*)
+      mrb_data_get_ptr(mrb, font, &mrb_sdl2_gpu_font_data_type);
+  if (NULL == data || NULL == data->font)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::Font is closed");
+  return data;
+}
+
+/* Frees the SDF program, called before GPU.quit. */
+void
+mrb_sdl2_gpu_font_release(void) {
+  if (0 != sdf_state.programid) {
+    GPU_FreeShaderProgram(sdf_state.programid);
+    sdf_state.programid = 0;
+  }
+}
+
+/* Submits the queued text. The target is looked up again, one that was
+ * freed since the draw gets nothing. */
+static void
+mrb_sdl2_gpu_font_flush_data(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data) {
+  GPU_Target *target;
+  if (0 == data->num_vertices)
+    return;
+  target = mrb_sdl2_gpu_target_get_ptr(mrb, data->pending);
+  if (NULL != target) {
+    mrb_sdl2_gpu_multi_batch_sync(target);
+    if (data->sdf)
+      GPU_ActivateShaderProgram(sdf_state.programid, &sdf_state.block);
+    GPU_TriangleBatch(data->atlas, target, data->num_vertices,
+                      data->vertices, data->num_vertices / 4 * 6,
+                      data->indices, GPU_BATCH_XY_ST_RGBA);
+    if (data->sdf)
+      GPU_DeactivateShaderProgram();
+  }
+  data->num_vertices = 0;
+  data->pending = mrb_nil_value();
+}
+
+/* Forgets every glyph so the atlas can be filled again from the top. */
+static void
+mrb_sdl2_gpu_font_reset_atlas(mrb_state *mrb,
+                              mrb_sdl2_gpu_font_data_t *data) {
+  int i;
+  mrb_sdl2_gpu_font_flush_data(mrb, data);
+  for (i = 0; i < data->glyph_capa; i++) {
+    data->glyphs[i].used = FALSE;
+  }
+  data->glyph_count = 0;
+  data->num_shelves = 0;
+  data->next_y = 0;
+  data->generation++;
+}
+
+/* Shelf packing: the first shelf tall enough (but not much taller) with
+ * room left, otherwise a new shelf. Returns FALSE when the atlas is full. */
+static mrb_bool
+mrb_sdl2_gpu_font_pack(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data,
+                       int w, int h, int *x, int *y) {
+  mrb_sdl2_gpu_shelf_t *shelf;
+  int i;
+  if (w > data->atlas_size || h > data->atlas_size)
+    return FALSE;
+  for (i = 0; i < data->num_shelves; i++) {
+    shelf = &data->shelves[i];
+    if (h <= shelf->h && h >= shelf->h * 3 / 4 &&
+        shelf->x + w <= data->atlas_size) {
+      *x = shelf->x;
+      *y = shelf->y;
+      shelf->x += w;
+      return TRUE;
+    }
+  }
+  if (data->next_y + h > data->atlas_size)
+    return FALSE;
+  if (data->num_shelves == data->shelf_capa) {
+    data->shelf_capa = data->shelf_capa == 0 ? 16 : data->shelf_capa * 2;
+    data->shelves = (mrb_sdl2_gpu_shelf_t*)
+        mrb_realloc(mrb, data->shelves,
+                    sizeof(mrb_sdl2_gpu_shelf_t) * data->shelf_capa);
+  }
+  shelf = &data->shelves[data->num_shelves++];
+  shelf->x = w;
+  shelf->y = data->next_y;
+  shelf->h = h;
+  data->next_y += h;
+  *x = 0;
+  *y = shelf->y;
+  return TRUE;
+}
+
+/* Converts the glyph coverage into white RGBA pixels, or into a signed
+ * distance field (distance in the alpha channel, 0.5 on the outline). */
+static Uint8 *
+mrb_sdl2_gpu_font_glyph_pixels(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data,
+                               Uint8 const *coverage, int cw, int ch,
+                               int w, int h) {
+  Uint8 *pixels = (Uint8*) mrb_malloc(mrb, w * h * 4);
+  int pad = data->padding;
+  int x, y;
+  for (y = 0; y < h; y++) {
+    for (x = 0; x < w; x++) {
+      int cx = x - pad, cy = y - pad;
+      Uint8 alpha;
+      if (!data->sdf) {
+        alpha = (cx >= 0 && cy >= 0 && cx < cw && cy < ch) ?
+            coverage[cy * cw + cx] : 0;
+      } else {
+        mrb_bool inside = cx >= 0 && cy >= 0 && cx < cw && cy < ch &&
+            coverage[cy * cw + cx] >= 128;
+        int best = pad * pad + 1;
+        int dx, dy;
+        float distance;
+        for (dy = -pad; dy <= pad; dy++) {
+          for (dx = -pad; dx <= pad; dx++) {
+            int sx = cx + dx, sy = cy + dy;
+            mrb_bool other = sx >= 0 && sy >= 0 && sx < cw && sy < ch &&
+                coverage[sy * cw + sx] >= 128;
+            if (other != inside && dx * dx + dy * dy < best)
+              best = dx * dx + dy * dy;
+          }
+        }
+        distance = sqrtf((float) best);
+        if (distance > pad)
+          distance = (float) pad;
+        distance = 0.5f + (inside ? distance : -distance) / (2.0f * pad);
+        alpha = (Uint8)(distance < 0.0f ? 0 :
+                        distance > 1.0f ? 255 : distance * 255.0f);
+      }
+      pixels[(y * w + x) * 4 + 0] = 255;
+      pixels[(y * w + x) * 4 + 1] = 255;
+      pixels[(y * w + x) * 4 + 2] = 255;
+      pixels[(y * w + x) * 4 + 3] = alpha;
+    }
+  }
+  return pixels;
+}
+
+/* Rasterizes a glyph into the atlas. Returns FALSE when it does not fit. */
+static mrb_bool
+mrb_sdl2_gpu_font_rasterize(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data,
+                            mrb_sdl2_gpu_glyph_t *glyph) {
+  SDL_Color white = {255, 255, 255, 255};
+  SDL_Surface *rendered, *surface;
+  Uint8 *coverage, *pixels;
+  int minx, maxx, miny, maxy, advance;
+  int left, top, right, bottom, x, y, w, h, ax, ay;
+  GPU_Rect rect;
+
+  glyph->visible = FALSE;
+  glyph->advance = 0.0f;
+  if (TTF_GlyphMetrics(data->font, glyph->codepoint,
+                       &minx, &maxx, &miny, &maxy, &advance) < 0)
+    return TRUE;
+  glyph->advance = (float) advance;
+  rendered = TTF_RenderGlyph_Blended(data->font, glyph->codepoint, white);
+  if (NULL == rendered)
+    return TRUE;
+  surface = SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0);
+  SDL_FreeSurface(rendered);
+  if (NULL == surface)
+    return TRUE;
+
+  /* tight bounds of the coverage, independent of SDL_ttf's surface size */
+  SDL_LockSurface(surface);
+  left = surface->w;
+  top = surface->h;
+  right = -1;
+  bottom = -1;
+  for (y = 0; y < surface->h; y++) {
+    Uint32 const *row = (Uint32 const*)
+        ((Uint8 const*) surface->pixels + y * surface->pitch);
+    for (x = 0; x < surface->w; x++) {
+      if (row[x] >> 24) {
+        if (x < left) left = x;
+        if (x > right) right = x;
+        if (y < top) top = y;
+        if (y > bottom) bottom = y;
+      }
+    }
+  }
+  if (right < 0) {
+    SDL_UnlockSurface(surface);
+    SDL_FreeSurface(surface);
+    return TRUE;
+  }
+  w = right - left + 1;
+  h = bottom - top + 1;
+  coverage = (Uint8*) mrb_malloc(mrb, w * h);
+  for (y = 0; y < h; y++) {
+    Uint32 const *row = (Uint32 const*)
+        ((Uint8 const*) surface->pixels + (y + top) * surface->pitch);
+    for (x = 0; x < w; x++) {
+      coverage[y * w + x] = row[x + left] >> 24;
+    }
+  }
+  SDL_UnlockSurface(surface);
+  SDL_FreeSurface(surface);
+
+  if (!mrb_sdl2_gpu_font_pack(mrb, data, w + 2 * data->padding + 1,
+                              h + 2 * data->padding + 1, &ax, &ay)) {
+    mrb_free(mrb, coverage);
+    return FALSE;
+  }
+  pixels = mrb_sdl2_gpu_font_glyph_pixels(mrb, data, coverage, w, h,
+                                          w + 2 * data->padding,
+                                          h + 2 * data->padding);
+  mrb_free(mrb, coverage);
+  w += 2 * data->padding;
+  h += 2 * data->padding;
+  rect.x = ax;
+  rect.y = ay;
+  rect.w = w;
+  rect.h = h;
+  mrb_sdl2_gpu_multi_batch_touch(data->atlas);
+  GPU_UpdateImageBytes(data->atlas, &rect, pixels, w * 4);
+  mrb_free(mrb, pixels);
+
+  glyph->visible = TRUE;
+  glyph->x0 = (float)(minx - data->padding);
+  glyph->y0 = (float)(data->ascent - maxy - data->padding);
+  glyph->x1 = glyph->x0 + w;
+  glyph->y1 = glyph->y0 + h;
+  glyph->s0 = (float) ax / data->atlas->texture_w;
+  glyph->t0 = (float) ay / data->atlas->texture_h;
+  glyph->s1 = (float)(ax + w) / data->atlas->texture_w;
+  glyph->t1 = (float)(ay + h) / data->atlas->texture_h;
+  return TRUE;
+}
+
+/* Looks the glyph up, rasterizing it on first use. Returns NULL when the
+ * atlas is full. */
+static mrb_sdl2_gpu_glyph_t *
+mrb_sdl2_gpu_font_glyph(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data,
+                        Uint16 codepoint) {
+  mrb_sdl2_gpu_glyph_t *glyph;
+  int mask, i;
+  if ((data->glyph_count + 1) * 2 > data->glyph_capa) {
+    mrb_sdl2_gpu_glyph_t *old = data->glyphs;
+    int old_capa = data->glyph_capa;
+    data->glyph_capa = old_capa == 0 ? 256 : old_capa * 2;
+    data->glyphs = (mrb_sdl2_gpu_glyph_t*)
+        mrb_calloc(mrb, data->glyph_capa, sizeof(mrb_sdl2_gpu_glyph_t));
+    mask = data->glyph_capa - 1;
+    for (i = 0; i < old_capa; i++) {
+      if (old[i].used) {
+        int j = old[i].codepoint & mask;
+        while (data->glyphs[j].used)
+          j = (j + 1) & mask;
+        data->glyphs[j] = old[i];
+      }
+    }
+    mrb_free(mrb, old);
+  }
+  mask = data->glyph_capa - 1;
+  i = codepoint & mask;
+  while (data->glyphs[i].used) {
+    if (data->glyphs[i].codepoint == codepoint)
+      return &data->glyphs[i];
+    i = (i + 1) & mask;
+  }
+  glyph = &data->glyphs[i];
+  glyph->codepoint = codepoint;
+  if (!mrb_sdl2_gpu_font_rasterize(mrb, data, glyph))
+    return NULL;
+  glyph->used = TRUE;
+  data->glyph_count++;
+  return glyph;
+}
+
+static Uint16
+mrb_sdl2_gpu_font_next_codepoint(char const **p, char const *end) {
+  Uint8 const *s = (Uint8 const*) *p;
+  Uint32 c = *s;
+  int extra = 0, i;
+  if (c >= 0xF0)      { extra = 3; c &= 0x07; }
+  else if (c >= 0xE0) { extra = 2; c &= 0x0F; }
+  else if (c >= 0xC0) { extra = 1; c &= 0x1F; }
+  else if (c >= 0x80) { *p += 1; return '?'; }
+  if ((char const*)(s + extra) >= end) {
+    *p = end;
+    return '?';
+  }
+  for (i = 1; i <= extra; i++) {
+    c = (c << 6) | (s[i] & 0x3F);
+  }
+  *p += extra + 1;
+  return c > 0xFFFF ? '?' : (Uint16) c;
+}
+
+/* Lays the text out into run->quads. Returns FALSE when the atlas filled
+ * up on the way. */
+static mrb_bool
+mrb_sdl2_gpu_font_layout(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data,
+                         mrb_sdl2_gpu_run_t *run, char const *text,
+                         mrb_int len) {
+  char const *p = text, *end = text + len;
+  float pen_x = 0.0f, pen_y = 0.0f;
+  Uint16 previous = 0;
+  int capa = 0;
+  run->num_quads = 0;
+  run->width = 0.0f;
+  run->height = len > 0 ? (float) data->line_skip : 0.0f;
+  while (p < end) {
+    Uint16 codepoint = mrb_sdl2_gpu_font_next_codepoint(&p, end);
+    mrb_sdl2_gpu_glyph_t *glyph;
+    float *q;
+    if ('\n' == codepoint) {
+      pen_x = 0.0f;
+      pen_y += data->line_skip;
+      run->height += data->line_skip;
+      previous = 0;
+      continue;
+    }
+    glyph = mrb_sdl2_gpu_font_glyph(mrb, data, codepoint);
+    if (NULL == glyph)
+      return FALSE;
+    if (0 != previous)
+      pen_x += TTF_GetFontKerningSizeGlyphs(data->font, previous, codepoint);
+    previous = codepoint;
+    if (glyph->visible) {
+      if (run->num_quads == capa) {
+        capa = capa == 0 ? 16 : capa * 2;
+        run->quads = (float*) mrb_realloc(mrb, run->quads,
+                                          sizeof(float) * 8 * capa);
+      }
+      q = &run->quads[run->num_quads++ * 8];
+      q[0] = pen_x + glyph->x0;
+      q[1] = pen_y + glyph->y0;
+      q[2] = pen_x + glyph->x1;
+      q[3] = pen_y + glyph->y1;
+      q[4] = glyph->s0;
+      q[5] = glyph->t0;
+      q[6] = glyph->s1;
+      q[7] = glyph->t1;
+    }
+    pen_x += glyph->advance;
+    if (pen_x > run->width)
+      run->width = pen_x;
+  }
+  return TRUE;
+}
+
+/* Returns the cached layout of the text, building it when needed. */
+static mrb_sdl2_gpu_run_t *
+mrb_sdl2_gpu_font_run(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data,
+                      mrb_value text) {
+  char const *ptr = RSTRING_PTR(text);
+  mrb_int len = RSTRING_LEN(text);
+  Uint32 hash = 2166136261u;
+  mrb_sdl2_gpu_run_t *run;
+  mrb_int i;
+  for (i = 0; i < len; i++) {
+    hash = (hash ^ (Uint8) ptr[i]) * 16777619u;
+  }
+  run = &data->runs[hash & (MRB_SDL2_GPU_FONT_RUN_CACHE - 1)];
+  if (run->len == len && run->hash == hash &&
+      run->generation == data->generation &&
+      0 == SDL_memcmp(run->text, ptr, len))
+    return run;
+
+  run->len = -1;
+  if (!mrb_sdl2_gpu_font_layout(mrb, data, run, ptr, len)) {
+    mrb_sdl2_gpu_font_reset_atlas(mrb, data);
+    if (!mrb_sdl2_gpu_font_layout(mrb, data, run, ptr, len))
+      mrb_raise(mrb, E_RUNTIME_ERROR, "text does not fit into the glyph atlas");
+  }
+  run->text = (char*) mrb_realloc(mrb, run->text, len + 1);
+  SDL_memcpy(run->text, ptr, len);
+  run->len = len;
+  run->hash = hash;
+  run->generation = data->generation;
+  return run;
+}
+
+static void
+mrb_sdl2_gpu_font_reserve(mrb_state *mrb, mrb_sdl2_gpu_font_data_t *data,
+                          int vertices) {
+  int capa = data->vertex_capa, i;
+  if (data->num_vertices + vertices <= capa)
+    return;
+  while (capa < data->num_vertices + vertices)
+    capa = capa == 0 ? 1024 : capa * 2;
+  if (capa > MRB_SDL2_GPU_FONT_MAX_VERTICES)
+    capa = MRB_SDL2_GPU_FONT_MAX_VERTICES;
+  data->vertices = (float*) mrb_realloc(mrb, data->vertices,
+      sizeof(float) * MRB_SDL2_GPU_FONT_FLOATS * capa);
+  data->indices = (Uint16*) mrb_realloc(mrb, data->indices,
+      sizeof(Uint16) * capa / 4 * 6);
+  for (i = data->vertex_capa / 4; i < capa / 4; i++) {
+    data->indices[i * 6 + 0] = i * 4 + 0;
+    data->indices[i * 6 + 1] = i * 4 + 1;
+    data->indices[i * 6 + 2] = i * 4 + 2;
+    data->indices[i * 6 + 3] = i * 4 + 0;
+    data->indices[i * 6 + 4] = i * 4 + 2;
+    data->indices[i * 6 + 5] = i * 4 + 3;
+  }
+  data->vertex_capa = capa;
+}
+
+static void
+mrb_sdl2_gpu_font_vertex(float *v, float x, float y, float s, float t,
+                         float const *rgba) {
+  v[0] = x;
+  v[1] = y;
+  v[2] = s;
+  v[3] = t;
+  v[4] = rgba[0];
+  v[5] = rgba[1];
+  v[6] = rgba[2];
+  v[7] = rgba[3];
+}
+
+/* The wrapper Font#atlas handed out must not outlive the atlas. */
+static void
+mrb_sdl2_gpu_font_detach_atlas(mrb_state *mrb, mrb_value self) {
+  mrb_sym sym = mrb_intern_lit(mrb, "__atlas__");
+  mrb_value atlas = mrb_iv_get(mrb, self, sym);
+  if (!mrb_nil_p(atlas)) {
+    mrb_sdl2_gpu_image_detach(mrb, atlas);
+    mrb_iv_set(mrb, self, sym, mrb_nil_value());
+  }
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_value path;
+  mrb_int ptsize, atlas_size = MRB_SDL2_GPU_FONT_ATLAS_SIZE;
+  mrb_bool sdf = FALSE;
+  mrb_sdl2_gpu_font_data_t *data =
+    (mrb_sdl2_gpu_font_data_t*)DATA_PTR(self);
+  TTF_Font *font;
+  GPU_Image *atlas;
+  int i;
+  mrb_get_args(mrb, "Si|bi", &path, &ptsize, &sdf, &atlas_size);
+
+  if (sdf && 0 == sdf_state.programid) {
+    sdf_state.programid =
+      mrb_sdl2_gpu_builtin_program(mrb, mrb_sdl2_gpu_builtin_vertex_source,
+                                   mrb_sdl2_gpu_font_sdf_fragment_source);
+    sdf_state.block = GPU_LoadShaderBlock(sdf_state.programid, "gpu_Vertex",
+                                          "gpu_TexCoord", "gpu_Color",
+                                          "gpu_ModelViewProjectionMatrix");
+  }
+  if (!mrb_sdl2_gpu_vram_reserve(
+          mrb, mrb_sdl2_gpu_vram_estimate(atlas_size, atlas_size,
+                                          GPU_FORMAT_RGBA)))
+    mrb_raise(mrb, E_RUNTIME_ERROR,
+              "glyph atlas would exceed the VRAM budget");
+  /* every open font holds one TTF_Init, released along with it */
+  if (TTF_Init() < 0)
+    mrb_raisef(mrb, E_RUNTIME_ERROR, "Could not initialize SDL_ttf: %S",
+               mrb_str_new_cstr(mrb, TTF_GetError()));
+  font = TTF_OpenFont(mrb_str_to_cstr(mrb, path), ptsize);
+  if (NULL == font) {
+    mrb_value error = mrb_str_new_cstr(mrb, TTF_GetError());
+    TTF_Quit();
+    mrb_raisef(mrb, E_RUNTIME_ERROR, "Could not open font: %S", error);
+  }
+  atlas = GPU_CreateImage(atlas_size, atlas_size, GPU_FORMAT_RGBA);
+  if (NULL == atlas) {
+    TTF_CloseFont(font);
+    TTF_Quit();
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create glyph atlas");
+  }
+  GPU_SetImageFilter(atlas, GPU_FILTER_LINEAR);
+  mrb_sdl2_gpu_vram_add(atlas, "Font.new");
+
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_font_data_t*)
+        mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_font_data_t));
+    if (NULL == data) {
+      mrb_sdl2_gpu_vram_remove(atlas);
+      GPU_FreeImage(atlas);
+      TTF_CloseFont(font);
+      TTF_Quit();
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+    for (i = 0; i < MRB_SDL2_GPU_FONT_RUN_CACHE; i++) {
+      data->runs[i].text = NULL;
+      data->runs[i].quads = NULL;
+    }
+    data->font = NULL;
+    data->atlas = NULL;
+    data->glyphs = NULL;
+    data->shelves = NULL;
+    data->vertices = NULL;
+    data->indices = NULL;
+    data->batching = 0;
+  } else {
+    mrb_sdl2_gpu_font_detach_atlas(mrb, self);
+    mrb_sdl2_gpu_font_release_data(mrb, data);
+  }
+  mrb_sdl2_gpu_font_clear_runs(mrb, data);
+  data->font = font;
+  data->atlas = atlas;
+  data->atlas_size = atlas_size;
+  data->sdf = sdf;
+  /* one pixel of padding keeps bilinear filtering from bleeding */
+  data->padding = sdf ? MRB_SDL2_GPU_FONT_SDF_SPREAD : 1;
+  data->line_skip = TTF_FontLineSkip(font);
+  data->ascent = TTF_FontAscent(font);
+  data->generation = 0;
+  data->glyph_capa = 0;
+  data->glyph_count = 0;
+  data->num_shelves = 0;
+  data->shelf_capa = 0;
+  data->next_y = 0;
+  data->num_vertices = 0;
+  data->vertex_capa = 0;
+  data->pending = mrb_nil_value();
+
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_font_data_type;
+  return self;
+}
+
+/* draw(target, text, x, y, scale = 1.0, r = 255, g = 255, b = 255, a = 255)
+ * Inside Font#batch the text is queued until the block ends. */
+static mrb_value
+mrb_sdl2_gpu_font_draw(mrb_state *mrb, mrb_value self) {
+  mrb_value target_obj, text;
+  mrb_float x, y, scale = 1.0;
+  mrb_int r = 255, g = 255, b = 255, a = 255;
+  mrb_sdl2_gpu_font_data_t *data = mrb_sdl2_gpu_font_get_ptr(mrb, self);
+  mrb_sdl2_gpu_run_t *run;
+  GPU_Target *target;
+  float rgba[4];
+  int i;
+  mrb_get_args(mrb, "oSff|fiiii", &target_obj, &text, &x, &y, &scale,
+               &r, &g, &b, &a);
+  target = mrb_sdl2_gpu_target_get_ptr(mrb, target_obj);
+  rgba[0] = r / 255.0f;
+  rgba[1] = g / 255.0f;
+  rgba[2] = b / 255.0f;
+  rgba[3] = a / 255.0f;
+
+  if (mrb_sdl2_gpu_target_get_ptr(mrb, data->pending) != target)
+    mrb_sdl2_gpu_font_flush_data(mrb, data);
+  run = mrb_sdl2_gpu_font_run(mrb, data, text);
+  data->pending = target_obj;
+
+  for (i = 0; i < run->num_quads; i++) {
+    float const *q = &run->quads[i * 8];
+    float x0 = x + q[0] * scale, y0 = y + q[1] * scale;
+    float x1 = x + q[2] * scale, y1 = y + q[3] * scale;
+    float *v;
+    if (data->num_vertices + 4 > MRB_SDL2_GPU_FONT_MAX_VERTICES) {
+      mrb_sdl2_gpu_font_flush_data(mrb, data);
+      data->pending = target_obj;
+    }
+    mrb_sdl2_gpu_font_reserve(mrb, data, 4);
+    v = &data->vertices[data->num_vertices * MRB_SDL2_GPU_FONT_FLOATS];
+    mrb_sdl2_gpu_font_vertex(v,      x0, y0, q[4], q[5], rgba);
+    mrb_sdl2_gpu_font_vertex(v + 8,  x1, y0, q[6], q[5], rgba);
+    mrb_sdl2_gpu_font_vertex(v + 16, x1, y1, q[6], q[7], rgba);
+    mrb_sdl2_gpu_font_vertex(v + 24, x0, y1, q[4], q[7], rgba);
+    data->num_vertices += 4;
+  }
+  if (0 == data->batching)
+    mrb_sdl2_gpu_font_flush_data(mrb, data);
+  else  /* keeps the queued target alive until the batch ends */
+    mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__target__"), target_obj);
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_flush(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_font_flush_data(mrb, mrb_sdl2_gpu_font_get_ptr(mrb, self));
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__target__"), mrb_nil_value());
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_batch_body(mrb_state *mrb, mrb_value block) {
+  return mrb_yield_argv(mrb, block, 0, NULL);
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_batch_end(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_font_data_t *data =
+    (mrb_sdl2_gpu_font_data_t*)
+      mrb_data_get_ptr(mrb, self, &mrb_sdl2_gpu_font_data_type);
+  if (NULL != data && data->batching > 0 && 0 == --data->batching) {
+    mrb_sdl2_gpu_font_flush_data(mrb, data);
+    mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__target__"), mrb_nil_value());
+  }
+  return mrb_nil_value();
+}
+
+/* batch { ... } -> the value of the block
+ * Text drawn inside is queued and goes out in one draw when the block
+ * ends, when it moves to another target or on Font#flush, so it lands on
+ * top of whatever else the block drew meanwhile. */
+static mrb_value
+mrb_sdl2_gpu_font_batch(mrb_state *mrb, mrb_value self) {
+  mrb_value block = mrb_nil_value();
+  mrb_sdl2_gpu_font_data_t *data = mrb_sdl2_gpu_font_get_ptr(mrb, self);
+  mrb_get_args(mrb, "&", &block);
+  if (mrb_nil_p(block))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "batch needs a block");
+  data->batching++;
+  return mrb_ensure(mrb, mrb_sdl2_gpu_font_batch_body, block,
+                    mrb_sdl2_gpu_font_batch_end, self);
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_measure(mrb_state *mrb, mrb_value self) {
+  mrb_value text, result;
+  mrb_float scale = 1.0;
+  mrb_sdl2_gpu_font_data_t *data = mrb_sdl2_gpu_font_get_ptr(mrb, self);
+  mrb_sdl2_gpu_run_t *run;
+  mrb_get_args(mrb, "S|f", &text, &scale);
+  run = mrb_sdl2_gpu_font_run(mrb, data, text);
+  result = mrb_ary_new_capa(mrb, 2);
+  mrb_ary_push(mrb, result, mrb_float_value(mrb, run->width * scale));
+  mrb_ary_push(mrb, result, mrb_float_value(mrb, run->height * scale));
+  return result;
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_line_height(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_font_get_ptr(mrb, self)->line_skip);
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_is_sdf(mrb_state *mrb, mrb_value self) {
+  return mrb_bool_value(mrb_sdl2_gpu_font_get_ptr(mrb, self)->sdf);
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_atlas(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_font_data_t *data = mrb_sdl2_gpu_font_get_ptr(mrb, self);
+  mrb_sym sym = mrb_intern_lit(mrb, "__atlas__");
+  mrb_value atlas = mrb_iv_get(mrb, self, sym);
+  if (mrb_nil_p(atlas)) {
+    atlas = mrb_sdl2_gpu_image_borrowed(mrb, data->atlas);
+    mrb_iv_set(mrb, atlas, mrb_intern_lit(mrb, "__font__"), self);
+    mrb_iv_set(mrb, self, sym, atlas);
+  }
+  return atlas;
+}
+
+static mrb_value
+mrb_sdl2_gpu_font_free(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_font_data_t *data =
+    (mrb_sdl2_gpu_font_data_t*)
+      mrb_data_get_ptr(mrb, self, &mrb_sdl2_gpu_font_data_type);
+  mrb_sdl2_gpu_font_detach_atlas(mrb, self);
+  if (NULL != data)
+    mrb_sdl2_gpu_font_release_data(mrb, data);
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__target__"), mrb_nil_value());
+  return self;
+}
+/***********************************
+ * GPU::Font bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_font_init(mrb_state *mrb) {
+  class_Font = mrb_define_class_under(mrb, mod_GPU, "Font", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_Font, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_Font, "initialize",  mrb_sdl2_gpu_font_initialize,  MRB_ARGS_REQ(2) | MRB_ARGS_OPT(2));
+  mrb_define_method(mrb, class_Font, "draw",        mrb_sdl2_gpu_font_draw,        MRB_ARGS_REQ(4) | MRB_ARGS_OPT(5));
+  mrb_define_method(mrb, class_Font, "flush",       mrb_sdl2_gpu_font_flush,       MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Font, "batch",       mrb_sdl2_gpu_font_batch,       MRB_ARGS_BLOCK());
+  mrb_define_method(mrb, class_Font, "measure",     mrb_sdl2_gpu_font_measure,     MRB_ARGS_REQ(1) | MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_Font, "line_height", mrb_sdl2_gpu_font_line_height, MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Font, "sdf?",        mrb_sdl2_gpu_font_is_sdf,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Font, "atlas",       mrb_sdl2_gpu_font_atlas,       MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Font, "free",        mrb_sdl2_gpu_font_free,        MRB_ARGS_NONE());
+}
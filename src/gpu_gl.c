@@ -0,0 +1,313 @@
+/*Copyright 2015 <Daniel Kolev>
+  Raw OpenGL access for the paths SDL_gpu has no API for (instancing,
+  GPU resident buffers). Callers bracket their GL calls with
+  mrb_sdl2_gpu_gl_begin/_end, which flush SDL_gpu, bind the target and
+  hand SDL_gpu its state back afterwards.
+
+  The entry points come from the table in gpu_gl.h, resolved by the first
+  raw GL call instead of at startup.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/hash.h"
+
+#include "../include/gpu_gl.h"
+#include "../include/gpu.h"
+
+/* SDL_gpu keeps these private; the OpenGL renderers all share the layout. */
+typedef struct mrb_sdl2_gpu_gl_image_data_t {
+  int    refcount;
+  Uint8  owns_handle;
+  GLuint handle;
+} mrb_sdl2_gpu_gl_image_data_t;
+
+typedef struct mrb_sdl2_gpu_gl_target_data_t {
+  int    refcount;
+  GLuint handle;
+} mrb_sdl2_gpu_gl_target_data_t;
+
+#define MRB_SDL2_GPU_GL_DEFINE(type, name, params, required)                  \
+  mrb_sdl2_gpu_gl##name##_t mrb_sdl2_gpu_gl##name = NULL;
+MRB_SDL2_GPU_GL_FUNCTIONS(MRB_SDL2_GPU_GL_DEFINE)
+#undef MRB_SDL2_GPU_GL_DEFINE
+
+typedef struct mrb_sdl2_gpu_gl_function_t {
+  const char *name;
+  void      **proc;
+  mrb_bool    required;
+} mrb_sdl2_gpu_gl_function_t;
+
+static mrb_sdl2_gpu_gl_function_t const gl_functions[] = {
+#define MRB_SDL2_GPU_GL_ENTRY(type, name, params, required)                   \
+  { "gl" #name, (void **) &mrb_sdl2_gpu_gl##name, required },
+  MRB_SDL2_GPU_GL_FUNCTIONS(MRB_SDL2_GPU_GL_ENTRY)
+#undef MRB_SDL2_GPU_GL_ENTRY
+};
+
+static mrb_bool gl_loaded     = FALSE;
+static GLuint   gl_vao        = 0;
+static GLint    gl_saved_vao  = 0;
+static mrb_bool gl_init_failed = FALSE;
+static int      gl_version     = 0;  /* major * 10 + minor */
+static mrb_bool gl_vao_support = FALSE;
+static mrb_bool gl_instancing  = FALSE;
+static int      gl_resolved    = 0;
+static double   gl_load_time   = 0.0;
+static Uint32   gl_generation  = 1;  /* bumped whenever the context goes */
+
+mrb_bool
+mrb_sdl2_gpu_gl_version(int major, int minor) {
+  return gl_loaded && gl_version >= major * 10 + minor;
+}
+
+mrb_bool
+mrb_sdl2_gpu_gl_extension(const char *name) {
+  return gl_loaded && SDL_GL_ExtensionSupported(name);
+}
+
+static mrb_bool
+mrb_sdl2_gpu_gl_has_vao(void) {
+  return gl_vao_support;
+}
+
+/* Resolves the table, FALSE when a required entry point is missing. */
+static mrb_bool
+mrb_sdl2_gpu_gl_resolve(void) {
+  size_t i;
+  int major = 0, minor = 0;
+  const char *version;
+  gl_resolved = 0;
+  for (i = 0; i < sizeof(gl_functions) / sizeof(gl_functions[0]); i++) {
+    *gl_functions[i].proc = SDL_GL_GetProcAddress(gl_functions[i].name);
+    if (NULL != *gl_functions[i].proc)
+      gl_resolved++;
+    else if (gl_functions[i].required)
+      return FALSE;
+  }
+  version = (const char *) glGetString(GL_VERSION);
+  if (NULL == version || 2 != SDL_sscanf(version, "%d.%d", &major, &minor))
+    return FALSE;
+  gl_version = major * 10 + minor;
+  return TRUE;
+}
+
+/* Loads the GL entry points on first use, the context has to exist.
+ * Returns NULL on success or why the raw GL paths are unavailable. */
+static const char *
+mrb_sdl2_gpu_gl_load(void) {
+  GPU_Renderer *renderer;
+  Uint64 start;
+  if (gl_loaded)
+    return NULL;
+  if (gl_init_failed)
+    return "Could not load OpenGL";
+  renderer = GPU_GetCurrentRenderer();
+  if (NULL == renderer || NULL == renderer->current_context_target)
+    return "GPU is not initialized";
+  if (GPU_RENDERER_OPENGL_1_BASE == renderer->id.renderer ||
+      GPU_RENDERER_OPENGL_1 == renderer->id.renderer ||
+      GPU_LANGUAGE_GLSL != renderer->shader_language)
+    return "raw GL paths need a shader based desktop GL renderer";
+  start = SDL_GetPerformanceCounter();
+  if (!mrb_sdl2_gpu_gl_resolve()) {
+    gl_init_failed = TRUE;
+    return "Could not load OpenGL";
+  }
+  gl_loaded = TRUE;
+  gl_vao_support = (mrb_sdl2_gpu_gl_version(3, 0) ||
+                    mrb_sdl2_gpu_gl_extension("GL_ARB_vertex_array_object")) &&
+                   NULL != glGenVertexArrays && NULL != glBindVertexArray;
+  if (mrb_sdl2_gpu_gl_version(3, 3))
+    gl_instancing = NULL != glVertexAttribDivisor &&
+                    NULL != glDrawArraysInstanced &&
+                    NULL != glDrawElementsInstanced;
+  else
+    gl_instancing = mrb_sdl2_gpu_gl_extension("GL_ARB_instanced_arrays") &&
+                    mrb_sdl2_gpu_gl_extension("GL_ARB_draw_instanced") &&
+                    NULL != glVertexAttribDivisorARB &&
+                    NULL != glDrawArraysInstancedARB &&
+                    NULL != glDrawElementsInstancedARB;
+  gl_load_time = (double) (SDL_GetPerformanceCounter() - start) /
+                 SDL_GetPerformanceFrequency();
+  return NULL;
+}
+
+void
+mrb_sdl2_gpu_gl_require(mrb_state *mrb) {
+  const char *error = mrb_sdl2_gpu_gl_load();
+  if (NULL != error)
+    mrb_raise(mrb, E_RUNTIME_ERROR, error);
+}
+
+/* Like mrb_sdl2_gpu_gl_require for paths that can fall back to SDL_gpu. */
+mrb_bool
+mrb_sdl2_gpu_gl_available(void) {
+  return NULL == mrb_sdl2_gpu_gl_load();
+}
+
+mrb_bool
+mrb_sdl2_gpu_gl_has_instancing(void) {
+  return gl_loaded && gl_instancing;
+}
+
+Uint32
+mrb_sdl2_gpu_gl_texture(GPU_Image *image) {
+  return ((mrb_sdl2_gpu_gl_image_data_t*) image->data)->handle;
+}
+
+/* The target's model view projection, column major like GL. It is built
+ * on SDL_gpu's own matrix stacks with the projection and camera SDL_gpu
+ * sets up for the target: y down on windows, up on images, the camera
+ * zooming and rotating around the target center (the mapping
+ * mrb_sdl2_gpu_target_visible_rect inverts). No public call applies a
+ * target's camera without drawing, so the stacks are pushed, set up and
+ * popped again. */
+static void
+mrb_sdl2_gpu_gl_mvp(GPU_Target *target, float *mvp) {
+  float w = target->w, h = target->h;
+  GPU_MatrixMode(GPU_PROJECTION);
+  GPU_PushMatrix();
+  GPU_LoadIdentity();
+  if (NULL == target->image)
+    GPU_Ortho(0.0f, w, h, 0.0f, -1.0f, 1.0f);
+  else
+    GPU_Ortho(0.0f, w, 0.0f, h, -1.0f, 1.0f);
+  GPU_MatrixMode(GPU_MODELVIEW);
+  GPU_PushMatrix();
+  GPU_LoadIdentity();
+  if (target->use_camera) {
+    float zoom = target->camera.zoom > 0.0f ? target->camera.zoom : 1.0f;
+    GPU_Translate(w / 2.0f, h / 2.0f, 0.0f);
+    GPU_Rotate(target->camera.angle, 0.0f, 0.0f, 1.0f);
+    GPU_Scale(zoom, zoom, 1.0f);
+    GPU_Translate(-target->camera.x - w / 2.0f, -target->camera.y - h / 2.0f,
+                  0.0f);
+  }
+  GPU_GetModelViewProjection(mvp);
+  GPU_PopMatrix();
+  GPU_MatrixMode(GPU_PROJECTION);
+  GPU_PopMatrix();
+  GPU_MatrixMode(GPU_MODELVIEW);
+}
+
+/* Flushes SDL_gpu, binds the target framebuffer and viewport and a VAO of
+ * our own, and returns the target's model view projection matrix. */
+void
+mrb_sdl2_gpu_gl_begin(mrb_state *mrb, GPU_Target *target, float *mvp) {
+  GLint y;
+  mrb_sdl2_gpu_gl_require(mrb);
+  mrb_sdl2_gpu_multi_batch_sync(target);
+  GPU_FlushBlitBuffer();
+  if (NULL == target->image) {
+    GPU_MakeCurrent(target, target->context->windowID);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    y = target->context->drawable_h - target->viewport.h - target->viewport.y;
+  } else {
+    glBindFramebuffer(GL_FRAMEBUFFER,
+                      ((mrb_sdl2_gpu_gl_target_data_t*) target->data)->handle);
+    y = target->viewport.y;
+  }
+  glViewport(target->viewport.x, y, target->viewport.w, target->viewport.h);
+  if (target->use_clip_rect) {
+    /* the clip rect is in virtual pixels, the scissor in real ones */
+    float sx = target->using_virtual_resolution ?
+        (float) target->base_w / target->w : 1.0f;
+    float sy = target->using_virtual_resolution ?
+        (float) target->base_h / target->h : 1.0f;
+    GLint cx = (GLint) (target->clip_rect.x * sx);
+    GLint cw = (GLint) (target->clip_rect.w * sx);
+    GLint ch = (GLint) (target->clip_rect.h * sy);
+    GLint cy = NULL == target->image ?
+        target->context->drawable_h - ch - (GLint) (target->clip_rect.y * sy) :
+        (GLint) (target->clip_rect.y * sy);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(cx, cy, cw, ch);
+  } else {
+    glDisable(GL_SCISSOR_TEST);
+  }
+  if (mrb_sdl2_gpu_gl_has_vao()) {
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &gl_saved_vao);
+    if (0 == gl_vao)
+      glGenVertexArrays(1, &gl_vao);
+    glBindVertexArray(gl_vao);
+  }
+  mrb_sdl2_gpu_gl_mvp(target, mvp);
+}
+
+/* Leaves GL the way SDL_gpu expects to find it. */
+void
+mrb_sdl2_gpu_gl_end(void) {
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  if (mrb_sdl2_gpu_gl_has_vao())
+    glBindVertexArray(gl_saved_vao);
+  GPU_ResetRendererState();
+}
+
+/* Which context GL objects made now belong to. Objects remember it, so a
+ * GPU.quit and GPU.init cycle in between is noticed. */
+Uint32
+mrb_sdl2_gpu_gl_generation(void) {
+  return gl_generation;
+}
+
+/* Deletes a buffer made in context generation unless that context already
+ * went away with GPU.quit, its name may belong to a new buffer by now. */
+void
+mrb_sdl2_gpu_gl_delete_buffer(Uint32 buffer, Uint32 generation) {
+  if (gl_loaded && 0 != buffer && generation == gl_generation)
+    glDeleteBuffers(1, &buffer);
+}
+
+/* Forgets the context bound objects, GPU.quit calls it. */
+void
+mrb_sdl2_gpu_gl_release(void) {
+  gl_generation++;
+  gl_loaded = FALSE;
+  gl_init_failed = FALSE;
+  gl_vao = 0;
+  gl_vao_support = FALSE;
+  gl_instancing = FALSE;
+}
+
+/* Binds the image texture and blend state on unit 0. */
+void
+mrb_sdl2_gpu_gl_bind_image(GPU_Image *image) {
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, mrb_sdl2_gpu_gl_texture(image));
+  if (image->use_blending) {
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(image->blend_mode.source_color,
+                        image->blend_mode.dest_color,
+                        image->blend_mode.source_alpha,
+                        image->blend_mode.dest_alpha);
+    glBlendEquationSeparate(image->blend_mode.color_equation,
+                            image->blend_mode.alpha_equation);
+  } else {
+    glDisable(GL_BLEND);
+  }
+}
+
+/* GPU.gl_stats -> {loaded:, version:, functions:, resolved:, load_time:}
+ * version is major * 10 + minor, load_time the seconds the first raw GL
+ * call spent resolving entry points. */
+static mrb_value
+mrb_sdl2_gpu_gl_stats(mrb_state *mrb, mrb_value self) {
+  mrb_value stats = mrb_hash_new_capa(mrb, 5);
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "loaded")),
+               mrb_bool_value(gl_loaded));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "version")),
+               mrb_fixnum_value(gl_version));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "functions")),
+               mrb_fixnum_value(sizeof(gl_functions) / sizeof(gl_functions[0])));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "resolved")),
+               mrb_fixnum_value(gl_resolved));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "load_time")),
+               mrb_float_value(mrb, gl_load_time));
+  return stats;
+}
+
+void
+mrb_sdl2_gpu_gl_init(mrb_state *mrb) {
+  mrb_define_module_function(mrb, mod_GPU, "gl_stats", mrb_sdl2_gpu_gl_stats, MRB_ARGS_NONE());
+}
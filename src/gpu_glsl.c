@@ -0,0 +1,79 @@
+/*Copyright 2015 <Daniel Kolev>
+  Helpers for the shaders the gem ships with. They are written against
+  GLSL 1.20 / GLSL ES 1.00 and get a version line and compatibility
+  defines matching the shader language of the current renderer.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/string.h"
+
+#include "../include/gpu.h"
+
+const char *mrb_sdl2_gpu_builtin_vertex_source =
+  "attribute vec3 gpu_Vertex;\n"
+  "attribute vec2 gpu_TexCoord;\n"
+  "attribute vec4 gpu_Color;\n"
+  "uniform mat4 gpu_ModelViewProjectionMatrix;\n"
+  "varying vec4 color;\n"
+  "varying vec2 texCoord;\n"
+  "void main() {\n"
+  "  color = gpu_Color;\n"
+  "  texCoord = gpu_TexCoord;\n"
+  "  gl_Position = gpu_ModelViewProjectionMatrix * vec4(gpu_Vertex, 1.0);\n"
+  "}\n";
+
+static const char *
+mrb_sdl2_gpu_glsl_prefix(GPU_ShaderEnum type) {
+  GPU_Renderer *renderer = GPU_GetCurrentRenderer();
+  if (NULL == renderer)
+    return "";
+  if (GPU_LANGUAGE_GLSLES == renderer->shader_language) {
+    return "#version 100\n"
+           "#extension GL_OES_standard_derivatives : enable\n"
+           "precision mediump float;\n"
+           "precision mediump int;\n";
+  }
+  if (renderer->max_shader_version < 130) {
+    return "#version 120\n";
+  }
+  if (GPU_VERTEX_SHADER == type) {
+    return "#version 130\n"
+           "#define attribute in\n"
+           "#define varying out\n";
+  }
+  return "#version 130\n"
+         "#define varying in\n"
+         "#define texture2D texture\n"
+         "out vec4 gpu_FragColor;\n"
+         "#define gl_FragColor gpu_FragColor\n";
+}
+
+static Uint32
+mrb_sdl2_gpu_builtin_shader(mrb_state *mrb, GPU_ShaderEnum type,
+                            const char *source) {
+  mrb_value code = mrb_str_new_cstr(mrb, mrb_sdl2_gpu_glsl_prefix(type));
+  mrb_str_cat_cstr(mrb, code, source);
+  return GPU_CompileShader(type, RSTRING_PTR(code));
+}
+
+/* Compiles and links a program from built-in sources, raising on error. */
+Uint32
+mrb_sdl2_gpu_builtin_program(mrb_state *mrb, const char *vertex_source,
+                             const char *fragment_source) {
+  Uint32 vertex, fragment, program = 0;
+  vertex = mrb_sdl2_gpu_builtin_shader(mrb, GPU_VERTEX_SHADER, vertex_source);
+  fragment = mrb_sdl2_gpu_builtin_shader(mrb, GPU_FRAGMENT_SHADER,
+                                         fragment_source);
+  if (vertex && fragment)
+    program = GPU_LinkShaders(vertex, fragment);
+  if (vertex)
+    GPU_FreeShader(vertex);
+  if (fragment)
+    GPU_FreeShader(fragment);
+  if (!program) {
+    mrb_raisef(mrb, E_RUNTIME_ERROR, "Could not build built-in shader: %S",
+               mrb_str_new_cstr(mrb, GPU_GetShaderMessage()));
+  }
+  return program;
+}
@@ -0,0 +1,169 @@
+/*Copyright 2015 <Daniel Kolev>
+  Wrapper identity map - remembers the Ruby object wrapping a GPU_* pointer
+  so accessors like Image#target or GPU.get_current_renderer hand back the
+  same object instead of allocating a new one every call.
+
+  The map is weak: it does not mark the wrappers, their free functions take
+  them out again. Entries are keyed by the pointer and the data type, so a
+  target and the camera cached for it can share the pointer.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/hash.h"
+
+#include "../include/gpu.h"
+
+typedef struct mrb_sdl2_gpu_identity_entry_t {
+  void const                      *ptr;
+  struct mrb_data_type const      *type;
+  struct RData                    *wrapper;
+} mrb_sdl2_gpu_identity_entry_t;
+
+static struct {
+  mrb_sdl2_gpu_identity_entry_t *entries;
+  size_t capacity;  /* power of two */
+  size_t count;
+  size_t hits;
+  size_t misses;
+} identity = { NULL, 0, 0, 0, 0 };
+
+static size_t
+mrb_sdl2_gpu_identity_hash(void const *ptr, struct mrb_data_type const *type) {
+  size_t h = ((size_t) ptr >> 4) ^ ((size_t) type >> 3);
+  h *= (size_t) 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 16);
+}
+
+/* Slot of the key, or of the empty slot ending its probe sequence. */
+static size_t
+mrb_sdl2_gpu_identity_slot(void const *ptr, struct mrb_data_type const *type) {
+  size_t mask = identity.capacity - 1;
+  size_t i = mrb_sdl2_gpu_identity_hash(ptr, type) & mask;
+  while (NULL != identity.entries[i].wrapper &&
+         (identity.entries[i].ptr != ptr || identity.entries[i].type != type)) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static mrb_bool
+mrb_sdl2_gpu_identity_grow(void) {
+  mrb_sdl2_gpu_identity_entry_t *old = identity.entries;
+  size_t old_capacity = identity.capacity, i;
+  size_t capacity = 0 == old_capacity ? 64 : old_capacity * 2;
+  mrb_sdl2_gpu_identity_entry_t *entries = (mrb_sdl2_gpu_identity_entry_t*)
+    SDL_calloc(capacity, sizeof(mrb_sdl2_gpu_identity_entry_t));
+  if (NULL == entries)
+    return FALSE;
+  identity.entries = entries;
+  identity.capacity = capacity;
+  for (i = 0; i < old_capacity; i++) {
+    if (NULL != old[i].wrapper)
+      identity.entries[mrb_sdl2_gpu_identity_slot(old[i].ptr, old[i].type)] =
+        old[i];
+  }
+  SDL_free(old);
+  return TRUE;
+}
+
+/* The live wrapper of ptr, NULL when there is none. A wrapper the GC
+ * already found unreachable is not handed out again, its sweep is pending
+ * and would free it under the caller. */
+struct RData *
+mrb_sdl2_gpu_identity_find(mrb_state *mrb, void const *ptr,
+                           struct mrb_data_type const *type) {
+  mrb_sdl2_gpu_identity_entry_t *entry;
+  if (NULL == ptr)
+    return NULL;
+  entry = 0 == identity.count ? NULL :
+            &identity.entries[mrb_sdl2_gpu_identity_slot(ptr, type)];
+  if (NULL == entry || NULL == entry->wrapper ||
+      mrb_object_dead_p(mrb, (struct RBasic*) entry->wrapper)) {
+    identity.misses++;
+    return NULL;
+  }
+  identity.hits++;
+  return entry->wrapper;
+}
+
+void
+mrb_sdl2_gpu_identity_add(void const *ptr, struct RData *wrapper) {
+  mrb_sdl2_gpu_identity_entry_t *entry;
+  if (NULL == ptr)
+    return;
+  if ((identity.count + 1) * 4 > identity.capacity * 3 &&
+      !mrb_sdl2_gpu_identity_grow())
+    return;  /* without room the object just is not deduplicated */
+  entry = &identity.entries[mrb_sdl2_gpu_identity_slot(ptr, wrapper->type)];
+  if (NULL == entry->wrapper)
+    identity.count++;
+  entry->ptr = ptr;
+  entry->type = wrapper->type;
+  entry->wrapper = wrapper;
+}
+
+/* Forgets the wrapper whose DATA_PTR is data, so data free functions can
+ * call it. A different wrapper of the same pointer stays. */
+void
+mrb_sdl2_gpu_identity_remove(void const *ptr,
+                             struct mrb_data_type const *type,
+                             void const *data) {
+  size_t mask, i, j;
+  if (0 == identity.count || NULL == ptr)
+    return;
+  mask = identity.capacity - 1;
+  i = mrb_sdl2_gpu_identity_slot(ptr, type);
+  if (NULL == identity.entries[i].wrapper ||
+      identity.entries[i].wrapper->data != data)
+    return;
+  identity.count--;
+  /* backward shift deletion keeps the probe sequences intact */
+  for (j = (i + 1) & mask; NULL != identity.entries[j].wrapper;
+       j = (j + 1) & mask) {
+    size_t home = mrb_sdl2_gpu_identity_hash(identity.entries[j].ptr,
+                                             identity.entries[j].type) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      identity.entries[i] = identity.entries[j];
+      i = j;
+    }
+  }
+  identity.entries[i].wrapper = NULL;
+  identity.entries[i].ptr = NULL;
+  identity.entries[i].type = NULL;
+}
+
+/* Hands every wrapper to detach and empties the map, GPU.quit uses it once
+ * SDL_gpu is about to free everything the wrappers point to. */
+void
+mrb_sdl2_gpu_identity_clear(mrb_state *mrb,
+                            void (*detach)(mrb_state *, struct RData *)) {
+  size_t i;
+  for (i = 0; i < identity.capacity; i++) {
+    if (NULL != identity.entries[i].wrapper && NULL != detach)
+      detach(mrb, identity.entries[i].wrapper);
+  }
+  SDL_free(identity.entries);
+  identity.entries = NULL;
+  identity.capacity = 0;
+  identity.count = 0;
+}
+
+/* GPU.wrapper_stats -> {live:, hits:, misses:} */
+static mrb_value
+mrb_sdl2_gpu_wrapper_stats(mrb_state *mrb, mrb_value self) {
+  mrb_value stats = mrb_hash_new_capa(mrb, 3);
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "live")),
+               mrb_fixnum_value(identity.count));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "hits")),
+               mrb_fixnum_value(identity.hits));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "misses")),
+               mrb_fixnum_value(identity.misses));
+  return stats;
+}
+
+void
+mrb_sdl2_gpu_identity_init(mrb_state *mrb) {
+  mrb_define_module_function(mrb, mod_GPU, "wrapper_stats", mrb_sdl2_gpu_wrapper_stats, MRB_ARGS_NONE());
+}
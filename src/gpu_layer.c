@@ -0,0 +1,295 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::Layer - static content recorded once into an offscreen image and
+  blitted as a single quad until it is invalidated. The texture follows the
+  pixel density of the target it is drawn onto, so a virtual resolution
+  change re-records the layer at the new scale.
+
+    hud = GPU::Layer.new(320, 64) { |t| ...draw the frame into t... }
+    hud.draw(screen, 0, 0)
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/variable.h"
+#include "mruby/hash.h"
+
+#include "../include/gpu.h"
+
+static struct RClass *class_Layer = NULL;
+
+/* texture memory held by every live layer, see GPU::Layer.stats */
+static size_t layer_bytes = 0;
+static Uint32 layer_count = 0;
+static Uint32 layer_renders = 0;
+
+/*************************************
+ * GPU::Layer bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_layer_data_t {
+  float       w;
+  float       h;
+  GPU_Image  *image;
+  GPU_Target *target;
+  float       scale_x;  /* texels per layer unit */
+  float       scale_y;
+  size_t      bytes;
+  mrb_bool    dirty;
+} mrb_sdl2_gpu_layer_data_t;
+
+static void
+mrb_sdl2_gpu_layer_destroy(mrb_sdl2_gpu_layer_data_t *data) {
+  if (NULL != data->target) {
+    mrb_sdl2_gpu_multi_batch_end(data->target);
+    GPU_FreeTarget(data->target);
+    data->target = NULL;
+  }
+  if (NULL != data->image) {
+    mrb_sdl2_gpu_multi_batch_forget(data->image);
+    mrb_sdl2_gpu_vram_remove(data->image);
+    GPU_FreeImage(data->image);
+    data->image = NULL;
+  }
+  layer_bytes -= data->bytes;
+  data->bytes = 0;
+}
+
+static void
+mrb_sdl2_gpu_layer_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_layer_data_t *data = (mrb_sdl2_gpu_layer_data_t*)p;
+  if (NULL == data)
+    return;
+  /* the wrappers reference the layer, so none of them is alive anymore */
+  mrb_sdl2_gpu_layer_destroy(data);
+  layer_count--;
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_layer_data_type = {
+  "Layer", mrb_sdl2_gpu_layer_data_free
+};
+
+static mrb_sdl2_gpu_layer_data_t *
+mrb_sdl2_gpu_layer_get_ptr(mrb_state *mrb, mrb_value layer) {
+  mrb_sdl2_gpu_layer_data_t *data =
+    (mrb_sdl2_gpu_layer_data_t*)
+      mrb_data_get_ptr(mrb, layer, &mrb_sdl2_gpu_layer_data_type);
+  if (NULL == data)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::Layer is not initialized");
+  return data;
+}
+
+/* Drops the texture and the wrappers handed out for it. */
+static void
+mrb_sdl2_gpu_layer_release(mrb_state *mrb, mrb_value self,
+                           mrb_sdl2_gpu_layer_data_t *data) {
+  mrb_value target = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__target__"));
+  mrb_value image = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__image__"));
+  if (!mrb_nil_p(target))
+    mrb_sdl2_gpu_target_detach(mrb, target);
+  if (!mrb_nil_p(image))
+    mrb_sdl2_gpu_image_detach(mrb, image);
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__target__"), mrb_nil_value());
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__image__"), mrb_nil_value());
+  mrb_sdl2_gpu_layer_destroy(data);
+}
+
+/* Creates the texture for the given density, re-using the current one
+ * when it already matches. */
+static void
+mrb_sdl2_gpu_layer_alloc(mrb_state *mrb, mrb_value self,
+                         mrb_sdl2_gpu_layer_data_t *data,
+                         float scale_x, float scale_y) {
+  Uint16 tw, th;
+  mrb_value obj;
+  if (NULL != data->image && scale_x == data->scale_x &&
+      scale_y == data->scale_y)
+    return;
+  mrb_sdl2_gpu_layer_release(mrb, self, data);
+  tw = (Uint16) SDL_max(1.0f, SDL_ceil(data->w * scale_x));
+  th = (Uint16) SDL_max(1.0f, SDL_ceil(data->h * scale_y));
+  if (!mrb_sdl2_gpu_vram_reserve(
+          mrb, mrb_sdl2_gpu_vram_estimate(tw, th, GPU_FORMAT_RGBA)))
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Layer would exceed the VRAM budget");
+  data->image = GPU_CreateImage(tw, th, GPU_FORMAT_RGBA);
+  if (NULL == data->image)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create the Layer Image");
+  data->target = GPU_LoadTarget(data->image);
+  if (NULL == data->target) {
+    GPU_FreeImage(data->image);
+    data->image = NULL;
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create the Layer Target");
+  }
+  mrb_sdl2_gpu_vram_add(data->image, "Layer");
+  /* record in layer units whatever the texture density */
+  GPU_SetVirtualResolution(data->target, (Uint16) data->w, (Uint16) data->h);
+  data->scale_x = scale_x;
+  data->scale_y = scale_y;
+  data->bytes = (size_t) data->image->texture_w * data->image->texture_h * 4;
+  layer_bytes += data->bytes;
+  data->dirty = TRUE;
+
+  obj = mrb_sdl2_gpu_target_borrowed(mrb, data->target);
+  mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "__layer__"), self);
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__target__"), obj);
+  obj = mrb_sdl2_gpu_image_borrowed(mrb, data->image);
+  mrb_iv_set(mrb, obj, mrb_intern_lit(mrb, "__layer__"), self);
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__image__"), obj);
+}
+
+static void
+mrb_sdl2_gpu_layer_render(mrb_state *mrb, mrb_value self,
+                          mrb_sdl2_gpu_layer_data_t *data) {
+  mrb_value block = mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__block__"));
+  mrb_sdl2_gpu_multi_batch_touch(data->image);
+  GPU_Clear(data->target);
+  data->dirty = FALSE;
+  layer_renders++;
+  if (!mrb_nil_p(block))
+    mrb_yield(mrb, block,
+              mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__target__")));
+}
+
+/* new(w, h) { |target| ... } */
+static mrb_value
+mrb_sdl2_gpu_layer_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_int w, h;
+  mrb_value block = mrb_nil_value();
+  mrb_sdl2_gpu_layer_data_t *data =
+    (mrb_sdl2_gpu_layer_data_t*)DATA_PTR(self);
+  mrb_get_args(mrb, "ii&", &w, &h, &block);
+  if (w <= 0 || h <= 0 || w > 0xffff || h > 0xffff)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "invalid Layer size");
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_layer_data_t*)
+        mrb_calloc(mrb, 1, sizeof(mrb_sdl2_gpu_layer_data_t));
+    if (NULL == data) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+    layer_count++;
+  } else {
+    mrb_sdl2_gpu_layer_release(mrb, self, data);
+  }
+  data->w = w;
+  data->h = h;
+  data->dirty = TRUE;
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_layer_data_type;
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__block__"), block);
+  return self;
+}
+
+/* draw(target, x, y) - records the layer first when it is dirty or the
+ * target's pixel density changed since the last recording. */
+static mrb_value
+mrb_sdl2_gpu_layer_draw(mrb_state *mrb, mrb_value self) {
+  mrb_value target;
+  mrb_float x, y;
+  mrb_sdl2_gpu_layer_data_t *data = mrb_sdl2_gpu_layer_get_ptr(mrb, self);
+  GPU_Target *t;
+  float scale_x = 1.0f, scale_y = 1.0f;
+  mrb_get_args(mrb, "off", &target, &x, &y);
+  t = mrb_sdl2_gpu_target_get_ptr(mrb, target);
+  if (NULL == t)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
+  if (t->using_virtual_resolution && t->w > 0 && t->h > 0) {
+    scale_x = (float) t->base_w / t->w;
+    scale_y = (float) t->base_h / t->h;
+  }
+  mrb_sdl2_gpu_layer_alloc(mrb, self, data, scale_x, scale_y);
+  if (data->dirty)
+    mrb_sdl2_gpu_layer_render(mrb, self, data);
+  if (mrb_sdl2_gpu_cull_box(t, x, y, x + data->w, y + data->h))
+    return self;
+  GPU_BlitScale(data->image, NULL, t, x + data->w / 2.0f, y + data->h / 2.0f,
+                data->w / data->image->w, data->h / data->image->h);
+  return self;
+}
+
+/* Re-records right away instead of on the next draw. */
+static mrb_value
+mrb_sdl2_gpu_layer_refresh(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_layer_data_t *data = mrb_sdl2_gpu_layer_get_ptr(mrb, self);
+  mrb_sdl2_gpu_layer_alloc(mrb, self, data,
+                           NULL == data->image ? 1.0f : data->scale_x,
+                           NULL == data->image ? 1.0f : data->scale_y);
+  mrb_sdl2_gpu_layer_render(mrb, self, data);
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_layer_invalidate(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_layer_get_ptr(mrb, self)->dirty = TRUE;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_layer_is_dirty(mrb_state *mrb, mrb_value self) {
+  return mrb_bool_value(mrb_sdl2_gpu_layer_get_ptr(mrb, self)->dirty);
+}
+
+static mrb_value
+mrb_sdl2_gpu_layer_image(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_layer_get_ptr(mrb, self);
+  return mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__image__"));
+}
+
+static mrb_value
+mrb_sdl2_gpu_layer_width(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value((mrb_int) mrb_sdl2_gpu_layer_get_ptr(mrb, self)->w);
+}
+
+static mrb_value
+mrb_sdl2_gpu_layer_height(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value((mrb_int) mrb_sdl2_gpu_layer_get_ptr(mrb, self)->h);
+}
+
+static mrb_value
+mrb_sdl2_gpu_layer_bytes(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value((mrb_int) mrb_sdl2_gpu_layer_get_ptr(mrb, self)->bytes);
+}
+
+/* Frees the texture now; the next draw records the layer again. */
+static mrb_value
+mrb_sdl2_gpu_layer_free(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_layer_data_t *data = mrb_sdl2_gpu_layer_get_ptr(mrb, self);
+  mrb_sdl2_gpu_layer_release(mrb, self, data);
+  data->dirty = TRUE;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_layer_stats(mrb_state *mrb, mrb_value self) {
+  mrb_value hash = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "count")),
+               mrb_fixnum_value(layer_count));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "bytes")),
+               mrb_fixnum_value((mrb_int) layer_bytes));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "renders")),
+               mrb_fixnum_value(layer_renders));
+  return hash;
+}
+/***********************************
+ * GPU::Layer bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_layer_init(mrb_state *mrb) {
+  class_Layer = mrb_define_class_under(mrb, mod_GPU, "Layer", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_Layer, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_Layer, "initialize",  mrb_sdl2_gpu_layer_initialize, MRB_ARGS_REQ(2) | MRB_ARGS_BLOCK());
+  mrb_define_method(mrb, class_Layer, "draw",        mrb_sdl2_gpu_layer_draw,       MRB_ARGS_REQ(3));
+  mrb_define_method(mrb, class_Layer, "refresh",     mrb_sdl2_gpu_layer_refresh,    MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Layer, "invalidate",  mrb_sdl2_gpu_layer_invalidate, MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Layer, "dirty?",      mrb_sdl2_gpu_layer_is_dirty,   MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Layer, "image",       mrb_sdl2_gpu_layer_image,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Layer, "width",       mrb_sdl2_gpu_layer_width,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Layer, "height",      mrb_sdl2_gpu_layer_height,     MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Layer, "bytes",       mrb_sdl2_gpu_layer_bytes,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Layer, "free",        mrb_sdl2_gpu_layer_free,       MRB_ARGS_NONE());
+
+  mrb_define_class_method(mrb, class_Layer, "stats", mrb_sdl2_gpu_layer_stats,     MRB_ARGS_NONE());
+}
@@ -0,0 +1,872 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::Mesh and GPU::InstanceBuffer - geometry living in GL buffers and
+  instanced drawing of it. A mesh is uploaded once and only changes through
+  update_vertices/update_indices; Target#draw_mesh draws it as is and
+  Target#draw_instanced once per instance with the transform and color
+  taken from the packed instance buffer, so nothing is expanded on the CPU.
+
+  Programs used with draw_instanced read these attributes:
+    gpu_Vertex (vec2), gpu_TexCoord (vec2)       per vertex
+    i_transform (vec4: x, y, scale x, scale y)   per instance
+    i_rotation (float, degrees), i_color (vec4)  per instance
+  and the gpu_ModelViewProjectionMatrix and tex uniforms.
+  */
+
+#include <stddef.h>
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/array.h"
+#include "mruby/string.h"
+
+#include "../include/gpu_gl.h"
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_MESH_FLOATS 4  /* x, y, s, t */
+#define MRB_SDL2_GPU_MESH_MAX_ATTRIBUTES 8
+
+static struct RClass *class_Mesh           = NULL;
+static struct RClass *class_InstanceBuffer = NULL;
+
+static Uint32 instancing_program = 0;
+static Uint32 mesh_program       = 0;
+
+static const char *mrb_sdl2_gpu_instancing_vertex_source =
+  "attribute vec2 gpu_Vertex;\n"
+  "attribute vec2 gpu_TexCoord;\n"
+  "attribute vec4 i_transform;\n"
+  "attribute float i_rotation;\n"
+  "attribute vec4 i_color;\n"
+  "uniform mat4 gpu_ModelViewProjectionMatrix;\n"
+  "varying vec4 color;\n"
+  "varying vec2 texCoord;\n"
+  "void main() {\n"
+  "  float a = radians(i_rotation);\n"
+  "  vec2 p = gpu_Vertex * i_transform.zw;\n"
+  "  p = vec2(p.x * cos(a) - p.y * sin(a), p.x * sin(a) + p.y * cos(a));\n"
+  "  color = i_color;\n"
+  "  texCoord = gpu_TexCoord;\n"
+  "  gl_Position = gpu_ModelViewProjectionMatrix *\n"
+  "                vec4(p + i_transform.xy, 0.0, 1.0);\n"
+  "}\n";
+
+static const char *mrb_sdl2_gpu_instancing_fragment_source =
+  "varying vec4 color;\n"
+  "varying vec2 texCoord;\n"
+  "uniform sampler2D tex;\n"
+  "void main() {\n"
+  "  gl_FragColor = texture2D(tex, texCoord) * color;\n"
+  "}\n";
+
+static const char *mrb_sdl2_gpu_mesh_fragment_source =
+  "varying vec4 color;\n"
+  "varying vec2 texCoord;\n"
+  "uniform sampler2D tex;\n"
+  "void main() {\n"
+  "  gl_FragColor = texture2D(tex, texCoord) * color;\n"
+  "}\n";
+
+/*************************************
+ * GPU::Mesh bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_mesh_data_t {
+  GLuint vbo;
+  GLuint ibo;
+  Uint32 generation;       /* of the context the buffers were made in */
+  int    vertex_count;
+  int    index_count;
+  GLenum index_type;       /* GL_UNSIGNED_SHORT or GL_UNSIGNED_INT */
+  int    stride;
+  int    attribute_count;  /* 0 for the default x, y, s, t layout */
+  GPU_Attribute attributes[MRB_SDL2_GPU_MESH_MAX_ATTRIBUTES];
+} mrb_sdl2_gpu_mesh_data_t;
+
+static void
+mrb_sdl2_gpu_mesh_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_mesh_data_t *data = (mrb_sdl2_gpu_mesh_data_t*)p;
+  if (NULL == data)
+    return;
+  mrb_sdl2_gpu_gl_delete_buffer(data->vbo, data->generation);
+  mrb_sdl2_gpu_gl_delete_buffer(data->ibo, data->generation);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_mesh_data_type = {
+  "Mesh", mrb_sdl2_gpu_mesh_data_free
+};
+
+/* Buffers of a context closed by GPU.quit are gone with it. */
+static void
+mrb_sdl2_gpu_mesh_check_context(mrb_sdl2_gpu_mesh_data_t *data) {
+  if (data->generation == mrb_sdl2_gpu_gl_generation())
+    return;
+  data->vbo = 0;
+  data->ibo = 0;
+  data->vertex_count = 0;
+  data->index_count = 0;
+  data->generation = mrb_sdl2_gpu_gl_generation();
+}
+
+static mrb_sdl2_gpu_mesh_data_t *
+mrb_sdl2_gpu_mesh_get_ptr(mrb_state *mrb, mrb_value mesh) {
+  mrb_sdl2_gpu_mesh_data_t *data =
+    (mrb_sdl2_gpu_mesh_data_t*)
+      mrb_data_get_ptr(mrb, mesh, &mrb_sdl2_gpu_mesh_data_type);
+  if (NULL != data)
+    mrb_sdl2_gpu_mesh_check_context(data);
+  if (NULL == data || 0 == data->vbo)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::Mesh is not initialized");
+  return data;
+}
+
+static int
+mrb_sdl2_gpu_mesh_type_size(GPU_TypeEnum type) {
+  switch (type) {
+    case GPU_TYPE_BYTE:
+    case GPU_TYPE_UNSIGNED_BYTE:
+      return 1;
+    case GPU_TYPE_SHORT:
+    case GPU_TYPE_UNSIGNED_SHORT:
+      return 2;
+    case GPU_TYPE_DOUBLE:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
+/* Copies the formats of an Array of GPU::Attribute and derives the vertex
+ * size from them. The attribute locations are the program's. */
+static void
+mrb_sdl2_gpu_mesh_set_layout(mrb_state *mrb, mrb_sdl2_gpu_mesh_data_t *data,
+                             mrb_value layout) {
+  mrb_int i;
+  data->attribute_count = 0;
+  data->stride = sizeof(float) * MRB_SDL2_GPU_MESH_FLOATS;
+  if (mrb_nil_p(layout))
+    return;
+  if (RARRAY_LEN(layout) > MRB_SDL2_GPU_MESH_MAX_ATTRIBUTES)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "too many mesh attributes");
+  data->stride = 0;
+  for (i = 0; i < RARRAY_LEN(layout); i++) {
+    GPU_Attribute *attribute =
+      mrb_sdl2_gpu_attribute_get_ptr(mrb, RARRAY_PTR(layout)[i]);
+    GPU_AttributeFormat *format;
+    int end;
+    if (NULL == attribute)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "mesh layout is an Array of Attribute");
+    format = &attribute->format;
+    end = format->offset_bytes +
+          format->num_elems_per_value * mrb_sdl2_gpu_mesh_type_size(format->type);
+    data->stride = SDL_max(data->stride, SDL_max(format->stride_bytes, end));
+    data->attributes[data->attribute_count++] = *attribute;
+  }
+  if (0 == data->stride)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "mesh layout has no vertex size");
+}
+
+/* Vertex data is an Array, packed as 32 bit floats, or a String of raw
+ * bytes (Array#pack) for layouts using other types. Sets *owned when the
+ * returned buffer has to be released with mrb_free. */
+static void const *
+mrb_sdl2_gpu_mesh_vertex_data(mrb_state *mrb, mrb_value values, size_t *bytes,
+                              mrb_bool *owned) {
+  float *floats;
+  mrb_int i, n;
+  if (mrb_string_p(values)) {
+    *owned = FALSE;
+    *bytes = RSTRING_LEN(values);
+    return RSTRING_PTR(values);
+  }
+  if (!mrb_array_p(values))
+    mrb_raise(mrb, E_TYPE_ERROR, "vertex data is an Array or a String");
+  n = RARRAY_LEN(values);
+  /* checked before the buffer exists, the conversion cannot raise */
+  for (i = 0; i < n; i++) {
+    if (!mrb_fixnum_p(RARRAY_PTR(values)[i]) &&
+        !mrb_float_p(RARRAY_PTR(values)[i]))
+      mrb_raise(mrb, E_TYPE_ERROR, "vertex values must be numbers");
+  }
+  floats = (float*) mrb_malloc(mrb, sizeof(float) * (n > 0 ? n : 1));
+  for (i = 0; i < n; i++) {
+    floats[i] = mrb_to_flo(mrb, RARRAY_PTR(values)[i]);
+  }
+  *owned = TRUE;
+  *bytes = sizeof(float) * n;
+  return floats;
+}
+
+/* Converts an Array of indices to the mesh index type. */
+static void *
+mrb_sdl2_gpu_mesh_index_data(mrb_state *mrb, mrb_sdl2_gpu_mesh_data_t *data,
+                             mrb_value indices, size_t *bytes) {
+  mrb_int i, n = RARRAY_LEN(indices);
+  size_t size = GL_UNSIGNED_SHORT == data->index_type ?
+                  sizeof(Uint16) : sizeof(Uint32);
+  void *values;
+  /* checked before the buffer exists, converting them again below
+   * cannot raise */
+  for (i = 0; i < n; i++) {
+    mrb_value v = RARRAY_PTR(indices)[i];
+    mrb_int index;
+    if (!mrb_fixnum_p(v) && !mrb_float_p(v))
+      mrb_raise(mrb, E_TYPE_ERROR, "mesh indices must be numbers");
+    index = mrb_fixnum(mrb_to_int(mrb, v));
+    if (index < 0 || index >= data->vertex_count)
+      mrb_raise(mrb, E_INDEX_ERROR, "mesh index out of range");
+  }
+  values = mrb_malloc(mrb, size * (n > 0 ? n : 1));
+  for (i = 0; i < n; i++) {
+    mrb_int index = mrb_fixnum(mrb_to_int(mrb, RARRAY_PTR(indices)[i]));
+    if (GL_UNSIGNED_SHORT == data->index_type)
+      ((Uint16*) values)[i] = (Uint16) index;
+    else
+      ((Uint32*) values)[i] = (Uint32) index;
+  }
+  *bytes = size * n;
+  return values;
+}
+
+/* new(vertices, indices = nil, layout = nil)
+ *
+ * Uploads the vertices, and the triangle list indices if given, once into
+ * GL buffers. Without a layout vertices are [x, y, s, t, ...] with texture
+ * coordinates in 0..1, read by gpu_Vertex and gpu_TexCoord. A layout is an
+ * Array of GPU::Attribute whose location and format describe one attribute
+ * each, the values of the attributes are unused. */
+static mrb_value
+mrb_sdl2_gpu_mesh_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_value vertices, indices = mrb_nil_value(), layout = mrb_nil_value();
+  mrb_sdl2_gpu_mesh_data_t *data =
+    (mrb_sdl2_gpu_mesh_data_t*)DATA_PTR(self);
+  void const *values;
+  void *index_values;
+  size_t bytes, index_bytes;
+  mrb_int index_count;
+  mrb_bool owned;
+  mrb_get_args(mrb, "o|A!A!", &vertices, &indices, &layout);
+  mrb_sdl2_gpu_gl_require(mrb);
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_mesh_data_t*)
+        mrb_calloc(mrb, 1, sizeof(mrb_sdl2_gpu_mesh_data_t));
+    if (NULL == data) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+  }
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_mesh_data_type;
+  mrb_sdl2_gpu_mesh_check_context(data);
+  mrb_sdl2_gpu_mesh_set_layout(mrb, data, layout);
+
+  values = mrb_sdl2_gpu_mesh_vertex_data(mrb, vertices, &bytes, &owned);
+  if (0 == bytes || 0 != bytes % data->stride) {
+    if (owned)
+      mrb_free(mrb, (void*) values);
+    mrb_raise(mrb, E_ARGUMENT_ERROR,
+              "mesh vertex data is not a whole number of vertices");
+  }
+  data->vertex_count = bytes / data->stride;
+  data->index_count = 0;
+  data->index_type = data->vertex_count > 65536 ?
+                       GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+  index_count = mrb_nil_p(indices) ? 0 : RARRAY_LEN(indices);
+  if (0 != (index_count ? index_count : data->vertex_count) % 3) {
+    if (owned)
+      mrb_free(mrb, (void*) values);
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "mesh is not a list of triangles");
+  }
+
+  if (0 == data->vbo)
+    glGenBuffers(1, &data->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, data->vbo);
+  glBufferData(GL_ARRAY_BUFFER, bytes, values, GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  if (owned)
+    mrb_free(mrb, (void*) values);
+
+  if (0 == index_count) {
+    mrb_sdl2_gpu_gl_delete_buffer(data->ibo, data->generation);
+    data->ibo = 0;
+    return self;
+  }
+  index_values = mrb_sdl2_gpu_mesh_index_data(mrb, data, indices,
+                                              &index_bytes);
+  if (0 == data->ibo)
+    glGenBuffers(1, &data->ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, data->ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, index_values,
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  mrb_free(mrb, index_values);
+  data->index_count = index_count;
+  return self;
+}
+
+/* update_vertices(byte_offset, data) rewrites part of the vertex buffer in
+ * place, data is an Array of floats or a String like for new. */
+static mrb_value
+mrb_sdl2_gpu_mesh_update_vertices(mrb_state *mrb, mrb_value self) {
+  mrb_int offset;
+  mrb_value vertices;
+  mrb_sdl2_gpu_mesh_data_t *data = mrb_sdl2_gpu_mesh_get_ptr(mrb, self);
+  void const *values;
+  size_t bytes;
+  mrb_bool owned;
+  mrb_get_args(mrb, "io", &offset, &vertices);
+  values = mrb_sdl2_gpu_mesh_vertex_data(mrb, vertices, &bytes, &owned);
+  if (offset < 0 ||
+      (size_t) offset + bytes > (size_t) data->vertex_count * data->stride) {
+    if (owned)
+      mrb_free(mrb, (void*) values);
+    mrb_raise(mrb, E_INDEX_ERROR, "vertex update out of range");
+  }
+  if (bytes > 0) {
+    glBindBuffer(GL_ARRAY_BUFFER, data->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, values);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+  if (owned)
+    mrb_free(mrb, (void*) values);
+  return self;
+}
+
+/* update_indices(first, [i, ...]) rewrites indices starting at first. */
+static mrb_value
+mrb_sdl2_gpu_mesh_update_indices(mrb_state *mrb, mrb_value self) {
+  mrb_int first;
+  mrb_value indices;
+  mrb_sdl2_gpu_mesh_data_t *data = mrb_sdl2_gpu_mesh_get_ptr(mrb, self);
+  void *values;
+  size_t bytes;
+  mrb_get_args(mrb, "iA", &first, &indices);
+  if (first < 0 || first + RARRAY_LEN(indices) > data->index_count)
+    mrb_raise(mrb, E_INDEX_ERROR, "index update out of range");
+  if (0 == RARRAY_LEN(indices))
+    return self;
+  values = mrb_sdl2_gpu_mesh_index_data(mrb, data, indices, &bytes);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, data->ibo);
+  glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, first * (bytes / RARRAY_LEN(indices)),
+                  bytes, values);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  mrb_free(mrb, values);
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_mesh_vertex_count(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_mesh_get_ptr(mrb, self)->vertex_count);
+}
+
+static mrb_value
+mrb_sdl2_gpu_mesh_index_count(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_mesh_get_ptr(mrb, self)->index_count);
+}
+
+static mrb_value
+mrb_sdl2_gpu_mesh_stride(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_mesh_get_ptr(mrb, self)->stride);
+}
+
+static mrb_value
+mrb_sdl2_gpu_mesh_free(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_mesh_data_t *data = mrb_sdl2_gpu_mesh_get_ptr(mrb, self);
+  mrb_sdl2_gpu_gl_delete_buffer(data->vbo, data->generation);
+  mrb_sdl2_gpu_gl_delete_buffer(data->ibo, data->generation);
+  data->vbo = 0;
+  data->ibo = 0;
+  data->vertex_count = 0;
+  data->index_count = 0;
+  return mrb_nil_value();
+}
+/***********************************
+ * GPU::Mesh bindings ends here
+ ***********************************/
+
+/*************************************
+ * GPU::InstanceBuffer bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_instance_t {
+  float x, y;
+  float scale_x, scale_y;
+  float rotation;
+  Uint8 r, g, b, a;
+} mrb_sdl2_gpu_instance_t;
+
+typedef struct mrb_sdl2_gpu_instance_buffer_data_t {
+  mrb_sdl2_gpu_instance_t *instances;
+  int    count;
+  int    capacity;
+  GLuint vbo;
+  Uint32 generation;  /* of the context vbo was made in */
+  int    uploaded_capacity;
+  int    dirty_from;  /* first and one past the last modified instance */
+  int    dirty_to;
+} mrb_sdl2_gpu_instance_buffer_data_t;
+
+static void
+mrb_sdl2_gpu_instance_buffer_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_instance_buffer_data_t *data =
+    (mrb_sdl2_gpu_instance_buffer_data_t*)p;
+  if (NULL == data)
+    return;
+  mrb_sdl2_gpu_gl_delete_buffer(data->vbo, data->generation);
+  mrb_free(mrb, data->instances);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_instance_buffer_data_type = {
+  "InstanceBuffer", mrb_sdl2_gpu_instance_buffer_data_free
+};
+
+static mrb_sdl2_gpu_instance_buffer_data_t *
+mrb_sdl2_gpu_instance_buffer_get_ptr(mrb_state *mrb, mrb_value buffer) {
+  mrb_sdl2_gpu_instance_buffer_data_t *data =
+    (mrb_sdl2_gpu_instance_buffer_data_t*)
+      mrb_data_get_ptr(mrb, buffer, &mrb_sdl2_gpu_instance_buffer_data_type);
+  if (NULL == data)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::InstanceBuffer is not initialized");
+  return data;
+}
+
+static void
+mrb_sdl2_gpu_instance_touch(mrb_sdl2_gpu_instance_buffer_data_t *data,
+                            int index) {
+  if (data->dirty_from >= data->dirty_to) {
+    data->dirty_from = index;
+    data->dirty_to = index + 1;
+  } else {
+    data->dirty_from = SDL_min(data->dirty_from, index);
+    data->dirty_to = SDL_max(data->dirty_to, index + 1);
+  }
+}
+
+static void
+mrb_sdl2_gpu_instance_store(mrb_sdl2_gpu_instance_buffer_data_t *data,
+                            int index, float const *v, int argc) {
+  mrb_sdl2_gpu_instance_t *instance = &data->instances[index];
+  instance->x = v[0];
+  instance->y = v[1];
+  instance->scale_x = argc > 2 ? v[2] : 1.0f;
+  instance->scale_y = argc > 3 ? v[3] : instance->scale_x;
+  instance->rotation = argc > 4 ? v[4] : 0.0f;
+  instance->r = argc > 5 ? (Uint8) v[5] : 255;
+  instance->g = argc > 6 ? (Uint8) v[6] : 255;
+  instance->b = argc > 7 ? (Uint8) v[7] : 255;
+  instance->a = argc > 8 ? (Uint8) v[8] : 255;
+  mrb_sdl2_gpu_instance_touch(data, index);
+}
+
+static mrb_value
+mrb_sdl2_gpu_instance_buffer_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_int capacity;
+  mrb_sdl2_gpu_instance_buffer_data_t *data =
+    (mrb_sdl2_gpu_instance_buffer_data_t*)DATA_PTR(self);
+  mrb_get_args(mrb, "i", &capacity);
+  if (capacity <= 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "capacity must be positive");
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_instance_buffer_data_t*)
+        mrb_calloc(mrb, 1, sizeof(mrb_sdl2_gpu_instance_buffer_data_t));
+    if (NULL == data) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+  }
+  data->instances = (mrb_sdl2_gpu_instance_t*) mrb_realloc(mrb,
+      data->instances, sizeof(mrb_sdl2_gpu_instance_t) * capacity);
+  SDL_memset(data->instances, 0, sizeof(mrb_sdl2_gpu_instance_t) * capacity);
+  data->capacity = capacity;
+  data->count = 0;
+  data->uploaded_capacity = 0;
+  data->dirty_from = 0;
+  data->dirty_to = 0;
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_instance_buffer_data_type;
+  return self;
+}
+
+/* set(index, x, y, scale_x = 1, scale_y = scale_x, rotation = 0,
+ *     r = 255, g = 255, b = 255, a = 255) */
+static mrb_value
+mrb_sdl2_gpu_instance_buffer_set(mrb_state *mrb, mrb_value self) {
+  mrb_int index;
+  mrb_float f[9];
+  float v[9];
+  mrb_sdl2_gpu_instance_buffer_data_t *data =
+    mrb_sdl2_gpu_instance_buffer_get_ptr(mrb, self);
+  int argc = mrb_get_args(mrb, "iff|fffffff", &index, &f[0], &f[1], &f[2],
+                          &f[3], &f[4], &f[5], &f[6], &f[7], &f[8]) - 1;
+  int k;
+  if (index < 0 || index >= data->capacity)
+    mrb_raise(mrb, E_INDEX_ERROR, "instance index out of range");
+  for (k = 0; k < argc; k++) {
+    v[k] = f[k];
+  }
+  mrb_sdl2_gpu_instance_store(data, index, v, argc);
+  if (index >= data->count)
+    data->count = index + 1;
+  return self;
+}
+
+/* push(x, y, ...) -> index, same arguments as set */
+static mrb_value
+mrb_sdl2_gpu_instance_buffer_push(mrb_state *mrb, mrb_value self) {
+  mrb_float f[9];
+  float v[9];
+  mrb_sdl2_gpu_instance_buffer_data_t *data =
+    mrb_sdl2_gpu_instance_buffer_get_ptr(mrb, self);
+  int argc = mrb_get_args(mrb, "ff|fffffff", &f[0], &f[1], &f[2], &f[3],
+                          &f[4], &f[5], &f[6], &f[7], &f[8]);
+  int k;
+  if (data->count == data->capacity)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "InstanceBuffer is full");
+  for (k = 0; k < argc; k++) {
+    v[k] = f[k];
+  }
+  mrb_sdl2_gpu_instance_store(data, data->count, v, argc);
+  return mrb_fixnum_value(data->count++);
+}
+
+/* load([x, y, scale_x, scale_y, rotation, r, g, b, a, ...]) replaces the
+ * contents with 9 values per instance */
+static mrb_value
+mrb_sdl2_gpu_instance_buffer_load(mrb_state *mrb, mrb_value self) {
+  mrb_value values;
+  mrb_sdl2_gpu_instance_buffer_data_t *data =
+    mrb_sdl2_gpu_instance_buffer_get_ptr(mrb, self);
+  mrb_int i, n;
+  float v[9];
+  int k;
+  mrb_get_args(mrb, "A", &values);
+  n = RARRAY_LEN(values);
+  if (0 != n % 9)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "instances are 9 values each");
+  if (n / 9 > data->capacity)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "more instances than capacity");
+  for (i = 0; i < n / 9; i++) {
+    for (k = 0; k < 9; k++) {
+      v[k] = mrb_to_flo(mrb, RARRAY_PTR(values)[i * 9 + k]);
+    }
+    mrb_sdl2_gpu_instance_store(data, i, v, 9);
+  }
+  data->count = n / 9;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_instance_buffer_count(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_instance_buffer_get_ptr(mrb, self)->count);
+}
+
+static mrb_value
+mrb_sdl2_gpu_instance_buffer_set_count(mrb_state *mrb, mrb_value self) {
+  mrb_int count;
+  mrb_sdl2_gpu_instance_buffer_data_t *data =
+    mrb_sdl2_gpu_instance_buffer_get_ptr(mrb, self);
+  mrb_get_args(mrb, "i", &count);
+  if (count < 0 || count > data->capacity)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "count out of range");
+  if (count > data->count) {
+    mrb_sdl2_gpu_instance_touch(data, data->count);
+    mrb_sdl2_gpu_instance_touch(data, count - 1);
+  }
+  data->count = count;
+  return mrb_fixnum_value(count);
+}
+
+static mrb_value
+mrb_sdl2_gpu_instance_buffer_capacity(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_instance_buffer_get_ptr(mrb, self)->capacity);
+}
+
+static mrb_value
+mrb_sdl2_gpu_instance_buffer_clear(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_instance_buffer_get_ptr(mrb, self)->count = 0;
+  return self;
+}
+
+/* Sends the modified range to the GL buffer, the whole buffer after a
+ * resize or when GPU.quit took the old one with its context. */
+static void
+mrb_sdl2_gpu_instance_buffer_upload(mrb_sdl2_gpu_instance_buffer_data_t *data) {
+  if (data->generation != mrb_sdl2_gpu_gl_generation()) {
+    data->vbo = 0;
+    data->uploaded_capacity = 0;
+    data->generation = mrb_sdl2_gpu_gl_generation();
+  }
+  if (0 == data->vbo)
+    glGenBuffers(1, &data->vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, data->vbo);
+  if (data->uploaded_capacity != data->capacity) {
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(mrb_sdl2_gpu_instance_t) * data->capacity,
+                 data->instances, GL_DYNAMIC_DRAW);
+    data->uploaded_capacity = data->capacity;
+  } else if (data->dirty_from < data->dirty_to) {
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    sizeof(mrb_sdl2_gpu_instance_t) * data->dirty_from,
+                    sizeof(mrb_sdl2_gpu_instance_t) *
+                      (data->dirty_to - data->dirty_from),
+                    &data->instances[data->dirty_from]);
+  }
+  data->dirty_from = 0;
+  data->dirty_to = 0;
+}
+/***********************************
+ * GPU::InstanceBuffer bindings ends here
+ ***********************************/
+
+static void
+mrb_sdl2_gpu_attrib_divisor(GLint location, GLuint divisor) {
+  if (!mrb_sdl2_gpu_gl_has_instancing())
+    return;
+  if (mrb_sdl2_gpu_gl_version(3, 3))
+    glVertexAttribDivisor(location, divisor);
+  else
+    glVertexAttribDivisorARB(location, divisor);
+}
+
+/* Enables a float attribute of the bound buffer if the program uses it. */
+static GLint
+mrb_sdl2_gpu_attrib(GLuint program, const char *name, GLint size,
+                    GLenum type, GLboolean normalized, GLsizei stride,
+                    size_t offset, GLuint divisor) {
+  GLint location = glGetAttribLocation(program, name);
+  if (location < 0)
+    return location;
+  glEnableVertexAttribArray(location);
+  glVertexAttribPointer(location, size, type, normalized, stride,
+                        (const GLvoid*) offset);
+  mrb_sdl2_gpu_attrib_divisor(location, divisor);
+  return location;
+}
+
+/* Binds the mesh buffers and enables its per vertex attributes, storing
+ * the locations in locations. Returns how many were stored. */
+static int
+mrb_sdl2_gpu_mesh_bind(mrb_sdl2_gpu_mesh_data_t *mesh, GLuint program,
+                       SDL_Color color, GLint *locations) {
+  GLint location;
+  int i, n = 0;
+  glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+  if (0 != mesh->ibo)
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+  if (0 == mesh->attribute_count) {
+    locations[n++] = mrb_sdl2_gpu_attrib(program, "gpu_Vertex", 2, GL_FLOAT,
+        GL_FALSE, mesh->stride, 0, 0);
+    locations[n++] = mrb_sdl2_gpu_attrib(program, "gpu_TexCoord", 2, GL_FLOAT,
+        GL_FALSE, mesh->stride, sizeof(float) * 2, 0);
+  }
+  for (i = 0; i < mesh->attribute_count; i++) {
+    GPU_Attribute *attribute = &mesh->attributes[i];
+    if (attribute->location < 0)
+      continue;
+    glEnableVertexAttribArray(attribute->location);
+    glVertexAttribPointer(attribute->location,
+                          attribute->format.num_elems_per_value,
+                          attribute->format.type,
+                          attribute->format.normalize ? GL_TRUE : GL_FALSE,
+                          mesh->stride,
+                          (const GLvoid*)(size_t) attribute->format.offset_bytes);
+    mrb_sdl2_gpu_attrib_divisor(attribute->location, 0);
+    locations[n++] = attribute->location;
+  }
+  /* a mesh without colors is tinted by the image color */
+  location = glGetAttribLocation(program, "gpu_Color");
+  for (i = 0; i < n && location >= 0; i++) {
+    if (locations[i] == location)
+      location = -1;
+  }
+  if (location >= 0) {
+    glDisableVertexAttribArray(location);
+    glVertexAttrib4f(location, color.r / 255.0f, color.g / 255.0f,
+                     color.b / 255.0f, color.a / 255.0f);
+  }
+  return n;
+}
+
+/* Undoes mrb_sdl2_gpu_mesh_bind and the instance attributes. */
+static void
+mrb_sdl2_gpu_mesh_unbind(GLint const *locations, int n) {
+  int k;
+  for (k = 0; k < n; k++) {
+    if (locations[k] < 0)
+      continue;
+    mrb_sdl2_gpu_attrib_divisor(locations[k], 0);
+    glDisableVertexAttribArray(locations[k]);
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+static GLuint
+mrb_sdl2_gpu_mesh_program(mrb_state *mrb, mrb_value program_obj,
+                          Uint32 *builtin, const char *vertex_source,
+                          const char *fragment_source) {
+  if (!mrb_nil_p(program_obj))
+    return mrb_sdl2_gpu_program_get_uint32(mrb, program_obj);
+  if (0 == *builtin)
+    *builtin = mrb_sdl2_gpu_builtin_program(mrb, vertex_source,
+                                            fragment_source);
+  return *builtin;
+}
+
+static void
+mrb_sdl2_gpu_mesh_uniforms(GLuint program, float const *mvp,
+                           GPU_Image *image) {
+  glUseProgram(program);
+  glUniformMatrix4fv(glGetUniformLocation(program,
+                                          "gpu_ModelViewProjectionMatrix"),
+                     1, GL_FALSE, mvp);
+  if (NULL != image) {
+    glUniform1i(glGetUniformLocation(program, "tex"), 0);
+    mrb_sdl2_gpu_gl_bind_image(image);
+  }
+}
+
+/* Target#draw_mesh(mesh, program = nil, image = nil) -> vertices drawn
+ *
+ * Draws the mesh straight from its GL buffers, nothing is uploaded. The
+ * program gets the target's gpu_ModelViewProjectionMatrix and the image on
+ * texture unit 0 as tex; the built-in program needs an image. */
+static mrb_value
+mrb_sdl2_gpu_target_draw_mesh(mrb_state *mrb, mrb_value self) {
+  mrb_value mesh_obj, program_obj = mrb_nil_value(), image_obj = mrb_nil_value();
+  GPU_Target *target = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  GPU_Image *image = NULL;
+  mrb_sdl2_gpu_mesh_data_t *mesh;
+  SDL_Color white = { 255, 255, 255, 255 };
+  GLuint program;
+  GLint locations[MRB_SDL2_GPU_MESH_MAX_ATTRIBUTES];
+  float mvp[16];
+  int n;
+  mrb_get_args(mrb, "o|oo", &mesh_obj, &program_obj, &image_obj);
+  if (NULL == target)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
+  mesh = mrb_sdl2_gpu_mesh_get_ptr(mrb, mesh_obj);
+  if (!mrb_nil_p(image_obj)) {
+    image = mrb_sdl2_gpu_image_get_ptr(mrb, image_obj);
+    if (NULL == image)
+      mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Image's ptr");
+  } else if (mrb_nil_p(program_obj)) {
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "the built-in mesh program needs an image");
+  }
+  program = mrb_sdl2_gpu_mesh_program(mrb, program_obj, &mesh_program,
+                                      mrb_sdl2_gpu_builtin_vertex_source,
+                                      mrb_sdl2_gpu_mesh_fragment_source);
+
+  mrb_sdl2_gpu_gl_begin(mrb, target, mvp);
+  mrb_sdl2_gpu_mesh_uniforms(program, mvp, image);
+  n = mrb_sdl2_gpu_mesh_bind(mesh, program,
+                             NULL != image ? image->color : white, locations);
+  if (0 != mesh->ibo)
+    glDrawElements(GL_TRIANGLES, mesh->index_count, mesh->index_type, NULL);
+  else
+    glDrawArrays(GL_TRIANGLES, 0, mesh->vertex_count);
+  mrb_sdl2_gpu_mesh_unbind(locations, n);
+  mrb_sdl2_gpu_gl_end();
+  return mrb_fixnum_value(0 != mesh->ibo ? mesh->index_count :
+                                           mesh->vertex_count);
+}
+
+/* Target#draw_instanced(image, mesh, instances, program = nil) -> count */
+static mrb_value
+mrb_sdl2_gpu_target_draw_instanced(mrb_state *mrb, mrb_value self) {
+  mrb_value image_obj, mesh_obj, buffer_obj, program_obj = mrb_nil_value();
+  GPU_Target *target = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  GPU_Image *image;
+  mrb_sdl2_gpu_mesh_data_t *mesh;
+  mrb_sdl2_gpu_instance_buffer_data_t *instances;
+  SDL_Color white = { 255, 255, 255, 255 };
+  GLuint program;
+  GLint locations[MRB_SDL2_GPU_MESH_MAX_ATTRIBUTES + 3];
+  float mvp[16];
+  int n;
+  mrb_get_args(mrb, "ooo|o", &image_obj, &mesh_obj, &buffer_obj, &program_obj);
+  if (NULL == target)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
+  image = mrb_sdl2_gpu_image_get_ptr(mrb, image_obj);
+  if (NULL == image)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Image's ptr");
+  mesh = mrb_sdl2_gpu_mesh_get_ptr(mrb, mesh_obj);
+  instances = mrb_sdl2_gpu_instance_buffer_get_ptr(mrb, buffer_obj);
+  mrb_sdl2_gpu_gl_require(mrb);
+  if (!mrb_sdl2_gpu_gl_has_instancing())
+    mrb_raise(mrb, E_RUNTIME_ERROR, "instanced rendering is not supported");
+  if (0 == instances->count)
+    return mrb_fixnum_value(0);
+  program = mrb_sdl2_gpu_mesh_program(mrb, program_obj, &instancing_program,
+                                      mrb_sdl2_gpu_instancing_vertex_source,
+                                      mrb_sdl2_gpu_instancing_fragment_source);
+
+  mrb_sdl2_gpu_gl_begin(mrb, target, mvp);
+  mrb_sdl2_gpu_mesh_uniforms(program, mvp, image);
+  n = mrb_sdl2_gpu_mesh_bind(mesh, program, white, locations);
+
+  mrb_sdl2_gpu_instance_buffer_upload(instances);
+  locations[n++] = mrb_sdl2_gpu_attrib(program, "i_transform", 4, GL_FLOAT,
+      GL_FALSE, sizeof(mrb_sdl2_gpu_instance_t), 0, 1);
+  locations[n++] = mrb_sdl2_gpu_attrib(program, "i_rotation", 1, GL_FLOAT,
+      GL_FALSE, sizeof(mrb_sdl2_gpu_instance_t),
+      offsetof(mrb_sdl2_gpu_instance_t, rotation), 1);
+  locations[n++] = mrb_sdl2_gpu_attrib(program, "i_color", 4, GL_UNSIGNED_BYTE,
+      GL_TRUE, sizeof(mrb_sdl2_gpu_instance_t),
+      offsetof(mrb_sdl2_gpu_instance_t, r), 1);
+
+  if (0 != mesh->ibo && mrb_sdl2_gpu_gl_version(3, 3))
+    glDrawElementsInstanced(GL_TRIANGLES, mesh->index_count, mesh->index_type,
+                            NULL, instances->count);
+  else if (0 != mesh->ibo)
+    glDrawElementsInstancedARB(GL_TRIANGLES, mesh->index_count,
+                               mesh->index_type, NULL, instances->count);
+  else if (mrb_sdl2_gpu_gl_version(3, 3))
+    glDrawArraysInstanced(GL_TRIANGLES, 0, mesh->vertex_count,
+                          instances->count);
+  else
+    glDrawArraysInstancedARB(GL_TRIANGLES, 0, mesh->vertex_count,
+                             instances->count);
+
+  mrb_sdl2_gpu_mesh_unbind(locations, n);
+  mrb_sdl2_gpu_gl_end();
+  return mrb_fixnum_value(instances->count);
+}
+
+/* Drops the built-in programs, GPU.quit calls it. */
+void
+mrb_sdl2_gpu_mesh_release(void) {
+  if (0 != instancing_program)
+    GPU_FreeShaderProgram(instancing_program);
+  if (0 != mesh_program)
+    GPU_FreeShaderProgram(mesh_program);
+  instancing_program = 0;
+  mesh_program = 0;
+}
+
+void
+mrb_sdl2_gpu_mesh_init(mrb_state *mrb) {
+  class_Mesh = mrb_define_class_under(mrb, mod_GPU, "Mesh", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_Mesh, MRB_TT_DATA);
+  class_InstanceBuffer = mrb_define_class_under(mrb, mod_GPU, "InstanceBuffer", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_InstanceBuffer, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_Mesh, "initialize",      mrb_sdl2_gpu_mesh_initialize,      MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+  mrb_define_method(mrb, class_Mesh, "update_vertices", mrb_sdl2_gpu_mesh_update_vertices, MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_Mesh, "update_indices",  mrb_sdl2_gpu_mesh_update_indices,  MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_Mesh, "vertex_count",    mrb_sdl2_gpu_mesh_vertex_count,    MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Mesh, "index_count",     mrb_sdl2_gpu_mesh_index_count,     MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Mesh, "stride",          mrb_sdl2_gpu_mesh_stride,          MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Mesh, "free",            mrb_sdl2_gpu_mesh_free,            MRB_ARGS_NONE());
+
+  mrb_define_method(mrb, class_InstanceBuffer, "initialize", mrb_sdl2_gpu_instance_buffer_initialize, MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_InstanceBuffer, "set",        mrb_sdl2_gpu_instance_buffer_set,        MRB_ARGS_REQ(3) | MRB_ARGS_OPT(7));
+  mrb_define_method(mrb, class_InstanceBuffer, "push",       mrb_sdl2_gpu_instance_buffer_push,       MRB_ARGS_REQ(2) | MRB_ARGS_OPT(7));
+  mrb_define_method(mrb, class_InstanceBuffer, "load",       mrb_sdl2_gpu_instance_buffer_load,       MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_InstanceBuffer, "count",      mrb_sdl2_gpu_instance_buffer_count,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_InstanceBuffer, "count=",     mrb_sdl2_gpu_instance_buffer_set_count,  MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_InstanceBuffer, "capacity",   mrb_sdl2_gpu_instance_buffer_capacity,   MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_InstanceBuffer, "clear",      mrb_sdl2_gpu_instance_buffer_clear,      MRB_ARGS_NONE());
+
+  mrb_define_method(mrb, class_Target, "draw_mesh",      mrb_sdl2_gpu_target_draw_mesh,      MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+  mrb_define_method(mrb, class_Target, "draw_instanced", mrb_sdl2_gpu_target_draw_instanced, MRB_ARGS_REQ(3) | MRB_ARGS_OPT(1));
+}
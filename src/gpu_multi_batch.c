@@ -0,0 +1,366 @@
+/*Copyright 2015 <Daniel Kolev>
+  Multi-texture batching - blits of different images go out as one draw
+  call. Every vertex carries the slot of its image and the program picks
+  the texture from an array of samplers, so interleaved draws need no
+  sorting by image:
+
+    screen.begin_multi_batch(8)
+    sprites.each { |s| screen.blit(s.image, nil, s.x, s.y) }
+    screen.end_multi_batch
+
+  Blits between begin and end are recorded instead of handed to SDL_gpu
+  and drawn through the streaming buffer. The batch goes out when its
+  slots or quads run out, when a blit needs other blending, and before
+  anything else draws on the target, reads it, changes its camera,
+  viewport or clip, flips or clears it. It also goes out before a
+  recorded image is drawn on, cleared, updated or gets another filter or
+  wrap mode, since those are read when the batch is drawn. Color, blend
+  and snap mode are taken when a blit is recorded.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+
+#include "../include/gpu_gl.h"
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_MULTI_BATCH_QUADS 4096
+
+static const char *mrb_sdl2_gpu_multi_batch_vertex_source =
+  "attribute vec3 gpu_Vertex;\n"
+  "attribute vec2 gpu_TexCoord;\n"
+  "attribute vec4 gpu_Color;\n"
+  "attribute float gpu_TexSlot;\n"
+  "uniform mat4 gpu_ModelViewProjectionMatrix;\n"
+  "varying vec4 color;\n"
+  "varying vec2 texCoord;\n"
+  "varying float texSlot;\n"
+  "void main() {\n"
+  "  color = gpu_Color;\n"
+  "  texCoord = gpu_TexCoord;\n"
+  "  texSlot = gpu_TexSlot;\n"
+  "  gl_Position = gpu_ModelViewProjectionMatrix * vec4(gpu_Vertex, 1.0);\n"
+  "}\n";
+
+static struct {
+  mrb_state  *mrb;
+  GPU_Target *target;  /* NULL when no batch is open */
+  int         slots;
+  mrb_sdl2_gpu_stream_program_t const *program;
+  GPU_Image  *images[MRB_SDL2_GPU_MAX_SLOTS];
+  int         num_images;
+  float      *vertices;
+  int         quads;
+  GPU_bool    use_blending;  /* of the recorded quads */
+  GPU_BlendMode blend_mode;
+  mrb_sdl2_gpu_stream_program_t programs[MRB_SDL2_GPU_MAX_SLOTS + 1];  /* by slot count */
+  Uint32      draws;
+  Uint32      drawn;  /* quads */
+} multi;
+
+/*************************************
+ * Multi-texture batch starts here
+ *************************************/
+
+/* GLSL 1.20 and ES 1.00 can only index sampler arrays with constants,
+ * hence the chain of ifs instead of tex[int(texSlot)]. */
+static Uint32
+mrb_sdl2_gpu_multi_batch_program(mrb_state *mrb, int slots) {
+  int arena = mrb_gc_arena_save(mrb);
+  mrb_value source = mrb_str_new_cstr(mrb,
+    "varying vec4 color;\n"
+    "varying vec2 texCoord;\n"
+    "varying float texSlot;\n");
+  char line[96];
+  Uint32 program;
+  int k;
+  SDL_snprintf(line, sizeof(line), "uniform sampler2D tex[%d];\n", slots);
+  mrb_str_cat_cstr(mrb, source, line);
+  mrb_str_cat_cstr(mrb, source, "void main() {\n  vec4 texel;\n");
+  for (k = 0; k < slots - 1; k++) {
+    SDL_snprintf(line, sizeof(line),
+                 "  %sif (texSlot < %d.5) texel = texture2D(tex[%d], texCoord);\n",
+                 0 == k ? "" : "else ", k, k);
+    mrb_str_cat_cstr(mrb, source, line);
+  }
+  SDL_snprintf(line, sizeof(line),
+               "  %stexel = texture2D(tex[%d], texCoord);\n",
+               1 == slots ? "" : "else ", slots - 1);
+  mrb_str_cat_cstr(mrb, source, line);
+  mrb_str_cat_cstr(mrb, source, "  gl_FragColor = texel * color;\n}\n");
+  program = mrb_sdl2_gpu_builtin_program(mrb,
+                                         mrb_sdl2_gpu_multi_batch_vertex_source,
+                                         RSTRING_PTR(source));
+  mrb_gc_arena_restore(mrb, arena);
+  return program;
+}
+
+/* Draws what was recorded. The count is cleared before drawing, so the
+ * hooks the draw itself passes through find nothing to flush. */
+void
+mrb_sdl2_gpu_multi_batch_flush(void) {
+  int quads = multi.quads;
+  if (0 == quads)
+    return;
+  multi.quads = 0;
+  mrb_sdl2_gpu_stream_draw_slots(multi.mrb, multi.target, multi.program,
+                                 multi.images, multi.num_images,
+                                 multi.vertices, quads);
+  multi.num_images = 0;
+  multi.draws++;
+  multi.drawn += quads;
+}
+
+/* Called before anything else draws on or changes target, which also
+ * changes the image it renders to. */
+void
+mrb_sdl2_gpu_multi_batch_sync(GPU_Target *target) {
+  if (NULL == target)
+    return;
+  if (target == multi.target)
+    mrb_sdl2_gpu_multi_batch_flush();
+  else
+    mrb_sdl2_gpu_multi_batch_touch(target->image);
+}
+
+/* Draws what is left and closes the batch if it is open on target, also
+ * called before target is freed. */
+void
+mrb_sdl2_gpu_multi_batch_end(GPU_Target *target) {
+  if (NULL == target || target != multi.target)
+    return;
+  mrb_sdl2_gpu_multi_batch_flush();
+  multi.target = NULL;
+}
+
+/* Called before the pixels, filter or wrap mode of image change, so the
+ * blits recorded with it still show it as it was. */
+void
+mrb_sdl2_gpu_multi_batch_touch(GPU_Image const *image) {
+  int k;
+  if (NULL == image)
+    return;
+  for (k = 0; k < multi.num_images; k++) {
+    if (multi.images[k] == image) {
+      mrb_sdl2_gpu_multi_batch_flush();
+      return;
+    }
+  }
+}
+
+/* Called before image is freed, along with the target it may own. */
+void
+mrb_sdl2_gpu_multi_batch_forget(GPU_Image const *image) {
+  if (NULL == image)
+    return;
+  mrb_sdl2_gpu_multi_batch_end(image->target);
+  mrb_sdl2_gpu_multi_batch_touch(image);
+}
+
+static int
+mrb_sdl2_gpu_multi_batch_slot(GPU_Image *image) {
+  int k;
+  for (k = 0; k < multi.num_images; k++) {
+    if (multi.images[k] == image)
+      return k;
+  }
+  if (multi.num_images == multi.slots)
+    mrb_sdl2_gpu_multi_batch_flush();
+  multi.images[multi.num_images] = image;
+  return multi.num_images++;
+}
+
+/* Records a blit on target if a batch is open there, with the arguments
+ * of GPU_BlitTransformX (or the image anchor as pivot with use_anchor).
+ * Returns FALSE when the caller has to draw it itself. */
+mrb_bool
+mrb_sdl2_gpu_multi_batch_blit(GPU_Target *target, GPU_Image *image,
+                              GPU_Rect *rect, float x, float y,
+                              mrb_bool use_anchor,
+                              float pivot_x, float pivot_y, float degrees,
+                              float scale_x, float scale_y) {
+  float w, h, sx, sy, u, v, s1, t1, s2, t2, c, s, r, g, b, a;
+  float corners[8];
+  float *out;
+  int slot, k;
+  if (NULL == target || target != multi.target || NULL == image)
+    return FALSE;
+  if (!mrb_sdl2_gpu_stream_usable(multi.mrb) || image->target == target) {
+    mrb_sdl2_gpu_multi_batch_flush();
+    return FALSE;
+  }
+  if (multi.quads > 0 &&
+      (MRB_SDL2_GPU_MULTI_BATCH_QUADS == multi.quads ||
+       multi.use_blending != image->use_blending ||
+       (image->use_blending &&
+        0 != SDL_memcmp(&multi.blend_mode, &image->blend_mode,
+                        sizeof(GPU_BlendMode)))))
+    mrb_sdl2_gpu_multi_batch_flush();
+  slot = mrb_sdl2_gpu_multi_batch_slot(image);
+  if (0 == multi.quads) {
+    multi.use_blending = image->use_blending;
+    multi.blend_mode = image->blend_mode;
+  }
+
+  w = NULL != rect ? rect->w : image->w;
+  h = NULL != rect ? rect->h : image->h;
+  sx = NULL != rect ? rect->x : 0.0f;
+  sy = NULL != rect ? rect->y : 0.0f;
+  if (use_anchor) {
+    pivot_x = image->anchor_x * w;
+    pivot_y = image->anchor_y * h;
+  }
+  if (GPU_SNAP_POSITION == image->snap_mode ||
+      GPU_SNAP_POSITION_AND_DIMENSIONS == image->snap_mode) {
+    x = SDL_floor(x);
+    y = SDL_floor(y);
+  }
+  /* source rects are in virtual pixels, texture coordinates in texels */
+  u = image->using_virtual_resolution ? (float) image->base_w / image->w : 1.0f;
+  v = image->using_virtual_resolution ? (float) image->base_h / image->h : 1.0f;
+  s1 = sx * u / image->texture_w;
+  t1 = sy * v / image->texture_h;
+  s2 = (sx + w) * u / image->texture_w;
+  t2 = (sy + h) * v / image->texture_h;
+
+  corners[0] = -pivot_x * scale_x;
+  corners[1] = -pivot_y * scale_y;
+  corners[2] = (w - pivot_x) * scale_x;
+  corners[3] = corners[1];
+  corners[4] = corners[2];
+  corners[5] = (h - pivot_y) * scale_y;
+  corners[6] = corners[0];
+  corners[7] = corners[5];
+  c = 1.0f;
+  s = 0.0f;
+  if (0.0f != degrees) {
+    float radians = degrees * (float) M_PI / 180.0f;
+    c = SDL_cos(radians);
+    s = SDL_sin(radians);
+  }
+
+  r = image->color.r / 255.0f;
+  g = image->color.g / 255.0f;
+  b = image->color.b / 255.0f;
+  a = image->color.a / 255.0f;
+  if (target->use_color) {
+    r *= target->color.r / 255.0f;
+    g *= target->color.g / 255.0f;
+    b *= target->color.b / 255.0f;
+    a *= target->color.a / 255.0f;
+  }
+
+  out = multi.vertices + multi.quads * 4 * MRB_SDL2_GPU_SLOT_FLOATS;
+  for (k = 0; k < 4; k++) {
+    float lx = corners[k * 2], ly = corners[k * 2 + 1];
+    out[0] = x + c * lx - s * ly;
+    out[1] = y + s * lx + c * ly;
+    out[2] = 1 == k || 2 == k ? s2 : s1;
+    out[3] = k < 2 ? t1 : t2;
+    out[4] = r;
+    out[5] = g;
+    out[6] = b;
+    out[7] = a;
+    out[8] = (float) slot;
+    out += MRB_SDL2_GPU_SLOT_FLOATS;
+  }
+  multi.quads++;
+  return TRUE;
+}
+
+/* Drops the batch and the programs, GPU.quit calls it before the context
+ * goes. */
+void
+mrb_sdl2_gpu_multi_batch_release(void) {
+  int k;
+  multi.quads = 0;
+  multi.num_images = 0;
+  multi.target = NULL;
+  for (k = 0; k <= MRB_SDL2_GPU_MAX_SLOTS; k++) {
+    if (0 != multi.programs[k].id)
+      GPU_FreeShaderProgram(multi.programs[k].id);
+    multi.programs[k].id = 0;
+  }
+  SDL_free(multi.vertices);
+  multi.vertices = NULL;
+}
+
+/* Target#begin_multi_batch(slots = 8) -> true, or false when raw GL or
+ * the streaming buffer is not available and blits draw one by one.
+ * slots is how many images one draw can span, at most 16 and what the
+ * GPU offers. */
+static mrb_value
+mrb_sdl2_gpu_target_begin_multi_batch(mrb_state *mrb, mrb_value self) {
+  GPU_Target *target = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  mrb_int slots = 8;
+  GLint units = 0;
+  mrb_get_args(mrb, "|i", &slots);
+  if (slots < 1 || slots > MRB_SDL2_GPU_MAX_SLOTS)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "slots must be between 1 and %S",
+               mrb_fixnum_value(MRB_SDL2_GPU_MAX_SLOTS));
+  mrb_sdl2_gpu_multi_batch_flush();
+  multi.target = NULL;
+  if (NULL == target || !mrb_sdl2_gpu_stream_usable(mrb))
+    return mrb_false_value();
+  glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+  if (units > 0 && slots > units)
+    slots = units;
+  if (NULL == multi.vertices) {
+    multi.vertices = (float*) SDL_malloc(sizeof(float) *
+                                         MRB_SDL2_GPU_SLOT_FLOATS * 4 *
+                                         MRB_SDL2_GPU_MULTI_BATCH_QUADS);
+    if (NULL == multi.vertices)
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+  }
+  if (0 == multi.programs[slots].id)
+    mrb_sdl2_gpu_stream_program_init(&multi.programs[slots],
+        mrb_sdl2_gpu_multi_batch_program(mrb, (int) slots));
+  multi.mrb = mrb;
+  multi.target = target;
+  multi.slots = (int) slots;
+  multi.program = &multi.programs[slots];
+  return mrb_true_value();
+}
+
+/* Target#end_multi_batch, draws what is left; blits draw one by one
+ * again. */
+static mrb_value
+mrb_sdl2_gpu_target_end_multi_batch(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_multi_batch_end(mrb_sdl2_gpu_target_get_ptr(mrb, self));
+  return self;
+}
+
+/* Target#flush_multi_batch, draws what was recorded so far. */
+static mrb_value
+mrb_sdl2_gpu_target_flush_multi_batch(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_multi_batch_sync(mrb_sdl2_gpu_target_get_ptr(mrb, self));
+  return self;
+}
+
+/* GPU.multi_batch_stats -> {active:, slots:, draws:, quads:} */
+static mrb_value
+mrb_sdl2_gpu_multi_batch_stats(mrb_state *mrb, mrb_value self) {
+  mrb_value stats = mrb_hash_new_capa(mrb, 4);
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "active")),
+               mrb_bool_value(NULL != multi.target));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "slots")),
+               mrb_fixnum_value(NULL != multi.target ? multi.slots : 0));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "draws")),
+               mrb_fixnum_value(multi.draws));
+  mrb_hash_set(mrb, stats, mrb_symbol_value(mrb_intern_lit(mrb, "quads")),
+               mrb_fixnum_value(multi.drawn));
+  return stats;
+}
+/***********************************
+ * Multi-texture batch ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_multi_batch_init(mrb_state *mrb) {
+  mrb_define_method(mrb, class_Target, "begin_multi_batch", mrb_sdl2_gpu_target_begin_multi_batch, MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_Target, "end_multi_batch",   mrb_sdl2_gpu_target_end_multi_batch,   MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Target, "flush_multi_batch", mrb_sdl2_gpu_target_flush_multi_batch, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "multi_batch_stats", mrb_sdl2_gpu_multi_batch_stats, MRB_ARGS_NONE());
+}
@@ -0,0 +1,566 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::ParticleSystem - a single emitter whose particles live in native
+  struct-of-arrays storage. Simulation and vertex generation run in plain
+  C loops, split over a small SDL thread pool for large systems, and every
+  system is drawn as one batch, written straight into the streaming buffer
+  when it is available.
+  */
+
+#include <math.h>
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/variable.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_PARTICLES_MAX         16383  /* 4 vertices each < 65536 */
+#define MRB_SDL2_GPU_PARTICLES_FLOATS      8      /* x, y, s, t, r, g, b, a */
+#define MRB_SDL2_GPU_PARTICLES_MAX_WORKERS 8
+#define MRB_SDL2_GPU_PARTICLES_PER_THREAD  2048   /* below this stay serial */
+
+static struct RClass *class_ParticleSystem = NULL;
+
+/*************************************
+ * Worker pool
+ *************************************/
+
+typedef void (*mrb_sdl2_gpu_job_fn)(void *ctx, int begin, int end);
+
+static struct {
+  SDL_Thread *threads[MRB_SDL2_GPU_PARTICLES_MAX_WORKERS];
+  SDL_sem    *start[MRB_SDL2_GPU_PARTICLES_MAX_WORKERS];
+  SDL_sem    *done;
+  int         num_workers;
+  mrb_bool    quit;
+  mrb_sdl2_gpu_job_fn fn;
+  void       *ctx;
+  int         begin[MRB_SDL2_GPU_PARTICLES_MAX_WORKERS];
+  int         end[MRB_SDL2_GPU_PARTICLES_MAX_WORKERS];
+} worker_pool;
+
+static int
+mrb_sdl2_gpu_worker(void *arg) {
+  int id = (int)(intptr_t) arg;
+  for (;;) {
+    SDL_SemWait(worker_pool.start[id]);
+    if (worker_pool.quit)
+      break;
+    worker_pool.fn(worker_pool.ctx, worker_pool.begin[id],
+                   worker_pool.end[id]);
+    SDL_SemPost(worker_pool.done);
+  }
+  return 0;
+}
+
+static int
+mrb_sdl2_gpu_worker_pool_grow(int workers) {
+  if (NULL == worker_pool.done) {
+    worker_pool.done = SDL_CreateSemaphore(0);
+    if (NULL == worker_pool.done)
+      return 0;
+  }
+  while (worker_pool.num_workers < workers) {
+    int id = worker_pool.num_workers;
+    worker_pool.start[id] = SDL_CreateSemaphore(0);
+    if (NULL == worker_pool.start[id])
+      break;
+    worker_pool.threads[id] = SDL_CreateThread(mrb_sdl2_gpu_worker,
+                                               "gpu_particles",
+                                               (void*)(intptr_t) id);
+    if (NULL == worker_pool.threads[id]) {
+      SDL_DestroySemaphore(worker_pool.start[id]);
+      break;
+    }
+    worker_pool.num_workers++;
+  }
+  return SDL_min(workers, worker_pool.num_workers);
+}
+
+/* Runs fn over [0, count) split into equal ranges, the calling thread
+ * taking the first one. Falls back to a serial call when threads are not
+ * worth it or cannot be created. */
+static void
+mrb_sdl2_gpu_parallel_for(mrb_sdl2_gpu_job_fn fn, void *ctx, int count,
+                          int threads) {
+  int workers = SDL_min(threads, count / MRB_SDL2_GPU_PARTICLES_PER_THREAD) - 1;
+  int step, i;
+  if (workers > MRB_SDL2_GPU_PARTICLES_MAX_WORKERS)
+    workers = MRB_SDL2_GPU_PARTICLES_MAX_WORKERS;
+  if (workers > 0)
+    workers = mrb_sdl2_gpu_worker_pool_grow(workers);
+  if (workers <= 0) {
+    fn(ctx, 0, count);
+    return;
+  }
+  step = count / (workers + 1);
+  worker_pool.fn = fn;
+  worker_pool.ctx = ctx;
+  for (i = 0; i < workers; i++) {
+    worker_pool.begin[i] = step * (i + 1);
+    worker_pool.end[i] = i == workers - 1 ? count : step * (i + 2);
+    SDL_SemPost(worker_pool.start[i]);
+  }
+  fn(ctx, 0, step);
+  for (i = 0; i < workers; i++) {
+    SDL_SemWait(worker_pool.done);
+  }
+}
+
+/* Stops the worker threads, called from the gem finalizer. */
+void
+mrb_sdl2_gpu_particles_release(void) {
+  int i;
+  worker_pool.quit = TRUE;
+  for (i = 0; i < worker_pool.num_workers; i++) {
+    SDL_SemPost(worker_pool.start[i]);
+    SDL_WaitThread(worker_pool.threads[i], NULL);
+    SDL_DestroySemaphore(worker_pool.start[i]);
+  }
+  if (NULL != worker_pool.done)
+    SDL_DestroySemaphore(worker_pool.done);
+  worker_pool.done = NULL;
+  worker_pool.num_workers = 0;
+  worker_pool.quit = FALSE;
+}
+
+/*************************************
+ * GPU::ParticleSystem bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_particles_data_t {
+  int    capacity;
+  int    count;
+  int    threads;
+  /* particle storage, one array per attribute */
+  float *x;
+  float *y;
+  float *vx;
+  float *vy;
+  float *age;
+  float *inv_life;
+  /* emitter settings */
+  float  emit_x, emit_y;
+  float  rate;
+  float  pending;  /* fractional particles carried to the next update */
+  mrb_bool emitting;
+  float  life_min, life_max;
+  float  speed_min, speed_max;
+  float  angle, spread;  /* radians */
+  float  gravity_x, gravity_y;
+  float  color0[4], color1[4];
+  float  size0, size1;
+  Uint32 seed;
+  /* per update */
+  float  dt;
+  float  s1, t1;
+  float *vertices;
+  Uint16 *indices;
+  float *out;  /* vertices, or the streaming buffer while drawing */
+} mrb_sdl2_gpu_particles_data_t;
+
+static void
+mrb_sdl2_gpu_particles_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_particles_data_t *data = (mrb_sdl2_gpu_particles_data_t*)p;
+  if (NULL == data)
+    return;
+  mrb_free(mrb, data->x);
+  mrb_free(mrb, data->y);
+  mrb_free(mrb, data->vx);
+  mrb_free(mrb, data->vy);
+  mrb_free(mrb, data->age);
+  mrb_free(mrb, data->inv_life);
+  mrb_free(mrb, data->vertices);
+  mrb_free(mrb, data->indices);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_particles_data_type = {
+  "ParticleSystem", mrb_sdl2_gpu_particles_data_free
+};
+
+static mrb_sdl2_gpu_particles_data_t *
+mrb_sdl2_gpu_particles_get_ptr(mrb_state *mrb, mrb_value system) {
+  mrb_sdl2_gpu_particles_data_t *data =
+    (mrb_sdl2_gpu_particles_data_t*)
+      mrb_data_get_ptr(mrb, system, &mrb_sdl2_gpu_particles_data_type);
+  if (NULL == data)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::ParticleSystem is not initialized");
+  return data;
+}
+
+static float
+mrb_sdl2_gpu_particles_random(mrb_sdl2_gpu_particles_data_t *data,
+                              float min, float max) {
+  Uint32 x = data->seed;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  data->seed = x;
+  return min + (max - min) * ((x >> 8) / 16777216.0f);
+}
+
+static void
+mrb_sdl2_gpu_particles_spawn(mrb_sdl2_gpu_particles_data_t *data, int n) {
+  int i;
+  n = SDL_min(n, data->capacity - data->count);
+  for (i = 0; i < n; i++) {
+    int p = data->count++;
+    float angle = data->angle + mrb_sdl2_gpu_particles_random(data,
+        -data->spread / 2.0f, data->spread / 2.0f);
+    float speed = mrb_sdl2_gpu_particles_random(data, data->speed_min,
+                                                data->speed_max);
+    float life = mrb_sdl2_gpu_particles_random(data, data->life_min,
+                                               data->life_max);
+    data->x[p] = data->emit_x;
+    data->y[p] = data->emit_y;
+    data->vx[p] = cosf(angle) * speed;
+    data->vy[p] = sinf(angle) * speed;
+    data->age[p] = 0.0f;
+    data->inv_life[p] = life > 0.0f ? 1.0f / life : 1.0e6f;
+  }
+}
+
+static void
+mrb_sdl2_gpu_particles_integrate(void *ctx, int begin, int end) {
+  mrb_sdl2_gpu_particles_data_t *data = (mrb_sdl2_gpu_particles_data_t*)ctx;
+  float * const x = data->x, * const y = data->y;
+  float * const vx = data->vx, * const vy = data->vy;
+  float * const age = data->age, * const inv_life = data->inv_life;
+  float const dt = data->dt;
+  float const gx = data->gravity_x * dt, gy = data->gravity_y * dt;
+  int i;
+  for (i = begin; i < end; i++) {
+    vx[i] += gx;
+    vy[i] += gy;
+    x[i] += vx[i] * dt;
+    y[i] += vy[i] * dt;
+    age[i] += dt * inv_life[i];
+  }
+}
+
+static void
+mrb_sdl2_gpu_particles_write(void *ctx, int begin, int end) {
+  mrb_sdl2_gpu_particles_data_t *data = (mrb_sdl2_gpu_particles_data_t*)ctx;
+  float const *c0 = data->color0, *c1 = data->color1;
+  int i, k;
+  for (i = begin; i < end; i++) {
+    float t = data->age[i];
+    float half = (data->size0 + (data->size1 - data->size0) * t) * 0.5f;
+    float x0 = data->x[i] - half, x1 = data->x[i] + half;
+    float y0 = data->y[i] - half, y1 = data->y[i] + half;
+    float rgba[4];
+    float *v = &data->out[i * 4 * MRB_SDL2_GPU_PARTICLES_FLOATS];
+    for (k = 0; k < 4; k++) {
+      rgba[k] = c0[k] + (c1[k] - c0[k]) * t;
+    }
+    for (k = 0; k < 4; k++) {
+      float *o = v + k * MRB_SDL2_GPU_PARTICLES_FLOATS;
+      o[0] = (k == 0 || k == 3) ? x0 : x1;
+      o[1] = (k < 2) ? y0 : y1;
+      o[2] = (k == 0 || k == 3) ? 0.0f : data->s1;
+      o[3] = (k < 2) ? 0.0f : data->t1;
+      o[4] = rgba[0];
+      o[5] = rgba[1];
+      o[6] = rgba[2];
+      o[7] = rgba[3];
+    }
+  }
+}
+
+/* Drops expired particles by moving the last live one into their slot. */
+static void
+mrb_sdl2_gpu_particles_compact(mrb_sdl2_gpu_particles_data_t *data) {
+  int i = 0;
+  while (i < data->count) {
+    if (data->age[i] < 1.0f) {
+      i++;
+      continue;
+    }
+    data->count--;
+    data->x[i] = data->x[data->count];
+    data->y[i] = data->y[data->count];
+    data->vx[i] = data->vx[data->count];
+    data->vy[i] = data->vy[data->count];
+    data->age[i] = data->age[data->count];
+    data->inv_life[i] = data->inv_life[data->count];
+  }
+}
+
+static float *
+mrb_sdl2_gpu_particles_array(mrb_state *mrb, int capacity) {
+  return (float*) mrb_malloc(mrb, sizeof(float) * capacity);
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_value image;
+  mrb_int capacity;
+  mrb_sdl2_gpu_particles_data_t *data =
+    (mrb_sdl2_gpu_particles_data_t*)DATA_PTR(self);
+  int i;
+  mrb_get_args(mrb, "oi", &image, &capacity);
+  mrb_sdl2_gpu_image_get_ptr(mrb, image);
+  if (capacity <= 0 || capacity > MRB_SDL2_GPU_PARTICLES_MAX)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "capacity must be between 1 and 16383");
+  if (NULL != data) {
+    mrb_sdl2_gpu_particles_data_free(mrb, data);
+    DATA_PTR(self) = NULL;
+  }
+  data = (mrb_sdl2_gpu_particles_data_t*)
+      mrb_calloc(mrb, 1, sizeof(mrb_sdl2_gpu_particles_data_t));
+  if (NULL == data) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+  }
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_particles_data_type;
+
+  data->capacity = capacity;
+  data->threads = 1;
+  data->x = mrb_sdl2_gpu_particles_array(mrb, capacity);
+  data->y = mrb_sdl2_gpu_particles_array(mrb, capacity);
+  data->vx = mrb_sdl2_gpu_particles_array(mrb, capacity);
+  data->vy = mrb_sdl2_gpu_particles_array(mrb, capacity);
+  data->age = mrb_sdl2_gpu_particles_array(mrb, capacity);
+  data->inv_life = mrb_sdl2_gpu_particles_array(mrb, capacity);
+  data->vertices = mrb_sdl2_gpu_particles_array(mrb,
+      capacity * 4 * MRB_SDL2_GPU_PARTICLES_FLOATS);
+  data->indices = (Uint16*) mrb_malloc(mrb, sizeof(Uint16) * capacity * 6);
+  for (i = 0; i < capacity; i++) {
+    data->indices[i * 6 + 0] = i * 4 + 0;
+    data->indices[i * 6 + 1] = i * 4 + 1;
+    data->indices[i * 6 + 2] = i * 4 + 2;
+    data->indices[i * 6 + 3] = i * 4 + 0;
+    data->indices[i * 6 + 4] = i * 4 + 2;
+    data->indices[i * 6 + 5] = i * 4 + 3;
+  }
+
+  data->emitting = TRUE;
+  data->life_min = data->life_max = 1.0f;
+  data->speed_min = data->speed_max = 50.0f;
+  data->spread = 2.0f * (float) M_PI;
+  for (i = 0; i < 4; i++) {
+    data->color0[i] = 1.0f;
+    data->color1[i] = i == 3 ? 0.0f : 1.0f;
+  }
+  data->size0 = data->size1 = 8.0f;
+  data->seed = 2463534242u;
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__image__"), image);
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_set_position(mrb_state *mrb, mrb_value self) {
+  mrb_float x, y;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "ff", &x, &y);
+  data->emit_x = x;
+  data->emit_y = y;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_set_rate(mrb_state *mrb, mrb_value self) {
+  mrb_float rate;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "f", &rate);
+  data->rate = rate < 0.0 ? 0.0f : rate;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_set_lifetime(mrb_state *mrb, mrb_value self) {
+  mrb_float min, max;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "ff", &min, &max);
+  data->life_min = min;
+  data->life_max = max;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_set_speed(mrb_state *mrb, mrb_value self) {
+  mrb_float min, max;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "ff", &min, &max);
+  data->speed_min = min;
+  data->speed_max = max;
+  return self;
+}
+
+/* set_direction(angle, spread), both in degrees */
+static mrb_value
+mrb_sdl2_gpu_particles_set_direction(mrb_state *mrb, mrb_value self) {
+  mrb_float angle, spread;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "ff", &angle, &spread);
+  data->angle = angle * (float) M_PI / 180.0f;
+  data->spread = spread * (float) M_PI / 180.0f;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_set_gravity(mrb_state *mrb, mrb_value self) {
+  mrb_float x, y;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "ff", &x, &y);
+  data->gravity_x = x;
+  data->gravity_y = y;
+  return self;
+}
+
+/* set_colors(r0, g0, b0, a0, r1, g1, b1, a1): color at birth and death */
+static mrb_value
+mrb_sdl2_gpu_particles_set_colors(mrb_state *mrb, mrb_value self) {
+  mrb_int c[8];
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  int i;
+  mrb_get_args(mrb, "iiiiiiii", &c[0], &c[1], &c[2], &c[3],
+               &c[4], &c[5], &c[6], &c[7]);
+  for (i = 0; i < 4; i++) {
+    data->color0[i] = c[i] / 255.0f;
+    data->color1[i] = c[i + 4] / 255.0f;
+  }
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_set_sizes(mrb_state *mrb, mrb_value self) {
+  mrb_float size0, size1;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "ff", &size0, &size1);
+  data->size0 = size0;
+  data->size1 = size1;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_set_threads(mrb_state *mrb, mrb_value self) {
+  mrb_int threads;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "i", &threads);
+  data->threads = SDL_max(1, SDL_min(threads,
+                                     MRB_SDL2_GPU_PARTICLES_MAX_WORKERS + 1));
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_set_emitting(mrb_state *mrb, mrb_value self) {
+  mrb_bool emitting;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "b", &emitting);
+  data->emitting = emitting;
+  data->pending = 0.0f;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_emit(mrb_state *mrb, mrb_value self) {
+  mrb_int n;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "i", &n);
+  if (n > 0)
+    mrb_sdl2_gpu_particles_spawn(data, n);
+  return self;
+}
+
+/* update(dt): emits, moves and ages particles, dropping the expired ones */
+static mrb_value
+mrb_sdl2_gpu_particles_update(mrb_state *mrb, mrb_value self) {
+  mrb_float dt;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  mrb_get_args(mrb, "f", &dt);
+  if (dt <= 0.0)
+    return self;
+  data->dt = dt;
+  mrb_sdl2_gpu_parallel_for(mrb_sdl2_gpu_particles_integrate, data,
+                            data->count, data->threads);
+  mrb_sdl2_gpu_particles_compact(data);
+  if (data->emitting && data->rate > 0.0f) {
+    int n;
+    data->pending += data->rate * dt;
+    n = (int) data->pending;
+    data->pending -= n;
+    mrb_sdl2_gpu_particles_spawn(data, n);
+  }
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_draw(mrb_state *mrb, mrb_value self) {
+  mrb_value target_obj;
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  GPU_Image *image = mrb_sdl2_gpu_image_get_ptr(mrb,
+      mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__image__")));
+  GPU_Target *target;
+  mrb_get_args(mrb, "o", &target_obj);
+  target = mrb_sdl2_gpu_target_get_ptr(mrb, target_obj);
+  if (NULL == target || NULL == image)
+    mrb_raise(mrb, E_RUNTIME_ERROR,
+              "ParticleSystem needs a live target and image");
+  if (0 == data->count)
+    return self;
+  data->s1 = (float) image->w / image->texture_w;
+  data->t1 = (float) image->h / image->texture_h;
+  data->out = NULL;
+  if (mrb_sdl2_gpu_stream_ready(mrb, image, GPU_BATCH_XY_ST_RGBA))
+    data->out = (float*) mrb_sdl2_gpu_stream_reserve(
+        sizeof(float) * MRB_SDL2_GPU_PARTICLES_FLOATS * 4 * data->count, 0,
+        NULL);
+  if (NULL != data->out) {
+    /* the workers write straight into the streaming buffer */
+    mrb_sdl2_gpu_parallel_for(mrb_sdl2_gpu_particles_write, data,
+                              data->count, data->threads);
+    mrb_sdl2_gpu_stream_draw(mrb, target, image, GPU_BATCH_XY_ST_RGBA,
+                             data->out, data->count * 4, NULL,
+                             data->count * 6);
+    return self;
+  }
+  data->out = data->vertices;
+  mrb_sdl2_gpu_parallel_for(mrb_sdl2_gpu_particles_write, data,
+                            data->count, data->threads);
+  mrb_sdl2_gpu_multi_batch_sync(target);
+  GPU_TriangleBatch(image, target, data->count * 4, data->vertices,
+                    data->count * 6, data->indices, GPU_BATCH_XY_ST_RGBA);
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_count(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_particles_get_ptr(mrb, self)->count);
+}
+
+static mrb_value
+mrb_sdl2_gpu_particles_clear(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_particles_data_t *data = mrb_sdl2_gpu_particles_get_ptr(mrb, self);
+  data->count = 0;
+  data->pending = 0.0f;
+  return self;
+}
+/***********************************
+ * GPU::ParticleSystem bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_particles_init(mrb_state *mrb) {
+  class_ParticleSystem = mrb_define_class_under(mrb, mod_GPU, "ParticleSystem", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_ParticleSystem, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_ParticleSystem, "initialize",    mrb_sdl2_gpu_particles_initialize,    MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_ParticleSystem, "set_position",  mrb_sdl2_gpu_particles_set_position,  MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_ParticleSystem, "set_rate",      mrb_sdl2_gpu_particles_set_rate,      MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_ParticleSystem, "set_lifetime",  mrb_sdl2_gpu_particles_set_lifetime,  MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_ParticleSystem, "set_speed",     mrb_sdl2_gpu_particles_set_speed,     MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_ParticleSystem, "set_direction", mrb_sdl2_gpu_particles_set_direction, MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_ParticleSystem, "set_gravity",   mrb_sdl2_gpu_particles_set_gravity,   MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_ParticleSystem, "set_colors",    mrb_sdl2_gpu_particles_set_colors,    MRB_ARGS_REQ(8));
+  mrb_define_method(mrb, class_ParticleSystem, "set_sizes",     mrb_sdl2_gpu_particles_set_sizes,     MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_ParticleSystem, "set_threads",   mrb_sdl2_gpu_particles_set_threads,   MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_ParticleSystem, "set_emitting",  mrb_sdl2_gpu_particles_set_emitting,  MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_ParticleSystem, "emit",          mrb_sdl2_gpu_particles_emit,          MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_ParticleSystem, "update",        mrb_sdl2_gpu_particles_update,        MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_ParticleSystem, "draw",          mrb_sdl2_gpu_particles_draw,          MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_ParticleSystem, "count",         mrb_sdl2_gpu_particles_count,         MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_ParticleSystem, "clear",         mrb_sdl2_gpu_particles_clear,         MRB_ARGS_NONE());
+}
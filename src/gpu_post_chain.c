@@ -0,0 +1,402 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::PostChain - runs a list of full screen shader passes natively.
+  Intermediate passes render into offscreen targets scaled relative to the
+  source image; targets are shared between passes whose outputs are no
+  longer needed, so a linear chain ping-pongs between two targets.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/variable.h"
+#include "mruby/array.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_POST_MAX_INPUTS 4
+#define MRB_SDL2_GPU_POST_SOURCE     -1
+
+static struct RClass *class_PostChain = NULL;
+
+/*************************************
+ * GPU::PostChain bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_post_pass_t {
+  Uint32          programid;
+  GPU_ShaderBlock block;
+  int             input_loc[MRB_SDL2_GPU_POST_MAX_INPUTS];
+  int             resolution_loc;
+  int             inputs[MRB_SDL2_GPU_POST_MAX_INPUTS];
+  int             num_inputs;
+  float           scale;
+  int             last_use;  /* index of the last pass reading the output */
+  int             slot;
+} mrb_sdl2_gpu_post_pass_t;
+
+typedef struct mrb_sdl2_gpu_post_slot_t {
+  GPU_Image  *image;
+  GPU_Target *target;
+  Uint16      w;
+  Uint16      h;
+  int         busy_until;
+} mrb_sdl2_gpu_post_slot_t;
+
+typedef struct mrb_sdl2_gpu_post_chain_data_t {
+  mrb_sdl2_gpu_post_pass_t *passes;
+  int    num_passes;
+  int    capa_passes;
+  mrb_sdl2_gpu_post_slot_t *slots;
+  int    num_slots;
+  int    capa_slots;
+  int    format;
+  Uint16 source_w;
+  Uint16 source_h;
+  mrb_bool dirty;
+} mrb_sdl2_gpu_post_chain_data_t;
+
+static void
+mrb_sdl2_gpu_post_slot_destroy(mrb_sdl2_gpu_post_slot_t *slot) {
+  if (NULL != slot->target) {
+    mrb_sdl2_gpu_multi_batch_end(slot->target);
+    GPU_FreeTarget(slot->target);
+    slot->target = NULL;
+  }
+  if (NULL != slot->image) {
+    mrb_sdl2_gpu_multi_batch_forget(slot->image);
+    mrb_sdl2_gpu_vram_remove(slot->image);
+    GPU_FreeImage(slot->image);
+    slot->image = NULL;
+  }
+}
+
+static void
+mrb_sdl2_gpu_post_chain_free_slots(mrb_sdl2_gpu_post_chain_data_t *data) {
+  int i;
+  for (i = 0; i < data->num_slots; i++) {
+    mrb_sdl2_gpu_post_slot_destroy(&data->slots[i]);
+  }
+  data->num_slots = 0;
+  data->dirty = TRUE;
+}
+
+static void
+mrb_sdl2_gpu_post_chain_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_post_chain_data_t *data =
+    (mrb_sdl2_gpu_post_chain_data_t*)p;
+  if (NULL == data)
+    return;
+  mrb_sdl2_gpu_post_chain_free_slots(data);
+  mrb_free(mrb, data->slots);
+  mrb_free(mrb, data->passes);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_post_chain_data_type = {
+  "PostChain", mrb_sdl2_gpu_post_chain_data_free
+};
+
+static mrb_sdl2_gpu_post_chain_data_t *
+mrb_sdl2_gpu_post_chain_get_ptr(mrb_state *mrb, mrb_value chain) {
+  mrb_sdl2_gpu_post_chain_data_t *data =
+    (mrb_sdl2_gpu_post_chain_data_t*)
+      mrb_data_get_ptr(mrb, chain, &mrb_sdl2_gpu_post_chain_data_type);
+  if (NULL == data)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::PostChain is not initialized");
+  return data;
+}
+
+static Uint16
+mrb_sdl2_gpu_post_scaled(Uint16 size, float scale) {
+  int scaled = (int)(size * scale + 0.5f);
+  return scaled < 1 ? 1 : (Uint16) scaled;
+}
+
+/* Assigns every intermediate pass to a slot. A slot can be handed to a new
+ * pass once the last reader of its previous output has run. */
+static void
+mrb_sdl2_gpu_post_chain_allocate(mrb_state *mrb,
+                                 mrb_sdl2_gpu_post_chain_data_t *data) {
+  mrb_sdl2_gpu_post_slot_t *old_slots = data->slots;
+  int old_count = data->num_slots;
+  mrb_bool *kept;
+  int i, j;
+
+  data->slots = NULL;
+  data->num_slots = 0;
+  data->capa_slots = 0;
+  kept = (mrb_bool*) mrb_calloc(mrb, old_count + 1, sizeof(mrb_bool));
+
+  for (i = 0; i < data->num_passes - 1; i++) {
+    mrb_sdl2_gpu_post_pass_t *pass = &data->passes[i];
+    Uint16 w = mrb_sdl2_gpu_post_scaled(data->source_w, pass->scale);
+    Uint16 h = mrb_sdl2_gpu_post_scaled(data->source_h, pass->scale);
+    mrb_sdl2_gpu_post_slot_t *slot = NULL;
+
+    for (j = 0; j < data->num_slots; j++) {
+      if (data->slots[j].busy_until < i &&
+          data->slots[j].w == w && data->slots[j].h == h) {
+        slot = &data->slots[j];
+        break;
+      }
+    }
+    if (NULL == slot) {
+      if (data->num_slots == data->capa_slots) {
+        data->capa_slots = data->capa_slots == 0 ? 4 : data->capa_slots * 2;
+        data->slots = (mrb_sdl2_gpu_post_slot_t*)
+            mrb_realloc(mrb, data->slots,
+                        sizeof(mrb_sdl2_gpu_post_slot_t) * data->capa_slots);
+      }
+      slot = &data->slots[data->num_slots++];
+      slot->image = NULL;
+      slot->target = NULL;
+      slot->w = w;
+      slot->h = h;
+      /* take over a matching target from the previous allocation */
+      for (j = 0; j < old_count; j++) {
+        if (!kept[j] && old_slots[j].w == w && old_slots[j].h == h) {
+          slot->image = old_slots[j].image;
+          slot->target = old_slots[j].target;
+          kept[j] = TRUE;
+          break;
+        }
+      }
+    }
+    slot->busy_until = pass->last_use < i ? i : pass->last_use;
+    pass->slot = (int)(slot - data->slots);
+  }
+
+  for (j = 0; j < old_count; j++) {
+    if (!kept[j])
+      mrb_sdl2_gpu_post_slot_destroy(&old_slots[j]);
+  }
+  mrb_free(mrb, kept);
+  mrb_free(mrb, old_slots);
+
+  for (j = 0; j < data->num_slots; j++) {
+    mrb_sdl2_gpu_post_slot_t *slot = &data->slots[j];
+    if (NULL != slot->target)
+      continue;
+    if (!mrb_sdl2_gpu_vram_reserve(
+            mrb, mrb_sdl2_gpu_vram_estimate(slot->w, slot->h,
+                                            (GPU_FormatEnum) data->format)))
+      mrb_raise(mrb, E_RUNTIME_ERROR,
+                "PostChain Image would exceed the VRAM budget");
+    slot->image = GPU_CreateImage(slot->w, slot->h, data->format);
+    if (NULL == slot->image)
+      mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create PostChain Image");
+    mrb_sdl2_gpu_vram_add(slot->image, "PostChain");
+    slot->target = GPU_LoadTarget(slot->image);
+    if (NULL == slot->target) {
+      mrb_sdl2_gpu_vram_remove(slot->image);
+      GPU_FreeImage(slot->image);
+      slot->image = NULL;
+      mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create PostChain Target");
+    }
+  }
+  data->dirty = FALSE;
+}
+
+static mrb_value
+mrb_sdl2_gpu_post_chain_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_int format = GPU_FORMAT_RGBA;
+  mrb_sdl2_gpu_post_chain_data_t *data =
+    (mrb_sdl2_gpu_post_chain_data_t*)DATA_PTR(self);
+  mrb_get_args(mrb, "|i", &format);
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_post_chain_data_t*)
+        mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_post_chain_data_t));
+    if (NULL == data) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+    data->passes = NULL;
+    data->num_passes = 0;
+    data->capa_passes = 0;
+    data->slots = NULL;
+    data->num_slots = 0;
+    data->capa_slots = 0;
+  }
+  data->format = format;
+  data->source_w = 0;
+  data->source_h = 0;
+  data->dirty = TRUE;
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_post_chain_data_type;
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__programs__"),
+             mrb_ary_new(mrb));
+  return self;
+}
+
+/* add_pass(program, scale = 1.0, inputs = [previous pass]) -> pass index
+ * Inputs are indices of earlier passes, -1 being the source image. The
+ * first input is the blitted texture, the others are bound to the
+ * sampler uniforms input1, input2 and input3. */
+static mrb_value
+mrb_sdl2_gpu_post_chain_add_pass(mrb_state *mrb, mrb_value self) {
+  mrb_value program, inputs = mrb_nil_value();
+  mrb_float scale = 1.0;
+  mrb_sdl2_gpu_post_chain_data_t *data =
+    mrb_sdl2_gpu_post_chain_get_ptr(mrb, self);
+  mrb_sdl2_gpu_post_pass_t *pass;
+  int index = data->num_passes;
+  int i;
+  char name[8];
+  mrb_get_args(mrb, "o|fo", &program, &scale, &inputs);
+
+  if (scale <= 0.0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "pass scale must be positive");
+  if (!mrb_nil_p(inputs) &&
+      (RARRAY_LEN(inputs) < 1 ||
+       RARRAY_LEN(inputs) > MRB_SDL2_GPU_POST_MAX_INPUTS))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "a pass takes 1 to 4 inputs");
+
+  if (data->num_passes == data->capa_passes) {
+    data->capa_passes = data->capa_passes == 0 ? 4 : data->capa_passes * 2;
+    data->passes = (mrb_sdl2_gpu_post_pass_t*)
+        mrb_realloc(mrb, data->passes,
+                    sizeof(mrb_sdl2_gpu_post_pass_t) * data->capa_passes);
+  }
+  pass = &data->passes[index];
+  pass->programid = mrb_sdl2_gpu_program_get_uint32(mrb, program);
+  pass->scale = scale;
+  pass->last_use = -1;
+  pass->slot = -1;
+  if (mrb_nil_p(inputs)) {
+    pass->inputs[0] = index - 1;
+    pass->num_inputs = 1;
+  } else {
+    pass->num_inputs = RARRAY_LEN(inputs);
+    for (i = 0; i < pass->num_inputs; i++) {
+      mrb_int input = mrb_fixnum(mrb_to_int(mrb, RARRAY_PTR(inputs)[i]));
+      if (input < MRB_SDL2_GPU_POST_SOURCE || input >= index)
+        mrb_raise(mrb, E_ARGUMENT_ERROR,
+                  "pass inputs must be -1 or an earlier pass");
+      pass->inputs[i] = input;
+    }
+  }
+  for (i = 0; i < pass->num_inputs; i++) {
+    if (pass->inputs[i] != MRB_SDL2_GPU_POST_SOURCE &&
+        data->passes[pass->inputs[i]].last_use < index)
+      data->passes[pass->inputs[i]].last_use = index;
+  }
+
+  pass->block = GPU_LoadShaderBlock(pass->programid, "gpu_Vertex",
+                                    "gpu_TexCoord", "gpu_Color",
+                                    "gpu_ModelViewProjectionMatrix");
+  pass->input_loc[0] = -1;
+  for (i = 1; i < MRB_SDL2_GPU_POST_MAX_INPUTS; i++) {
+    SDL_snprintf(name, sizeof(name), "input%d", i);
+    pass->input_loc[i] = GPU_GetUniformLocation(pass->programid, name);
+  }
+  pass->resolution_loc = GPU_GetUniformLocation(pass->programid,
+                                                "resolution");
+
+  data->num_passes++;
+  data->dirty = TRUE;
+  mrb_ary_push(mrb, mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__programs__")),
+               program);
+  return mrb_fixnum_value(index);
+}
+
+static GPU_Image *
+mrb_sdl2_gpu_post_chain_input(mrb_sdl2_gpu_post_chain_data_t *data,
+                              GPU_Image *source, int input) {
+  if (MRB_SDL2_GPU_POST_SOURCE == input)
+    return source;
+  return data->slots[data->passes[input].slot].image;
+}
+
+/* run(source_image, target) renders every pass; the last one is drawn
+ * stretched over the whole target with the target's blending. */
+static mrb_value
+mrb_sdl2_gpu_post_chain_run(mrb_state *mrb, mrb_value self) {
+  mrb_value source_obj, target_obj;
+  mrb_sdl2_gpu_post_chain_data_t *data =
+    mrb_sdl2_gpu_post_chain_get_ptr(mrb, self);
+  GPU_Image *source;
+  GPU_Target *dest;
+  int i, j;
+  mrb_get_args(mrb, "oo", &source_obj, &target_obj);
+  source = mrb_sdl2_gpu_image_get_ptr(mrb, source_obj);
+  dest = mrb_sdl2_gpu_target_get_ptr(mrb, target_obj);
+  if (0 == data->num_passes)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::PostChain has no passes");
+
+  if (source->w != data->source_w || source->h != data->source_h) {
+    data->source_w = source->w;
+    data->source_h = source->h;
+    data->dirty = TRUE;
+  }
+  if (data->dirty)
+    mrb_sdl2_gpu_post_chain_allocate(mrb, data);
+
+  mrb_sdl2_gpu_multi_batch_sync(source->target);
+  for (i = 0; i < data->num_passes; i++) {
+    mrb_sdl2_gpu_post_pass_t *pass = &data->passes[i];
+    mrb_bool last = (i == data->num_passes - 1);
+    GPU_Target *target = last ? dest : data->slots[pass->slot].target;
+    GPU_Image *input = mrb_sdl2_gpu_post_chain_input(data, source,
+                                                     pass->inputs[0]);
+    GPU_bool blending = GPU_GetBlending(input);
+
+    if (!last) {
+      mrb_sdl2_gpu_multi_batch_touch(target->image);
+      GPU_Clear(target);
+      GPU_SetBlending(input, 0);
+    }
+    GPU_ActivateShaderProgram(pass->programid, &pass->block);
+    for (j = 1; j < pass->num_inputs; j++) {
+      if (pass->input_loc[j] >= 0)
+        GPU_SetShaderImage(mrb_sdl2_gpu_post_chain_input(data, source,
+                                                         pass->inputs[j]),
+                           pass->input_loc[j], j);
+    }
+    if (pass->resolution_loc >= 0) {
+      float resolution[2];
+      resolution[0] = target->w;
+      resolution[1] = target->h;
+      GPU_SetUniformfv(pass->resolution_loc, 2, 1, resolution);
+    }
+    mrb_sdl2_gpu_multi_batch_sync(target);
+    GPU_BlitScale(input, NULL, target, target->w / 2.0f, target->h / 2.0f,
+                  (float) target->w / input->w, (float) target->h / input->h);
+    GPU_DeactivateShaderProgram();
+    if (!last)
+      GPU_SetBlending(input, blending);
+  }
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_post_chain_passes(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_post_chain_get_ptr(mrb, self)->num_passes);
+}
+
+static mrb_value
+mrb_sdl2_gpu_post_chain_targets(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_post_chain_get_ptr(mrb, self)->num_slots);
+}
+
+static mrb_value
+mrb_sdl2_gpu_post_chain_free(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_post_chain_free_slots(
+      mrb_sdl2_gpu_post_chain_get_ptr(mrb, self));
+  return self;
+}
+/***********************************
+ * GPU::PostChain bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_post_chain_init(mrb_state *mrb) {
+  class_PostChain = mrb_define_class_under(mrb, mod_GPU, "PostChain", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_PostChain, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_PostChain, "initialize", mrb_sdl2_gpu_post_chain_initialize, MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_PostChain, "add_pass",   mrb_sdl2_gpu_post_chain_add_pass,   MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+  mrb_define_method(mrb, class_PostChain, "run",        mrb_sdl2_gpu_post_chain_run,        MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_PostChain, "passes",     mrb_sdl2_gpu_post_chain_passes,     MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_PostChain, "targets",    mrb_sdl2_gpu_post_chain_targets,    MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_PostChain, "free",       mrb_sdl2_gpu_post_chain_free,       MRB_ARGS_NONE());
+}
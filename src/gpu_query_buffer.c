@@ -0,0 +1,212 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::QueryBuffer - a preallocated native array the query methods
+  (uniform getters, GPU.get_virtual_coords) write into instead of returning
+  a new Array, so polling them every frame creates no garbage. Values are
+  kept as 32 bit floats, ints or unsigned ints, picked with the GPU_TYPE_*
+  constants.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/array.h"
+
+#include "../include/gpu.h"
+
+static struct RClass *class_QueryBuffer = NULL;
+
+/*************************************
+ * GPU::QueryBuffer bindings starts here
+ *************************************/
+
+typedef union mrb_sdl2_gpu_query_value_t {
+  float  f;
+  Sint32 i;
+  Uint32 u;
+} mrb_sdl2_gpu_query_value_t;
+
+typedef struct mrb_sdl2_gpu_query_buffer_data_t {
+  mrb_sdl2_gpu_query_value_t *values;
+  int          capacity;
+  int          count;  /* values written by the last query */
+  GPU_TypeEnum type;
+} mrb_sdl2_gpu_query_buffer_data_t;
+
+static void
+mrb_sdl2_gpu_query_buffer_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    (mrb_sdl2_gpu_query_buffer_data_t*)p;
+  if (NULL == data)
+    return;
+  mrb_free(mrb, data->values);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_query_buffer_data_type = {
+  "QueryBuffer", mrb_sdl2_gpu_query_buffer_data_free
+};
+
+static mrb_sdl2_gpu_query_buffer_data_t *
+mrb_sdl2_gpu_query_buffer_get_ptr(mrb_state *mrb, mrb_value buffer) {
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    (mrb_sdl2_gpu_query_buffer_data_t*)
+      mrb_data_get_ptr(mrb, buffer, &mrb_sdl2_gpu_query_buffer_data_type);
+  if (NULL == data)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::QueryBuffer is not initialized");
+  return data;
+}
+
+static mrb_sdl2_gpu_query_buffer_data_t *
+mrb_sdl2_gpu_query_buffer_reserve(mrb_state *mrb, mrb_value buffer, int n) {
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    mrb_sdl2_gpu_query_buffer_get_ptr(mrb, buffer);
+  if (n > data->capacity)
+    mrb_raisef(mrb, E_ARGUMENT_ERROR, "QueryBuffer holds %S values, need %S",
+               mrb_fixnum_value(data->capacity), mrb_fixnum_value(n));
+  data->count = n;
+  return data;
+}
+
+/* Stores n query results, converted to the buffer type. */
+void
+mrb_sdl2_gpu_query_buffer_write_floats(mrb_state *mrb, mrb_value buffer,
+                                       float const *values, int n) {
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    mrb_sdl2_gpu_query_buffer_reserve(mrb, buffer, n);
+  int k;
+  for (k = 0; k < n; k++) {
+    if (GPU_TYPE_FLOAT == data->type)
+      data->values[k].f = values[k];
+    else if (GPU_TYPE_INT == data->type)
+      data->values[k].i = (Sint32) values[k];
+    else
+      data->values[k].u = (Uint32) values[k];
+  }
+}
+
+void
+mrb_sdl2_gpu_query_buffer_write_uints(mrb_state *mrb, mrb_value buffer,
+                                      Uint32 const *values, int n) {
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    mrb_sdl2_gpu_query_buffer_reserve(mrb, buffer, n);
+  int k;
+  for (k = 0; k < n; k++) {
+    if (GPU_TYPE_FLOAT == data->type)
+      data->values[k].f = (float) values[k];
+    else
+      data->values[k].u = values[k];
+  }
+}
+
+static mrb_value
+mrb_sdl2_gpu_query_buffer_value(mrb_state *mrb,
+                                mrb_sdl2_gpu_query_buffer_data_t *data,
+                                int index) {
+  if (GPU_TYPE_FLOAT == data->type)
+    return mrb_float_value(mrb, data->values[index].f);
+  if (GPU_TYPE_INT == data->type)
+    return mrb_fixnum_value(data->values[index].i);
+  return mrb_fixnum_value(data->values[index].u);
+}
+
+/* new(capacity, type = GPU::GPU_TYPE_FLOAT) */
+static mrb_value
+mrb_sdl2_gpu_query_buffer_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_int capacity, type = GPU_TYPE_FLOAT;
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    (mrb_sdl2_gpu_query_buffer_data_t*)DATA_PTR(self);
+  mrb_get_args(mrb, "i|i", &capacity, &type);
+  if (capacity <= 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "capacity must be positive");
+  if (GPU_TYPE_FLOAT != type && GPU_TYPE_INT != type &&
+      GPU_TYPE_UNSIGNED_INT != type)
+    mrb_raise(mrb, E_ARGUMENT_ERROR,
+              "QueryBuffer holds GPU_TYPE_FLOAT, _INT or _UNSIGNED_INT");
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_query_buffer_data_t*)
+        mrb_calloc(mrb, 1, sizeof(mrb_sdl2_gpu_query_buffer_data_t));
+    if (NULL == data) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+  }
+  data->values = (mrb_sdl2_gpu_query_value_t*) mrb_realloc(mrb, data->values,
+      sizeof(mrb_sdl2_gpu_query_value_t) * capacity);
+  SDL_memset(data->values, 0, sizeof(mrb_sdl2_gpu_query_value_t) * capacity);
+  data->capacity = capacity;
+  data->count = 0;
+  data->type = (GPU_TypeEnum) type;
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_query_buffer_data_type;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_query_buffer_aref(mrb_state *mrb, mrb_value self) {
+  mrb_int index;
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    mrb_sdl2_gpu_query_buffer_get_ptr(mrb, self);
+  mrb_get_args(mrb, "i", &index);
+  if (index < 0)
+    index += data->capacity;
+  if (index < 0 || index >= data->capacity)
+    return mrb_nil_value();
+  return mrb_sdl2_gpu_query_buffer_value(mrb, data, index);
+}
+
+static mrb_value
+mrb_sdl2_gpu_query_buffer_aset(mrb_state *mrb, mrb_value self) {
+  mrb_int index;
+  mrb_value value;
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    mrb_sdl2_gpu_query_buffer_get_ptr(mrb, self);
+  mrb_get_args(mrb, "io", &index, &value);
+  if (index < 0 || index >= data->capacity)
+    mrb_raise(mrb, E_INDEX_ERROR, "QueryBuffer index out of range");
+  if (GPU_TYPE_FLOAT == data->type)
+    data->values[index].f = mrb_to_flo(mrb, value);
+  else
+    data->values[index].i = mrb_fixnum(mrb_to_int(mrb, value));
+  return value;
+}
+
+/* count -> values written by the last query */
+static mrb_value
+mrb_sdl2_gpu_query_buffer_count(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_query_buffer_get_ptr(mrb, self)->count);
+}
+
+static mrb_value
+mrb_sdl2_gpu_query_buffer_capacity(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(
+      mrb_sdl2_gpu_query_buffer_get_ptr(mrb, self)->capacity);
+}
+
+/* to_a -> the values of the last query, allocates an Array */
+static mrb_value
+mrb_sdl2_gpu_query_buffer_to_a(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_query_buffer_data_t *data =
+    mrb_sdl2_gpu_query_buffer_get_ptr(mrb, self);
+  mrb_value ary = mrb_ary_new_capa(mrb, data->count);
+  int k;
+  for (k = 0; k < data->count; k++) {
+    mrb_ary_push(mrb, ary, mrb_sdl2_gpu_query_buffer_value(mrb, data, k));
+  }
+  return ary;
+}
+/***********************************
+ * GPU::QueryBuffer bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_query_buffer_init(mrb_state *mrb) {
+  class_QueryBuffer = mrb_define_class_under(mrb, mod_GPU, "QueryBuffer", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_QueryBuffer, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_QueryBuffer, "initialize", mrb_sdl2_gpu_query_buffer_initialize, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_QueryBuffer, "[]",         mrb_sdl2_gpu_query_buffer_aref,       MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_QueryBuffer, "[]=",        mrb_sdl2_gpu_query_buffer_aset,       MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_QueryBuffer, "count",      mrb_sdl2_gpu_query_buffer_count,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_QueryBuffer, "capacity",   mrb_sdl2_gpu_query_buffer_capacity,   MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_QueryBuffer, "to_a",       mrb_sdl2_gpu_query_buffer_to_a,       MRB_ARGS_NONE());
+}
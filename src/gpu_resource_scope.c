@@ -0,0 +1,234 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU.resource_scope - frees, in one pass when the block is left, every
+  Image, Target, Shader and Program created inside it that is still
+  alive. Level loading can drop a whole level's worth of textures without
+  freeing them one by one or waiting for the GC:
+
+    GPU.resource_scope do
+      level = Level.load("forest")  # images, render targets, shaders
+      GPU.retain(level.icon)        # outlives the scope
+      level.run
+    end
+
+  Scopes nest, each frees what was created while it was the innermost
+  one. Objects are freed newest first, so a Target goes before the Image
+  it renders to, and freeing something twice is harmless.
+
+  A scope does not keep its objects alive: temporaries made every frame
+  inside it are collected as usual and drop out of the scope when the GC
+  frees them. Members are kept in a table keyed by the wrapper's data
+  pointer, so adopting, retaining and forgetting one is a hash lookup.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/array.h"
+#include "mruby/data.h"
+#include "mruby/error.h"
+
+#include "../include/gpu.h"
+
+typedef struct mrb_sdl2_gpu_scope_entry_t {
+  void const   *data;   /* the wrapper's data pointer, NULL when empty */
+  struct RData *obj;    /* not marked, the GC removes it with the data */
+  Uint32        seq;    /* creation order */
+  int           depth;  /* scope that owns it */
+} mrb_sdl2_gpu_scope_entry_t;
+
+static struct {
+  mrb_sdl2_gpu_scope_entry_t *entries;  /* open addressing by data */
+  size_t capacity;                      /* power of two */
+  size_t count;
+  Uint32 seq;
+  int    depth;                         /* open scopes */
+} scopes = { NULL, 0, 0, 0, 0 };
+
+static size_t
+mrb_sdl2_gpu_scope_hash(void const *data) {
+  size_t h = (size_t) data >> 4;
+  h *= (size_t) 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 16);
+}
+
+/* Slot of data, or of the empty slot ending its probe sequence. */
+static size_t
+mrb_sdl2_gpu_scope_slot(void const *data) {
+  size_t mask = scopes.capacity - 1;
+  size_t i = mrb_sdl2_gpu_scope_hash(data) & mask;
+  while (NULL != scopes.entries[i].data && scopes.entries[i].data != data) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static mrb_bool
+mrb_sdl2_gpu_scope_grow(void) {
+  mrb_sdl2_gpu_scope_entry_t *old = scopes.entries;
+  size_t old_capacity = scopes.capacity, i;
+  size_t capacity = 0 == old_capacity ? 64 : old_capacity * 2;
+  mrb_sdl2_gpu_scope_entry_t *entries = (mrb_sdl2_gpu_scope_entry_t*)
+    SDL_calloc(capacity, sizeof(mrb_sdl2_gpu_scope_entry_t));
+  if (NULL == entries)
+    return FALSE;
+  scopes.entries = entries;
+  scopes.capacity = capacity;
+  for (i = 0; i < old_capacity; i++) {
+    if (NULL != old[i].data)
+      scopes.entries[mrb_sdl2_gpu_scope_slot(old[i].data)] = old[i];
+  }
+  SDL_free(old);
+  return TRUE;
+}
+
+/* Takes data out of the scopes. */
+static void
+mrb_sdl2_gpu_scope_remove(void const *data) {
+  size_t mask, i, j;
+  if (0 == scopes.count || NULL == data)
+    return;
+  mask = scopes.capacity - 1;
+  i = mrb_sdl2_gpu_scope_slot(data);
+  if (NULL == scopes.entries[i].data)
+    return;
+  scopes.count--;
+  /* backward shift deletion keeps the probe sequences intact */
+  for (j = (i + 1) & mask; NULL != scopes.entries[j].data;
+       j = (j + 1) & mask) {
+    size_t home = mrb_sdl2_gpu_scope_hash(scopes.entries[j].data) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      scopes.entries[i] = scopes.entries[j];
+      i = j;
+    }
+  }
+  scopes.entries[i].data = NULL;
+  scopes.entries[i].obj = NULL;
+}
+
+/* Hands obj, a wrapper that owns its resource, to the innermost scope. */
+void
+mrb_sdl2_gpu_scope_adopt(mrb_state *mrb, mrb_value obj) {
+  mrb_sdl2_gpu_scope_entry_t *entry;
+  void const *data;
+  if (0 == scopes.depth || MRB_TT_DATA != mrb_type(obj))
+    return;
+  data = DATA_PTR(obj);
+  if (NULL == data)
+    return;
+  if ((scopes.count + 1) * 4 > scopes.capacity * 3 &&
+      !mrb_sdl2_gpu_scope_grow())
+    mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+  entry = &scopes.entries[mrb_sdl2_gpu_scope_slot(data)];
+  if (NULL == entry->data)
+    scopes.count++;
+  entry->data = data;
+  entry->obj = RDATA(obj);
+  entry->seq = scopes.seq++;
+  entry->depth = scopes.depth;
+}
+
+/* The wrappers' free functions call it with their data pointer before it
+ * goes away. */
+void
+mrb_sdl2_gpu_scope_forget(void const *data) {
+  mrb_sdl2_gpu_scope_remove(data);
+}
+
+static mrb_value
+mrb_sdl2_gpu_scope_body(mrb_state *mrb, mrb_value block) {
+  return mrb_yield_argv(mrb, block, 0, NULL);
+}
+
+static int
+mrb_sdl2_gpu_scope_newest_first(const void *a, const void *b) {
+  Uint32 sa = ((mrb_sdl2_gpu_scope_entry_t const*) a)->seq;
+  Uint32 sb = ((mrb_sdl2_gpu_scope_entry_t const*) b)->seq;
+  return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+static mrb_value
+mrb_sdl2_gpu_scope_free_one(mrb_state *mrb, mrb_value obj) {
+  return mrb_funcall(mrb, obj, "free", 0);
+}
+
+/* Frees the members of the innermost scope. One whose free raises does
+ * not stop the others; the first error is raised once all are done. */
+static mrb_value
+mrb_sdl2_gpu_scope_leave(mrb_state *mrb, mrb_value unused) {
+  int arena = mrb_gc_arena_save(mrb);
+  int depth = scopes.depth;
+  mrb_sdl2_gpu_scope_entry_t *members;
+  mrb_value owned, error = mrb_nil_value();
+  size_t i, n = 0, live;
+  mrb_int k;
+  /* allocated first: a GC it runs only shrinks the scope */
+  owned = mrb_ary_new_capa(mrb, (mrb_int) scopes.count);
+  members = (mrb_sdl2_gpu_scope_entry_t*)
+    SDL_malloc(sizeof(mrb_sdl2_gpu_scope_entry_t) * (scopes.count + 1));
+  scopes.depth--;
+  if (NULL == members)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+  for (i = 0; i < scopes.capacity; i++) {
+    if (NULL != scopes.entries[i].data && depth == scopes.entries[i].depth)
+      members[n++] = scopes.entries[i];
+  }
+  /* the ones the GC already found unreachable are left to their pending
+   * sweep, reaching them again would free them under the loop below */
+  for (i = 0, live = 0; i < n; i++) {
+    mrb_sdl2_gpu_scope_remove(members[i].data);
+    if (!mrb_object_dead_p(mrb, (struct RBasic*) members[i].obj))
+      members[live++] = members[i];
+  }
+  n = live;
+  SDL_qsort(members, n, sizeof(members[0]),
+            mrb_sdl2_gpu_scope_newest_first);
+  for (i = 0; i < n; i++) {
+    mrb_ary_push(mrb, owned, mrb_obj_value(members[i].obj));  /* fits capa */
+  }
+  SDL_free(members);
+
+  mrb_gc_protect(mrb, owned);  /* keeps the objects marked while freeing */
+  for (k = 0; k < RARRAY_LEN(owned); k++) {
+    int ai = mrb_gc_arena_save(mrb);
+    mrb_bool failed = FALSE;
+    mrb_value result = mrb_protect(mrb, mrb_sdl2_gpu_scope_free_one,
+                                   RARRAY_PTR(owned)[k], &failed);
+    mrb_gc_arena_restore(mrb, ai);
+    if (failed && mrb_nil_p(error)) {
+      error = result;
+      mrb_gc_protect(mrb, error);
+    }
+  }
+  mrb_gc_arena_restore(mrb, arena);
+  if (!mrb_nil_p(error))
+    mrb_exc_raise(mrb, error);
+  return mrb_nil_value();
+}
+
+/* GPU.resource_scope { ... } -> the value of the block */
+static mrb_value
+mrb_sdl2_gpu_resource_scope(mrb_state *mrb, mrb_value self) {
+  mrb_value block = mrb_nil_value();
+  mrb_get_args(mrb, "&", &block);
+  if (mrb_nil_p(block))
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "resource_scope needs a block");
+  scopes.depth++;
+  return mrb_ensure(mrb, mrb_sdl2_gpu_scope_body, block,
+                    mrb_sdl2_gpu_scope_leave, mrb_nil_value());
+}
+
+/* GPU.retain(obj) -> obj, taken out of the scopes so it is not freed
+ * when they end. */
+static mrb_value
+mrb_sdl2_gpu_retain(mrb_state *mrb, mrb_value self) {
+  mrb_value obj;
+  mrb_get_args(mrb, "o", &obj);
+  if (MRB_TT_DATA == mrb_type(obj))
+    mrb_sdl2_gpu_scope_remove(DATA_PTR(obj));
+  return obj;
+}
+
+void
+mrb_sdl2_gpu_resource_scope_init(mrb_state *mrb) {
+  mrb_define_module_function(mrb, mod_GPU, "resource_scope", mrb_sdl2_gpu_resource_scope, MRB_ARGS_BLOCK());
+  mrb_define_module_function(mrb, mod_GPU, "retain",         mrb_sdl2_gpu_retain,         MRB_ARGS_REQ(1));
+}
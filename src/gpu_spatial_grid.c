@@ -0,0 +1,614 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::SpatialGrid - a loose uniform grid of sprites sharing one image.
+  Every sprite lives in the cell holding its center, queries widen their
+  range by the largest sprite extent, and Target#draw_visible writes the
+  sprites found inside the target's visible area into the streaming buffer
+  (or SDL_gpu triangle batches).
+  */
+
+#include <math.h>
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/variable.h"
+#include "mruby/array.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_GRID_FLOATS    4      /* x, y, s, t */
+#define MRB_SDL2_GPU_GRID_MAX_QUADS 16383  /* per batch, 16 bit indices */
+#define MRB_SDL2_GPU_GRID_NONE      -1
+
+static struct RClass *class_SpatialGrid = NULL;
+
+/*************************************
+ * GPU::SpatialGrid bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_sprite_t {
+  float    x, y, w, h;
+  float    s0, t0, s1, t1;
+  int      cell;  /* slot in the cell table, NONE when removed */
+  int      prev;
+  int      next;  /* also links the free list */
+} mrb_sdl2_gpu_sprite_t;
+
+typedef struct mrb_sdl2_gpu_cell_t {
+  Sint32   cx;
+  Sint32   cy;
+  int      head;
+  mrb_bool used;
+} mrb_sdl2_gpu_cell_t;
+
+typedef struct mrb_sdl2_gpu_grid_data_t {
+  float    cell_size;
+  mrb_sdl2_gpu_sprite_t *sprites;
+  int      num_sprites;  /* used slots, including removed ones */
+  int      sprite_capa;
+  int      free_list;
+  int      count;
+  float    max_w;
+  float    max_h;
+  mrb_bool max_dirty;  /* a removed sprite may have held max_w or max_h */
+  mrb_sdl2_gpu_cell_t *cells;  /* open addressing on (cx, cy) */
+  int      cell_capa;
+  int      cell_count;
+  float   *vertices;
+  Uint16  *indices;
+} mrb_sdl2_gpu_grid_data_t;
+
+static void
+mrb_sdl2_gpu_grid_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_grid_data_t *data = (mrb_sdl2_gpu_grid_data_t*)p;
+  if (NULL == data)
+    return;
+  mrb_free(mrb, data->sprites);
+  mrb_free(mrb, data->cells);
+  mrb_free(mrb, data->vertices);
+  mrb_free(mrb, data->indices);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_grid_data_type = {
+  "SpatialGrid", mrb_sdl2_gpu_grid_data_free
+};
+
+static mrb_sdl2_gpu_grid_data_t *
+mrb_sdl2_gpu_grid_get_ptr(mrb_state *mrb, mrb_value grid) {
+  mrb_sdl2_gpu_grid_data_t *data =
+    (mrb_sdl2_gpu_grid_data_t*)
+      mrb_data_get_ptr(mrb, grid, &mrb_sdl2_gpu_grid_data_type);
+  if (NULL == data)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::SpatialGrid is not initialized");
+  return data;
+}
+
+static Uint32
+mrb_sdl2_gpu_grid_hash(Sint32 cx, Sint32 cy) {
+  return ((Uint32) cx * 73856093u) ^ ((Uint32) cy * 19349663u);
+}
+
+static int
+mrb_sdl2_gpu_grid_find(mrb_sdl2_gpu_grid_data_t *data, Sint32 cx, Sint32 cy) {
+  int mask = data->cell_capa - 1;
+  int i = mrb_sdl2_gpu_grid_hash(cx, cy) & mask;
+  while (data->cells[i].used) {
+    if (data->cells[i].cx == cx && data->cells[i].cy == cy)
+      return i;
+    i = (i + 1) & mask;
+  }
+  return MRB_SDL2_GPU_GRID_NONE;
+}
+
+/* Returns the slot of a cell, creating it (and growing the table). */
+static int
+mrb_sdl2_gpu_grid_cell(mrb_state *mrb, mrb_sdl2_gpu_grid_data_t *data,
+                       Sint32 cx, Sint32 cy) {
+  int mask, i;
+  if ((data->cell_count + 1) * 2 > data->cell_capa) {
+    mrb_sdl2_gpu_cell_t *old = data->cells;
+    int old_capa = data->cell_capa, j, k;
+    data->cell_capa = old_capa == 0 ? 1024 : old_capa * 2;
+    data->cells = (mrb_sdl2_gpu_cell_t*)
+        mrb_calloc(mrb, data->cell_capa, sizeof(mrb_sdl2_gpu_cell_t));
+    mask = data->cell_capa - 1;
+    for (j = 0; j < old_capa; j++) {
+      if (!old[j].used)
+        continue;
+      i = mrb_sdl2_gpu_grid_hash(old[j].cx, old[j].cy) & mask;
+      while (data->cells[i].used)
+        i = (i + 1) & mask;
+      data->cells[i] = old[j];
+      /* sprites remember their cell slot */
+      for (k = old[j].head; k != MRB_SDL2_GPU_GRID_NONE;
+           k = data->sprites[k].next) {
+        data->sprites[k].cell = i;
+      }
+    }
+    mrb_free(mrb, old);
+  }
+  mask = data->cell_capa - 1;
+  i = mrb_sdl2_gpu_grid_hash(cx, cy) & mask;
+  while (data->cells[i].used) {
+    if (data->cells[i].cx == cx && data->cells[i].cy == cy)
+      return i;
+    i = (i + 1) & mask;
+  }
+  data->cells[i].used = TRUE;
+  data->cells[i].cx = cx;
+  data->cells[i].cy = cy;
+  data->cells[i].head = MRB_SDL2_GPU_GRID_NONE;
+  data->cell_count++;
+  return i;
+}
+
+/* Frees an emptied cell. Backward shift deletion keeps the probe
+ * sequences intact; the sprites of a shifted cell follow it. */
+static void
+mrb_sdl2_gpu_grid_cell_remove(mrb_sdl2_gpu_grid_data_t *data, int i) {
+  int mask = data->cell_capa - 1, j, k;
+  data->cell_count--;
+  for (j = (i + 1) & mask; data->cells[j].used; j = (j + 1) & mask) {
+    int home = mrb_sdl2_gpu_grid_hash(data->cells[j].cx,
+                                      data->cells[j].cy) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      data->cells[i] = data->cells[j];
+      for (k = data->cells[i].head; k != MRB_SDL2_GPU_GRID_NONE;
+           k = data->sprites[k].next) {
+        data->sprites[k].cell = i;
+      }
+      i = j;
+    }
+  }
+  data->cells[i].used = FALSE;
+  data->cells[i].head = MRB_SDL2_GPU_GRID_NONE;
+}
+
+static Sint32
+mrb_sdl2_gpu_grid_coord(mrb_sdl2_gpu_grid_data_t *data, float v) {
+  return (Sint32) floorf(v / data->cell_size);
+}
+
+static void
+mrb_sdl2_gpu_grid_link(mrb_state *mrb, mrb_sdl2_gpu_grid_data_t *data,
+                       int id) {
+  mrb_sdl2_gpu_sprite_t *sprite = &data->sprites[id];
+  int cell = mrb_sdl2_gpu_grid_cell(mrb, data,
+      mrb_sdl2_gpu_grid_coord(data, sprite->x + sprite->w / 2.0f),
+      mrb_sdl2_gpu_grid_coord(data, sprite->y + sprite->h / 2.0f));
+  sprite = &data->sprites[id];
+  sprite->cell = cell;
+  sprite->prev = MRB_SDL2_GPU_GRID_NONE;
+  sprite->next = data->cells[cell].head;
+  if (MRB_SDL2_GPU_GRID_NONE != sprite->next)
+    data->sprites[sprite->next].prev = id;
+  data->cells[cell].head = id;
+}
+
+static void
+mrb_sdl2_gpu_grid_unlink(mrb_sdl2_gpu_grid_data_t *data, int id) {
+  mrb_sdl2_gpu_sprite_t *sprite = &data->sprites[id];
+  if (MRB_SDL2_GPU_GRID_NONE != sprite->prev)
+    data->sprites[sprite->prev].next = sprite->next;
+  else
+    data->cells[sprite->cell].head = sprite->next;
+  if (MRB_SDL2_GPU_GRID_NONE != sprite->next)
+    data->sprites[sprite->next].prev = sprite->prev;
+  if (MRB_SDL2_GPU_GRID_NONE == data->cells[sprite->cell].head)
+    mrb_sdl2_gpu_grid_cell_remove(data, sprite->cell);
+}
+
+/* Shrinks max_w and max_h back to the largest sprite still stored. */
+static void
+mrb_sdl2_gpu_grid_update_max(mrb_sdl2_gpu_grid_data_t *data) {
+  int i, k;
+  if (!data->max_dirty)
+    return;
+  data->max_w = 0.0f;
+  data->max_h = 0.0f;
+  for (i = 0; i < data->cell_capa; i++) {
+    if (!data->cells[i].used)
+      continue;
+    for (k = data->cells[i].head; k != MRB_SDL2_GPU_GRID_NONE;
+         k = data->sprites[k].next) {
+      data->max_w = SDL_max(data->max_w, data->sprites[k].w);
+      data->max_h = SDL_max(data->max_h, data->sprites[k].h);
+    }
+  }
+  data->max_dirty = FALSE;
+}
+
+static mrb_sdl2_gpu_sprite_t *
+mrb_sdl2_gpu_grid_sprite(mrb_state *mrb, mrb_sdl2_gpu_grid_data_t *data,
+                         mrb_int id) {
+  if (id < 0 || id >= data->num_sprites ||
+      MRB_SDL2_GPU_GRID_NONE == data->sprites[id].cell)
+    mrb_raise(mrb, E_INDEX_ERROR, "no such sprite in the grid");
+  return &data->sprites[id];
+}
+
+/* Stores a sprite; src holds the source rect (x, y, w, h) in pixels or is
+ * NULL for the whole image. */
+static int
+mrb_sdl2_gpu_grid_insert(mrb_state *mrb, mrb_sdl2_gpu_grid_data_t *data,
+                         GPU_Image *image, float x, float y, float w, float h,
+                         float const *src) {
+  mrb_sdl2_gpu_sprite_t *sprite;
+  int id;
+  if (MRB_SDL2_GPU_GRID_NONE != data->free_list) {
+    id = data->free_list;
+    data->free_list = data->sprites[id].next;
+  } else {
+    if (data->num_sprites == data->sprite_capa) {
+      data->sprite_capa = data->sprite_capa == 0 ? 256 : data->sprite_capa * 2;
+      data->sprites = (mrb_sdl2_gpu_sprite_t*) mrb_realloc(mrb, data->sprites,
+          sizeof(mrb_sdl2_gpu_sprite_t) * data->sprite_capa);
+    }
+    id = data->num_sprites++;
+  }
+  sprite = &data->sprites[id];
+  sprite->x = x;
+  sprite->y = y;
+  sprite->w = w;
+  sprite->h = h;
+  if (NULL == src) {
+    sprite->s0 = 0.0f;
+    sprite->t0 = 0.0f;
+    sprite->s1 = (float) image->w / image->texture_w;
+    sprite->t1 = (float) image->h / image->texture_h;
+  } else {
+    sprite->s0 = src[0] / image->texture_w;
+    sprite->t0 = src[1] / image->texture_h;
+    sprite->s1 = (src[0] + src[2]) / image->texture_w;
+    sprite->t1 = (src[1] + src[3]) / image->texture_h;
+  }
+  data->max_w = SDL_max(data->max_w, w);
+  data->max_h = SDL_max(data->max_h, h);
+  data->count++;
+  mrb_sdl2_gpu_grid_link(mrb, data, id);
+  return id;
+}
+
+static GPU_Image *
+mrb_sdl2_gpu_grid_image(mrb_state *mrb, mrb_value self) {
+  GPU_Image *image = mrb_sdl2_gpu_image_get_ptr(mrb,
+      mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__image__")));
+  if (NULL == image)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "SpatialGrid image was freed");
+  return image;
+}
+
+static mrb_value
+mrb_sdl2_gpu_grid_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_value image;
+  mrb_float cell_size = 256.0;
+  mrb_sdl2_gpu_grid_data_t *data =
+    (mrb_sdl2_gpu_grid_data_t*)DATA_PTR(self);
+  mrb_get_args(mrb, "o|f", &image, &cell_size);
+  mrb_sdl2_gpu_image_get_ptr(mrb, image);
+  if (cell_size <= 0.0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "cell size must be positive");
+  if (NULL != data) {
+    mrb_sdl2_gpu_grid_data_free(mrb, data);
+    DATA_PTR(self) = NULL;
+  }
+  data = (mrb_sdl2_gpu_grid_data_t*)
+      mrb_calloc(mrb, 1, sizeof(mrb_sdl2_gpu_grid_data_t));
+  if (NULL == data) {
+    mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+  }
+  data->cell_size = cell_size;
+  data->free_list = MRB_SDL2_GPU_GRID_NONE;
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_grid_data_type;
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__image__"), image);
+  return self;
+}
+
+/* add(x, y, w, h, src_rect = nil) -> id */
+static mrb_value
+mrb_sdl2_gpu_grid_add(mrb_state *mrb, mrb_value self) {
+  mrb_float x, y, w, h;
+  mrb_value rect = mrb_nil_value();
+  mrb_sdl2_gpu_grid_data_t *data = mrb_sdl2_gpu_grid_get_ptr(mrb, self);
+  GPU_Image *image = mrb_sdl2_gpu_grid_image(mrb, self);
+  float src[4];
+  mrb_get_args(mrb, "ffff|o", &x, &y, &w, &h, &rect);
+  if (!mrb_nil_p(rect)) {
+    GPU_Rect *r = mrb_sdl2_gpu_rect_get_ptr(mrb, rect);
+    src[0] = r->x;
+    src[1] = r->y;
+    src[2] = r->w;
+    src[3] = r->h;
+  }
+  return mrb_fixnum_value(mrb_sdl2_gpu_grid_insert(mrb, data, image, x, y, w, h,
+                                                   mrb_nil_p(rect) ? NULL : src));
+}
+
+/* add_many([[x, y, w, h], [x, y, w, h, sx, sy, sw, sh], ...]) -> [ids] */
+static mrb_value
+mrb_sdl2_gpu_grid_add_many(mrb_state *mrb, mrb_value self) {
+  mrb_value sprites, ids;
+  mrb_sdl2_gpu_grid_data_t *data = mrb_sdl2_gpu_grid_get_ptr(mrb, self);
+  GPU_Image *image = mrb_sdl2_gpu_grid_image(mrb, self);
+  mrb_int i, n;
+  int ai;
+  mrb_get_args(mrb, "A", &sprites);
+  n = RARRAY_LEN(sprites);
+  ids = mrb_ary_new_capa(mrb, n);
+  ai = mrb_gc_arena_save(mrb);  /* after ids, which must stay protected */
+  for (i = 0; i < n; i++) {
+    mrb_value row = RARRAY_PTR(sprites)[i];
+    float v[8];
+    int k, len;
+    if (!mrb_array_p(row) ||
+        (RARRAY_LEN(row) != 4 && RARRAY_LEN(row) != 8))
+      mrb_raise(mrb, E_ARGUMENT_ERROR,
+                "sprites are [x, y, w, h] or [x, y, w, h, sx, sy, sw, sh]");
+    len = RARRAY_LEN(row);
+    for (k = 0; k < len; k++) {
+      v[k] = mrb_to_flo(mrb, RARRAY_PTR(row)[k]);
+    }
+    mrb_ary_push(mrb, ids, mrb_fixnum_value(
+        mrb_sdl2_gpu_grid_insert(mrb, data, image, v[0], v[1], v[2], v[3],
+                                 8 == len ? &v[4] : NULL)));
+    mrb_gc_arena_restore(mrb, ai);
+  }
+  return ids;
+}
+
+/* move(id, x, y) */
+static mrb_value
+mrb_sdl2_gpu_grid_move(mrb_state *mrb, mrb_value self) {
+  mrb_int id;
+  mrb_float x, y;
+  mrb_sdl2_gpu_grid_data_t *data = mrb_sdl2_gpu_grid_get_ptr(mrb, self);
+  mrb_sdl2_gpu_sprite_t *sprite;
+  Sint32 cx, cy;
+  mrb_get_args(mrb, "iff", &id, &x, &y);
+  sprite = mrb_sdl2_gpu_grid_sprite(mrb, data, id);
+  cx = mrb_sdl2_gpu_grid_coord(data, x + sprite->w / 2.0f);
+  cy = mrb_sdl2_gpu_grid_coord(data, y + sprite->h / 2.0f);
+  if (data->cells[sprite->cell].cx == cx &&
+      data->cells[sprite->cell].cy == cy) {
+    sprite->x = x;
+    sprite->y = y;
+    return self;
+  }
+  mrb_sdl2_gpu_grid_unlink(data, id);
+  sprite->x = x;
+  sprite->y = y;
+  mrb_sdl2_gpu_grid_link(mrb, data, id);
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_grid_remove(mrb_state *mrb, mrb_value self) {
+  mrb_int id;
+  mrb_sdl2_gpu_sprite_t *sprite;
+  mrb_sdl2_gpu_grid_data_t *data = mrb_sdl2_gpu_grid_get_ptr(mrb, self);
+  mrb_get_args(mrb, "i", &id);
+  sprite = mrb_sdl2_gpu_grid_sprite(mrb, data, id);
+  if (sprite->w >= data->max_w || sprite->h >= data->max_h)
+    data->max_dirty = TRUE;
+  mrb_sdl2_gpu_grid_unlink(data, id);
+  data->sprites[id].cell = MRB_SDL2_GPU_GRID_NONE;
+  data->sprites[id].next = data->free_list;
+  data->free_list = id;
+  data->count--;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_grid_clear(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_grid_data_t *data = mrb_sdl2_gpu_grid_get_ptr(mrb, self);
+  data->num_sprites = 0;
+  data->count = 0;
+  data->free_list = MRB_SDL2_GPU_GRID_NONE;
+  data->max_w = 0.0f;
+  data->max_h = 0.0f;
+  data->max_dirty = FALSE;
+  if (NULL != data->cells)
+    SDL_memset(data->cells, 0, sizeof(mrb_sdl2_gpu_cell_t) * data->cell_capa);
+  data->cell_count = 0;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_grid_count(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_grid_get_ptr(mrb, self)->count);
+}
+
+typedef void (*mrb_sdl2_gpu_grid_visit_fn)(void *ctx,
+                                           mrb_sdl2_gpu_sprite_t *sprite,
+                                           int id);
+
+/* Calls visit for every sprite overlapping the area. */
+static void
+mrb_sdl2_gpu_grid_query(mrb_sdl2_gpu_grid_data_t *data, GPU_Rect area,
+                        mrb_sdl2_gpu_grid_visit_fn visit, void *ctx) {
+  Sint32 cx0, cy0, cx1, cy1, cx, cy;
+  float x2 = area.x + area.w, y2 = area.y + area.h;
+  if (0 == data->count)
+    return;
+  mrb_sdl2_gpu_grid_update_max(data);
+  cx0 = mrb_sdl2_gpu_grid_coord(data, area.x - data->max_w / 2.0f);
+  cy0 = mrb_sdl2_gpu_grid_coord(data, area.y - data->max_h / 2.0f);
+  cx1 = mrb_sdl2_gpu_grid_coord(data, x2 + data->max_w / 2.0f);
+  cy1 = mrb_sdl2_gpu_grid_coord(data, y2 + data->max_h / 2.0f);
+  /* a view much larger than the populated cells walks the table instead */
+  if ((Sint64)(cx1 - cx0 + 1) * (cy1 - cy0 + 1) > data->cell_capa) {
+    int i, k;
+    for (i = 0; i < data->cell_capa; i++) {
+      if (!data->cells[i].used || data->cells[i].cx < cx0 ||
+          data->cells[i].cx > cx1 || data->cells[i].cy < cy0 ||
+          data->cells[i].cy > cy1)
+        continue;
+      for (k = data->cells[i].head; k != MRB_SDL2_GPU_GRID_NONE;
+           k = data->sprites[k].next) {
+        mrb_sdl2_gpu_sprite_t *s = &data->sprites[k];
+        if (s->x <= x2 && s->y <= y2 &&
+            s->x + s->w >= area.x && s->y + s->h >= area.y)
+          visit(ctx, s, k);
+      }
+    }
+    return;
+  }
+  for (cy = cy0; cy <= cy1; cy++) {
+    for (cx = cx0; cx <= cx1; cx++) {
+      int cell = mrb_sdl2_gpu_grid_find(data, cx, cy), k;
+      if (MRB_SDL2_GPU_GRID_NONE == cell)
+        continue;
+      for (k = data->cells[cell].head; k != MRB_SDL2_GPU_GRID_NONE;
+           k = data->sprites[k].next) {
+        mrb_sdl2_gpu_sprite_t *s = &data->sprites[k];
+        if (s->x <= x2 && s->y <= y2 &&
+            s->x + s->w >= area.x && s->y + s->h >= area.y)
+          visit(ctx, s, k);
+      }
+    }
+  }
+}
+
+typedef struct mrb_sdl2_gpu_grid_collect_t {
+  mrb_state *mrb;
+  mrb_value  ids;
+} mrb_sdl2_gpu_grid_collect_t;
+
+static void
+mrb_sdl2_gpu_grid_collect(void *ctx, mrb_sdl2_gpu_sprite_t *sprite, int id) {
+  mrb_sdl2_gpu_grid_collect_t *c = (mrb_sdl2_gpu_grid_collect_t*) ctx;
+  mrb_ary_push(c->mrb, c->ids, mrb_fixnum_value(id));
+}
+
+/* query(x, y, w, h) -> ids of the sprites overlapping the area */
+static mrb_value
+mrb_sdl2_gpu_grid_query_ids(mrb_state *mrb, mrb_value self) {
+  mrb_float x, y, w, h;
+  mrb_sdl2_gpu_grid_data_t *data = mrb_sdl2_gpu_grid_get_ptr(mrb, self);
+  mrb_sdl2_gpu_grid_collect_t collect;
+  GPU_Rect area;
+  mrb_get_args(mrb, "ffff", &x, &y, &w, &h);
+  area.x = x;
+  area.y = y;
+  area.w = w;
+  area.h = h;
+  collect.mrb = mrb;
+  collect.ids = mrb_ary_new(mrb);
+  mrb_sdl2_gpu_grid_query(data, area, mrb_sdl2_gpu_grid_collect, &collect);
+  return collect.ids;
+}
+
+typedef struct mrb_sdl2_gpu_grid_draw_t {
+  mrb_state  *mrb;
+  mrb_sdl2_gpu_grid_data_t *data;
+  GPU_Image  *image;
+  GPU_Target *target;
+  mrb_bool    streamed;
+  float      *vertices;  /* reserved in the streaming buffer or data's own */
+  int         quads;
+  int         drawn;
+} mrb_sdl2_gpu_grid_draw_t;
+
+static void
+mrb_sdl2_gpu_grid_flush(mrb_sdl2_gpu_grid_draw_t *d) {
+  if (0 == d->quads)
+    return;
+  if (d->streamed) {
+    mrb_sdl2_gpu_stream_trim(d->vertices, sizeof(float) *
+                             MRB_SDL2_GPU_GRID_FLOATS * 4 * d->quads);
+    mrb_sdl2_gpu_stream_draw(d->mrb, d->target, d->image, GPU_BATCH_XY_ST,
+                             d->vertices, d->quads * 4, NULL, d->quads * 6);
+    d->vertices = NULL;
+  } else {
+    mrb_sdl2_gpu_multi_batch_sync(d->target);
+    GPU_TriangleBatch(d->image, d->target, d->quads * 4, d->vertices,
+                      d->quads * 6, d->data->indices, GPU_BATCH_XY_ST);
+  }
+  d->drawn += d->quads;
+  d->quads = 0;
+}
+
+static void
+mrb_sdl2_gpu_grid_emit(void *ctx, mrb_sdl2_gpu_sprite_t *s, int id) {
+  mrb_sdl2_gpu_grid_draw_t *d = (mrb_sdl2_gpu_grid_draw_t*) ctx;
+  float *v;
+  if (MRB_SDL2_GPU_GRID_MAX_QUADS == d->quads)
+    mrb_sdl2_gpu_grid_flush(d);
+  if (NULL == d->vertices) {
+    d->vertices = (float*) mrb_sdl2_gpu_stream_reserve(sizeof(float) *
+        MRB_SDL2_GPU_GRID_FLOATS * 4 * MRB_SDL2_GPU_GRID_MAX_QUADS, 0, NULL);
+    if (NULL == d->vertices) {
+      d->streamed = FALSE;
+      d->vertices = d->data->vertices;
+    }
+  }
+  v = &d->vertices[d->quads * 4 * MRB_SDL2_GPU_GRID_FLOATS];
+  v[0]  = s->x;        v[1]  = s->y;        v[2]  = s->s0; v[3]  = s->t0;
+  v[4]  = s->x + s->w; v[5]  = s->y;        v[6]  = s->s1; v[7]  = s->t0;
+  v[8]  = s->x + s->w; v[9]  = s->y + s->h; v[10] = s->s1; v[11] = s->t1;
+  v[12] = s->x;        v[13] = s->y + s->h; v[14] = s->s0; v[15] = s->t1;
+  d->quads++;
+}
+
+/* Target#draw_visible(grid) -> number of sprites drawn */
+static mrb_value
+mrb_sdl2_gpu_target_draw_visible(mrb_state *mrb, mrb_value self) {
+  mrb_value grid;
+  mrb_sdl2_gpu_grid_data_t *data;
+  mrb_sdl2_gpu_grid_draw_t draw;
+  int i;
+  mrb_get_args(mrb, "o", &grid);
+  data = mrb_sdl2_gpu_grid_get_ptr(mrb, grid);
+  draw.mrb = mrb;
+  draw.data = data;
+  draw.image = mrb_sdl2_gpu_grid_image(mrb, grid);
+  draw.target = mrb_sdl2_gpu_target_get_ptr(mrb, self);
+  draw.quads = 0;
+  draw.drawn = 0;
+  if (NULL == draw.target)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not get the Target's ptr");
+
+  if (NULL == data->vertices) {
+    data->vertices = (float*) mrb_malloc(mrb, sizeof(float) *
+        MRB_SDL2_GPU_GRID_FLOATS * 4 * MRB_SDL2_GPU_GRID_MAX_QUADS);
+    data->indices = (Uint16*) mrb_malloc(mrb, sizeof(Uint16) *
+        6 * MRB_SDL2_GPU_GRID_MAX_QUADS);
+    for (i = 0; i < MRB_SDL2_GPU_GRID_MAX_QUADS; i++) {
+      data->indices[i * 6 + 0] = i * 4 + 0;
+      data->indices[i * 6 + 1] = i * 4 + 1;
+      data->indices[i * 6 + 2] = i * 4 + 2;
+      data->indices[i * 6 + 3] = i * 4 + 0;
+      data->indices[i * 6 + 4] = i * 4 + 2;
+      data->indices[i * 6 + 5] = i * 4 + 3;
+    }
+  }
+  draw.streamed = mrb_sdl2_gpu_stream_ready(mrb, draw.image, GPU_BATCH_XY_ST);
+  draw.vertices = draw.streamed ? NULL : data->vertices;
+  mrb_sdl2_gpu_grid_query(data,
+                          mrb_sdl2_gpu_target_visible_rect(draw.target),
+                          mrb_sdl2_gpu_grid_emit, &draw);
+  mrb_sdl2_gpu_grid_flush(&draw);
+  return mrb_fixnum_value(draw.drawn);
+}
+/***********************************
+ * GPU::SpatialGrid bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_spatial_grid_init(mrb_state *mrb) {
+  class_SpatialGrid = mrb_define_class_under(mrb, mod_GPU, "SpatialGrid", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_SpatialGrid, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_SpatialGrid, "initialize", mrb_sdl2_gpu_grid_initialize, MRB_ARGS_REQ(1) | MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_SpatialGrid, "add",        mrb_sdl2_gpu_grid_add,        MRB_ARGS_REQ(4) | MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_SpatialGrid, "add_many",   mrb_sdl2_gpu_grid_add_many,   MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_SpatialGrid, "move",       mrb_sdl2_gpu_grid_move,       MRB_ARGS_REQ(3));
+  mrb_define_method(mrb, class_SpatialGrid, "remove",     mrb_sdl2_gpu_grid_remove,     MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_SpatialGrid, "clear",      mrb_sdl2_gpu_grid_clear,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_SpatialGrid, "count",      mrb_sdl2_gpu_grid_count,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_SpatialGrid, "query",      mrb_sdl2_gpu_grid_query_ids,  MRB_ARGS_REQ(4));
+
+  mrb_define_method(mrb, class_Target,      "draw_visible", mrb_sdl2_gpu_target_draw_visible, MRB_ARGS_REQ(1));
+}
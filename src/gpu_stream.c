@@ -0,0 +1,429 @@
+/*Copyright 2015 <Daniel Kolev>
+  Streaming vertex buffer - one GL buffer split in three sections that the
+  batch, particle and sprite paths write their vertices and indices into
+  directly, instead of handing SDL_gpu arrays to copy and upload again.
+
+  With GL_ARB_buffer_storage the buffer is mapped once, persistently, and
+  a fence per section keeps the CPU from overwriting a section the GPU is
+  still reading. Without it writes go to a CPU side copy that is uploaded
+  range by range, and the buffer is orphaned every time the ring wraps.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/hash.h"
+
+#include "../include/gpu_gl.h"
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_STREAM_SECTIONS     3
+#define MRB_SDL2_GPU_STREAM_SECTION_SIZE (4 * 1024 * 1024)
+#define MRB_SDL2_GPU_STREAM_SIZE \
+  (MRB_SDL2_GPU_STREAM_SECTIONS * MRB_SDL2_GPU_STREAM_SECTION_SIZE)
+#define MRB_SDL2_GPU_STREAM_QUADS        16383
+
+static const char *mrb_sdl2_gpu_stream_fragment_source =
+  "varying vec4 color;\n"
+  "varying vec2 texCoord;\n"
+  "uniform sampler2D tex;\n"
+  "void main() {\n"
+  "  gl_FragColor = texture2D(tex, texCoord) * color;\n"
+  "}\n";
+
+static struct {
+  mrb_bool enabled;
+  mrb_bool ready;
+  mrb_bool persistent;
+  GLuint   vbo;
+  GLuint   quad_ibo;
+  Uint8   *memory;  /* the persistent mapping or the CPU side copy */
+  size_t   offset;
+  int      section;
+  GLsync   fences[MRB_SDL2_GPU_STREAM_SECTIONS];
+  mrb_bool orphan;
+  mrb_sdl2_gpu_stream_program_t program;
+  Uint32   draws;
+  Uint32   waits;
+  Uint32   orphans;
+  size_t   bytes;
+} stream = {
+  TRUE, FALSE, FALSE, 0, 0, NULL, 0, 0, { NULL, NULL, NULL }, FALSE,
+  { 0, -1, -1, { -1, -1, -1, -1 } }, 0, 0, 0, 0
+};
+
+/*************************************
+ * Streaming buffer starts here
+ *************************************/
+
+static void
+mrb_sdl2_gpu_stream_create(mrb_state *mrb) {
+  Uint16 *indices;
+  int i;
+  stream.persistent =
+    mrb_sdl2_gpu_gl_extension("GL_ARB_buffer_storage") &&
+    (mrb_sdl2_gpu_gl_version(3, 2) || mrb_sdl2_gpu_gl_extension("GL_ARB_sync")) &&
+    NULL != glBufferStorage && NULL != glMapBufferRange &&
+    NULL != glFenceSync && NULL != glClientWaitSync;
+  glGenBuffers(1, &stream.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+  if (stream.persistent) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT |
+                       GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, MRB_SDL2_GPU_STREAM_SIZE, NULL, flags);
+    stream.memory = (Uint8*) glMapBufferRange(GL_ARRAY_BUFFER, 0,
+                                              MRB_SDL2_GPU_STREAM_SIZE, flags);
+  }
+  if (NULL == stream.memory) {
+    stream.persistent = FALSE;
+    glBufferData(GL_ARRAY_BUFFER, MRB_SDL2_GPU_STREAM_SIZE, NULL,
+                 GL_STREAM_DRAW);
+    stream.memory = (Uint8*) SDL_malloc(MRB_SDL2_GPU_STREAM_SIZE);
+  }
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  if (NULL == stream.memory) {
+    glDeleteBuffers(1, &stream.vbo);
+    stream.vbo = 0;
+    mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+  }
+
+  /* every quad batch shares the same indices */
+  indices = (Uint16*) mrb_malloc(mrb,
+                                 sizeof(Uint16) * 6 * MRB_SDL2_GPU_STREAM_QUADS);
+  for (i = 0; i < MRB_SDL2_GPU_STREAM_QUADS; i++) {
+    indices[i * 6 + 0] = i * 4 + 0;
+    indices[i * 6 + 1] = i * 4 + 1;
+    indices[i * 6 + 2] = i * 4 + 2;
+    indices[i * 6 + 3] = i * 4 + 0;
+    indices[i * 6 + 4] = i * 4 + 2;
+    indices[i * 6 + 5] = i * 4 + 3;
+  }
+  glGenBuffers(1, &stream.quad_ibo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream.quad_ibo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+               sizeof(Uint16) * 6 * MRB_SDL2_GPU_STREAM_QUADS, indices,
+               GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  mrb_free(mrb, indices);
+
+  mrb_sdl2_gpu_stream_program_init(&stream.program,
+    mrb_sdl2_gpu_builtin_program(mrb, mrb_sdl2_gpu_builtin_vertex_source,
+                                 mrb_sdl2_gpu_stream_fragment_source));
+  stream.offset = 0;
+  stream.section = 0;
+  stream.ready = TRUE;
+}
+
+/* Looks up the locations the draws below set, so a draw does not pay for
+ * the string lookups. */
+void
+mrb_sdl2_gpu_stream_program_init(mrb_sdl2_gpu_stream_program_t *program,
+                                 Uint32 id) {
+  program->id = id;
+  program->mvp = glGetUniformLocation(id, "gpu_ModelViewProjectionMatrix");
+  program->tex = glGetUniformLocation(id, "tex");
+  program->attribs[0] = glGetAttribLocation(id, "gpu_Vertex");
+  program->attribs[1] = glGetAttribLocation(id, "gpu_TexCoord");
+  program->attribs[2] = glGetAttribLocation(id, "gpu_Color");
+  program->attribs[3] = glGetAttribLocation(id, "gpu_TexSlot");
+}
+
+/* Whether the stream can be drawn through right now: raw GL works and
+ * SDL_gpu's default shader is active (a user program expects SDL_gpu's
+ * own batching). Creates the stream on first use. */
+mrb_bool
+mrb_sdl2_gpu_stream_usable(mrb_state *mrb) {
+  GPU_Target *context_target;
+  if (!stream.enabled || !mrb_sdl2_gpu_gl_available())
+    return FALSE;
+  context_target = GPU_GetContextTarget();
+  if (NULL == context_target || NULL == context_target->context ||
+      !GPU_IsDefaultShaderProgram(
+        context_target->context->current_shader_program))
+    return FALSE;
+  if (!stream.ready)
+    mrb_sdl2_gpu_stream_create(mrb);
+  return TRUE;
+}
+
+/* Whether a draw with the given image and batch format can go through the
+ * stream: positions in 2 or 3 floats, texture coordinates and optional
+ * float colors. */
+mrb_bool
+mrb_sdl2_gpu_stream_ready(mrb_state *mrb, GPU_Image *image, Uint32 flags) {
+  if (NULL == image || !(flags & GPU_BATCH_ST) ||
+      !(flags & (GPU_BATCH_XY | GPU_BATCH_XYZ)))
+    return FALSE;
+  return mrb_sdl2_gpu_stream_usable(mrb);
+}
+
+/* Moves to the next section, waiting for the GPU to be done with it. */
+static void
+mrb_sdl2_gpu_stream_advance(void) {
+  GLsync fence;
+  if (stream.persistent)
+    stream.fences[stream.section] =
+      glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  stream.section = (stream.section + 1) % MRB_SDL2_GPU_STREAM_SECTIONS;
+  stream.offset = (size_t) stream.section * MRB_SDL2_GPU_STREAM_SECTION_SIZE;
+  if (0 == stream.section && !stream.persistent)
+    stream.orphan = TRUE;
+  fence = stream.fences[stream.section];
+  if (NULL == fence)
+    return;
+  if (GL_ALREADY_SIGNALED != glClientWaitSync(fence, 0, 0)) {
+    stream.waits++;
+    while (GL_TIMEOUT_EXPIRED ==
+           glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000)) {
+    }
+  }
+  glDeleteSync(fence);
+  stream.fences[stream.section] = NULL;
+}
+
+/* Reserves room for vertex_bytes of vertices followed by index_bytes of
+ * indices and returns where the vertices go, or NULL if the batch does
+ * not fit a section. Only one reservation may be pending at a time, so a
+ * pending multi-texture batch goes out first. */
+void *
+mrb_sdl2_gpu_stream_reserve(size_t vertex_bytes, size_t index_bytes,
+                            Uint16 **indices) {
+  size_t bytes = ((vertex_bytes + 15) & ~(size_t) 15) +
+                 ((index_bytes + 15) & ~(size_t) 15);
+  size_t end;
+  Uint8 *vertices;
+  if (!stream.ready || bytes > MRB_SDL2_GPU_STREAM_SECTION_SIZE)
+    return NULL;
+  mrb_sdl2_gpu_multi_batch_flush();
+  end = (size_t)(stream.section + 1) * MRB_SDL2_GPU_STREAM_SECTION_SIZE;
+  if (stream.offset + bytes > end)
+    mrb_sdl2_gpu_stream_advance();
+  vertices = stream.memory + stream.offset;
+  stream.offset += bytes;
+  if (NULL != indices)
+    *indices = index_bytes > 0 ?
+        (Uint16*)(vertices + ((vertex_bytes + 15) & ~(size_t) 15)) : NULL;
+  return vertices;
+}
+
+/* Hands back the tail of the pending reservation when fewer than the
+ * reserved vertex_bytes were written at vertices (no indices). */
+void
+mrb_sdl2_gpu_stream_trim(void const *vertices, size_t vertex_bytes) {
+  stream.offset = (((Uint8 const*) vertices - stream.memory) + vertex_bytes +
+                   15) & ~(size_t) 15;
+}
+
+/* Uploads the bytes written at ptr when there is no persistent mapping. */
+static size_t
+mrb_sdl2_gpu_stream_commit(void const *ptr, size_t bytes) {
+  size_t offset = (Uint8 const*) ptr - stream.memory;
+  if (!stream.persistent && bytes > 0) {
+    if (stream.orphan) {
+      glBufferData(GL_ARRAY_BUFFER, MRB_SDL2_GPU_STREAM_SIZE, NULL,
+                   GL_STREAM_DRAW);
+      stream.orphan = FALSE;
+      stream.orphans++;
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, ptr);
+  }
+  stream.bytes += bytes;
+  return offset;
+}
+
+static void
+mrb_sdl2_gpu_stream_attrib(GLint location, GLint size, GLsizei stride,
+                           size_t offset) {
+  if (location < 0)
+    return;
+  glEnableVertexAttribArray(location);
+  glVertexAttribPointer(location, size, GL_FLOAT, GL_FALSE, stride,
+                        (const GLvoid*) offset);
+}
+
+/* Draws the pending reservation as triangles. indices is the pointer
+ * handed out by reserve, or NULL with num_indices = quads * 6 to use the
+ * shared quad indices, or NULL with 0 for a plain triangle list. */
+void
+mrb_sdl2_gpu_stream_draw(mrb_state *mrb, GPU_Target *target, GPU_Image *image,
+                         Uint32 flags, float const *vertices, int num_vertices,
+                         Uint16 const *indices, int num_indices) {
+  int position = (flags & GPU_BATCH_XYZ) ? 3 : 2;
+  int color = (flags & GPU_BATCH_RGBA) ? 4 : (flags & GPU_BATCH_RGB) ? 3 : 0;
+  int floats = position + 2 + color;
+  GLsizei stride = sizeof(float) * floats;
+  GLint const *locations = stream.program.attribs;
+  size_t offset, index_offset = 0;
+  float mvp[16];
+  int k;
+  if (num_vertices <= 0)
+    return;
+  mrb_sdl2_gpu_gl_begin(mrb, target, mvp);
+  glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+  offset = mrb_sdl2_gpu_stream_commit(vertices, (size_t) stride * num_vertices);
+  if (NULL != indices) {
+    index_offset = mrb_sdl2_gpu_stream_commit(indices,
+                                              sizeof(Uint16) * num_indices);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream.vbo);
+  } else if (num_indices > 0) {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream.quad_ibo);
+  }
+
+  glUseProgram(stream.program.id);
+  glUniformMatrix4fv(stream.program.mvp, 1, GL_FALSE, mvp);
+  glUniform1i(stream.program.tex, 0);
+  mrb_sdl2_gpu_gl_bind_image(image);
+
+  mrb_sdl2_gpu_stream_attrib(locations[0], position, stride, offset);
+  mrb_sdl2_gpu_stream_attrib(locations[1], 2, stride,
+                             offset + sizeof(float) * position);
+  if (color > 0) {
+    mrb_sdl2_gpu_stream_attrib(locations[2], color, stride,
+                               offset + sizeof(float) * (position + 2));
+  } else if (locations[2] >= 0) {
+    glDisableVertexAttribArray(locations[2]);
+    glVertexAttrib4f(locations[2], image->color.r / 255.0f,
+                     image->color.g / 255.0f, image->color.b / 255.0f,
+                     image->color.a / 255.0f);
+  }
+
+  if (num_indices > 0)
+    glDrawElements(GL_TRIANGLES, num_indices, GL_UNSIGNED_SHORT,
+                   (const GLvoid*) index_offset);
+  else
+    glDrawArrays(GL_TRIANGLES, 0, num_vertices);
+  stream.draws++;
+
+  for (k = 0; k < 3; k++) {
+    if (locations[k] >= 0)
+      glDisableVertexAttribArray(locations[k]);
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  mrb_sdl2_gpu_gl_end();
+}
+
+/* Draws num_quads quads of MRB_SDL2_GPU_SLOT_FLOATS floats per vertex (x,
+ * y, s, t, r, g, b, a, texture slot) with program, a sampler array named
+ * tex, and images[k] bound to texture unit k. The first image sets the
+ * blend state. */
+void
+mrb_sdl2_gpu_stream_draw_slots(mrb_state *mrb, GPU_Target *target,
+                               mrb_sdl2_gpu_stream_program_t const *program,
+                               GPU_Image *const *images,
+                               int num_images, float const *vertices,
+                               int num_quads) {
+  GLsizei stride = sizeof(float) * MRB_SDL2_GPU_SLOT_FLOATS;
+  size_t bytes = (size_t) stride * 4 * num_quads;
+  GLint const *locations = program->attribs;
+  GLint units[MRB_SDL2_GPU_MAX_SLOTS];
+  float *dst;
+  size_t offset;
+  float mvp[16];
+  int k;
+  if (num_quads <= 0 || num_images <= 0)
+    return;
+  dst = (float*) mrb_sdl2_gpu_stream_reserve(bytes, 0, NULL);
+  if (NULL == dst)
+    return;
+  SDL_memcpy(dst, vertices, bytes);
+  mrb_sdl2_gpu_gl_begin(mrb, target, mvp);
+  glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+  offset = mrb_sdl2_gpu_stream_commit(dst, bytes);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream.quad_ibo);
+
+  glUseProgram(program->id);
+  glUniformMatrix4fv(program->mvp, 1, GL_FALSE, mvp);
+  for (k = 0; k < num_images; k++) {
+    units[k] = k;
+  }
+  glUniform1iv(program->tex, num_images, units);
+  for (k = num_images - 1; k > 0; k--) {
+    glActiveTexture(GL_TEXTURE0 + k);
+    glBindTexture(GL_TEXTURE_2D, mrb_sdl2_gpu_gl_texture(images[k]));
+  }
+  mrb_sdl2_gpu_gl_bind_image(images[0]);  /* leaves unit 0 active */
+
+  mrb_sdl2_gpu_stream_attrib(locations[0], 2, stride, offset);
+  mrb_sdl2_gpu_stream_attrib(locations[1], 2, stride,
+                             offset + sizeof(float) * 2);
+  mrb_sdl2_gpu_stream_attrib(locations[2], 4, stride,
+                             offset + sizeof(float) * 4);
+  mrb_sdl2_gpu_stream_attrib(locations[3], 1, stride,
+                             offset + sizeof(float) * 8);
+
+  glDrawElements(GL_TRIANGLES, num_quads * 6, GL_UNSIGNED_SHORT, NULL);
+  stream.draws++;
+
+  for (k = 0; k < 4; k++) {
+    if (locations[k] >= 0)
+      glDisableVertexAttribArray(locations[k]);
+  }
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  mrb_sdl2_gpu_gl_end();
+}
+
+/* Drops the buffer and fences, GPU.quit calls it before the context goes. */
+void
+mrb_sdl2_gpu_stream_release(void) {
+  int i;
+  if (!stream.ready)
+    return;
+  for (i = 0; i < MRB_SDL2_GPU_STREAM_SECTIONS; i++) {
+    if (NULL != stream.fences[i])
+      glDeleteSync(stream.fences[i]);
+    stream.fences[i] = NULL;
+  }
+  if (stream.persistent) {
+    glBindBuffer(GL_ARRAY_BUFFER, stream.vbo);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  } else {
+    SDL_free(stream.memory);
+  }
+  glDeleteBuffers(1, &stream.vbo);
+  glDeleteBuffers(1, &stream.quad_ibo);
+  GPU_FreeShaderProgram(stream.program.id);
+  stream.memory = NULL;
+  stream.vbo = 0;
+  stream.quad_ibo = 0;
+  stream.program.id = 0;
+  stream.ready = FALSE;
+}
+
+static mrb_value
+mrb_sdl2_gpu_set_streaming(mrb_state *mrb, mrb_value self) {
+  mrb_bool enabled;
+  mrb_get_args(mrb, "b", &enabled);
+  stream.enabled = enabled;
+  return mrb_bool_value(enabled);
+}
+
+static mrb_value
+mrb_sdl2_gpu_is_streaming(mrb_state *mrb, mrb_value self) {
+  return mrb_bool_value(stream.enabled);
+}
+
+static mrb_value
+mrb_sdl2_gpu_stream_stats(mrb_state *mrb, mrb_value self) {
+  mrb_value hash = mrb_hash_new(mrb);
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "persistent")),
+               mrb_bool_value(stream.ready && stream.persistent));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "draws")),
+               mrb_fixnum_value(stream.draws));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "bytes")),
+               mrb_fixnum_value((mrb_int) stream.bytes));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "waits")),
+               mrb_fixnum_value(stream.waits));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "orphans")),
+               mrb_fixnum_value(stream.orphans));
+  return hash;
+}
+/***********************************
+ * Streaming buffer ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_stream_init(mrb_state *mrb) {
+  mrb_define_module_function(mrb, mod_GPU, "set_streaming", mrb_sdl2_gpu_set_streaming, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, mod_GPU, "streaming?",    mrb_sdl2_gpu_is_streaming,  MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "stream_stats",  mrb_sdl2_gpu_stream_stats,  MRB_ARGS_NONE());
+}
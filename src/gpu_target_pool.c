@@ -0,0 +1,306 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::TargetPool - recycles offscreen render targets so that frame loops
+  which need transient targets (post processing, UI caches) do not create
+  a new texture and framebuffer every frame.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/variable.h"
+#include "mruby/array.h"
+#include "mruby/hash.h"
+
+#include "../include/gpu.h"
+
+static struct RClass *class_TargetPool = NULL;
+
+/*************************************
+ * GPU::TargetPool bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_pool_entry_t {
+  GPU_Image  *image;
+  GPU_Target *target;
+  mrb_value   target_obj;  /* borrowed GPU::Target handed out to scripts */
+  Uint16      w;
+  Uint16      h;
+  int         format;
+  mrb_bool    in_use;
+  Uint32      last_frame;
+} mrb_sdl2_gpu_pool_entry_t;
+
+typedef struct mrb_sdl2_gpu_target_pool_data_t {
+  mrb_sdl2_gpu_pool_entry_t *entries;
+  int    size;
+  int    capa;
+  Uint32 frame;
+  int    max_idle_frames;
+  Uint32 created;
+  Uint32 reused;
+} mrb_sdl2_gpu_target_pool_data_t;
+
+static void
+mrb_sdl2_gpu_pool_entry_destroy(mrb_sdl2_gpu_pool_entry_t *entry) {
+  if (NULL != entry->target) {
+    mrb_sdl2_gpu_multi_batch_end(entry->target);
+    GPU_FreeTarget(entry->target);
+    entry->target = NULL;
+  }
+  if (NULL != entry->image) {
+    mrb_sdl2_gpu_multi_batch_forget(entry->image);
+    mrb_sdl2_gpu_vram_remove(entry->image);
+    GPU_FreeImage(entry->image);
+    entry->image = NULL;
+  }
+}
+
+static void
+mrb_sdl2_gpu_target_pool_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_target_pool_data_t *data =
+    (mrb_sdl2_gpu_target_pool_data_t*)p;
+  int i;
+  if (NULL == data)
+    return;
+  /* every wrapper references the pool, so none of them is alive anymore */
+  for (i = 0; i < data->size; i++) {
+    mrb_sdl2_gpu_pool_entry_destroy(&data->entries[i]);
+  }
+  mrb_free(mrb, data->entries);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_target_pool_data_type = {
+  "TargetPool", mrb_sdl2_gpu_target_pool_data_free
+};
+
+static mrb_sdl2_gpu_target_pool_data_t *
+mrb_sdl2_gpu_target_pool_get_ptr(mrb_state *mrb, mrb_value pool) {
+  mrb_sdl2_gpu_target_pool_data_t *data =
+    (mrb_sdl2_gpu_target_pool_data_t*)
+      mrb_data_get_ptr(mrb, pool, &mrb_sdl2_gpu_target_pool_data_type);
+  if (NULL == data)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::TargetPool is not initialized");
+  return data;
+}
+
+/* Keeps the handed out wrappers reachable for as long as the pool is. */
+static void
+mrb_sdl2_gpu_target_pool_sync_objects(mrb_state *mrb, mrb_value self,
+                                      mrb_sdl2_gpu_target_pool_data_t *data) {
+  mrb_value objects = mrb_ary_new_capa(mrb, data->size);
+  int i;
+  for (i = 0; i < data->size; i++) {
+    mrb_ary_push(mrb, objects, data->entries[i].target_obj);
+  }
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__targets__"), objects);
+}
+
+static void
+mrb_sdl2_gpu_target_pool_remove(mrb_state *mrb,
+                                mrb_sdl2_gpu_target_pool_data_t *data,
+                                int index) {
+  mrb_sdl2_gpu_pool_entry_t *entry = &data->entries[index];
+  mrb_sdl2_gpu_target_detach(mrb, entry->target_obj);
+  mrb_sdl2_gpu_pool_entry_destroy(entry);
+  data->entries[index] = data->entries[data->size - 1];
+  data->size--;
+}
+
+/* Target#free on a handed out wrapper only detaches it, the pool still
+ * owns the target. Such an entry gets a fresh wrapper when reused. */
+static mrb_value
+mrb_sdl2_gpu_target_pool_wrapper(mrb_state *mrb, mrb_value self,
+                                 mrb_sdl2_gpu_target_pool_data_t *data,
+                                 mrb_sdl2_gpu_pool_entry_t *entry) {
+  if (mrb_sdl2_gpu_target_get_ptr(mrb, entry->target_obj) != entry->target) {
+    entry->target_obj = mrb_sdl2_gpu_target_borrowed(mrb, entry->target);
+    mrb_iv_set(mrb, entry->target_obj, mrb_intern_lit(mrb, "__pool__"), self);
+    mrb_sdl2_gpu_target_pool_sync_objects(mrb, self, data);
+  }
+  return entry->target_obj;
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_pool_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_int max_idle_frames = 60;
+  mrb_sdl2_gpu_target_pool_data_t *data =
+    (mrb_sdl2_gpu_target_pool_data_t*)DATA_PTR(self);
+  mrb_get_args(mrb, "|i", &max_idle_frames);
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_target_pool_data_t*)
+        mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_target_pool_data_t));
+    if (NULL == data) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+    data->entries = NULL;
+    data->size = 0;
+    data->capa = 0;
+  }
+  data->frame = 0;
+  data->max_idle_frames = max_idle_frames;
+  data->created = 0;
+  data->reused = 0;
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_target_pool_data_type;
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_pool_acquire(mrb_state *mrb, mrb_value self) {
+  mrb_int w, h, format = GPU_FORMAT_RGBA;
+  mrb_sdl2_gpu_target_pool_data_t *data =
+    mrb_sdl2_gpu_target_pool_get_ptr(mrb, self);
+  mrb_sdl2_gpu_pool_entry_t *entry;
+  GPU_Image *image;
+  GPU_Target *target;
+  int i;
+  mrb_get_args(mrb, "ii|i", &w, &h, &format);
+  if (w <= 0 || h <= 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "target size must be positive");
+
+  for (i = 0; i < data->size; i++) {
+    entry = &data->entries[i];
+    if (!entry->in_use && entry->w == w && entry->h == h &&
+        entry->format == format) {
+      entry->in_use = TRUE;
+      entry->last_frame = data->frame;
+      data->reused++;
+      return mrb_sdl2_gpu_target_pool_wrapper(mrb, self, data, entry);
+    }
+  }
+
+  /* grown first, mrb_realloc raises and would leak the new target */
+  if (data->size == data->capa) {
+    int capa = data->capa == 0 ? 8 : data->capa * 2;
+    mrb_sdl2_gpu_pool_entry_t *entries = (mrb_sdl2_gpu_pool_entry_t*)
+        mrb_realloc(mrb, data->entries,
+                    sizeof(mrb_sdl2_gpu_pool_entry_t) * capa);
+    data->entries = entries;
+    data->capa = capa;
+  }
+  if (!mrb_sdl2_gpu_vram_reserve(
+          mrb, mrb_sdl2_gpu_vram_estimate(w, h, (GPU_FormatEnum) format)))
+    mrb_raise(mrb, E_RUNTIME_ERROR,
+              "pooled Image would exceed the VRAM budget");
+  image = GPU_CreateImage(w, h, format);
+  if (NULL == image)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create pooled Image");
+  target = GPU_LoadTarget(image);
+  if (NULL == target) {
+    GPU_FreeImage(image);
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Could not create pooled Target");
+  }
+  mrb_sdl2_gpu_vram_add(image, "TargetPool");
+
+  entry = &data->entries[data->size++];
+  entry->image = image;
+  entry->target = target;
+  entry->w = w;
+  entry->h = h;
+  entry->format = format;
+  entry->in_use = TRUE;
+  entry->last_frame = data->frame;
+  entry->target_obj = mrb_nil_value();  /* until the wrapper exists */
+  entry->target_obj = mrb_sdl2_gpu_target_borrowed(mrb, target);
+  mrb_iv_set(mrb, entry->target_obj, mrb_intern_lit(mrb, "__pool__"), self);
+  data->created++;
+  mrb_sdl2_gpu_target_pool_sync_objects(mrb, self, data);
+  return entry->target_obj;
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_pool_release(mrb_state *mrb, mrb_value self) {
+  mrb_value target;
+  GPU_Target *t;
+  mrb_sdl2_gpu_target_pool_data_t *data =
+    mrb_sdl2_gpu_target_pool_get_ptr(mrb, self);
+  int i;
+  mrb_get_args(mrb, "o", &target);
+  t = mrb_sdl2_gpu_target_get_ptr(mrb, target);
+  for (i = 0; i < data->size; i++) {
+    if (data->entries[i].target == t) {
+      data->entries[i].in_use = FALSE;
+      return mrb_true_value();
+    }
+  }
+  return mrb_false_value();
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_pool_end_frame(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_target_pool_data_t *data =
+    mrb_sdl2_gpu_target_pool_get_ptr(mrb, self);
+  int i, trimmed = 0;
+  data->frame++;
+  for (i = data->size - 1; i >= 0; i--) {
+    mrb_sdl2_gpu_pool_entry_t *entry = &data->entries[i];
+    if (entry->in_use) {
+      entry->in_use = FALSE;
+    } else if (data->frame - entry->last_frame >
+               (Uint32) data->max_idle_frames) {
+      mrb_sdl2_gpu_target_pool_remove(mrb, data, i);
+      trimmed++;
+    }
+  }
+  if (trimmed > 0)
+    mrb_sdl2_gpu_target_pool_sync_objects(mrb, self, data);
+  return mrb_fixnum_value(trimmed);
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_pool_clear(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_target_pool_data_t *data =
+    mrb_sdl2_gpu_target_pool_get_ptr(mrb, self);
+  while (data->size > 0) {
+    mrb_sdl2_gpu_target_pool_remove(mrb, data, data->size - 1);
+  }
+  mrb_sdl2_gpu_target_pool_sync_objects(mrb, self, data);
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_target_pool_stats(mrb_state *mrb, mrb_value self) {
+  mrb_sdl2_gpu_target_pool_data_t *data =
+    mrb_sdl2_gpu_target_pool_get_ptr(mrb, self);
+  mrb_value hash = mrb_hash_new(mrb);
+  mrb_int in_use = 0, bytes = 0;
+  int i;
+  for (i = 0; i < data->size; i++) {
+    GPU_Image *image = data->entries[i].image;
+    if (data->entries[i].in_use)
+      in_use++;
+    bytes += (mrb_int) image->texture_w * image->texture_h *
+             image->bytes_per_pixel;
+  }
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "size")),
+               mrb_fixnum_value(data->size));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "in_use")),
+               mrb_fixnum_value(in_use));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "free")),
+               mrb_fixnum_value(data->size - in_use));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "created")),
+               mrb_fixnum_value(data->created));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "reused")),
+               mrb_fixnum_value(data->reused));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "bytes")),
+               mrb_fixnum_value(bytes));
+  return hash;
+}
+/***********************************
+ * GPU::TargetPool bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_target_pool_init(mrb_state *mrb) {
+  class_TargetPool = mrb_define_class_under(mrb, mod_GPU, "TargetPool", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_TargetPool, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_TargetPool, "initialize", mrb_sdl2_gpu_target_pool_initialize, MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_TargetPool, "acquire",    mrb_sdl2_gpu_target_pool_acquire,    MRB_ARGS_REQ(2) | MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_TargetPool, "release",    mrb_sdl2_gpu_target_pool_release,    MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_TargetPool, "end_frame",  mrb_sdl2_gpu_target_pool_end_frame,  MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_TargetPool, "clear",      mrb_sdl2_gpu_target_pool_clear,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_TargetPool, "stats",      mrb_sdl2_gpu_target_pool_stats,      MRB_ARGS_NONE());
+}
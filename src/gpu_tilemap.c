@@ -0,0 +1,344 @@
+/*Copyright 2015 <Daniel Kolev>
+  GPU::Tilemap - draws a grid of tiles from a tileset image. The map is
+  split into square chunks whose vertex data is built once and rebuilt only
+  after one of their tiles changed; every chunk inside the target's visible
+  area is drawn with a single GPU_TriangleBatch.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/data.h"
+#include "mruby/class.h"
+#include "mruby/variable.h"
+#include "mruby/array.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_TILEMAP_FLOATS    4     /* x, y, s, t */
+#define MRB_SDL2_GPU_TILEMAP_MAX_CHUNK 127   /* 4 * 127^2 < 65536 vertices */
+#define MRB_SDL2_GPU_TILEMAP_EMPTY     -1
+
+static struct RClass *class_Tilemap = NULL;
+
+/*************************************
+ * GPU::Tilemap bindings starts here
+ *************************************/
+
+typedef struct mrb_sdl2_gpu_chunk_t {
+  float   *vertices;
+  int      num_vertices;
+  mrb_bool dirty;
+} mrb_sdl2_gpu_chunk_t;
+
+typedef struct mrb_sdl2_gpu_tilemap_data_t {
+  Sint32 *tiles;
+  int     map_w;
+  int     map_h;
+  int     tile_w;
+  int     tile_h;
+  int     chunk_size;
+  int     chunks_x;
+  int     chunks_y;
+  mrb_sdl2_gpu_chunk_t *chunks;
+  Uint16 *indices;  /* shared quad indices for a full chunk */
+} mrb_sdl2_gpu_tilemap_data_t;
+
+static void
+mrb_sdl2_gpu_tilemap_release(mrb_state *mrb,
+                             mrb_sdl2_gpu_tilemap_data_t *data) {
+  int i;
+  if (NULL != data->chunks) {
+    for (i = 0; i < data->chunks_x * data->chunks_y; i++) {
+      mrb_free(mrb, data->chunks[i].vertices);
+    }
+  }
+  mrb_free(mrb, data->chunks);
+  mrb_free(mrb, data->tiles);
+  mrb_free(mrb, data->indices);
+  data->chunks = NULL;
+  data->tiles = NULL;
+  data->indices = NULL;
+}
+
+static void
+mrb_sdl2_gpu_tilemap_data_free(mrb_state *mrb, void *p) {
+  mrb_sdl2_gpu_tilemap_data_t *data = (mrb_sdl2_gpu_tilemap_data_t*)p;
+  if (NULL == data)
+    return;
+  mrb_sdl2_gpu_tilemap_release(mrb, data);
+  mrb_free(mrb, data);
+}
+
+static struct mrb_data_type const mrb_sdl2_gpu_tilemap_data_type = {
+  "Tilemap", mrb_sdl2_gpu_tilemap_data_free
+};
+
+static mrb_sdl2_gpu_tilemap_data_t *
+mrb_sdl2_gpu_tilemap_get_ptr(mrb_state *mrb, mrb_value tilemap) {
+  mrb_sdl2_gpu_tilemap_data_t *data =
+    (mrb_sdl2_gpu_tilemap_data_t*)
+      mrb_data_get_ptr(mrb, tilemap, &mrb_sdl2_gpu_tilemap_data_type);
+  if (NULL == data || NULL == data->tiles)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "GPU::Tilemap is not initialized");
+  return data;
+}
+
+static mrb_int
+mrb_sdl2_gpu_tilemap_index(mrb_state *mrb, mrb_sdl2_gpu_tilemap_data_t *data,
+                           mrb_int x, mrb_int y) {
+  if (x < 0 || y < 0 || x >= data->map_w || y >= data->map_h)
+    mrb_raise(mrb, E_INDEX_ERROR, "tile position out of the map");
+  return y * data->map_w + x;
+}
+
+static void
+mrb_sdl2_gpu_tilemap_touch(mrb_sdl2_gpu_tilemap_data_t *data, int x, int y) {
+  data->chunks[(y / data->chunk_size) * data->chunks_x +
+               x / data->chunk_size].dirty = TRUE;
+}
+
+static void
+mrb_sdl2_gpu_tilemap_touch_all(mrb_sdl2_gpu_tilemap_data_t *data) {
+  int i;
+  for (i = 0; i < data->chunks_x * data->chunks_y; i++) {
+    data->chunks[i].dirty = TRUE;
+  }
+}
+
+/* Rebuilds the quads of one chunk in map pixel coordinates. */
+static void
+mrb_sdl2_gpu_tilemap_build(mrb_state *mrb, mrb_sdl2_gpu_tilemap_data_t *data,
+                           GPU_Image *tileset, int cx, int cy) {
+  mrb_sdl2_gpu_chunk_t *chunk = &data->chunks[cy * data->chunks_x + cx];
+  int columns = tileset->w / data->tile_w;
+  int count = columns * (tileset->h / data->tile_h);
+  float tex_w = tileset->texture_w, tex_h = tileset->texture_h;
+  int x0 = cx * data->chunk_size, y0 = cy * data->chunk_size;
+  int x1 = SDL_min(x0 + data->chunk_size, data->map_w);
+  int y1 = SDL_min(y0 + data->chunk_size, data->map_h);
+  int x, y;
+  float *v;
+
+  if (NULL == chunk->vertices) {
+    chunk->vertices = (float*) mrb_malloc(mrb, sizeof(float) *
+        MRB_SDL2_GPU_TILEMAP_FLOATS * 4 * data->chunk_size * data->chunk_size);
+  }
+  v = chunk->vertices;
+  chunk->num_vertices = 0;
+  for (y = y0; y < y1; y++) {
+    for (x = x0; x < x1; x++) {
+      Sint32 tile = data->tiles[y * data->map_w + x];
+      float px, py, s0, t0, s1, t1;
+      if (tile < 0 || tile >= count)
+        continue;
+      px = (float)(x * data->tile_w);
+      py = (float)(y * data->tile_h);
+      s0 = (tile % columns) * data->tile_w / tex_w;
+      t0 = (tile / columns) * data->tile_h / tex_h;
+      s1 = s0 + data->tile_w / tex_w;
+      t1 = t0 + data->tile_h / tex_h;
+      v[0]  = px;                v[1]  = py;
+      v[2]  = s0;                v[3]  = t0;
+      v[4]  = px + data->tile_w; v[5]  = py;
+      v[6]  = s1;                v[7]  = t0;
+      v[8]  = px + data->tile_w; v[9]  = py + data->tile_h;
+      v[10] = s1;                v[11] = t1;
+      v[12] = px;                v[13] = py + data->tile_h;
+      v[14] = s0;                v[15] = t1;
+      v += 4 * MRB_SDL2_GPU_TILEMAP_FLOATS;
+      chunk->num_vertices += 4;
+    }
+  }
+  chunk->dirty = FALSE;
+}
+
+static mrb_value
+mrb_sdl2_gpu_tilemap_initialize(mrb_state *mrb, mrb_value self) {
+  mrb_value tileset;
+  mrb_int map_w, map_h, tile_w, tile_h, chunk_size = 16;
+  mrb_sdl2_gpu_tilemap_data_t *data =
+    (mrb_sdl2_gpu_tilemap_data_t*)DATA_PTR(self);
+  int i, quads;
+  mrb_get_args(mrb, "oiiii|i", &tileset, &map_w, &map_h, &tile_w, &tile_h,
+               &chunk_size);
+  mrb_sdl2_gpu_image_get_ptr(mrb, tileset);
+  if (map_w <= 0 || map_h <= 0 || tile_w <= 0 || tile_h <= 0)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "map and tile sizes must be positive");
+  if (chunk_size <= 0 || chunk_size > MRB_SDL2_GPU_TILEMAP_MAX_CHUNK)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "chunk size must be between 1 and 127");
+
+  if (NULL == data) {
+    data = (mrb_sdl2_gpu_tilemap_data_t*)
+        mrb_malloc(mrb, sizeof(mrb_sdl2_gpu_tilemap_data_t));
+    if (NULL == data) {
+      mrb_raise(mrb, E_RUNTIME_ERROR, "insufficient memory.");
+    }
+    data->tiles = NULL;
+    data->chunks = NULL;
+    data->indices = NULL;
+  } else {
+    mrb_sdl2_gpu_tilemap_release(mrb, data);
+  }
+  DATA_PTR(self) = data;
+  DATA_TYPE(self) = &mrb_sdl2_gpu_tilemap_data_type;
+
+  data->map_w = map_w;
+  data->map_h = map_h;
+  data->tile_w = tile_w;
+  data->tile_h = tile_h;
+  data->chunk_size = chunk_size;
+  data->chunks_x = (map_w + chunk_size - 1) / chunk_size;
+  data->chunks_y = (map_h + chunk_size - 1) / chunk_size;
+  data->tiles = (Sint32*) mrb_malloc(mrb, sizeof(Sint32) * map_w * map_h);
+  for (i = 0; i < map_w * map_h; i++) {
+    data->tiles[i] = MRB_SDL2_GPU_TILEMAP_EMPTY;
+  }
+  data->chunks = (mrb_sdl2_gpu_chunk_t*) mrb_calloc(mrb,
+      data->chunks_x * data->chunks_y, sizeof(mrb_sdl2_gpu_chunk_t));
+  mrb_sdl2_gpu_tilemap_touch_all(data);
+  quads = chunk_size * chunk_size;
+  data->indices = (Uint16*) mrb_malloc(mrb, sizeof(Uint16) * quads * 6);
+  for (i = 0; i < quads; i++) {
+    data->indices[i * 6 + 0] = i * 4 + 0;
+    data->indices[i * 6 + 1] = i * 4 + 1;
+    data->indices[i * 6 + 2] = i * 4 + 2;
+    data->indices[i * 6 + 3] = i * 4 + 0;
+    data->indices[i * 6 + 4] = i * 4 + 2;
+    data->indices[i * 6 + 5] = i * 4 + 3;
+  }
+  mrb_iv_set(mrb, self, mrb_intern_lit(mrb, "__tileset__"), tileset);
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_tilemap_set(mrb_state *mrb, mrb_value self) {
+  mrb_int x, y, tile;
+  mrb_sdl2_gpu_tilemap_data_t *data = mrb_sdl2_gpu_tilemap_get_ptr(mrb, self);
+  mrb_int index;
+  mrb_get_args(mrb, "iii", &x, &y, &tile);
+  index = mrb_sdl2_gpu_tilemap_index(mrb, data, x, y);
+  if (data->tiles[index] != tile) {
+    data->tiles[index] = tile;
+    mrb_sdl2_gpu_tilemap_touch(data, x, y);
+  }
+  return self;
+}
+
+static mrb_value
+mrb_sdl2_gpu_tilemap_get(mrb_state *mrb, mrb_value self) {
+  mrb_int x, y;
+  mrb_sdl2_gpu_tilemap_data_t *data = mrb_sdl2_gpu_tilemap_get_ptr(mrb, self);
+  mrb_get_args(mrb, "ii", &x, &y);
+  return mrb_fixnum_value(
+      data->tiles[mrb_sdl2_gpu_tilemap_index(mrb, data, x, y)]);
+}
+
+static mrb_value
+mrb_sdl2_gpu_tilemap_fill(mrb_state *mrb, mrb_value self) {
+  mrb_int tile;
+  mrb_sdl2_gpu_tilemap_data_t *data = mrb_sdl2_gpu_tilemap_get_ptr(mrb, self);
+  int i;
+  mrb_get_args(mrb, "i", &tile);
+  for (i = 0; i < data->map_w * data->map_h; i++) {
+    data->tiles[i] = tile;
+  }
+  mrb_sdl2_gpu_tilemap_touch_all(data);
+  return self;
+}
+
+/* load(tiles) replaces the map with a flat, row major array. */
+static mrb_value
+mrb_sdl2_gpu_tilemap_load(mrb_state *mrb, mrb_value self) {
+  mrb_value tiles;
+  mrb_sdl2_gpu_tilemap_data_t *data = mrb_sdl2_gpu_tilemap_get_ptr(mrb, self);
+  int i;
+  mrb_get_args(mrb, "A", &tiles);
+  if (RARRAY_LEN(tiles) != data->map_w * data->map_h)
+    mrb_raise(mrb, E_ARGUMENT_ERROR, "tile array does not match the map size");
+  for (i = 0; i < data->map_w * data->map_h; i++) {
+    mrb_value tile = RARRAY_PTR(tiles)[i];
+    data->tiles[i] = mrb_nil_p(tile) ? MRB_SDL2_GPU_TILEMAP_EMPTY :
+        (Sint32) mrb_fixnum(mrb_to_int(mrb, tile));
+  }
+  mrb_sdl2_gpu_tilemap_touch_all(data);
+  return self;
+}
+
+/* draw(target, x = 0.0, y = 0.0) -> number of chunks drawn */
+static mrb_value
+mrb_sdl2_gpu_tilemap_draw(mrb_state *mrb, mrb_value self) {
+  mrb_value target_obj;
+  mrb_float x = 0.0, y = 0.0;
+  mrb_sdl2_gpu_tilemap_data_t *data = mrb_sdl2_gpu_tilemap_get_ptr(mrb, self);
+  GPU_Image *tileset = mrb_sdl2_gpu_image_get_ptr(mrb,
+      mrb_iv_get(mrb, self, mrb_intern_lit(mrb, "__tileset__")));
+  GPU_Target *target;
+  GPU_Rect visible;
+  float chunk_w, chunk_h;
+  int cx0, cy0, cx1, cy1, cx, cy, drawn = 0;
+  mrb_get_args(mrb, "o|ff", &target_obj, &x, &y);
+  target = mrb_sdl2_gpu_target_get_ptr(mrb, target_obj);
+  if (NULL == target || NULL == tileset)
+    mrb_raise(mrb, E_RUNTIME_ERROR, "Tilemap needs a live target and tileset");
+
+  /* only the chunks overlapping the visible area, in map space */
+  visible = mrb_sdl2_gpu_target_visible_rect(target);
+  chunk_w = (float) data->chunk_size * data->tile_w;
+  chunk_h = (float) data->chunk_size * data->tile_h;
+  cx0 = SDL_max(0, (int) SDL_floor((visible.x - x) / chunk_w));
+  cy0 = SDL_max(0, (int) SDL_floor((visible.y - y) / chunk_h));
+  cx1 = SDL_min(data->chunks_x - 1,
+                (int) SDL_floor((visible.x + visible.w - x) / chunk_w));
+  cy1 = SDL_min(data->chunks_y - 1,
+                (int) SDL_floor((visible.y + visible.h - y) / chunk_h));
+  if (cx0 > cx1 || cy0 > cy1)
+    return mrb_fixnum_value(0);
+
+  mrb_sdl2_gpu_multi_batch_sync(target);
+  GPU_MatrixMode(GPU_MODELVIEW);
+  GPU_PushMatrix();
+  GPU_Translate(x, y, 0.0f);
+  for (cy = cy0; cy <= cy1; cy++) {
+    for (cx = cx0; cx <= cx1; cx++) {
+      mrb_sdl2_gpu_chunk_t *chunk = &data->chunks[cy * data->chunks_x + cx];
+      if (chunk->dirty)
+        mrb_sdl2_gpu_tilemap_build(mrb, data, tileset, cx, cy);
+      if (0 == chunk->num_vertices)
+        continue;
+      GPU_TriangleBatch(tileset, target, chunk->num_vertices,
+                        chunk->vertices, chunk->num_vertices / 4 * 6,
+                        data->indices, GPU_BATCH_XY_ST);
+      drawn++;
+    }
+  }
+  GPU_PopMatrix();
+  return mrb_fixnum_value(drawn);
+}
+
+static mrb_value
+mrb_sdl2_gpu_tilemap_width(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_tilemap_get_ptr(mrb, self)->map_w);
+}
+
+static mrb_value
+mrb_sdl2_gpu_tilemap_height(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_tilemap_get_ptr(mrb, self)->map_h);
+}
+/***********************************
+ * GPU::Tilemap bindings ends here
+ ***********************************/
+
+void
+mrb_sdl2_gpu_tilemap_init(mrb_state *mrb) {
+  class_Tilemap = mrb_define_class_under(mrb, mod_GPU, "Tilemap", mrb->object_class);
+  MRB_SET_INSTANCE_TT(class_Tilemap, MRB_TT_DATA);
+
+  mrb_define_method(mrb, class_Tilemap, "initialize", mrb_sdl2_gpu_tilemap_initialize, MRB_ARGS_REQ(5) | MRB_ARGS_OPT(1));
+  mrb_define_method(mrb, class_Tilemap, "set",        mrb_sdl2_gpu_tilemap_set,        MRB_ARGS_REQ(3));
+  mrb_define_method(mrb, class_Tilemap, "get",        mrb_sdl2_gpu_tilemap_get,        MRB_ARGS_REQ(2));
+  mrb_define_method(mrb, class_Tilemap, "fill",       mrb_sdl2_gpu_tilemap_fill,       MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_Tilemap, "load",       mrb_sdl2_gpu_tilemap_load,       MRB_ARGS_REQ(1));
+  mrb_define_method(mrb, class_Tilemap, "draw",       mrb_sdl2_gpu_tilemap_draw,       MRB_ARGS_REQ(1) | MRB_ARGS_OPT(2));
+  mrb_define_method(mrb, class_Tilemap, "width",      mrb_sdl2_gpu_tilemap_width,      MRB_ARGS_NONE());
+  mrb_define_method(mrb, class_Tilemap, "height",     mrb_sdl2_gpu_tilemap_height,     MRB_ARGS_NONE());
+}
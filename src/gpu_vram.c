@@ -0,0 +1,448 @@
+/*Copyright 2015 <Daniel Kolev>
+  VRAM registry - every GPU_Image the bindings create is recorded here
+  with where it came from, the frame it was created in and the last frame
+  it was drawn. GPU.memory_report sums them up; GPU.vram_budget= makes
+  the creating calls check the total first and, when it would be
+  exceeded, ask the GPU.on_vram_budget block to free something. If that
+  does not make room the call fails like any allocation would.
+
+  Sizes are estimates: texture_w * texture_h * bytes_per_pixel, plus a
+  third for mipmaps. Each is taken when the image is recorded and again
+  by the calls that change it (Image#generate_mipmaps and the raw size
+  setters), and a running total keeps the budget check O(1).
+
+  The GC only sees the small wrappers, so the bytes created since the
+  last collection are counted as well (programs add a nominal amount).
+  Once they pass GPU.gc_pressure_limit the next allocation runs a full
+  GC first, freeing the textures of dropped wrappers before new ones
+  pile up. GPU.collect_unused does the same on demand.
+  */
+
+#include <SDL/SDL_gpu.h>
+#include "../include/mruby.h"
+#include "mruby/array.h"
+#include "mruby/error.h"
+#include "mruby/hash.h"
+#include "mruby/string.h"
+#include "mruby/variable.h"
+
+#include "../include/gpu.h"
+
+#define MRB_SDL2_GPU_VRAM_SITE 32
+#define MRB_SDL2_GPU_GC_PRESSURE_LIMIT (64 * 1024 * 1024)
+
+typedef struct mrb_sdl2_gpu_vram_entry_t {
+  GPU_Image *image;
+  char       site[MRB_SDL2_GPU_VRAM_SITE];
+  Uint32     created;
+  Uint32     last_used;
+  size_t     bytes;
+} mrb_sdl2_gpu_vram_entry_t;
+
+static struct {
+  mrb_sdl2_gpu_vram_entry_t *entries;  /* open addressing by image */
+  size_t   capacity;                   /* power of two */
+  size_t   count;
+  size_t   total;                      /* bytes of the entries */
+  Uint32   frame;
+  size_t   budget;                     /* 0 is unlimited */
+  mrb_bool evicting;
+  size_t   pending;                    /* bytes created since the last GC */
+  size_t   pressure_limit;             /* 0 leaves collecting to mruby */
+  size_t   collections;
+} vram = { NULL, 0, 0, 0, 0, 0, FALSE, 0, MRB_SDL2_GPU_GC_PRESSURE_LIMIT, 0 };
+
+static size_t
+mrb_sdl2_gpu_vram_hash(GPU_Image const *image) {
+  size_t h = (size_t) image >> 4;
+  h *= (size_t) 0x9E3779B97F4A7C15ULL;
+  return h ^ (h >> 16);
+}
+
+/* Slot of image, or of the empty slot ending its probe sequence. */
+static size_t
+mrb_sdl2_gpu_vram_slot(GPU_Image const *image) {
+  size_t mask = vram.capacity - 1;
+  size_t i = mrb_sdl2_gpu_vram_hash(image) & mask;
+  while (NULL != vram.entries[i].image && vram.entries[i].image != image) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static mrb_bool
+mrb_sdl2_gpu_vram_grow(void) {
+  mrb_sdl2_gpu_vram_entry_t *old = vram.entries;
+  size_t old_capacity = vram.capacity, i;
+  size_t capacity = 0 == old_capacity ? 64 : old_capacity * 2;
+  mrb_sdl2_gpu_vram_entry_t *entries = (mrb_sdl2_gpu_vram_entry_t*)
+    SDL_calloc(capacity, sizeof(mrb_sdl2_gpu_vram_entry_t));
+  if (NULL == entries)
+    return FALSE;
+  vram.entries = entries;
+  vram.capacity = capacity;
+  for (i = 0; i < old_capacity; i++) {
+    if (NULL != old[i].image)
+      vram.entries[mrb_sdl2_gpu_vram_slot(old[i].image)] = old[i];
+  }
+  SDL_free(old);
+  return TRUE;
+}
+
+static mrb_sdl2_gpu_vram_entry_t *
+mrb_sdl2_gpu_vram_find(GPU_Image const *image) {
+  mrb_sdl2_gpu_vram_entry_t *entry;
+  if (NULL == image || 0 == vram.count)
+    return NULL;
+  entry = &vram.entries[mrb_sdl2_gpu_vram_slot(image)];
+  return NULL == entry->image ? NULL : entry;
+}
+
+static size_t
+mrb_sdl2_gpu_vram_image_bytes(GPU_Image const *image) {
+  size_t bytes = (size_t) image->texture_w * image->texture_h *
+                 image->bytes_per_pixel;
+  return image->has_mipmaps ? bytes + bytes / 3 : bytes;
+}
+
+static size_t
+mrb_sdl2_gpu_vram_total(void) {
+  return vram.total;
+}
+
+/* Bytes a w x h image of format will take, before it exists. */
+size_t
+mrb_sdl2_gpu_vram_estimate(Uint16 w, Uint16 h, GPU_FormatEnum format) {
+  size_t bpp;
+  switch (format) {
+  case GPU_FORMAT_LUMINANCE:
+  case GPU_FORMAT_ALPHA:
+    bpp = 1;
+    break;
+  case GPU_FORMAT_LUMINANCE_ALPHA:
+  case GPU_FORMAT_RG:
+    bpp = 2;
+    break;
+  case GPU_FORMAT_RGB:
+    bpp = 3;
+    break;
+  default:
+    bpp = 4;
+    break;
+  }
+  return (size_t) w * h * bpp;
+}
+
+/* Records image, created by site. Images already known keep their entry.
+ * Long sites, usually paths, keep their end. */
+void
+mrb_sdl2_gpu_vram_add(GPU_Image *image, const char *site) {
+  mrb_sdl2_gpu_vram_entry_t *entry;
+  size_t len = SDL_strlen(site);
+  if (NULL == image || NULL != mrb_sdl2_gpu_vram_find(image))
+    return;
+  if (len >= sizeof(entry->site))
+    site += len - (sizeof(entry->site) - 1);
+  if ((vram.count + 1) * 4 > vram.capacity * 3 && !mrb_sdl2_gpu_vram_grow())
+    return;  /* without room the image just goes uncounted */
+  entry = &vram.entries[mrb_sdl2_gpu_vram_slot(image)];
+  entry->image = image;
+  SDL_strlcpy(entry->site, site, sizeof(entry->site));
+  entry->created = vram.frame;
+  entry->last_used = vram.frame;
+  entry->bytes = mrb_sdl2_gpu_vram_image_bytes(image);
+  vram.total += entry->bytes;
+  vram.count++;
+}
+
+/* Takes the size of image again after something changed it. */
+void
+mrb_sdl2_gpu_vram_resize(GPU_Image const *image) {
+  mrb_sdl2_gpu_vram_entry_t *entry = mrb_sdl2_gpu_vram_find(image);
+  if (NULL == entry)
+    return;
+  vram.total -= entry->bytes;
+  entry->bytes = mrb_sdl2_gpu_vram_image_bytes(image);
+  vram.total += entry->bytes;
+}
+
+/* Forgets image, callers do it right before GPU_FreeImage. What is freed
+ * by hand is no longer waiting for the GC. */
+void
+mrb_sdl2_gpu_vram_remove(GPU_Image const *image) {
+  mrb_sdl2_gpu_vram_entry_t *entry = mrb_sdl2_gpu_vram_find(image);
+  size_t mask, i, j, bytes;
+  if (NULL == entry)
+    return;
+  bytes = entry->bytes;
+  vram.total -= bytes;
+  vram.pending = vram.pending > bytes ? vram.pending - bytes : 0;
+  mask = vram.capacity - 1;
+  i = mrb_sdl2_gpu_vram_slot(image);
+  vram.count--;
+  /* backward shift deletion keeps the probe sequences intact */
+  for (j = (i + 1) & mask; NULL != vram.entries[j].image;
+       j = (j + 1) & mask) {
+    size_t home = mrb_sdl2_gpu_vram_hash(vram.entries[j].image) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      vram.entries[i] = vram.entries[j];
+      i = j;
+    }
+  }
+  vram.entries[i].image = NULL;
+}
+
+void
+mrb_sdl2_gpu_vram_touch(GPU_Image const *image) {
+  mrb_sdl2_gpu_vram_entry_t *entry = mrb_sdl2_gpu_vram_find(image);
+  if (NULL != entry)
+    entry->last_used = vram.frame;
+}
+
+/* Target#flip ends a frame. */
+void
+mrb_sdl2_gpu_vram_next_frame(void) {
+  vram.frame++;
+}
+
+/* Full GC, the textures of unreachable wrappers go with it. Returns the
+ * bytes that were released. */
+static size_t
+mrb_sdl2_gpu_vram_collect(mrb_state *mrb) {
+  size_t before = mrb_sdl2_gpu_vram_total(), after;
+  mrb_full_gc(mrb);
+  vram.pending = 0;
+  vram.collections++;
+  after = mrb_sdl2_gpu_vram_total();
+  return before > after ? before - after : 0;
+}
+
+/* Counts bytes of native memory the GC cannot see, collecting once
+ * they pass the pressure limit. */
+void
+mrb_sdl2_gpu_gc_pressure(mrb_state *mrb, size_t bytes) {
+  if (0 != vram.pressure_limit && vram.pending + bytes > vram.pressure_limit)
+    mrb_sdl2_gpu_vram_collect(mrb);
+  vram.pending += bytes;
+}
+
+static mrb_value
+mrb_sdl2_gpu_vram_evict(mrb_state *mrb, mrb_value args) {
+  return mrb_yield(mrb, RARRAY_PTR(args)[0], RARRAY_PTR(args)[1]);
+}
+
+static mrb_value
+mrb_sdl2_gpu_vram_evicted(mrb_state *mrb, mrb_value unused) {
+  vram.evicting = FALSE;
+  return mrb_nil_value();
+}
+
+/* Whether bytes more fit the budget. When they do not, dropped wrappers
+ * are collected and then the GPU.on_vram_budget block gets the bytes
+ * still over budget and may free images to make room; callers treat
+ * FALSE like a failed allocation. */
+mrb_bool
+mrb_sdl2_gpu_vram_reserve(mrb_state *mrb, size_t bytes) {
+  mrb_value block;
+  if (0 != vram.pressure_limit && vram.pending + bytes > vram.pressure_limit)
+    mrb_sdl2_gpu_vram_collect(mrb);
+  if (0 != vram.budget && mrb_sdl2_gpu_vram_total() + bytes > vram.budget) {
+    if (0 != vram.pending)
+      mrb_sdl2_gpu_vram_collect(mrb);
+    block = mrb_iv_get(mrb, mrb_obj_value(mod_GPU),
+                       mrb_intern_lit(mrb, "__vram_budget__"));
+    if (mrb_sdl2_gpu_vram_total() + bytes > vram.budget &&
+        !vram.evicting && !mrb_nil_p(block)) {
+      vram.evicting = TRUE;  /* images the block creates are just checked */
+      mrb_ensure(mrb, mrb_sdl2_gpu_vram_evict, mrb_assoc_new(mrb, block,
+                   mrb_fixnum_value(mrb_sdl2_gpu_vram_total() + bytes -
+                                    vram.budget)),
+                 mrb_sdl2_gpu_vram_evicted, mrb_nil_value());
+    }
+    if (mrb_sdl2_gpu_vram_total() + bytes > vram.budget)
+      return FALSE;
+  }
+  vram.pending += bytes;
+  return TRUE;
+}
+
+/* GPU.quit frees every image behind our back. */
+void
+mrb_sdl2_gpu_vram_clear(void) {
+  SDL_free(vram.entries);
+  vram.entries = NULL;
+  vram.capacity = 0;
+  vram.count = 0;
+  vram.total = 0;
+}
+
+/* What the report shows of an entry, copied out before any Ruby object
+ * is created: a GC run could free images and reshuffle the table. */
+typedef struct mrb_sdl2_gpu_vram_row_t {
+  char     site[MRB_SDL2_GPU_VRAM_SITE];
+  Uint16   w, h;
+  size_t   bytes;
+  mrb_bool target;
+  Uint32   created;
+  Uint32   last_used;
+} mrb_sdl2_gpu_vram_row_t;
+
+static int
+mrb_sdl2_gpu_vram_by_size(const void *a, const void *b) {
+  size_t sa = ((mrb_sdl2_gpu_vram_row_t const*) a)->bytes;
+  size_t sb = ((mrb_sdl2_gpu_vram_row_t const*) b)->bytes;
+  return sa < sb ? 1 : sa > sb ? -1 : 0;
+}
+
+static mrb_value
+mrb_sdl2_gpu_vram_row_hash(mrb_state *mrb,
+                           mrb_sdl2_gpu_vram_row_t const *row) {
+  mrb_value hash = mrb_hash_new_capa(mrb, 7);
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "site")),
+               mrb_str_new_cstr(mrb, row->site));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "w")),
+               mrb_fixnum_value(row->w));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "h")),
+               mrb_fixnum_value(row->h));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "bytes")),
+               mrb_fixnum_value(row->bytes));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "target")),
+               mrb_bool_value(row->target));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "created")),
+               mrb_fixnum_value(row->created));
+  mrb_hash_set(mrb, hash, mrb_symbol_value(mrb_intern_lit(mrb, "last_used")),
+               mrb_fixnum_value(row->last_used));
+  return hash;
+}
+
+/* GPU.memory_report -> {total:, budget:, frame:, images:, targets:,
+ *                       gc_pending:, gc_collections:,
+ *                       entries: [{site:, w:, h:, bytes:, target:,
+ *                                  created:, last_used:}, ...]}
+ * with the entries largest first. */
+static mrb_value
+mrb_sdl2_gpu_memory_report(mrb_state *mrb, mrb_value self) {
+  mrb_value report, list;
+  mrb_sdl2_gpu_vram_row_t *rows = NULL;
+  size_t i, n = 0, total = 0, targets = 0;
+  if (vram.count > 0)
+    rows = (mrb_sdl2_gpu_vram_row_t*) mrb_sdl2_gpu_arena_alloc(
+        mrb, sizeof(mrb_sdl2_gpu_vram_row_t) * vram.count);
+  for (i = 0; i < vram.capacity; i++) {
+    mrb_sdl2_gpu_vram_entry_t const *entry = &vram.entries[i];
+    mrb_sdl2_gpu_vram_row_t *row;
+    if (NULL == entry->image)
+      continue;
+    row = &rows[n++];
+    SDL_memcpy(row->site, entry->site, sizeof(row->site));
+    row->w = entry->image->texture_w;
+    row->h = entry->image->texture_h;
+    row->bytes = entry->bytes;
+    row->target = NULL != entry->image->target;
+    row->created = entry->created;
+    row->last_used = entry->last_used;
+    total += row->bytes;
+    if (row->target)
+      targets++;
+  }
+  if (n > 1)
+    SDL_qsort(rows, n, sizeof(rows[0]), mrb_sdl2_gpu_vram_by_size);
+
+  report = mrb_hash_new_capa(mrb, 8);
+  list = mrb_ary_new_capa(mrb, n);
+  mrb_hash_set(mrb, report, mrb_symbol_value(mrb_intern_lit(mrb, "total")),
+               mrb_fixnum_value(total));
+  mrb_hash_set(mrb, report, mrb_symbol_value(mrb_intern_lit(mrb, "budget")),
+               0 == vram.budget ? mrb_nil_value() :
+                                  mrb_fixnum_value(vram.budget));
+  mrb_hash_set(mrb, report, mrb_symbol_value(mrb_intern_lit(mrb, "frame")),
+               mrb_fixnum_value(vram.frame));
+  mrb_hash_set(mrb, report, mrb_symbol_value(mrb_intern_lit(mrb, "images")),
+               mrb_fixnum_value(n - targets));
+  mrb_hash_set(mrb, report, mrb_symbol_value(mrb_intern_lit(mrb, "targets")),
+               mrb_fixnum_value(targets));
+  mrb_hash_set(mrb, report,
+               mrb_symbol_value(mrb_intern_lit(mrb, "gc_pending")),
+               mrb_fixnum_value(vram.pending));
+  mrb_hash_set(mrb, report,
+               mrb_symbol_value(mrb_intern_lit(mrb, "gc_collections")),
+               mrb_fixnum_value(vram.collections));
+  mrb_hash_set(mrb, report, mrb_symbol_value(mrb_intern_lit(mrb, "entries")),
+               list);
+  for (i = 0; i < n; i++) {
+    mrb_ary_push(mrb, list, mrb_sdl2_gpu_vram_row_hash(mrb, &rows[i]));
+  }
+  return report;
+}
+
+/* GPU.vram_budget = bytes, nil or 0 for none */
+static mrb_value
+mrb_sdl2_gpu_set_vram_budget(mrb_state *mrb, mrb_value self) {
+  mrb_value budget;
+  mrb_get_args(mrb, "o", &budget);
+  if (mrb_nil_p(budget)) {
+    vram.budget = 0;
+  } else {
+    mrb_int bytes = mrb_int(mrb, budget);
+    if (bytes < 0)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "budget must not be negative");
+    vram.budget = (size_t) bytes;
+  }
+  return budget;
+}
+
+static mrb_value
+mrb_sdl2_gpu_get_vram_budget(mrb_state *mrb, mrb_value self) {
+  return 0 == vram.budget ? mrb_nil_value() : mrb_fixnum_value(vram.budget);
+}
+
+/* GPU.on_vram_budget { |bytes_over| ... }, no block removes it */
+static mrb_value
+mrb_sdl2_gpu_on_vram_budget(mrb_state *mrb, mrb_value self) {
+  mrb_value block = mrb_nil_value();
+  mrb_get_args(mrb, "&", &block);
+  mrb_iv_set(mrb, mrb_obj_value(mod_GPU),
+             mrb_intern_lit(mrb, "__vram_budget__"), block);
+  return self;
+}
+
+/* GPU.gc_pressure_limit = bytes, nil or 0 to never collect early */
+static mrb_value
+mrb_sdl2_gpu_set_gc_pressure_limit(mrb_state *mrb, mrb_value self) {
+  mrb_value limit;
+  mrb_get_args(mrb, "o", &limit);
+  if (mrb_nil_p(limit)) {
+    vram.pressure_limit = 0;
+  } else {
+    mrb_int bytes = mrb_int(mrb, limit);
+    if (bytes < 0)
+      mrb_raise(mrb, E_ARGUMENT_ERROR, "limit must not be negative");
+    vram.pressure_limit = (size_t) bytes;
+  }
+  return limit;
+}
+
+static mrb_value
+mrb_sdl2_gpu_get_gc_pressure_limit(mrb_state *mrb, mrb_value self) {
+  return 0 == vram.pressure_limit ? mrb_nil_value() :
+                                    mrb_fixnum_value(vram.pressure_limit);
+}
+
+/* GPU.collect_unused -> bytes released. Frees the textures, targets and
+ * programs no Ruby object refers to any more; call it where a pause does
+ * not hurt, right after Target#flip or a level change. */
+static mrb_value
+mrb_sdl2_gpu_collect_unused(mrb_state *mrb, mrb_value self) {
+  return mrb_fixnum_value(mrb_sdl2_gpu_vram_collect(mrb));
+}
+
+void
+mrb_sdl2_gpu_vram_init(mrb_state *mrb) {
+  mrb_define_module_function(mrb, mod_GPU, "memory_report",      mrb_sdl2_gpu_memory_report,         MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "vram_budget=",       mrb_sdl2_gpu_set_vram_budget,       MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, mod_GPU, "vram_budget",        mrb_sdl2_gpu_get_vram_budget,       MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "on_vram_budget",     mrb_sdl2_gpu_on_vram_budget,        MRB_ARGS_BLOCK());
+  mrb_define_module_function(mrb, mod_GPU, "gc_pressure_limit=", mrb_sdl2_gpu_set_gc_pressure_limit, MRB_ARGS_REQ(1));
+  mrb_define_module_function(mrb, mod_GPU, "gc_pressure_limit",  mrb_sdl2_gpu_get_gc_pressure_limit, MRB_ARGS_NONE());
+  mrb_define_module_function(mrb, mod_GPU, "collect_unused",     mrb_sdl2_gpu_collect_unused,        MRB_ARGS_NONE());
+}